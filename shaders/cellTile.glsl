@@ -0,0 +1,150 @@
+// Cell enumeration of the cell-tiled density and force kernels. Each workgroup owns a brick of
+// 4x4x4 cells and enumerates the particles of the brick and of the 6x6x6 cells around it through
+// exclusive scans of the cell counts. The including shader declares the cells image, or the
+// hashKeys and hashCells buffers and the hashMask uniform with a hashed grid.
+
+const uint TILE_GROUP_SIZE = 64u;
+const int BRICK_SIZE = 4;
+const int HALO_SIZE = BRICK_SIZE + 2;
+const uint HALO_CELL_COUNT = 216u;
+const uint HALO_CELLS_PER_INVOCATION = 4u;
+
+shared uint brickOffsets[TILE_GROUP_SIZE];
+shared uint brickPrefix[TILE_GROUP_SIZE + 1u];
+shared uint haloOffsets[HALO_CELL_COUNT];
+shared uint haloPrefix[HALO_CELL_COUNT + 1u];
+shared uvec2 scanSums[TILE_GROUP_SIZE];
+
+// Particle offset and count of the cell, which are zero outside of the grid.
+uvec2 loadCell(ivec3 voxelCoord)
+{
+  if (any(greaterThanEqual(uvec3(voxelCoord), GRID_RES)))
+  {
+    return uvec2(0);
+  }
+
+#ifdef HASHED_GRID
+  uint slot = findCell(voxelCoord);
+
+  return slot == EMPTY_KEY ? uvec2(0) : hashCells[slot];
+#else
+  return imageLoad(cells, voxelCoord).xy;
+#endif
+}
+
+// Scans the cells of the workgroup's brick and halo. Returns the particle count of the brick,
+// which is the same for all invocations.
+uint scanCellTile()
+{
+  uint localId = gl_LocalInvocationIndex;
+  ivec3 brickOrigin = ivec3(gl_WorkGroupID) * BRICK_SIZE;
+
+  ivec3 brickCoord = ivec3(localId % BRICK_SIZE, (localId / BRICK_SIZE) % BRICK_SIZE, localId / (BRICK_SIZE * BRICK_SIZE));
+  uvec2 brickCell = loadCell(brickOrigin + brickCoord);
+  brickOffsets[localId] = brickCell.x;
+
+  uint haloCounts[HALO_CELLS_PER_INVOCATION];
+  uint haloSum = 0;
+
+  for (uint i = 0; i < HALO_CELLS_PER_INVOCATION; i++)
+  {
+    uint haloId = localId * HALO_CELLS_PER_INVOCATION + i;
+    haloCounts[i] = 0;
+
+    if (haloId < HALO_CELL_COUNT)
+    {
+      ivec3 haloCoord = ivec3(haloId % HALO_SIZE, (haloId / HALO_SIZE) % HALO_SIZE, haloId / (HALO_SIZE * HALO_SIZE));
+      uvec2 haloCell = loadCell(brickOrigin - 1 + haloCoord);
+      haloOffsets[haloId] = haloCell.x;
+      haloCounts[i] = haloCell.y;
+      haloSum += haloCell.y;
+    }
+  }
+
+  // Inclusive scan of the brick counts and the halo sums.
+  uvec2 counts = uvec2(brickCell.y, haloSum);
+  uvec2 sum = counts;
+  scanSums[localId] = sum;
+  barrier();
+
+  for (uint stride = 1; stride < TILE_GROUP_SIZE; stride *= 2)
+  {
+    if (localId >= stride)
+    {
+      sum += scanSums[localId - stride];
+    }
+    barrier();
+    scanSums[localId] = sum;
+    barrier();
+  }
+
+  brickPrefix[localId] = sum.x - counts.x;
+
+  uint haloOffset = sum.y - counts.y;
+  for (uint i = 0; i < HALO_CELLS_PER_INVOCATION; i++)
+  {
+    uint haloId = localId * HALO_CELLS_PER_INVOCATION + i;
+
+    if (haloId < HALO_CELL_COUNT)
+    {
+      haloPrefix[haloId] = haloOffset;
+      haloOffset += haloCounts[i];
+    }
+  }
+
+  if (localId == TILE_GROUP_SIZE - 1)
+  {
+    brickPrefix[TILE_GROUP_SIZE] = sum.x;
+    haloPrefix[HALO_CELL_COUNT] = sum.y;
+  }
+  barrier();
+
+  return brickPrefix[TILE_GROUP_SIZE];
+}
+
+// Particle id of the index-th particle of the brick. The cell is the last one whose prefix
+// does not exceed the index, which skips empty cells.
+uint brickParticle(uint index)
+{
+  uint lo = 0;
+  uint hi = TILE_GROUP_SIZE;
+
+  while (hi - lo > 1)
+  {
+    uint mid = (lo + hi) / 2;
+
+    if (brickPrefix[mid] <= index)
+    {
+      lo = mid;
+    }
+    else
+    {
+      hi = mid;
+    }
+  }
+
+  return brickOffsets[lo] + index - brickPrefix[lo];
+}
+
+// Particle id of the index-th particle of the halo.
+uint haloParticle(uint index)
+{
+  uint lo = 0;
+  uint hi = HALO_CELL_COUNT;
+
+  while (hi - lo > 1)
+  {
+    uint mid = (lo + hi) / 2;
+
+    if (haloPrefix[mid] <= index)
+    {
+      lo = mid;
+    }
+    else
+    {
+      hi = mid;
+    }
+  }
+
+  return haloOffsets[lo] + index - haloPrefix[lo];
+}
@@ -3,17 +3,20 @@ const float GRID_EPS = 0.000001;
 const float MAX_DENSITY = 30.0;
 const vec3 PARTICLE_COLOR = vec3(0.0, 0.0, 0.6);
 
-struct Particle
+layout(binding = 0, std430) restrict readonly buffer positionBuf
 {
-  vec3 position;
-  float density;
-  vec3 velocity;
-  float pressure;
+  vec4 positions[];
 };
 
-layout(binding = 0, std430) restrict readonly buffer particleBuf
+layout(binding = 1, std430) restrict readonly buffer velocityBuf
 {
-  Particle particles[];
+  vec4 velocities[];
+};
+
+// Density and pressure.
+layout(binding = 2, std430) restrict readonly buffer densityBuf
+{
+  vec2 densities[];
 };
 
 layout (location = 0) uniform mat4 VP;
@@ -38,7 +41,7 @@ void main()
   uint gid = gl_VertexID / 4;
   uint lid = gl_VertexID % 4;
 
-  vec3 particlePos = particles[gid].position;
+  vec3 particlePos = positions[gid].xyz;
 
   if (colorMode == 0)
   {
@@ -46,22 +49,22 @@ void main()
   }
   else if (colorMode == 1)
   {
-    vec3 velocity = abs(particles[gid].velocity);
+    vec3 velocity = abs(velocities[gid].xyz);
     float w = max(max(FLOAT_MIN, velocity.x), max(velocity.y, velocity.z));
     bool invalid = any(isnan(velocity)) || any(isinf(velocity));
     color = mix(velocity / w, vec3(1.0, 0.0, 0.0), float(invalid));
   }
   else if (colorMode == 2)
   {
-    vec3 velocity = particles[gid].velocity;
+    vec3 velocity = velocities[gid].xyz;
     float speed = length(velocity);
     color = vec3(speed, speed, 0.0);
   }
   else if (colorMode == 3)
   {
-    float density = particles[gid].density;
+    float density = densities[gid].x;
     float norm = density / MAX_DENSITY;
-    bool invalid = (density <= 0.0) || any(isnan(density)) || any(isinf(density));
+    bool invalid = (density <= 0.0) || isnan(density) || isinf(density);
     color = mix(vec3(0.0, norm, 0.0), vec3(1.0, 0.0, 0.0), float(invalid));
   }
   else if (colorMode == 4)
@@ -0,0 +1,39 @@
+// Lookup in the hash table of occupied cells, see SpatialHash.hpp. The including shader
+// declares the hashKeys buffer and the hashMask uniform.
+
+const uint EMPTY_KEY = 0xFFFFFFFFu;
+
+uint cellKey(ivec3 voxelCoord)
+{
+  return uint(voxelCoord.x) + uint(GRID_RES.x) * (uint(voxelCoord.y) + uint(GRID_RES.y) * uint(voxelCoord.z));
+}
+
+// Same hash as SpatialHash::slot with SLOT_RUN = 4.
+uint cellSlot(ivec3 voxelCoord)
+{
+  uint run = (uint(voxelCoord.x / 4) * 73856093u) ^ (uint(voxelCoord.y) * 19349663u) ^ (uint(voxelCoord.z) * 83492791u);
+  return (run * 4u + uint(voxelCoord.x % 4)) & hashMask;
+}
+
+// Returns the slot of the cell, or EMPTY_KEY if the cell is not occupied.
+uint findCell(ivec3 voxelCoord)
+{
+  uint key = cellKey(voxelCoord);
+  uint slot = cellSlot(voxelCoord);
+
+  while (true)
+  {
+    uint slotKey = hashKeys[slot];
+
+    if (slotKey == key)
+    {
+      return slot;
+    }
+    if (slotKey == EMPTY_KEY)
+    {
+      return EMPTY_KEY;
+    }
+
+    slot = (slot + 1) & hashMask;
+  }
+}
@@ -0,0 +1,98 @@
+#include "EglContext.hpp"
+
+#include <glad/glad.h>
+#include <EGL/eglext.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace flut;
+
+namespace
+{
+  EGLDisplay getDeviceDisplay()
+  {
+    auto eglQueryDevicesEXT = (PFNEGLQUERYDEVICESEXTPROC) eglGetProcAddress("eglQueryDevicesEXT");
+    auto eglGetPlatformDisplayEXT = (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+
+    if (!eglQueryDevicesEXT || !eglGetPlatformDisplayEXT)
+    {
+      return EGL_NO_DISPLAY;
+    }
+
+    constexpr EGLint MAX_DEVICES = 16;
+    EGLDeviceEXT devices[MAX_DEVICES];
+    EGLint deviceCount = 0;
+
+    if (!eglQueryDevicesEXT(MAX_DEVICES, devices, &deviceCount) || deviceCount == 0)
+    {
+      return EGL_NO_DISPLAY;
+    }
+
+    return eglGetPlatformDisplayEXT(EGL_PLATFORM_DEVICE_EXT, devices[0], nullptr);
+  }
+}
+
+EglContext::EglContext()
+{
+  m_display = getDeviceDisplay();
+
+  if (m_display == EGL_NO_DISPLAY)
+  {
+    m_display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+  }
+
+  if (m_display == EGL_NO_DISPLAY || !eglInitialize(m_display, nullptr, nullptr)) {
+    fprintf(stderr, "Unable to initialize EGL display (0x%x)", eglGetError());
+    abort();
+  }
+
+  if (!eglBindAPI(EGL_OPENGL_API)) {
+    fprintf(stderr, "EGL does not support the OpenGL API");
+    abort();
+  }
+
+  const EGLint contextAttribs[] = {
+    EGL_CONTEXT_MAJOR_VERSION, 4,
+    EGL_CONTEXT_MINOR_VERSION, 6,
+    EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+#ifndef NDEBUG
+    EGL_CONTEXT_OPENGL_DEBUG, EGL_TRUE,
+#endif
+    EGL_NONE
+  };
+
+  // No config and no surface: requires EGL_KHR_no_config_context and EGL_KHR_surfaceless_context.
+  m_context = eglCreateContext(m_display, EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, contextAttribs);
+
+  if (m_context == EGL_NO_CONTEXT) {
+    fprintf(stderr, "Unable to create EGL context (0x%x)", eglGetError());
+    abort();
+  }
+
+  if (!eglMakeCurrent(m_display, EGL_NO_SURFACE, EGL_NO_SURFACE, m_context)) {
+    fprintf(stderr, "Unable to make EGL context current (0x%x)", eglGetError());
+    abort();
+  }
+
+  if (!gladLoadGLLoader((GLADloadproc) eglGetProcAddress)) {
+    fprintf(stderr, "Unable to initialize Glad");
+    abort();
+  }
+
+  if (GLVersion.major < 4 || (GLVersion.major == 4 && GLVersion.minor < 6)) {
+    fprintf(stderr, "OpenGL 4.6 required");
+    abort();
+  }
+
+  if (!GLAD_GL_ARB_bindless_texture) {
+    fprintf(stderr, "GL_ARB_bindless_texture extension is required");
+    abort();
+  }
+}
+
+EglContext::~EglContext()
+{
+  eglMakeCurrent(m_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+  eglDestroyContext(m_display, m_context);
+  eglTerminate(m_display);
+}
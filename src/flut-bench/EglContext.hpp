@@ -0,0 +1,19 @@
+#pragma once
+
+#include <EGL/egl.h>
+
+namespace flut
+{
+  // Windowless OpenGL 4.6 context for headless runs. Prefers a GPU device
+  // enumerated via EGL_EXT_device_enumeration and falls back to the default display.
+  class EglContext
+  {
+  public:
+    EglContext();
+    ~EglContext();
+
+  private:
+    EGLDisplay m_display;
+    EGLContext m_context;
+  };
+}
@@ -0,0 +1,294 @@
+#include "Checkpoint.hpp"
+#include "CpuSimulationBackend.hpp"
+#include "ParticleSpawner.hpp"
+#include "Simulation.hpp"
+
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace flut;
+
+// Writes checkpoints and checks that reading them restores the state, that invalid and truncated
+// files are rejected, and that a simulation resumed from a checkpoint continues as if it had not
+// been interrupted.
+
+namespace
+{
+  constexpr uint32_t PARTICLE_COUNT = 4096;
+  constexpr uint32_t SEED = 1;
+  // Steps before the checkpoint, and after it on both the interrupted and the resumed simulation.
+  constexpr uint32_t STEP_COUNT = 20;
+
+  struct CheckOptions
+  {
+    std::string directory;
+  };
+
+  CheckpointState makeState(const std::vector<Particle>& particles, const SimulationGrid& grid)
+  {
+    CheckpointState state;
+    state.header.frame = 3;
+    state.header.step = STEP_COUNT;
+    state.header.time = STEP_COUNT * double(Simulation::DT);
+    state.header.seed = SEED;
+    state.header.integrationsPerFrame = 8;
+    state.setGrid(grid);
+    state.header.params = Simulation::PARAMS;
+    state.header.gravity[1] = -9.81f;
+    state.header.deltaTimeMod = 1.0f;
+    state.header.pointScale = 1.0f;
+    state.particles = particles;
+    return state;
+  }
+
+  bool patchFile(const std::string& path, uint64_t offset, const void* data, size_t size)
+  {
+    FILE* file = fopen(path.c_str(), "r+b");
+    if (!file)
+    {
+      fprintf(stderr, "Unable to open %s\n", path.c_str());
+      return false;
+    }
+
+    bool written = fseek(file, long(offset), SEEK_SET) == 0 && fwrite(data, size, 1, file) == 1;
+    written = fclose(file) == 0 && written;
+    if (!written)
+    {
+      fprintf(stderr, "Unable to modify %s\n", path.c_str());
+    }
+    return written;
+  }
+
+  // Reads the checkpoint back and compares it byte by byte, including the grid it describes.
+  bool checkRoundTrip(const std::string& path, CheckpointState state)
+  {
+    const SimulationGrid grid = state.grid();
+    CheckpointState read;
+    if (!writeCheckpoint(path, state) || !readCheckpoint(path, read))
+    {
+      return false;
+    }
+
+    const SimulationGrid readGrid = read.grid();
+    if (memcmp(&read.header, &state.header, sizeof(CheckpointHeader)) != 0 || read.particles.size() != state.particles.size() ||
+        memcmp(read.particles.data(), state.particles.data(), state.particles.size() * sizeof(Particle)) != 0 ||
+        readGrid.size != grid.size || readGrid.origin != grid.origin || readGrid.res != grid.res ||
+        readGrid.cellOrder != grid.cellOrder || readGrid.mode != grid.mode)
+    {
+      fprintf(stderr, "Checkpoint %s differs from the written state\n", path.c_str());
+      return false;
+    }
+    if (std::filesystem::exists(path + ".tmp"))
+    {
+      fprintf(stderr, "Checkpoint %s left its temporary file behind\n", path.c_str());
+      return false;
+    }
+    return true;
+  }
+
+  // Damages copies of a valid checkpoint in ways which the reader must reject.
+  bool checkInvalid(const std::string& path, CheckpointState state)
+  {
+    if (!writeCheckpoint(path, state))
+    {
+      return false;
+    }
+
+    const std::string copy = path + ".invalid";
+    bool passed = true;
+
+    auto expectRejected = [&](const char* damage, const std::function<bool()>& modify) {
+      std::error_code error;
+      std::filesystem::copy_file(path, copy, std::filesystem::copy_options::overwrite_existing, error);
+      CheckpointState read;
+      if (error || !modify())
+      {
+        passed = false;
+      }
+      else if (readCheckpoint(copy, read))
+      {
+        fprintf(stderr, "A checkpoint with %s was accepted\n", damage);
+        passed = false;
+      }
+    };
+
+    const uint64_t magic = 0;
+    const uint32_t version = Checkpoint::VERSION + 1;
+    const uint32_t particleCount = 0;
+    auto resize = [&](uint64_t size) {
+      std::error_code error;
+      std::filesystem::resize_file(copy, size, error);
+      return !error;
+    };
+
+    expectRejected("a wrong magic", [&] { return patchFile(copy, offsetof(CheckpointHeader, magic), &magic, sizeof(magic)); });
+    expectRejected("a newer version", [&] { return patchFile(copy, offsetof(CheckpointHeader, version), &version, sizeof(version)); });
+    expectRejected("no particles", [&] { return patchFile(copy, offsetof(CheckpointHeader, particleCount), &particleCount, sizeof(particleCount)); });
+    expectRejected("no data", [&] { return resize(0); });
+    expectRejected("a truncated header", [&] { return resize(sizeof(CheckpointHeader) / 2); });
+    expectRejected("truncated particles", [&] { return resize(Checkpoint::PAGE_SIZE + state.particles.size() / 2 * sizeof(Particle)); });
+    expectRejected("a missing file", [&] { return std::filesystem::remove(copy); });
+
+    std::error_code error;
+    std::filesystem::remove(copy, error);
+    return passed;
+  }
+
+  // A write which fails leaves the previous checkpoint in place.
+  bool checkFailedWrite(const std::string& path, CheckpointState state)
+  {
+    CheckpointState previous = state;
+    previous.header.frame = 1;
+    if (!writeCheckpoint(path, previous))
+    {
+      return false;
+    }
+
+    // The temporary file cannot be created where a directory is in the way.
+    std::error_code error;
+    std::filesystem::create_directory(path + ".tmp", error);
+    const bool written = writeCheckpoint(path, state);
+    std::filesystem::remove(path + ".tmp", error);
+
+    CheckpointState read;
+    return !written && readCheckpoint(path, read) && read.header.frame == previous.header.frame;
+  }
+
+  // Submits a checkpoint to the background writer and waits until it is written.
+  bool checkWriter(const std::string& path, const CheckpointState& state)
+  {
+    {
+      CheckpointWriter writer(path);
+      CheckpointState submitted = state;
+      if (!writer.idle() || !writer.submit(std::move(submitted)))
+      {
+        return false;
+      }
+      // A pending snapshot is still written on shutdown.
+    }
+
+    CheckpointState read;
+    return readCheckpoint(path, read) && read.header.frame == state.header.frame && read.particles.size() == state.particles.size() &&
+           memcmp(read.particles.data(), state.particles.data(), state.particles.size() * sizeof(Particle)) == 0;
+  }
+
+  // Interrupts a simulation with a checkpoint and compares the resumed simulation with the one
+  // which kept running. Runs on one thread, since the thread count may change the rounding.
+  bool checkResume(const std::string& path, const SimulationGrid& grid, const std::vector<Particle>& particles)
+  {
+    const glm::vec3 gravity{0.0f, -9.81f, 0.0f};
+    CpuSimulationBackend running(particles, grid, Simulation::PARAMS, 1);
+    for (uint32_t i = 0; i < STEP_COUNT; i++)
+    {
+      running.step(Simulation::DT, gravity);
+    }
+
+    const Particle* state = running.hostParticles();
+    CheckpointState checkpoint = makeState(std::vector<Particle>(state, state + running.particleCount()), grid);
+    CheckpointState read;
+    if (!writeCheckpoint(path, checkpoint) || !readCheckpoint(path, read))
+    {
+      return false;
+    }
+
+    CpuSimulationBackend resumed(read.particles, read.grid(), read.header.params, 1);
+    for (uint32_t i = 0; i < STEP_COUNT; i++)
+    {
+      running.step(Simulation::DT, gravity);
+      resumed.step(Simulation::DT, gravity);
+    }
+
+    if (resumed.particleCount() != running.particleCount() ||
+        memcmp(resumed.hostParticles(), running.hostParticles(), running.particleCount() * sizeof(Particle)) != 0)
+    {
+      fprintf(stderr, "The simulation resumed from %s diverged\n", path.c_str());
+      return false;
+    }
+    return true;
+  }
+
+  void printUsage()
+  {
+    fprintf(stderr,
+      "Usage: flut-checkpoint-check [options]\n"
+      "  --dir=PATH           Directory of the checkpoints (default: the temporary directory)\n");
+  }
+
+  bool parseArgs(int argc, char* argv[], CheckOptions& options)
+  {
+    for (int i = 1; i < argc; i++)
+    {
+      const std::string_view arg{argv[i]};
+
+      if (arg.substr(0, 6) == "--dir=")
+      {
+        options.directory = std::string(arg.substr(6));
+      }
+      else
+      {
+        fprintf(stderr, "Unknown argument %s\n", argv[i]);
+        printUsage();
+        return false;
+      }
+    }
+
+    return true;
+  }
+}
+
+int main(int argc, char* argv[])
+{
+  CheckOptions options;
+
+  if (argc == 2 && std::string_view(argv[1]) == "--help")
+  {
+    printUsage();
+    return EXIT_SUCCESS;
+  }
+
+  if (!parseArgs(argc, argv, options))
+  {
+    return EXIT_FAILURE;
+  }
+  if (options.directory.empty())
+  {
+    options.directory = std::filesystem::temp_directory_path().string();
+  }
+
+  SimulationGrid grid = Simulation::GRID;
+  grid.cellOrder = CellOrder::Hilbert;
+  grid.mode = GridMode::Hashed;
+  const std::vector<Particle> particles = ParticleSpawner::spawnBlock(PARTICLE_COUNT, SEED, Simulation::SPAWN_DENSITY, grid, Simulation::PARAMS);
+  const CheckpointState state = makeState(particles, grid);
+  uint32_t failedChecks = 0;
+  uint32_t checkCount = 0;
+
+  // Every check writes its own file, which is removed afterwards.
+  auto check = [&](const char* name, const std::function<bool(const std::string&)>& run) {
+    const std::string path = options.directory + "/flut-checkpoint-check-" + name + ".checkpoint";
+    const bool passed = run(path);
+    std::error_code error;
+    std::filesystem::remove(path, error);
+
+    printf("%s,%s\n", name, passed ? "pass" : "fail");
+    failedChecks += passed ? 0 : 1;
+    checkCount++;
+  };
+
+  check("round_trip", [&](const std::string& path) { return checkRoundTrip(path, state); });
+  check("invalid", [&](const std::string& path) { return checkInvalid(path, state); });
+  check("failed_write", [&](const std::string& path) { return checkFailedWrite(path, state); });
+  check("writer", [&](const std::string& path) { return checkWriter(path, state); });
+  check("resume", [&](const std::string& path) { return checkResume(path, Simulation::GRID, particles); });
+
+  printf("failed_checks,%u,%u\n", failedChecks, checkCount);
+
+  return failedChecks == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,500 @@
+#include "CellOrdering.hpp"
+#include "CpuKernels.hpp"
+#include "CpuSimulationBackend.hpp"
+#include "GlSimulationBackend.hpp"
+#include "ParticleSpawner.hpp"
+#include "Simulation.hpp"
+#include "SpatialHash.hpp"
+
+#ifdef FLUT_HAS_EGL
+#include "EglContext.hpp"
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace flut;
+
+// Runs a fixed scene from a fixed seed and compares reduced statistics of every step against
+// a recorded reference trajectory, so that optimizations can be checked for changed physics.
+
+namespace
+{
+  constexpr uint32_t HISTOGRAM_BIN_COUNT = 16;
+  // Cell densities outside of this range are counted in the first or last bin.
+  constexpr float HISTOGRAM_MIN_DENSITY = Simulation::SPAWN_DENSITY * 0.5f;
+  constexpr float HISTOGRAM_MAX_DENSITY = Simulation::SPAWN_DENSITY * 1.5f;
+
+  struct SceneOptions
+  {
+    uint32_t particleCount = 20480;
+    uint32_t stepCount = 400;
+    uint32_t seed = 1;
+  };
+
+  // Defaults leave headroom for the differing rounding of the CPU instruction sets and thread
+  // counts; the maximum density is an extreme value and diverges the fastest.
+  struct Tolerances
+  {
+    // Relative tolerances, with an absolute floor for quantities which start at zero.
+    float kineticEnergy = 0.02f;
+    float kineticEnergyFloor = 1.0f;
+    float meanDensity = 0.002f;
+    float maxDensity = 0.15f;
+    // Absolute tolerance per component.
+    float centerOfMass = 0.002f;
+    // Fraction of occupied cells which may fall into a different histogram bin.
+    float histogram = 0.03f;
+  };
+
+  struct StepStats
+  {
+    double kineticEnergy = 0.0;
+    double meanDensity = 0.0;
+    double maxDensity = 0.0;
+    double centerOfMass[3] = {};
+    // Number of occupied grid cells per bin of the cell-averaged particle density.
+    uint32_t histogram[HISTOGRAM_BIN_COUNT] = {};
+  };
+
+  StepStats computeStats(const Particle* particles, uint32_t particleCount, const SimulationGrid& grid)
+  {
+    StepStats stats;
+
+    std::vector<float> cellDensities(grid.voxelCount(), 0.0f);
+    std::vector<uint32_t> cellCounts(grid.voxelCount(), 0);
+    const glm::vec3 invCellSize = grid.invCellSize();
+
+    for (uint32_t i = 0; i < particleCount; i++)
+    {
+      const Particle& p = particles[i];
+
+      const double speed2 = p.velocity_x * p.velocity_x + p.velocity_y * p.velocity_y + p.velocity_z * p.velocity_z;
+      stats.kineticEnergy += 0.5 * Simulation::MASS * speed2;
+      stats.meanDensity += p.density;
+      stats.maxDensity = std::max(stats.maxDensity, double(p.density));
+      stats.centerOfMass[0] += p.position_x;
+      stats.centerOfMass[1] += p.position_y;
+      stats.centerOfMass[2] += p.position_z;
+
+      const glm::ivec3 cell = glm::clamp(
+        glm::ivec3((glm::vec3(p.position_x, p.position_y, p.position_z) - grid.origin) * invCellSize),
+        glm::ivec3(0), grid.res - 1);
+      const uint32_t cellIdx = cell.x + grid.res.x * (cell.y + grid.res.y * cell.z);
+      cellDensities[cellIdx] += p.density;
+      cellCounts[cellIdx]++;
+    }
+
+    stats.meanDensity /= particleCount;
+    for (double& c : stats.centerOfMass)
+    {
+      c /= particleCount;
+    }
+
+    for (uint32_t i = 0; i < grid.voxelCount(); i++)
+    {
+      if (cellCounts[i] == 0)
+      {
+        continue;
+      }
+      const float density = cellDensities[i] / cellCounts[i];
+      const float t = (density - HISTOGRAM_MIN_DENSITY) / (HISTOGRAM_MAX_DENSITY - HISTOGRAM_MIN_DENSITY);
+      const auto bin = static_cast<int32_t>(t * HISTOGRAM_BIN_COUNT);
+      stats.histogram[glm::clamp(bin, 0, int32_t(HISTOGRAM_BIN_COUNT) - 1)]++;
+    }
+
+    return stats;
+  }
+
+  bool writeReference(const char* path, const SceneOptions& scene, const std::vector<StepStats>& trajectory)
+  {
+    FILE* file = fopen(path, "w");
+    if (!file)
+    {
+      fprintf(stderr, "Unable to write %s\n", path);
+      return false;
+    }
+
+    fprintf(file, "# particles=%u steps=%u seed=%u\n", scene.particleCount, scene.stepCount, scene.seed);
+    fprintf(file, "step,kinetic_energy,mean_density,max_density,com_x,com_y,com_z");
+    for (uint32_t b = 0; b < HISTOGRAM_BIN_COUNT; b++)
+    {
+      fprintf(file, ",hist_%u", b);
+    }
+    fprintf(file, "\n");
+
+    for (size_t i = 0; i < trajectory.size(); i++)
+    {
+      const StepStats& s = trajectory[i];
+      fprintf(file, "%zu,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g", i, s.kineticEnergy, s.meanDensity, s.maxDensity,
+        s.centerOfMass[0], s.centerOfMass[1], s.centerOfMass[2]);
+      for (uint32_t count : s.histogram)
+      {
+        fprintf(file, ",%u", count);
+      }
+      fprintf(file, "\n");
+    }
+
+    fclose(file);
+    return true;
+  }
+
+  bool readReference(const char* path, SceneOptions& scene, std::vector<StepStats>& trajectory)
+  {
+    FILE* file = fopen(path, "r");
+    if (!file)
+    {
+      fprintf(stderr, "Unable to read %s\n", path);
+      return false;
+    }
+
+    char line[1024];
+    bool valid = fgets(line, sizeof(line), file) &&
+      sscanf(line, "# particles=%u steps=%u seed=%u", &scene.particleCount, &scene.stepCount, &scene.seed) == 3 &&
+      fgets(line, sizeof(line), file);
+
+    trajectory.clear();
+    while (valid && fgets(line, sizeof(line), file))
+    {
+      StepStats s;
+      uint32_t step;
+      int offset;
+      valid = sscanf(line, "%u,%lf,%lf,%lf,%lf,%lf,%lf%n", &step, &s.kineticEnergy, &s.meanDensity, &s.maxDensity,
+        &s.centerOfMass[0], &s.centerOfMass[1], &s.centerOfMass[2], &offset) == 7 && step == trajectory.size();
+
+      const char* cursor = line + offset;
+      for (uint32_t b = 0; valid && b < HISTOGRAM_BIN_COUNT; b++)
+      {
+        int read;
+        valid = sscanf(cursor, ",%u%n", &s.histogram[b], &read) == 1;
+        cursor += read;
+      }
+
+      trajectory.push_back(s);
+    }
+
+    fclose(file);
+
+    if (!valid || trajectory.size() != scene.stepCount)
+    {
+      fprintf(stderr, "Malformed reference trajectory %s\n", path);
+      return false;
+    }
+    return true;
+  }
+
+  bool withinRelative(double value, double reference, double tolerance, double floor = 0.0)
+  {
+    return std::abs(value - reference) <= tolerance * std::max(std::abs(reference), floor);
+  }
+
+  // Returns the name of the first statistic which exceeds its tolerance, or nullptr.
+  const char* compareStats(const StepStats& s, const StepStats& ref, const Tolerances& tol)
+  {
+    if (!withinRelative(s.kineticEnergy, ref.kineticEnergy, tol.kineticEnergy, tol.kineticEnergyFloor))
+    {
+      return "kinetic energy";
+    }
+    if (!withinRelative(s.meanDensity, ref.meanDensity, tol.meanDensity))
+    {
+      return "mean density";
+    }
+    if (!withinRelative(s.maxDensity, ref.maxDensity, tol.maxDensity))
+    {
+      return "max density";
+    }
+    for (uint32_t a = 0; a < 3; a++)
+    {
+      if (std::abs(s.centerOfMass[a] - ref.centerOfMass[a]) > tol.centerOfMass)
+      {
+        return "center of mass";
+      }
+    }
+
+    uint32_t cellCount = 0;
+    uint32_t difference = 0;
+    for (uint32_t b = 0; b < HISTOGRAM_BIN_COUNT; b++)
+    {
+      cellCount += ref.histogram[b];
+      difference += std::abs(int32_t(s.histogram[b]) - int32_t(ref.histogram[b]));
+    }
+    // Every cell which changes its bin is counted twice.
+    if (difference > 2.0f * tol.histogram * cellCount)
+    {
+      return "density histogram";
+    }
+
+    return nullptr;
+  }
+
+  void printUsage()
+  {
+    fprintf(stderr,
+      "Usage: flut-golden [options]\n"
+      "  --reference=FILE     Reference trajectory (default: %s)\n"
+      "  --record             Record the reference instead of comparing against it\n"
+      "  --particles=N        Particle count of a new recording (default: 20480)\n"
+      "  --steps=N            Step count of a new recording (default: 400)\n"
+      "  --seed=N             Seed of a new recording (default: 1)\n"
+      "  --backend=cpu|gl     Simulation backend (default: cpu)\n"
+      "  --threads=N          CPU worker threads, 0 for all cores (default: 0)\n"
+      "  --isa=NAME           CPU instruction set: scalar, sse4, avx2, avx512\n"
+      "  --cell-order=NAME    Cell order: linear, morton, hilbert (default: linear)\n"
+      "  --grid=NAME          Neighbor grid: dense, hashed (default: dense)\n"
+      "  --gl-kernels=NAME    Density and force kernels of the GL backend: particle, tiled (default: particle)\n"
+      "  --verlet-skin=F      Skin of the CPU neighbor lists relative to the kernel radius (default: 0)\n"
+      "  --tol-energy=F       Relative kinetic energy tolerance (default: 0.02)\n"
+      "  --tol-mean-density=F Relative mean density tolerance (default: 0.002)\n"
+      "  --tol-max-density=F  Relative max density tolerance (default: 0.15)\n"
+      "  --tol-com=F          Absolute center of mass tolerance (default: 0.002)\n"
+      "  --tol-histogram=F    Fraction of cells allowed to change density bin (default: 0.03)\n",
+      GOLDEN_REFERENCE);
+  }
+
+  struct GoldenOptions
+  {
+    std::string referencePath = GOLDEN_REFERENCE;
+    bool record = false;
+    SceneOptions scene;
+    Tolerances tolerances;
+    Simulation::BackendType backend = Simulation::BackendType::Cpu;
+    uint32_t threadCount = 0;
+    CpuIsa isa = CpuKernels::bestIsa();
+    CellOrder cellOrder = CellOrder::Linear;
+    GridMode gridMode = GridMode::Dense;
+    GlKernelMode glKernelMode = GlKernelMode::PerParticle;
+    NeighborListConfig neighborLists;
+  };
+
+  bool parseUint(std::string_view arg, std::string_view prefix, uint32_t& value)
+  {
+    if (arg.substr(0, prefix.size()) != prefix)
+    {
+      return false;
+    }
+    value = static_cast<uint32_t>(std::stoul(std::string(arg.substr(prefix.size()))));
+    return true;
+  }
+
+  bool parseFloat(std::string_view arg, std::string_view prefix, float& value)
+  {
+    if (arg.substr(0, prefix.size()) != prefix)
+    {
+      return false;
+    }
+    value = std::stof(std::string(arg.substr(prefix.size())));
+    return true;
+  }
+
+  bool parseArgs(int argc, char* argv[], GoldenOptions& options)
+  {
+    Tolerances& tol = options.tolerances;
+
+    for (int i = 1; i < argc; i++)
+    {
+      const std::string_view arg{argv[i]};
+
+      if (parseUint(arg, "--particles=", options.scene.particleCount) ||
+          parseUint(arg, "--steps=", options.scene.stepCount) ||
+          parseUint(arg, "--seed=", options.scene.seed) ||
+          parseUint(arg, "--threads=", options.threadCount) ||
+          parseFloat(arg, "--tol-energy=", tol.kineticEnergy) ||
+          parseFloat(arg, "--tol-mean-density=", tol.meanDensity) ||
+          parseFloat(arg, "--tol-max-density=", tol.maxDensity) ||
+          parseFloat(arg, "--tol-com=", tol.centerOfMass) ||
+          parseFloat(arg, "--tol-histogram=", tol.histogram) ||
+          parseFloat(arg, "--verlet-skin=", options.neighborLists.skin))
+      {
+        continue;
+      }
+      else if (arg == "--record")
+      {
+        options.record = true;
+      }
+      else if (arg.substr(0, 12) == "--reference=")
+      {
+        options.referencePath = std::string(arg.substr(12));
+      }
+      else if (arg == "--backend=cpu")
+      {
+        options.backend = Simulation::BackendType::Cpu;
+      }
+      else if (arg == "--backend=gl")
+      {
+        options.backend = Simulation::BackendType::Gl;
+      }
+      else if (arg.substr(0, 6) == "--isa=")
+      {
+        if (!CpuKernels::parseIsa(arg.substr(6), options.isa))
+        {
+          fprintf(stderr, "Unknown instruction set %s\n", argv[i]);
+          return false;
+        }
+        if (!CpuKernels::isSupported(options.isa))
+        {
+          fprintf(stderr, "Instruction set %s is not supported\n", CpuKernels::isaName(options.isa));
+          return false;
+        }
+      }
+      else if (arg.substr(0, 13) == "--cell-order=")
+      {
+        if (!CellOrdering::parse(arg.substr(13), options.cellOrder))
+        {
+          fprintf(stderr, "Unknown cell order %s\n", argv[i]);
+          return false;
+        }
+      }
+      else if (arg.substr(0, 7) == "--grid=")
+      {
+        if (!SpatialHash::parse(arg.substr(7), options.gridMode))
+        {
+          fprintf(stderr, "Unknown grid mode %s\n", argv[i]);
+          return false;
+        }
+      }
+      else if (arg.substr(0, 13) == "--gl-kernels=")
+      {
+        if (!GlSimulationBackend::parseKernelMode(arg.substr(13), options.glKernelMode))
+        {
+          fprintf(stderr, "Unknown kernel mode %s\n", argv[i]);
+          return false;
+        }
+      }
+      else
+      {
+        fprintf(stderr, "Unknown argument %s\n", argv[i]);
+        printUsage();
+        return false;
+      }
+    }
+
+    return true;
+  }
+}
+
+int main(int argc, char* argv[])
+{
+  GoldenOptions options;
+
+  if (argc == 2 && std::string_view(argv[1]) == "--help")
+  {
+    printUsage();
+    return EXIT_SUCCESS;
+  }
+
+  if (!parseArgs(argc, argv, options))
+  {
+    return EXIT_FAILURE;
+  }
+
+  const bool record = options.record;
+  SceneOptions& scene = options.scene;
+  const Tolerances& tol = options.tolerances;
+
+  std::vector<StepStats> reference;
+  if (!record && !readReference(options.referencePath.c_str(), scene, reference))
+  {
+    return EXIT_FAILURE;
+  }
+
+  SimulationGrid grid = Simulation::GRID;
+  grid.cellOrder = options.cellOrder;
+  grid.mode = options.gridMode;
+  const std::vector<Particle> particles = ParticleSpawner::spawnBlock(scene.particleCount, scene.seed, Simulation::SPAWN_DENSITY, grid, Simulation::PARAMS);
+
+#ifdef FLUT_HAS_EGL
+  std::unique_ptr<EglContext> context;
+#endif
+  std::unique_ptr<SimulationBackend> backend;
+
+  if (options.backend == Simulation::BackendType::Gl)
+  {
+#ifdef FLUT_HAS_EGL
+    context = std::make_unique<EglContext>();
+    backend = std::make_unique<GlSimulationBackend>(particles, grid, Simulation::PARAMS, nullptr, options.glKernelMode);
+#else
+    fprintf(stderr, "flut-golden was built without EGL, the GL backend is unavailable\n");
+    return EXIT_FAILURE;
+#endif
+  }
+  else
+  {
+    backend = std::make_unique<CpuSimulationBackend>(particles, grid, Simulation::PARAMS, options.threadCount, options.isa,
+                                                     options.neighborLists);
+  }
+
+  fprintf(stderr, "%s %u steps with %u particles on %s\n", record ? "Recording" : "Comparing",
+    scene.stepCount, scene.particleCount, backend->name());
+
+  const glm::vec3 gravity{0.0f, -9.81f, 0.0f};
+  std::vector<Particle> readback;
+  std::vector<StepStats> trajectory;
+  uint32_t failedSteps = 0;
+  // Largest deviations from the reference over all steps: relative for energy and densities,
+  // absolute for the center of mass.
+  StepStats maxError;
+
+  for (uint32_t i = 0; i < scene.stepCount; i++)
+  {
+    backend->step(Simulation::DT, gravity);
+
+    const Particle* state = backend->hostParticles();
+    if (!state)
+    {
+      GlSimulationBackend::readParticles(backend->particleBuffers(), scene.particleCount, readback);
+      state = readback.data();
+    }
+
+    trajectory.push_back(computeStats(state, scene.particleCount, grid));
+
+    if (record)
+    {
+      continue;
+    }
+
+    const StepStats& s = trajectory.back();
+    const StepStats& ref = reference[i];
+    maxError.kineticEnergy = std::max(maxError.kineticEnergy,
+      std::abs(s.kineticEnergy - ref.kineticEnergy) / std::max(std::abs(ref.kineticEnergy), double(tol.kineticEnergyFloor)));
+    maxError.meanDensity = std::max(maxError.meanDensity, std::abs(s.meanDensity - ref.meanDensity) / std::abs(ref.meanDensity));
+    maxError.maxDensity = std::max(maxError.maxDensity, std::abs(s.maxDensity - ref.maxDensity) / std::abs(ref.maxDensity));
+    for (uint32_t a = 0; a < 3; a++)
+    {
+      maxError.centerOfMass[a] = std::max(maxError.centerOfMass[a], std::abs(s.centerOfMass[a] - ref.centerOfMass[a]));
+    }
+
+    const char* failure = compareStats(s, ref, tol);
+    if (failure)
+    {
+      if (failedSteps == 0)
+      {
+        fprintf(stderr, "Step %u: %s exceeds its tolerance\n", i, failure);
+      }
+      failedSteps++;
+    }
+  }
+
+  if (record)
+  {
+    return writeReference(options.referencePath.c_str(), scene, trajectory) ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  const StepStats& last = trajectory.back();
+  const StepStats& lastRef = reference.back();
+  // Last value, reference value and largest deviation over the trajectory.
+  printf("kinetic_energy,%.6g,%.6g,%.3g\n", last.kineticEnergy, lastRef.kineticEnergy, maxError.kineticEnergy);
+  printf("mean_density,%.6g,%.6g,%.3g\n", last.meanDensity, lastRef.meanDensity, maxError.meanDensity);
+  printf("max_density,%.6g,%.6g,%.3g\n", last.maxDensity, lastRef.maxDensity, maxError.maxDensity);
+  printf("center_of_mass,%.6g;%.6g;%.6g,%.6g;%.6g;%.6g,%.3g\n", last.centerOfMass[0], last.centerOfMass[1], last.centerOfMass[2],
+    lastRef.centerOfMass[0], lastRef.centerOfMass[1], lastRef.centerOfMass[2],
+    std::max({ maxError.centerOfMass[0], maxError.centerOfMass[1], maxError.centerOfMass[2] }));
+  printf("failed_steps,%u,%u\n", failedSteps, scene.stepCount);
+
+  return failedSteps == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,647 @@
+#include "CellOrdering.hpp"
+#include "CpuKernels.hpp"
+#include "CpuSimulationBackend.hpp"
+#include "GlParticleReadback.hpp"
+#include "GlQueryRetriever.hpp"
+#include "GlSimulationBackend.hpp"
+#include "ParticleSpawner.hpp"
+#include "Simulation.hpp"
+#include "SpatialHash.hpp"
+#include "ThreadPool.hpp"
+
+#ifdef FLUT_HAS_EGL
+#include "EglContext.hpp"
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace flut;
+
+namespace
+{
+  constexpr uint32_t STAGE_COUNT = GlQueryRetriever::SIM_STEP_COUNT;
+
+  enum class OutputFormat
+  {
+    Csv,
+    Json
+  };
+
+  struct BenchOptions
+  {
+    Simulation::BackendType backend = Simulation::BackendType::Cpu;
+    uint32_t particleCount = Simulation::DEFAULT_PARTICLE_COUNT;
+    uint32_t stepCount = 100;
+    uint32_t integrationsPerStep = 8;
+    uint32_t warmupStepCount = 10;
+    uint32_t seed = 1;
+    uint32_t threadCount = 0;
+    CpuIsa isa = CpuKernels::bestIsa();
+    CellOrder cellOrder = CellOrder::Linear;
+    GridMode gridMode = GridMode::Dense;
+    glm::vec3 domainSize = Simulation::GRID_SIZE;
+    GlKernelMode glKernelMode = GlKernelMode::PerParticle;
+    NeighborListConfig neighborLists;
+    SleepConfig sleep;
+    TimeStepConfig timeStep;
+    uint32_t readbackInterval = 0;
+    OutputFormat format = OutputFormat::Csv;
+  };
+
+  // Timings of one step, i.e. of integrationsPerStep integrations.
+  struct StepRecord
+  {
+    float stageMs[STAGE_COUNT];
+    double wallMs;
+  };
+
+  // Neighbor list activity during the timed steps.
+  struct NeighborListRecord
+  {
+    float skin;
+    uint64_t steps;
+    uint64_t builds;
+    uint32_t overflowParticles;
+
+    double stepsPerBuild() const
+    {
+      return builds > 0 ? double(steps) / builds : double(steps);
+    }
+  };
+
+  // Adaptive time steps over the timed steps.
+  struct TimeStepRecord
+  {
+    float cfl;
+    double meanIntegrations;
+    float minDt;
+    float maxDt;
+    double meanDt;
+    // Simulated time which the GPU dropped.
+    double droppedTime;
+  };
+
+  // Particles which steps 5 and 6 processed, averaged over the timed steps.
+  struct SleepRecord
+  {
+    float velocityThreshold;
+    double meanAwakeParticles;
+  };
+
+  void printUsage()
+  {
+    fprintf(stderr,
+      "Usage: flut-bench [options]\n"
+      "  --backend=cpu|gl   Simulation backend (default: cpu)\n"
+      "  --particles=N      Particle count (default: %u)\n"
+      "  --steps=N          Timed steps (default: 100)\n"
+      "  --ipf=N            Integrations per step (default: 8)\n"
+      "  --warmup=N         Untimed steps before measuring (default: 10)\n"
+      "  --seed=N           Seed of the initial particle distribution (default: 1)\n"
+      "  --threads=N        CPU worker threads, 0 for all cores (default: 0)\n"
+      "  --isa=NAME         CPU instruction set: scalar, sse4, avx2, avx512\n"
+      "  --cell-order=NAME  Cell order: linear, morton, hilbert (default: linear)\n"
+      "  --grid=NAME        Neighbor grid: dense, hashed (default: dense)\n"
+      "  --domain=X,Y,Z     Size of the simulation domain (default: %.0f,%.0f,%.0f)\n"
+      "  --gl-kernels=NAME  Density and force kernels of the GL backend: particle, tiled (default: particle)\n"
+      "  --verlet-skin=F    Skin of the CPU neighbor lists relative to the kernel radius, 0 disables them (default: 0)\n"
+      "  --verlet-max-neighbors=N  Neighbor list entries per particle (default: %u)\n"
+      "  --sleep-velocity=F  Speed below which GL particles count as calm, 0 disables sleeping (default: 0)\n"
+      "  --sleep-density=F  Relative density change below which GL particles count as calm (default: %g)\n"
+      "  --sleep-steps=N    Calm steps after which GL particles sleep (default: %u)\n"
+      "  --cfl=F            CFL number of the adaptive GL time step, 0 uses the fixed one; a step then\n"
+      "                     advances the time of --ipf fixed integrations (default: 0)\n"
+      "  --max-dt=F         Largest adaptive time step (default: %g)\n"
+      "  --readback-interval=N  Copy the GL particle state to the CPU every N steps, 0 disables it (default: 0)\n"
+      "  --format=csv|json  Output format (default: csv)\n",
+      Simulation::DEFAULT_PARTICLE_COUNT, Simulation::GRID_SIZE.x, Simulation::GRID_SIZE.y, Simulation::GRID_SIZE.z,
+      NeighborListConfig{}.maxNeighbors, SleepConfig{}.densityThreshold, SleepConfig{}.calmSteps,
+      TimeStepConfig{}.maxDt);
+  }
+
+  bool parseUint(std::string_view arg, std::string_view prefix, uint32_t& value)
+  {
+    if (arg.substr(0, prefix.size()) != prefix)
+    {
+      return false;
+    }
+    value = static_cast<uint32_t>(std::stoul(std::string(arg.substr(prefix.size()))));
+    return true;
+  }
+
+  bool parseFloat(std::string_view arg, std::string_view prefix, float& value)
+  {
+    if (arg.substr(0, prefix.size()) != prefix)
+    {
+      return false;
+    }
+    value = std::stof(std::string(arg.substr(prefix.size())));
+    return true;
+  }
+
+  bool parseArgs(int argc, char* argv[], BenchOptions& options)
+  {
+    for (int i = 1; i < argc; i++)
+    {
+      const std::string_view arg{argv[i]};
+
+      if (parseUint(arg, "--particles=", options.particleCount) ||
+          parseUint(arg, "--steps=", options.stepCount) ||
+          parseUint(arg, "--ipf=", options.integrationsPerStep) ||
+          parseUint(arg, "--warmup=", options.warmupStepCount) ||
+          parseUint(arg, "--seed=", options.seed) ||
+          parseUint(arg, "--threads=", options.threadCount) ||
+          parseUint(arg, "--verlet-max-neighbors=", options.neighborLists.maxNeighbors) ||
+          parseUint(arg, "--sleep-steps=", options.sleep.calmSteps) ||
+          parseUint(arg, "--readback-interval=", options.readbackInterval) ||
+          parseFloat(arg, "--verlet-skin=", options.neighborLists.skin) ||
+          parseFloat(arg, "--sleep-velocity=", options.sleep.velocityThreshold) ||
+          parseFloat(arg, "--sleep-density=", options.sleep.densityThreshold) ||
+          parseFloat(arg, "--cfl=", options.timeStep.cfl) ||
+          parseFloat(arg, "--max-dt=", options.timeStep.maxDt))
+      {
+        continue;
+      }
+      else if (arg == "--backend=cpu")
+      {
+        options.backend = Simulation::BackendType::Cpu;
+      }
+      else if (arg == "--backend=gl")
+      {
+        options.backend = Simulation::BackendType::Gl;
+      }
+      else if (arg.substr(0, 6) == "--isa=")
+      {
+        if (!CpuKernels::parseIsa(arg.substr(6), options.isa))
+        {
+          fprintf(stderr, "Unknown instruction set %s\n", argv[i]);
+          return false;
+        }
+        if (!CpuKernels::isSupported(options.isa))
+        {
+          fprintf(stderr, "Instruction set %s is not supported\n", CpuKernels::isaName(options.isa));
+          return false;
+        }
+      }
+      else if (arg.substr(0, 13) == "--cell-order=")
+      {
+        if (!CellOrdering::parse(arg.substr(13), options.cellOrder))
+        {
+          fprintf(stderr, "Unknown cell order %s\n", argv[i]);
+          return false;
+        }
+      }
+      else if (arg.substr(0, 7) == "--grid=")
+      {
+        if (!SpatialHash::parse(arg.substr(7), options.gridMode))
+        {
+          fprintf(stderr, "Unknown grid mode %s\n", argv[i]);
+          return false;
+        }
+      }
+      else if (arg.substr(0, 13) == "--gl-kernels=")
+      {
+        if (!GlSimulationBackend::parseKernelMode(arg.substr(13), options.glKernelMode))
+        {
+          fprintf(stderr, "Unknown kernel mode %s\n", argv[i]);
+          return false;
+        }
+      }
+      else if (arg.substr(0, 9) == "--domain=")
+      {
+        glm::vec3& size = options.domainSize;
+        if (sscanf(argv[i] + 9, "%f,%f,%f", &size.x, &size.y, &size.z) != 3 || size.x <= 0.0f || size.y <= 0.0f || size.z <= 0.0f)
+        {
+          fprintf(stderr, "Invalid domain size %s\n", argv[i]);
+          return false;
+        }
+      }
+      else if (arg == "--format=csv")
+      {
+        options.format = OutputFormat::Csv;
+      }
+      else if (arg == "--format=json")
+      {
+        options.format = OutputFormat::Json;
+      }
+      else
+      {
+        fprintf(stderr, "Unknown argument %s\n", argv[i]);
+        printUsage();
+        return false;
+      }
+    }
+
+    if (options.particleCount == 0 || options.stepCount == 0 || options.integrationsPerStep == 0)
+    {
+      fprintf(stderr, "Particle, step and integration counts must be positive\n");
+      return false;
+    }
+
+    if (options.backend == Simulation::BackendType::Gl)
+    {
+      if (options.neighborLists.skin > 0.0f)
+      {
+        fprintf(stderr, "Neighbor lists are only supported by the CPU backend\n");
+        return false;
+      }
+      if (options.integrationsPerStep > GlQueryRetriever::MAX_SIM_ITERS_PER_FRAME)
+      {
+        fprintf(stderr, "The GL backend supports at most %u integrations per step\n", GlQueryRetriever::MAX_SIM_ITERS_PER_FRAME);
+        return false;
+      }
+      if (options.sleep.velocityThreshold > 0.0f && options.glKernelMode != GlKernelMode::PerParticle)
+      {
+        fprintf(stderr, "Sleeping particles are only supported with per-particle kernels\n");
+        return false;
+      }
+    }
+    else if (options.glKernelMode != GlKernelMode::PerParticle)
+    {
+      fprintf(stderr, "Cell-tiled kernels are only supported by the GL backend\n");
+      return false;
+    }
+    else if (options.sleep.velocityThreshold > 0.0f)
+    {
+      fprintf(stderr, "Sleeping particles are only supported by the GL backend\n");
+      return false;
+    }
+    else if (options.timeStep.cfl > 0.0f)
+    {
+      fprintf(stderr, "The adaptive time step is only supported by the GL backend\n");
+      return false;
+    }
+    else if (options.readbackInterval > 0)
+    {
+      fprintf(stderr, "The asynchronous readback is only supported by the GL backend\n");
+      return false;
+    }
+
+    return true;
+  }
+
+  double idlePercent(const ThreadPool::WorkerStats& stats)
+  {
+    const double totalMs = stats.busyMs + stats.idleMs;
+    return totalMs > 0.0 ? stats.idleMs / totalMs * 100.0 : 0.0;
+  }
+
+  void printCsv(const BenchOptions& options, const char* backendName, size_t gridBytes, const std::vector<StepRecord>& records,
+                const StepRecord& mean, double particlesPerSecond, double sortParticlesPerSecond, const ThreadPool* pool,
+                const NeighborListRecord* lists, const SleepRecord* sleep,
+                const TimeStepRecord* timeSteps,
+                const GlParticleReadback::Stats* readback)
+  {
+    const glm::vec3& domain = options.domainSize;
+    printf("# backend=%s cell_order=%s grid=%s grid_bytes=%zu domain=%g,%g,%g particles=%u steps=%u ipf=%u seed=%u particles_per_s=%.0f sort_particles_per_s=%.0f\n",
+      backendName, CellOrdering::name(options.cellOrder), SpatialHash::name(options.gridMode), gridBytes, domain.x, domain.y, domain.z,
+      options.particleCount, options.stepCount, options.integrationsPerStep, options.seed, particlesPerSecond, sortParticlesPerSecond);
+
+    if (pool)
+    {
+      const ThreadPool::WorkerStats total = pool->totalStats();
+      printf("# tasks=%llu steals=%llu stolen_tasks=%llu idle_pct=%.2f\n", (unsigned long long) total.tasks,
+        (unsigned long long) total.steals, (unsigned long long) total.stolenTasks, idlePercent(total));
+    }
+
+    if (lists)
+    {
+      printf("# list_skin=%.4f list_steps=%llu list_builds=%llu steps_per_build=%.2f overflow_particles=%u\n", lists->skin,
+        (unsigned long long) lists->steps, (unsigned long long) lists->builds, lists->stepsPerBuild(), lists->overflowParticles);
+    }
+
+    if (sleep)
+    {
+      printf("# sleep_velocity=%.4f awake_particles=%.0f\n", sleep->velocityThreshold, sleep->meanAwakeParticles);
+    }
+
+    if (timeSteps)
+    {
+      printf("# cfl=%.3f integrations_per_step=%.2f dt_mean=%.6f dt_min=%.6f dt_max=%.6f dropped_time=%.6f\n", timeSteps->cfl,
+        timeSteps->meanIntegrations, timeSteps->meanDt, timeSteps->minDt, timeSteps->maxDt, timeSteps->droppedTime);
+    }
+
+    if (readback)
+    {
+      printf("# readback_interval=%u readbacks=%llu dropped=%llu latency_frames=%.2f readback_mib_per_s=%.1f\n",
+        options.readbackInterval, (unsigned long long) readback->completed, (unsigned long long) readback->dropped,
+        readback->meanLatencyFrames, readback->bytesPerSecond / (1024.0 * 1024.0));
+    }
+
+    printf("step,step1_ms,step2_ms,step3_ms,step4_ms,step5_ms,step6_ms,wall_ms\n");
+
+    auto printRecord = [](const char* label, const StepRecord& record) {
+      printf("%s", label);
+      for (float ms : record.stageMs)
+      {
+        printf(",%.4f", ms);
+      }
+      printf(",%.4f\n", record.wallMs);
+    };
+
+    for (size_t i = 0; i < records.size(); i++)
+    {
+      printRecord(std::to_string(i).c_str(), records[i]);
+    }
+    printRecord("mean", mean);
+  }
+
+  void printJson(const BenchOptions& options, const char* backendName, size_t gridBytes, const std::vector<StepRecord>& records,
+                 const StepRecord& mean, double particlesPerSecond, double sortParticlesPerSecond, const ThreadPool* pool,
+                 const NeighborListRecord* lists, const SleepRecord* sleep,
+                 const TimeStepRecord* timeSteps,
+                 const GlParticleReadback::Stats* readback)
+  {
+    auto printStages = [](const StepRecord& record) {
+      printf("[");
+      for (uint32_t s = 0; s < STAGE_COUNT; s++)
+      {
+        printf(s == 0 ? "%.4f" : ", %.4f", record.stageMs[s]);
+      }
+      printf("]");
+    };
+
+    printf("{\n");
+    printf("  \"backend\": \"%s\",\n", backendName);
+    printf("  \"cell_order\": \"%s\",\n", CellOrdering::name(options.cellOrder));
+    printf("  \"grid\": \"%s\",\n", SpatialHash::name(options.gridMode));
+    printf("  \"grid_bytes\": %zu,\n", gridBytes);
+    printf("  \"domain\": [%g, %g, %g],\n", options.domainSize.x, options.domainSize.y, options.domainSize.z);
+    printf("  \"particles\": %u,\n", options.particleCount);
+    printf("  \"steps\": %u,\n", options.stepCount);
+    printf("  \"ipf\": %u,\n", options.integrationsPerStep);
+    printf("  \"seed\": %u,\n", options.seed);
+    printf("  \"particles_per_s\": %.0f,\n", particlesPerSecond);
+    printf("  \"sort_particles_per_s\": %.0f,\n", sortParticlesPerSecond);
+    if (pool)
+    {
+      const ThreadPool::WorkerStats total = pool->totalStats();
+      printf("  \"scheduler\": { \"tasks\": %llu, \"steals\": %llu, \"stolen_tasks\": %llu, \"idle_pct\": %.2f, \"workers\": [\n",
+        (unsigned long long) total.tasks, (unsigned long long) total.steals, (unsigned long long) total.stolenTasks, idlePercent(total));
+      for (uint32_t i = 0; i < pool->threadCount(); i++)
+      {
+        const ThreadPool::WorkerStats& stats = pool->workerStats(i);
+        printf("    { \"tasks\": %llu, \"steals\": %llu, \"stolen_tasks\": %llu, \"busy_ms\": %.3f, \"idle_ms\": %.3f }%s\n",
+          (unsigned long long) stats.tasks, (unsigned long long) stats.steals, (unsigned long long) stats.stolenTasks,
+          stats.busyMs, stats.idleMs, i + 1 < pool->threadCount() ? "," : "");
+      }
+      printf("  ] },\n");
+    }
+    if (lists)
+    {
+      printf("  \"neighbor_lists\": { \"skin\": %.4f, \"steps\": %llu, \"builds\": %llu, \"steps_per_build\": %.2f, \"overflow_particles\": %u },\n",
+        lists->skin, (unsigned long long) lists->steps, (unsigned long long) lists->builds, lists->stepsPerBuild(), lists->overflowParticles);
+    }
+    if (sleep)
+    {
+      printf("  \"sleep\": { \"velocity\": %.4f, \"awake_particles\": %.0f },\n", sleep->velocityThreshold, sleep->meanAwakeParticles);
+    }
+    if (timeSteps)
+    {
+      printf("  \"time_step\": { \"cfl\": %.3f, \"integrations_per_step\": %.2f, \"dt_mean\": %.6f, \"dt_min\": %.6f, \"dt_max\": %.6f, "
+        "\"dropped_time\": %.6f },\n",
+        timeSteps->cfl, timeSteps->meanIntegrations, timeSteps->meanDt, timeSteps->minDt, timeSteps->maxDt, timeSteps->droppedTime);
+    }
+    if (readback)
+    {
+      printf("  \"readback\": { \"interval\": %u, \"readbacks\": %llu, \"dropped\": %llu, \"latency_frames\": %.2f, \"mib_per_s\": %.1f },\n",
+        options.readbackInterval, (unsigned long long) readback->completed, (unsigned long long) readback->dropped,
+        readback->meanLatencyFrames, readback->bytesPerSecond / (1024.0 * 1024.0));
+    }
+    printf("  \"mean\": { \"stages_ms\": ");
+    printStages(mean);
+    printf(", \"wall_ms\": %.4f },\n", mean.wallMs);
+    printf("  \"records\": [\n");
+    for (size_t i = 0; i < records.size(); i++)
+    {
+      printf("    { \"stages_ms\": ");
+      printStages(records[i]);
+      printf(", \"wall_ms\": %.4f }%s\n", records[i].wallMs, i + 1 < records.size() ? "," : "");
+    }
+    printf("  ]\n");
+    printf("}\n");
+  }
+}
+
+int main(int argc, char* argv[])
+{
+  BenchOptions options;
+
+  if (argc == 2 && std::string_view(argv[1]) == "--help")
+  {
+    printUsage();
+    return EXIT_SUCCESS;
+  }
+
+  if (!parseArgs(argc, argv, options))
+  {
+    return EXIT_FAILURE;
+  }
+
+  SimulationGrid grid = SimulationGrid::fromSize(options.domainSize, Simulation::CELL_SIZE);
+  grid.cellOrder = options.cellOrder;
+  grid.mode = options.gridMode;
+
+  const std::vector<Particle> particles = ParticleSpawner::spawnBlock(options.particleCount, options.seed, Simulation::SPAWN_DENSITY, grid, Simulation::PARAMS);
+
+#ifdef FLUT_HAS_EGL
+  std::unique_ptr<EglContext> context;
+#endif
+  std::unique_ptr<GlQueryRetriever> queries;
+  std::unique_ptr<GlParticleReadback> readback;
+  std::unique_ptr<SimulationBackend> backend;
+  ThreadPool* pool = nullptr;
+  CpuSimulationBackend* cpu = nullptr;
+
+  if (options.backend == Simulation::BackendType::Gl)
+  {
+#ifdef FLUT_HAS_EGL
+    context = std::make_unique<EglContext>();
+    queries = std::make_unique<GlQueryRetriever>();
+    backend = std::make_unique<GlSimulationBackend>(particles, grid, Simulation::PARAMS, queries.get(), options.glKernelMode,
+                                                    options.sleep, options.timeStep);
+    if (options.readbackInterval > 0)
+    {
+      readback = std::make_unique<GlParticleReadback>();
+    }
+#else
+    fprintf(stderr, "flut-bench was built without EGL, the GL backend is unavailable\n");
+    return EXIT_FAILURE;
+#endif
+  }
+  else
+  {
+    auto cpuBackend = std::make_unique<CpuSimulationBackend>(particles, grid, Simulation::PARAMS, options.threadCount, options.isa,
+                                                             options.neighborLists);
+    pool = &cpuBackend->threadPool();
+    cpu = cpuBackend.get();
+    backend = std::move(cpuBackend);
+  }
+
+  fprintf(stderr, "Running %u steps of %u integrations with %u particles on %s\n",
+    options.stepCount, options.integrationsPerStep, options.particleCount, backend->name());
+
+  const float dt = Simulation::DT;
+  const glm::vec3 gravity{0.0f, -9.81f, 0.0f};
+
+  using clock = std::chrono::high_resolution_clock;
+
+  std::vector<StepRecord> records;
+  records.reserve(options.stepCount);
+
+  CpuSimulationBackend::NeighborListStats warmupListStats;
+  double awakeParticleSum = 0.0;
+  const bool adaptive = queries && options.timeStep.cfl > 0.0f;
+  TimeStepRecord timeSteps{options.timeStep.cfl, 0.0, options.timeStep.maxDt, 0.0f, 0.0, 0.0};
+  uint64_t integrationCount = 0;
+
+  const uint32_t totalStepCount = options.warmupStepCount + options.stepCount;
+  for (uint32_t i = 0; i < totalStepCount; i++)
+  {
+    const auto startTime = clock::now();
+
+    // The adaptive time step advances the same simulated time in as many integrations as it needs.
+    uint32_t integrations = options.integrationsPerStep;
+    if (adaptive)
+    {
+      integrations = backend->advance(options.integrationsPerStep * dt, gravity);
+    }
+    else
+    {
+      for (uint32_t j = 0; j < options.integrationsPerStep; j++)
+      {
+        backend->step(dt, gravity);
+      }
+    }
+
+    // The copy is queued behind the step and read by a later step, like an analysis would.
+    if (readback)
+    {
+      if (i % options.readbackInterval == 0)
+      {
+        readback->request(backend->particleBuffers(), backend->particleCount(), i);
+      }
+
+      GlParticleReadback::View view;
+      if (readback->acquire(view))
+      {
+        readback->release();
+      }
+    }
+
+    SimulationBackend::StepTimings times{};
+
+    if (queries)
+    {
+      // An empty render query marks the end of the frame for the query retriever.
+      // Waiting for completion keeps the query ring from overflowing.
+      queries->beginRenderQuery();
+      queries->endQuery();
+      glFinish();
+
+      if (!queries->readFinishedQueries(times))
+      {
+        fprintf(stderr, "GPU timer queries not available after glFinish\n");
+        return EXIT_FAILURE;
+      }
+      queries->incFrame();
+    }
+
+    if (readback)
+    {
+      readback->update(i);
+    }
+
+    backend->readTimes(times);
+
+    const std::chrono::duration<double, std::milli> wallTime{clock::now() - startTime};
+
+    if (i < options.warmupStepCount)
+    {
+      if (cpu && i + 1 == options.warmupStepCount)
+      {
+        pool->resetStats();
+        warmupListStats = cpu->neighborListStats();
+      }
+      continue;
+    }
+
+    // Reported stage times are per-integration averages; scale them to the whole step.
+    StepRecord record;
+    for (uint32_t s = 0; s < STAGE_COUNT; s++)
+    {
+      record.stageMs[s] = times.simStempMs[s] * integrations;
+    }
+    record.wallMs = wallTime.count();
+    records.push_back(record);
+
+    // Read back after the wall time, the count is only known once the GPU is done.
+    awakeParticleSum += backend->awakeParticleCount();
+    integrationCount += integrations;
+
+    TimeStepStats stepStats;
+    if (adaptive && backend->readTimeStepStats(stepStats))
+    {
+      timeSteps.minDt = std::min(timeSteps.minDt, stepStats.minDt);
+      timeSteps.maxDt = std::max(timeSteps.maxDt, stepStats.maxDt);
+      timeSteps.meanDt += double(stepStats.meanDt) * stepStats.steps;
+      timeSteps.droppedTime += stepStats.droppedTime;
+    }
+  }
+
+  StepRecord mean{};
+  for (const StepRecord& record : records)
+  {
+    for (uint32_t s = 0; s < STAGE_COUNT; s++)
+    {
+      mean.stageMs[s] += record.stageMs[s] / records.size();
+    }
+    mean.wallMs += record.wallMs / records.size();
+  }
+
+  const double meanIntegrations = double(integrationCount) / records.size();
+  const double particlesPerSecond = double(options.particleCount) * meanIntegrations / (mean.wallMs / 1000.0);
+
+  // Steps 1-3 build the grid, i.e. sort the particles by voxel.
+  const double sortMs = mean.stageMs[0] + mean.stageMs[1] + mean.stageMs[2];
+  const double sortParticlesPerSecond = double(options.particleCount) * meanIntegrations / (sortMs / 1000.0);
+
+  NeighborListRecord lists{};
+  const bool hasLists = cpu && cpu->neighborListSkin() > 0.0f;
+  if (hasLists)
+  {
+    const CpuSimulationBackend::NeighborListStats& stats = cpu->neighborListStats();
+    lists.skin = cpu->neighborListSkin();
+    lists.steps = stats.steps - warmupListStats.steps;
+    lists.builds = stats.builds - warmupListStats.builds;
+    lists.overflowParticles = stats.overflowParticles;
+  }
+
+  const SleepRecord sleep{options.sleep.velocityThreshold, awakeParticleSum / records.size()};
+  const bool hasSleep = queries && options.sleep.velocityThreshold > 0.0f;
+
+  timeSteps.meanIntegrations = meanIntegrations;
+  timeSteps.meanDt = integrationCount > 0 ? timeSteps.meanDt / integrationCount : 0.0;
+
+  if (options.format == OutputFormat::Json)
+  {
+    printJson(options, backend->name(), backend->gridMemoryBytes(), records, mean, particlesPerSecond, sortParticlesPerSecond, pool,
+              hasLists ? &lists : nullptr, hasSleep ? &sleep : nullptr,
+              adaptive ? &timeSteps : nullptr, readback ? &readback->stats() : nullptr);
+  }
+  else
+  {
+    printCsv(options, backend->name(), backend->gridMemoryBytes(), records, mean, particlesPerSecond, sortParticlesPerSecond, pool,
+             hasLists ? &lists : nullptr, hasSleep ? &sleep : nullptr,
+             adaptive ? &timeSteps : nullptr, readback ? &readback->stats() : nullptr);
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,805 @@
+#include "CellOrdering.hpp"
+#include "CpuKernels.hpp"
+#include "CpuSimulationBackend.hpp"
+#include "FluidRenderer.hpp"
+#include "GlSimulationBackend.hpp"
+#include "ParticleSpawner.hpp"
+#include "Simulation.hpp"
+#include "SpatialHash.hpp"
+#include "ThreadPool.hpp"
+#include "TrajectoryCodec.hpp"
+#include "TrajectoryFormat.hpp"
+
+#ifdef FLUT_HAS_EGL
+#include "EglContext.hpp"
+#endif
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace flut;
+
+// Times each stage of the pipeline in isolation. For every combination of particle count,
+// grid resolution and fill ratio, the scene is simulated for a number of warmup steps and
+// the stage is then repeated on the frozen state (dt = 0), so that every repetition does
+// the same work.
+
+namespace
+{
+  enum class OutputFormat
+  {
+    Csv,
+    Json
+  };
+
+  struct BenchCase
+  {
+    const char* name;
+    uint32_t firstStep;
+    uint32_t lastStep;
+    bool render;
+    // Compresses or decompresses the sorted particles as a trajectory frame on the CPU.
+    bool codec;
+  };
+
+  const BenchCase BENCH_CASES[] = {
+    { "grid",      0, 2, false, false }, // Steps 1-3: counting, offsets and scatter
+    { "velocity",  3, 3, false, false }, // Step 4: velocity grid
+    { "density",   4, 4, false, false }, // Step 5
+    { "forces",    5, 5, false, false }, // Step 6
+    { "splat",     0, 0, true,  false }, // Step 7: billboard splat
+    { "curvature", 0, 0, true,  false }, // Step 7.1: curvature flow loop
+    { "encode",    0, 0, false, true  }, // TrajectoryCodec
+    { "decode",    0, 0, false, true  }
+  };
+
+  struct BenchOptions
+  {
+    Simulation::BackendType backend = Simulation::BackendType::Cpu;
+    std::vector<const BenchCase*> cases;
+    std::vector<uint32_t> particleCounts = { Simulation::DEFAULT_PARTICLE_COUNT };
+    std::vector<glm::ivec3> gridResolutions = { Simulation::GRID_RES };
+    std::vector<float> fillRatios = { 0.125f };
+    std::vector<CellOrder> cellOrders = { CellOrder::Linear };
+    std::vector<GridMode> gridModes = { GridMode::Dense };
+    std::vector<GlKernelMode> glKernelModes = { GlKernelMode::PerParticle };
+    TrajectoryCodec::Config codec = { 1e-4f, 1e-3f };
+    uint32_t repetitions = 30;
+    uint32_t warmupStepCount = 20;
+    uint32_t seed = 1;
+    uint32_t threadCount = 0;
+    CpuIsa isa = CpuKernels::bestIsa();
+    uint32_t width = 1200;
+    uint32_t height = 800;
+    OutputFormat format = OutputFormat::Csv;
+  };
+
+  struct CaseResult
+  {
+    const BenchCase* benchCase;
+    uint32_t particleCount;
+    glm::ivec3 gridRes;
+    float fillRatio;
+    CellOrder cellOrder;
+    GridMode gridMode;
+    GlKernelMode glKernelMode;
+    size_t gridBytes;
+    // Bytes of an uncompressed frame per compressed byte, only set for the codec cases.
+    double compressionRatio;
+    // Largest deviation of a decoded component from the encoded one, in m and m/s, only set for the
+    // codec cases.
+    double positionMaxError;
+    double velocityMaxError;
+    uint32_t repetitions;
+    double meanMs;
+    double medianMs;
+    double stddevMs;
+    double minMs;
+    double maxMs;
+    // Particles processed per second; for the grid case this is the sort throughput.
+    double particlesPerSecond;
+    // Simulated cache hit rates of the neighborhood walk, only set for the density and force cases.
+    bool hasCacheStats;
+    double l1HitPercent;
+    double l2HitPercent;
+  };
+
+  // Set-associative cache with LRU replacement, fed with the cache lines of the particle buffer.
+  class CacheSimulator
+  {
+  public:
+    constexpr static uint32_t LINE_SIZE = 64;
+    constexpr static uint32_t WAYS = 8;
+
+    explicit CacheSimulator(uint32_t sizeBytes)
+      : m_setCount(sizeBytes / LINE_SIZE / WAYS)
+      , m_tags(size_t(m_setCount) * WAYS, UINT64_MAX)
+      , m_lastUse(size_t(m_setCount) * WAYS, 0)
+    {
+    }
+
+    void access(uint64_t line)
+    {
+      m_time++;
+      m_accesses++;
+
+      const size_t set = (line % m_setCount) * WAYS;
+      size_t victim = set;
+      for (size_t i = set; i < set + WAYS; i++)
+      {
+        if (m_tags[i] == line)
+        {
+          m_lastUse[i] = m_time;
+          m_hits++;
+          return;
+        }
+        if (m_lastUse[i] < m_lastUse[victim])
+        {
+          victim = i;
+        }
+      }
+
+      m_tags[victim] = line;
+      m_lastUse[victim] = m_time;
+    }
+
+    double hitPercent() const
+    {
+      return m_accesses > 0 ? 100.0 * m_hits / m_accesses : 0.0;
+    }
+
+  private:
+    uint32_t m_setCount;
+    std::vector<uint64_t> m_tags;
+    std::vector<uint64_t> m_lastUse;
+    uint64_t m_time = 0;
+    uint64_t m_hits = 0;
+    uint64_t m_accesses = 0;
+  };
+
+  // Replays the particle reads of steps 5 and 6, particle after particle, on an L1- and an
+  // L2-sized cache. The voxel ranges are recovered from the cell-sorted particle buffer.
+  void simulateNeighborhoodCache(const std::vector<Particle>& particles, const SimulationGrid& grid,
+                                 double& l1HitPercent, double& l2HitPercent)
+  {
+    const glm::vec3 invCellSize = grid.invCellSize();
+    auto voxelCoord = [&](const Particle& p) {
+      const glm::vec3 position{p.position_x, p.position_y, p.position_z};
+      return glm::clamp(glm::ivec3((position - grid.origin) * invCellSize), glm::ivec3(0), grid.res - 1);
+    };
+
+    std::vector<uint32_t> voxelOffsets(grid.voxelCount(), 0);
+    std::vector<uint32_t> voxelCounts(grid.voxelCount(), 0);
+    for (uint32_t i = 0; i < particles.size(); i++)
+    {
+      const glm::ivec3 c = voxelCoord(particles[i]);
+      const uint32_t voxel = c.x + grid.res.x * (c.y + grid.res.y * c.z);
+      if (voxelCounts[voxel]++ == 0)
+      {
+        voxelOffsets[voxel] = i;
+      }
+    }
+
+    CacheSimulator l1{32 * 1024};
+    CacheSimulator l2{1024 * 1024};
+    // Lines of the position stream, which all neighbor passes read.
+    constexpr uint32_t PARTICLES_PER_LINE = CacheSimulator::LINE_SIZE / sizeof(glm::vec4);
+
+    for (const Particle& particle : particles)
+    {
+      const glm::ivec3 c = voxelCoord(particle);
+
+      for (int32_t z = c.z - 1; z <= c.z + 1; z++)
+      for (int32_t y = c.y - 1; y <= c.y + 1; y++)
+      for (int32_t x = c.x - 1; x <= c.x + 1; x++)
+      {
+        if (glm::any(glm::greaterThanEqual(glm::uvec3(x, y, z), glm::uvec3(grid.res))))
+        {
+          continue;
+        }
+
+        const uint32_t voxel = x + grid.res.x * (y + grid.res.y * z);
+        const uint32_t count = voxelCounts[voxel];
+        if (count == 0)
+        {
+          continue;
+        }
+
+        const uint32_t firstLine = voxelOffsets[voxel] / PARTICLES_PER_LINE;
+        const uint32_t lastLine = (voxelOffsets[voxel] + count - 1) / PARTICLES_PER_LINE;
+        for (uint32_t line = firstLine; line <= lastLine; line++)
+        {
+          l1.access(line);
+          l2.access(line);
+        }
+      }
+    }
+
+    l1HitPercent = l1.hitPercent();
+    l2HitPercent = l2.hitPercent();
+  }
+
+  void printUsage()
+  {
+    fprintf(stderr,
+      "Usage: flut-microbench [options]\n"
+      "  --backend=cpu|gl      Simulation backend (default: cpu)\n"
+      "  --cases=A,B,...       Cases: grid, velocity, density, forces, splat, curvature, encode, decode (default: all)\n"
+      "  --particles=N,...     Particle counts (default: %u)\n"
+      "  --grid-res=XxYxZ,...  Grid resolutions (default: %dx%dx%d)\n"
+      "  --fill=F,...          Fraction of the domain covered by the fluid block (default: 0.125)\n"
+      "  --cell-order=A,...    Cell orders: linear, morton, hilbert (default: linear)\n"
+      "  --grid=A,...          Neighbor grids: dense, hashed (default: dense); hashed grids ignore the cell order\n"
+      "  --gl-kernels=A,...    Density and force kernels of the GL backend: particle, tiled (default: particle)\n"
+      "  --codec-error=P,V     Position and velocity error bounds of the codec cases (default: 0.0001,0.001)\n"
+      "  --reps=N              Repetitions per case (default: 30)\n"
+      "  --warmup=N            Simulation steps before measuring (default: 20)\n"
+      "  --seed=N              Seed of the initial particle distribution (default: 1)\n"
+      "  --threads=N           CPU worker threads, 0 for all cores (default: 0)\n"
+      "  --isa=NAME            CPU instruction set: scalar, sse4, avx2, avx512\n"
+      "  --width=N --height=N  Framebuffer size of the render cases (default: 1200x800)\n"
+      "  --format=csv|json     Output format (default: csv)\n",
+      Simulation::DEFAULT_PARTICLE_COUNT, Simulation::GRID_RES.x, Simulation::GRID_RES.y, Simulation::GRID_RES.z);
+  }
+
+  bool startsWith(std::string_view arg, std::string_view prefix)
+  {
+    return arg.substr(0, prefix.size()) == prefix;
+  }
+
+  template<typename T, typename F>
+  bool parseList(std::string_view list, std::vector<T>& values, F&& parseValue)
+  {
+    values.clear();
+
+    while (!list.empty())
+    {
+      const size_t end = std::min(list.find(','), list.size());
+      T value;
+      if (!parseValue(std::string(list.substr(0, end)), value))
+      {
+        return false;
+      }
+      values.push_back(value);
+      list.remove_prefix(std::min(end + 1, list.size()));
+    }
+
+    return !values.empty();
+  }
+
+  bool parseArgs(int argc, char* argv[], BenchOptions& options)
+  {
+    auto parseUint = [](const std::string& str, uint32_t& value) {
+      value = static_cast<uint32_t>(std::stoul(str));
+      return value > 0;
+    };
+
+    auto parseFloat = [](const std::string& str, float& value) {
+      value = std::stof(str);
+      return value > 0.0f && value <= 1.0f;
+    };
+
+    auto parseRes = [](const std::string& str, glm::ivec3& value) {
+      return sscanf(str.c_str(), "%dx%dx%d", &value.x, &value.y, &value.z) == 3;
+    };
+
+    auto parseCellOrder = [](const std::string& str, CellOrder& value) {
+      return CellOrdering::parse(str, value);
+    };
+
+    auto parseGridMode = [](const std::string& str, GridMode& value) {
+      return SpatialHash::parse(str, value);
+    };
+
+    auto parseKernelMode = [](const std::string& str, GlKernelMode& value) {
+      return GlSimulationBackend::parseKernelMode(str, value);
+    };
+
+    auto parseCase = [](const std::string& str, const BenchCase*& value) {
+      for (const BenchCase& benchCase : BENCH_CASES)
+      {
+        if (str == benchCase.name)
+        {
+          value = &benchCase;
+          return true;
+        }
+      }
+      return false;
+    };
+
+    for (int i = 1; i < argc; i++)
+    {
+      const std::string_view arg{argv[i]};
+      bool valid = true;
+
+      if (arg == "--backend=cpu")
+      {
+        options.backend = Simulation::BackendType::Cpu;
+      }
+      else if (arg == "--backend=gl")
+      {
+        options.backend = Simulation::BackendType::Gl;
+      }
+      else if (startsWith(arg, "--cases="))
+      {
+        valid = parseList(arg.substr(8), options.cases, parseCase);
+      }
+      else if (startsWith(arg, "--particles="))
+      {
+        valid = parseList(arg.substr(12), options.particleCounts, parseUint);
+      }
+      else if (startsWith(arg, "--grid-res="))
+      {
+        valid = parseList(arg.substr(11), options.gridResolutions, parseRes);
+      }
+      else if (startsWith(arg, "--fill="))
+      {
+        valid = parseList(arg.substr(7), options.fillRatios, parseFloat);
+      }
+      else if (startsWith(arg, "--cell-order="))
+      {
+        valid = parseList(arg.substr(13), options.cellOrders, parseCellOrder);
+      }
+      else if (startsWith(arg, "--grid="))
+      {
+        valid = parseList(arg.substr(7), options.gridModes, parseGridMode);
+      }
+      else if (startsWith(arg, "--gl-kernels="))
+      {
+        valid = parseList(arg.substr(13), options.glKernelModes, parseKernelMode);
+      }
+      else if (startsWith(arg, "--codec-error="))
+      {
+        valid = sscanf(std::string(arg.substr(14)).c_str(), "%f,%f", &options.codec.positionError, &options.codec.velocityError) == 2 &&
+                options.codec.positionError > 0.0f && options.codec.velocityError > 0.0f;
+      }
+      else if (startsWith(arg, "--reps="))
+      {
+        valid = parseUint(std::string(arg.substr(7)), options.repetitions);
+      }
+      else if (startsWith(arg, "--warmup="))
+      {
+        options.warmupStepCount = static_cast<uint32_t>(std::stoul(std::string(arg.substr(9))));
+      }
+      else if (startsWith(arg, "--seed="))
+      {
+        options.seed = static_cast<uint32_t>(std::stoul(std::string(arg.substr(7))));
+      }
+      else if (startsWith(arg, "--threads="))
+      {
+        options.threadCount = static_cast<uint32_t>(std::stoul(std::string(arg.substr(10))));
+      }
+      else if (startsWith(arg, "--width="))
+      {
+        valid = parseUint(std::string(arg.substr(8)), options.width);
+      }
+      else if (startsWith(arg, "--height="))
+      {
+        valid = parseUint(std::string(arg.substr(9)), options.height);
+      }
+      else if (startsWith(arg, "--isa="))
+      {
+        if (!CpuKernels::parseIsa(arg.substr(6), options.isa) || !CpuKernels::isSupported(options.isa))
+        {
+          fprintf(stderr, "Instruction set %s is unknown or not supported\n", argv[i]);
+          return false;
+        }
+      }
+      else if (arg == "--format=csv")
+      {
+        options.format = OutputFormat::Csv;
+      }
+      else if (arg == "--format=json")
+      {
+        options.format = OutputFormat::Json;
+      }
+      else
+      {
+        fprintf(stderr, "Unknown argument %s\n", argv[i]);
+        printUsage();
+        return false;
+      }
+
+      if (!valid)
+      {
+        fprintf(stderr, "Invalid value in %s\n", argv[i]);
+        return false;
+      }
+    }
+
+    if (options.cases.empty())
+    {
+      for (const BenchCase& benchCase : BENCH_CASES)
+      {
+        if (!benchCase.render || options.backend == Simulation::BackendType::Gl)
+        {
+          options.cases.push_back(&benchCase);
+        }
+      }
+    }
+
+    for (const BenchCase* benchCase : options.cases)
+    {
+      if (benchCase->render && options.backend != Simulation::BackendType::Gl)
+      {
+        fprintf(stderr, "Case %s requires the GL backend\n", benchCase->name);
+        return false;
+      }
+    }
+
+    for (GlKernelMode kernelMode : options.glKernelModes)
+    {
+      if (kernelMode != GlKernelMode::PerParticle && options.backend != Simulation::BackendType::Gl)
+      {
+        fprintf(stderr, "Cell-tiled kernels are only supported by the GL backend\n");
+        return false;
+      }
+    }
+
+    // Each axis needs room for the boundaries and at least a few cells of fluid.
+    for (const glm::ivec3& res : options.gridResolutions)
+    {
+      if (glm::any(glm::lessThan(res, glm::ivec3(8))))
+      {
+        fprintf(stderr, "Grid resolutions must be at least 8 in each dimension\n");
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  CaseResult computeStats(std::vector<double>& samples)
+  {
+    CaseResult result{};
+    result.repetitions = static_cast<uint32_t>(samples.size());
+
+    std::sort(samples.begin(), samples.end());
+    result.minMs = samples.front();
+    result.maxMs = samples.back();
+    result.medianMs = samples[samples.size() / 2];
+
+    for (double ms : samples)
+    {
+      result.meanMs += ms / samples.size();
+    }
+
+    double variance = 0.0;
+    for (double ms : samples)
+    {
+      variance += (ms - result.meanMs) * (ms - result.meanMs);
+    }
+    if (samples.size() > 1)
+    {
+      variance /= samples.size() - 1;
+    }
+    result.stddevMs = std::sqrt(variance);
+
+    return result;
+  }
+
+  // Calls func once per repetition and returns the time of each call, measured on the device
+  // which executes the work.
+  std::vector<double> measure(bool gpu, uint32_t repetitions, const std::function<void()>& func)
+  {
+    std::vector<double> samples;
+    samples.reserve(repetitions);
+
+    GLuint query = 0;
+    if (gpu)
+    {
+      glCreateQueries(GL_TIME_ELAPSED, 1, &query);
+    }
+
+    for (uint32_t i = 0; i < repetitions; i++)
+    {
+      if (gpu)
+      {
+        glBeginQuery(GL_TIME_ELAPSED, query);
+        func();
+        glEndQuery(GL_TIME_ELAPSED);
+
+        GLuint64 elapsedNs = 0;
+        glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsedNs);
+        samples.push_back(elapsedNs / 1000000.0);
+      }
+      else
+      {
+        const auto start = std::chrono::high_resolution_clock::now();
+        func();
+        const std::chrono::duration<double, std::milli> elapsed{std::chrono::high_resolution_clock::now() - start};
+        samples.push_back(elapsed.count());
+      }
+    }
+
+    if (gpu)
+    {
+      glDeleteQueries(1, &query);
+    }
+
+    return samples;
+  }
+
+  void printCsv(const char* backendName, const std::vector<CaseResult>& results)
+  {
+    printf("# backend=%s\n", backendName);
+    printf("case,particles,grid_x,grid_y,grid_z,fill,cell_order,grid,gl_kernels,grid_bytes,reps,mean_ms,median_ms,stddev_ms,min_ms,max_ms,"
+           "particles_per_s,l1_hit_pct,l2_hit_pct,compression_ratio,position_max_error,velocity_max_error\n");
+
+    for (const CaseResult& r : results)
+    {
+      printf("%s,%u,%d,%d,%d,%.4f,%s,%s,%s,%zu,%u,%.4f,%.4f,%.4f,%.4f,%.4f,%.0f,", r.benchCase->name, r.particleCount,
+        r.gridRes.x, r.gridRes.y, r.gridRes.z, r.fillRatio, CellOrdering::name(r.cellOrder), SpatialHash::name(r.gridMode),
+        GlSimulationBackend::kernelModeName(r.glKernelMode), r.gridBytes, r.repetitions, r.meanMs, r.medianMs, r.stddevMs, r.minMs, r.maxMs, r.particlesPerSecond);
+
+      if (r.hasCacheStats)
+      {
+        printf("%.2f,%.2f,", r.l1HitPercent, r.l2HitPercent);
+      }
+      else
+      {
+        printf(",,");
+      }
+
+      if (r.benchCase->codec)
+      {
+        printf("%.3f,%.3g,%.3g\n", r.compressionRatio, r.positionMaxError, r.velocityMaxError);
+      }
+      else
+      {
+        printf("\n");
+      }
+    }
+  }
+
+  void printJson(const char* backendName, const std::vector<CaseResult>& results)
+  {
+    printf("{\n");
+    printf("  \"backend\": \"%s\",\n", backendName);
+    printf("  \"results\": [\n");
+
+    for (size_t i = 0; i < results.size(); i++)
+    {
+      const CaseResult& r = results[i];
+      printf("    { \"case\": \"%s\", \"particles\": %u, \"grid_res\": [%d, %d, %d], \"fill\": %.4f, \"cell_order\": \"%s\", "
+             "\"grid\": \"%s\", \"gl_kernels\": \"%s\", \"grid_bytes\": %zu, \"reps\": %u, \"mean_ms\": %.4f, \"median_ms\": %.4f, \"stddev_ms\": %.4f, "
+             "\"min_ms\": %.4f, \"max_ms\": %.4f, \"particles_per_s\": %.0f",
+        r.benchCase->name, r.particleCount, r.gridRes.x, r.gridRes.y, r.gridRes.z, r.fillRatio, CellOrdering::name(r.cellOrder),
+        SpatialHash::name(r.gridMode), GlSimulationBackend::kernelModeName(r.glKernelMode), r.gridBytes, r.repetitions, r.meanMs, r.medianMs, r.stddevMs, r.minMs, r.maxMs,
+        r.particlesPerSecond);
+
+      if (r.hasCacheStats)
+      {
+        printf(", \"l1_hit_pct\": %.2f, \"l2_hit_pct\": %.2f", r.l1HitPercent, r.l2HitPercent);
+      }
+      if (r.benchCase->codec)
+      {
+        printf(", \"compression_ratio\": %.3f, \"position_max_error\": %.3g, \"velocity_max_error\": %.3g", r.compressionRatio,
+          r.positionMaxError, r.velocityMaxError);
+      }
+      printf(" }%s\n", i + 1 < results.size() ? "," : "");
+    }
+
+    printf("  ]\n");
+    printf("}\n");
+  }
+}
+
+int main(int argc, char* argv[])
+{
+  BenchOptions options;
+
+  if (argc == 2 && std::string_view(argv[1]) == "--help")
+  {
+    printUsage();
+    return EXIT_SUCCESS;
+  }
+
+  if (!parseArgs(argc, argv, options))
+  {
+    return EXIT_FAILURE;
+  }
+
+  const bool gpu = options.backend == Simulation::BackendType::Gl;
+
+#ifdef FLUT_HAS_EGL
+  std::unique_ptr<EglContext> context;
+  if (gpu)
+  {
+    context = std::make_unique<EglContext>();
+  }
+#else
+  if (gpu)
+  {
+    fprintf(stderr, "flut-microbench was built without EGL, the GL backend is unavailable\n");
+    return EXIT_FAILURE;
+  }
+#endif
+
+  // Same view as the initial camera of the interactive application.
+  constexpr float NEAR_PLANE = 0.01f;
+  constexpr float FAR_PLANE = 50.0f;
+  const glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 0.0f, 18.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+  const glm::mat4 projection = glm::perspective(glm::radians(60.0f), float(options.width) / options.height, NEAR_PLANE, FAR_PLANE);
+  const float pointRadius = Simulation::KERNEL_RADIUS * 0.75f;
+
+  const glm::vec3 gravity{0.0f, -9.81f, 0.0f};
+
+  std::vector<CaseResult> results;
+  std::string backendName;
+
+  // The codec cases run on the CPU threads in any case.
+  ThreadPool codecPool{options.threadCount};
+  TrajectoryCodec codec{&codecPool};
+
+  for (uint32_t particleCount : options.particleCounts)
+  {
+    for (const glm::ivec3& gridRes : options.gridResolutions)
+    {
+      for (float fillRatio : options.fillRatios)
+      for (CellOrder cellOrder : options.cellOrders)
+      for (GridMode gridMode : options.gridModes)
+      for (GlKernelMode kernelMode : options.glKernelModes)
+      {
+        // The layout of a hashed grid does not depend on the cell order.
+        if (gridMode == GridMode::Hashed && cellOrder != options.cellOrders.front())
+        {
+          continue;
+        }
+
+        SimulationGrid grid = SimulationGrid::fromResolution(gridRes, Simulation::CELL_SIZE);
+        grid.cellOrder = cellOrder;
+        grid.mode = gridMode;
+
+        const std::vector<Particle> particles = ParticleSpawner::spawnFilled(particleCount, options.seed, fillRatio, grid);
+
+        std::unique_ptr<SimulationBackend> backend;
+        std::unique_ptr<FluidRenderer> renderer;
+
+        if (gpu)
+        {
+          backend = std::make_unique<GlSimulationBackend>(particles, grid, Simulation::PARAMS, nullptr, kernelMode);
+          renderer = std::make_unique<FluidRenderer>(options.width, options.height, particleCount, grid, NEAR_PLANE, FAR_PLANE);
+        }
+        else
+        {
+          backend = std::make_unique<CpuSimulationBackend>(particles, grid, Simulation::PARAMS, options.threadCount, options.isa);
+        }
+
+        backendName = backend->name();
+
+        fprintf(stderr, "%u particles, %dx%dx%d %s grid, fill %.3f, %s order, %s kernels\n", particleCount, gridRes.x, gridRes.y, gridRes.z,
+          SpatialHash::name(gridMode), fillRatio, CellOrdering::name(cellOrder), GlSimulationBackend::kernelModeName(kernelMode));
+
+        for (uint32_t i = 0; i < options.warmupStepCount; i++)
+        {
+          backend->step(Simulation::DT, gravity);
+        }
+
+        // Leaves the grid, densities and the depth buffer in a valid state for all cases.
+        backend->step(0.0f, gravity);
+        if (renderer)
+        {
+          renderer->renderGeometry(backend->particleBuffers(), view, projection, pointRadius, 0);
+        }
+
+        // The particle buffer is now sorted by cell, as seen by steps 5 and 6.
+        double l1HitPercent;
+        double l2HitPercent;
+        std::vector<glm::vec4> positions(particleCount);
+        std::vector<glm::vec4> velocities(particleCount);
+        {
+          std::vector<Particle> sortedParticles(particleCount);
+          if (gpu)
+          {
+            GlSimulationBackend::readParticles(backend->particleBuffers(), particleCount, sortedParticles);
+          }
+          else
+          {
+            std::copy_n(backend->hostParticles(), particleCount, sortedParticles.begin());
+          }
+          simulateNeighborhoodCache(sortedParticles, grid, l1HitPercent, l2HitPercent);
+
+          for (uint32_t i = 0; i < particleCount; i++)
+          {
+            const Particle& p = sortedParticles[i];
+            positions[i] = glm::vec4(p.position_x, p.position_y, p.position_z, 0.0f);
+            velocities[i] = glm::vec4(p.velocity_x, p.velocity_y, p.velocity_z, 0.0f);
+          }
+        }
+
+        std::vector<uint8_t> encoded;
+        if (!codec.encode(options.codec, grid.origin, positions.data(), velocities.data(), particleCount, encoded))
+        {
+          fprintf(stderr, "The particles cannot be compressed at the given error bounds\n");
+          return EXIT_FAILURE;
+        }
+
+        // Decoding into separate arrays keeps the encoded frame intact for the other cases.
+        std::vector<glm::vec4> decodedPositions(particleCount);
+        std::vector<glm::vec4> decodedVelocities(particleCount);
+        codec.decode(encoded.data(), encoded.size(), decodedPositions.data(), decodedVelocities.data());
+
+        double positionMaxError = 0.0;
+        double velocityMaxError = 0.0;
+        for (uint32_t i = 0; i < particleCount; i++)
+        {
+          for (int a = 0; a < 3; a++)
+          {
+            positionMaxError = std::max(positionMaxError, double(std::abs(decodedPositions[i][a] - positions[i][a])));
+            velocityMaxError = std::max(velocityMaxError, double(std::abs(decodedVelocities[i][a] - velocities[i][a])));
+          }
+        }
+
+        for (const BenchCase* benchCase : options.cases)
+        {
+          std::function<void()> func;
+
+          if (benchCase->codec)
+          {
+            if (std::string_view(benchCase->name) == "encode")
+            {
+              func = [&]() { codec.encode(options.codec, grid.origin, positions.data(), velocities.data(), particleCount, encoded); };
+            }
+            else
+            {
+              func = [&]() { codec.decode(encoded.data(), encoded.size(), decodedPositions.data(), decodedVelocities.data()); };
+            }
+          }
+          else if (!benchCase->render)
+          {
+            func = [&]() { backend->runSteps(benchCase->firstStep, benchCase->lastStep, 0.0f, gravity); };
+          }
+          else if (std::string_view(benchCase->name) == "splat")
+          {
+            func = [&]() { renderer->renderGeometry(backend->particleBuffers(), view, projection, pointRadius, 0); };
+          }
+          else
+          {
+            func = [&]() { renderer->renderCurvatureFlow(view, projection); };
+          }
+
+          std::vector<double> samples = measure(gpu && !benchCase->codec, options.repetitions, func);
+
+          CaseResult result = computeStats(samples);
+          result.benchCase = benchCase;
+          result.particleCount = particleCount;
+          result.gridRes = gridRes;
+          result.fillRatio = fillRatio;
+          result.cellOrder = cellOrder;
+          result.gridMode = gridMode;
+          result.glKernelMode = kernelMode;
+          result.gridBytes = backend->gridMemoryBytes();
+          result.hasCacheStats = !benchCase->render && !benchCase->codec && benchCase->firstStep >= 4;
+          result.compressionRatio = double(TrajectoryFrameHeader::stride(particleCount)) / encoded.size();
+          result.positionMaxError = positionMaxError;
+          result.velocityMaxError = velocityMaxError;
+          result.l1HitPercent = l1HitPercent;
+          result.l2HitPercent = l2HitPercent;
+          result.particlesPerSecond = particleCount / (result.meanMs / 1000.0);
+          results.push_back(result);
+        }
+      }
+    }
+  }
+
+  if (options.format == OutputFormat::Json)
+  {
+    printJson(backendName.c_str(), results);
+  }
+  else
+  {
+    printCsv(backendName.c_str(), results);
+  }
+
+  return EXIT_SUCCESS;
+}
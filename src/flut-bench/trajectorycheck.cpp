@@ -0,0 +1,502 @@
+#include "ReplaySimulationBackend.hpp"
+#include "Simulation.hpp"
+#include "ThreadPool.hpp"
+#include "TrajectoryReader.hpp"
+#include "TrajectoryWriter.hpp"
+
+#ifdef FLUT_HAS_EGL
+#include "EglContext.hpp"
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace flut;
+
+// Records trajectories with the TrajectoryWriter and checks that the TrajectoryReader returns the
+// recorded frames, also from recordings whose writer died and from file systems without direct I/O,
+// and that truncated, invalid and corrupt recordings are rejected or read up to the damage.
+
+namespace
+{
+  // More than one codec block, so that compressed frames are coded in parallel.
+  constexpr uint32_t PARTICLE_COUNT = 20000;
+  constexpr uint32_t FRAME_COUNT = 12;
+  constexpr uint32_t FRAME_INTERVAL = 4;
+  constexpr float DT = 0.002f;
+  constexpr float POSITION_ERROR = 1e-4f;
+  constexpr float VELOCITY_ERROR = 1e-3f;
+  // Decoded values are within the error bound up to their float rounding.
+  constexpr float ROUNDING = 1e-5f;
+  // Frame which the damaged recordings truncate or corrupt.
+  constexpr uint64_t CORRUPT_FRAME = 4;
+
+  struct CheckOptions
+  {
+    std::string directory;
+    bool replay = false;
+  };
+
+  // Modifies or checks the recording at a path.
+  using FileCheck = std::function<bool(const std::string&)>;
+
+  // Positions and velocities of every frame, as handed to the writer.
+  struct Recording
+  {
+    std::vector<std::vector<glm::vec4>> positions;
+    std::vector<std::vector<glm::vec4>> velocities;
+  };
+
+  Recording makeRecording(const SimulationGrid& grid)
+  {
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    std::uniform_real_distribution<float> speed(-2.0f, 2.0f);
+
+    Recording recording;
+    recording.positions.resize(FRAME_COUNT, std::vector<glm::vec4>(PARTICLE_COUNT));
+    recording.velocities.resize(FRAME_COUNT, std::vector<glm::vec4>(PARTICLE_COUNT));
+    for (uint32_t frame = 0; frame < FRAME_COUNT; frame++)
+    {
+      for (uint32_t i = 0; i < PARTICLE_COUNT; i++)
+      {
+        for (int c = 0; c < 3; c++)
+        {
+          recording.positions[frame][i][c] = grid.origin[c] + grid.size[c] * unit(rng);
+          recording.velocities[frame][i][c] = speed(rng);
+        }
+      }
+    }
+    return recording;
+  }
+
+  TrajectoryWriter::Config writerConfig(bool compressed, bool directIo)
+  {
+    TrajectoryWriter::Config config;
+    config.frameInterval = FRAME_INTERVAL;
+    config.directIo = directIo;
+    if (compressed)
+    {
+      config.codec.positionError = POSITION_ERROR;
+      config.codec.velocityError = VELOCITY_ERROR;
+      config.codecThreadCount = 2;
+    }
+    return config;
+  }
+
+  bool writeRecording(const std::string& path, const Recording& recording, const TrajectoryWriter::Config& config)
+  {
+    std::unique_ptr<TrajectoryWriter> writer = TrajectoryWriter::create(path, PARTICLE_COUNT, Simulation::GRID, Simulation::PARAMS, DT, config);
+    if (!writer)
+    {
+      return false;
+    }
+
+    for (uint32_t i = 0; i < FRAME_COUNT; i++)
+    {
+      // Waits for the I/O thread instead of dropping the frame.
+      TrajectoryWriter::Frame frame;
+      while (!writer->beginFrame(frame))
+      {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+      memcpy(frame.positions, recording.positions[i].data(), PARTICLE_COUNT * sizeof(glm::vec4));
+      memcpy(frame.velocities, recording.velocities[i].data(), PARTICLE_COUNT * sizeof(glm::vec4));
+      writer->endFrame(uint64_t(i) * FRAME_INTERVAL, double(i) * FRAME_INTERVAL * DT);
+    }
+    return true;
+  }
+
+  float maxError(const std::vector<glm::vec4>& values, const std::vector<glm::vec4>& expected)
+  {
+    float error = 0.0f;
+    for (size_t i = 0; i < values.size(); i++)
+    {
+      for (int c = 0; c < 3; c++)
+      {
+        error = std::max(error, std::abs(values[i][c] - expected[i][c]));
+      }
+    }
+    return error;
+  }
+
+  // Compares the first frameCount frames of the file with the recording, exactly or within the
+  // error bounds of the header. The corrupt frame must fail to read.
+  bool checkRecording(const std::string& path, const Recording& recording, uint64_t frameCount, uint64_t corruptFrame = UINT64_MAX)
+  {
+    ThreadPool pool(2);
+    std::unique_ptr<TrajectoryReader> reader = TrajectoryReader::open(path, &pool);
+    if (!reader)
+    {
+      return false;
+    }
+
+    const TrajectoryHeader& header = reader->header();
+    if (reader->frameCount() != frameCount || header.particleCount != PARTICLE_COUNT || header.frameInterval != FRAME_INTERVAL ||
+        header.dt != DT)
+    {
+      fprintf(stderr, "%s holds %llu frames of %u particles, expected %llu of %u\n", path.c_str(),
+        static_cast<unsigned long long>(reader->frameCount()), header.particleCount, static_cast<unsigned long long>(frameCount), PARTICLE_COUNT);
+      return false;
+    }
+
+    const float positionBound = header.positionError > 0.0f ? header.positionError + ROUNDING : 0.0f;
+    const float velocityBound = header.velocityError > 0.0f ? header.velocityError + ROUNDING : 0.0f;
+    std::vector<glm::vec4> positions(PARTICLE_COUNT);
+    std::vector<glm::vec4> velocities(PARTICLE_COUNT);
+
+    for (uint64_t frame = 0; frame < frameCount; frame++)
+    {
+      const TrajectoryIndexEntry& entry = reader->entry(frame);
+      if (entry.step != frame * FRAME_INTERVAL || entry.time != double(frame) * FRAME_INTERVAL * DT)
+      {
+        fprintf(stderr, "Frame %llu of %s has step %llu\n", static_cast<unsigned long long>(frame), path.c_str(),
+          static_cast<unsigned long long>(entry.step));
+        return false;
+      }
+      const bool read = reader->read(frame, positions.data(), velocities.data());
+      if (read != (frame != corruptFrame))
+      {
+        fprintf(stderr, "Frame %llu of %s %s\n", static_cast<unsigned long long>(frame), path.c_str(),
+          read ? "was read although it is corrupt" : "cannot be read");
+        return false;
+      }
+      if (!read)
+      {
+        continue;
+      }
+
+      const float positionError = maxError(positions, recording.positions[frame]);
+      const float velocityError = maxError(velocities, recording.velocities[frame]);
+      if (positionError > positionBound || velocityError > velocityBound)
+      {
+        fprintf(stderr, "Frame %llu of %s is off by %g m and %g m/s\n", static_cast<unsigned long long>(frame), path.c_str(),
+          positionError, velocityError);
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Drops the index and leaves the header as the writer last rewrote it, as if it had died.
+  bool removeIndex(const std::string& path)
+  {
+    FILE* file = fopen(path.c_str(), "r+b");
+    if (!file)
+    {
+      fprintf(stderr, "Unable to open %s\n", path.c_str());
+      return false;
+    }
+
+    TrajectoryHeader header;
+    bool written = fread(&header, sizeof(header), 1, file) == 1 && header.indexOffset != 0;
+    const uint64_t indexOffset = header.indexOffset;
+    header.indexOffset = 0;
+    written = written && fseek(file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, file) == 1;
+    written = fclose(file) == 0 && written;
+
+    std::error_code error;
+    if (written)
+    {
+      std::filesystem::resize_file(path, indexOffset, error);
+    }
+    if (!written || error)
+    {
+      fprintf(stderr, "Unable to remove the index of %s\n", path.c_str());
+      return false;
+    }
+    return true;
+  }
+
+  bool patchFile(const std::string& path, uint64_t offset, const void* data, size_t size)
+  {
+    FILE* file = fopen(path.c_str(), "r+b");
+    if (!file)
+    {
+      fprintf(stderr, "Unable to open %s\n", path.c_str());
+      return false;
+    }
+
+    bool written = fseek(file, long(offset), SEEK_SET) == 0 && fwrite(data, size, 1, file) == 1;
+    written = fclose(file) == 0 && written;
+    if (!written)
+    {
+      fprintf(stderr, "Unable to modify %s\n", path.c_str());
+    }
+    return written;
+  }
+
+  // Offset of a frame chunk, or 0 if the file cannot be read.
+  uint64_t frameOffset(const std::string& path, uint64_t frame)
+  {
+    std::unique_ptr<TrajectoryReader> reader = TrajectoryReader::open(path);
+    return reader && frame < reader->frameCount() ? reader->entry(frame).offset : 0;
+  }
+
+  // Cuts the file within the chunk of CORRUPT_FRAME, which also cuts off the index.
+  bool truncateFrames(const std::string& path)
+  {
+    const uint64_t offset = frameOffset(path, CORRUPT_FRAME);
+    std::error_code error;
+    if (offset != 0)
+    {
+      std::filesystem::resize_file(path, offset + Trajectory::PAGE_SIZE / 2, error);
+    }
+    return offset != 0 && !error;
+  }
+
+  // Lets the chunk of CORRUPT_FRAME extend beyond the end of the file.
+  bool corruptChunk(const std::string& path)
+  {
+    const uint64_t offset = frameOffset(path, CORRUPT_FRAME);
+    const uint64_t chunkSize = UINT64_MAX / 2;
+    return offset != 0 && patchFile(path, offset + offsetof(TrajectoryFrameHeader, chunkSize), &chunkSize, sizeof(chunkSize));
+  }
+
+  // Clears the magic of a compressed frame, which the reader only notices when it decodes the frame.
+  bool corruptFrame(const std::string& path, uint64_t frame)
+  {
+    const uint64_t offset = frameOffset(path, frame);
+    const uint32_t magic = 0;
+    return offset != 0 && patchFile(path, offset + sizeof(TrajectoryFrameHeader), &magic, sizeof(magic));
+  }
+
+  // Damages copies of a valid recording in ways which the reader must reject.
+  bool checkInvalid(const std::string& path)
+  {
+    const std::string copy = path + ".invalid";
+    bool passed = true;
+
+    auto expectRejected = [&](const char* damage, const std::function<bool()>& modify) {
+      std::error_code error;
+      std::filesystem::copy_file(path, copy, std::filesystem::copy_options::overwrite_existing, error);
+      if (error || !modify())
+      {
+        passed = false;
+      }
+      else if (TrajectoryReader::open(copy))
+      {
+        fprintf(stderr, "A trajectory with %s was accepted\n", damage);
+        passed = false;
+      }
+    };
+
+    const uint64_t magic = 0;
+    const uint32_t version = Trajectory::VERSION + 1;
+    const uint64_t frameCount = 0;
+    auto resize = [&](uint64_t size) {
+      std::error_code error;
+      std::filesystem::resize_file(copy, size, error);
+      return !error;
+    };
+
+    expectRejected("a wrong magic", [&] { return patchFile(copy, offsetof(TrajectoryHeader, magic), &magic, sizeof(magic)); });
+    expectRejected("a newer version", [&] { return patchFile(copy, offsetof(TrajectoryHeader, version), &version, sizeof(version)); });
+    expectRejected("no frames", [&] { return patchFile(copy, offsetof(TrajectoryHeader, frameCount), &frameCount, sizeof(frameCount)); });
+    expectRejected("no data", [&] { return resize(0); });
+    expectRejected("a truncated header", [&] { return resize(sizeof(TrajectoryHeader) / 2); });
+    expectRejected("a truncated first frame", [&] { return resize(Trajectory::PAGE_SIZE + sizeof(TrajectoryFrameHeader) / 2); });
+    expectRejected("a missing file", [&] { return std::filesystem::remove(copy); });
+
+    std::error_code error;
+    std::filesystem::remove(copy, error);
+    return passed;
+  }
+
+#ifdef FLUT_HAS_EGL
+  // Plays back a recording whose frames CORRUPT_FRAME and FRAME_COUNT - 1 are corrupt. Corrupt
+  // frames keep the previous one on screen.
+  bool checkReplay(const std::string& path)
+  {
+    std::unique_ptr<ReplaySimulationBackend> replay = ReplaySimulationBackend::create(path, 2);
+    if (!replay || replay->frameCount() != FRAME_COUNT || replay->frame() != 0)
+    {
+      return false;
+    }
+
+    replay->seek(CORRUPT_FRAME);
+    replay->update(0.0);
+    bool passed = replay->frame() == 0;
+    replay->seek(CORRUPT_FRAME + 1);
+    replay->update(0.0);
+    passed = passed && replay->frame() == CORRUPT_FRAME + 1;
+    replay->seek(FRAME_COUNT - 1);
+    replay->update(0.0);
+    passed = passed && replay->frame() == CORRUPT_FRAME + 1;
+
+    // Playing at the end starts over, although the last frame was never shown.
+    replay->setPlaying(true);
+    replay->update(0.0);
+    passed = passed && replay->playing() && replay->frame() == 0;
+    if (!passed)
+    {
+      fprintf(stderr, "The replay of %s shows frame %llu\n", path.c_str(), static_cast<unsigned long long>(replay->frame()));
+    }
+    return passed;
+  }
+
+  // Plays back a recording whose first frame is corrupt, which shows no particles until the next.
+  bool checkReplayFirstFrame(const std::string& path)
+  {
+    std::unique_ptr<ReplaySimulationBackend> replay = ReplaySimulationBackend::create(path, 2);
+    if (!replay || replay->frame() != 0)
+    {
+      return false;
+    }
+
+    replay->seek(1);
+    replay->update(0.0);
+    return replay->frame() == 1;
+  }
+#endif
+
+  // Whether the writer opens files in the directory for direct I/O rather than falling back to
+  // the page cache.
+  bool supportsDirectIo(const std::string& directory)
+  {
+#if defined(_WIN32)
+    return true;
+#elif defined(O_DIRECT)
+    const std::string path = directory + "/flut-trajectory-check-probe";
+    const int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+    if (fd >= 0)
+    {
+      close(fd);
+    }
+    std::error_code error;
+    std::filesystem::remove(path, error);
+    return fd >= 0;
+#else
+    return false;
+#endif
+  }
+
+  void printUsage()
+  {
+    fprintf(stderr,
+      "Usage: flut-trajectory-check [options]\n"
+      "  --dir=PATH           Directory of the recordings, e.g. on a file system without direct I/O\n"
+      "                       (default: the temporary directory)\n"
+      "  --replay             Also play back corrupt recordings, which needs an OpenGL 4.6 context\n");
+  }
+
+  bool parseArgs(int argc, char* argv[], CheckOptions& options)
+  {
+    for (int i = 1; i < argc; i++)
+    {
+      const std::string_view arg{argv[i]};
+
+      if (arg.substr(0, 6) == "--dir=")
+      {
+        options.directory = std::string(arg.substr(6));
+      }
+      else if (arg == "--replay")
+      {
+#ifdef FLUT_HAS_EGL
+        options.replay = true;
+#else
+        fprintf(stderr, "flut-trajectory-check was built without EGL, the replay check is unavailable\n");
+        return false;
+#endif
+      }
+      else
+      {
+        fprintf(stderr, "Unknown argument %s\n", argv[i]);
+        printUsage();
+        return false;
+      }
+    }
+
+    return true;
+  }
+}
+
+int main(int argc, char* argv[])
+{
+  CheckOptions options;
+
+  if (argc == 2 && std::string_view(argv[1]) == "--help")
+  {
+    printUsage();
+    return EXIT_SUCCESS;
+  }
+
+  if (!parseArgs(argc, argv, options))
+  {
+    return EXIT_FAILURE;
+  }
+  if (options.directory.empty())
+  {
+    options.directory = std::filesystem::temp_directory_path().string();
+  }
+
+  const Recording recording = makeRecording(Simulation::GRID);
+  uint32_t failedChecks = 0;
+  uint32_t checkCount = 0;
+
+  // Every check writes its own file, which is removed afterwards.
+  auto check = [&](const char* name, bool compressed, bool directIo, const FileCheck& modify, const FileCheck& verify) {
+    const std::string path = options.directory + "/flut-trajectory-check-" + name + ".trajectory";
+    const bool passed = writeRecording(path, recording, writerConfig(compressed, directIo)) && (!modify || modify(path)) && verify(path);
+    std::error_code error;
+    std::filesystem::remove(path, error);
+
+    printf("%s,%s\n", name, passed ? "pass" : "fail");
+    failedChecks += passed ? 0 : 1;
+    checkCount++;
+  };
+
+  const FileCheck allFrames = [&](const std::string& path) { return checkRecording(path, recording, FRAME_COUNT); };
+  // The frames before the damage remain readable.
+  const FileCheck leadingFrames = [&](const std::string& path) { return checkRecording(path, recording, CORRUPT_FRAME); };
+  const FileCheck otherFrames = [&](const std::string& path) { return checkRecording(path, recording, FRAME_COUNT, CORRUPT_FRAME); };
+
+  check("raw", false, false, nullptr, allFrames);
+  check("compressed", true, false, nullptr, allFrames);
+  // Without an index, the reader follows the chunks up to the frame count of the header.
+  check("died_raw", false, false, removeIndex, allFrames);
+  check("died_compressed", true, false, removeIndex, allFrames);
+  // Passes either way; the path taken depends on the file system of the directory.
+  printf("direct_io,%s\n", supportsDirectIo(options.directory) ? "direct" : "page_cache");
+  check("direct_io_raw", false, true, nullptr, allFrames);
+  check("direct_io_compressed", true, true, nullptr, allFrames);
+
+  check("truncated_raw", false, false, truncateFrames, leadingFrames);
+  check("truncated_compressed", true, false, truncateFrames, leadingFrames);
+  check("corrupt_chunk", false, false, corruptChunk, leadingFrames);
+  check("corrupt_chunk_died", true, false, [](const std::string& path) { return removeIndex(path) && corruptChunk(path); }, leadingFrames);
+  check("corrupt_frame", true, false, [](const std::string& path) { return corruptFrame(path, CORRUPT_FRAME); }, otherFrames);
+  check("invalid", false, false, nullptr, checkInvalid);
+
+#ifdef FLUT_HAS_EGL
+  if (options.replay)
+  {
+    EglContext context;
+    check("replay_corrupt_frame", true, false,
+      [](const std::string& path) { return corruptFrame(path, CORRUPT_FRAME) && corruptFrame(path, FRAME_COUNT - 1); }, checkReplay);
+    check("replay_corrupt_first_frame", true, false, [](const std::string& path) { return corruptFrame(path, 0); }, checkReplayFirstFrame);
+  }
+#endif
+
+  printf("failed_checks,%u,%u\n", failedChecks, checkCount);
+
+  return failedChecks == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,126 @@
+#include "CellOrdering.hpp"
+
+#include <algorithm>
+#include <numeric>
+
+using namespace flut;
+
+// Interleaves the bits of the coordinates, most significant bit first, with x in the lowest bit.
+static uint64_t interleave(const uint32_t coords[3], uint32_t bits)
+{
+  uint64_t code = 0;
+  for (int32_t b = bits - 1; b >= 0; b--)
+  {
+    code = (code << 3) | (((coords[2] >> b) & 1) << 2) | (((coords[1] >> b) & 1) << 1) | ((coords[0] >> b) & 1);
+  }
+  return code;
+}
+
+std::vector<uint32_t> CellOrdering::orderedVoxels(const SimulationGrid& grid)
+{
+  const glm::ivec3& res = grid.res;
+  const uint32_t voxelCount = grid.voxelCount();
+
+  std::vector<uint32_t> voxels(voxelCount);
+  std::iota(voxels.begin(), voxels.end(), 0u);
+
+  if (grid.cellOrder == CellOrder::Linear)
+  {
+    return voxels;
+  }
+
+  // The curves are defined on the smallest power-of-two cube which contains the grid.
+  uint32_t bits = 1;
+  while ((1 << bits) < std::max({ res.x, res.y, res.z }))
+  {
+    bits++;
+  }
+
+  std::vector<uint64_t> codes(voxelCount);
+  for (uint32_t i = 0; i < voxelCount; i++)
+  {
+    const uint32_t x = i % res.x;
+    const uint32_t y = (i / res.x) % res.y;
+    const uint32_t z = i / (res.x * res.y);
+    codes[i] = grid.cellOrder == CellOrder::Morton ? mortonCode(x, y, z, bits) : hilbertCode(x, y, z, bits);
+  }
+
+  std::sort(voxels.begin(), voxels.end(), [&](uint32_t a, uint32_t b) { return codes[a] < codes[b]; });
+  return voxels;
+}
+
+const char* CellOrdering::name(CellOrder order)
+{
+  switch (order)
+  {
+  case CellOrder::Morton:
+    return "Morton";
+  case CellOrder::Hilbert:
+    return "Hilbert";
+  default:
+    return "Linear";
+  }
+}
+
+bool CellOrdering::parse(std::string_view name, CellOrder& order)
+{
+  if (name == "linear") { order = CellOrder::Linear; return true; }
+  if (name == "morton") { order = CellOrder::Morton; return true; }
+  if (name == "hilbert") { order = CellOrder::Hilbert; return true; }
+  return false;
+}
+
+uint64_t CellOrdering::mortonCode(uint32_t x, uint32_t y, uint32_t z, uint32_t bits)
+{
+  const uint32_t coords[3] = { x, y, z };
+  return interleave(coords, bits);
+}
+
+// Skilling, "Programming the Hilbert curve", AIP Conference Proceedings 707 (2004):
+// transforms the coordinates in place into the transposed Hilbert index.
+uint64_t CellOrdering::hilbertCode(uint32_t x, uint32_t y, uint32_t z, uint32_t bits)
+{
+  uint32_t X[3] = { z, y, x };
+  const uint32_t M = 1u << (bits - 1);
+
+  // Inverse undo
+  for (uint32_t Q = M; Q > 1; Q >>= 1)
+  {
+    const uint32_t P = Q - 1;
+    for (uint32_t i = 0; i < 3; i++)
+    {
+      if (X[i] & Q)
+      {
+        X[0] ^= P;
+      }
+      else
+      {
+        const uint32_t t = (X[0] ^ X[i]) & P;
+        X[0] ^= t;
+        X[i] ^= t;
+      }
+    }
+  }
+
+  // Gray encode
+  for (uint32_t i = 1; i < 3; i++)
+  {
+    X[i] ^= X[i - 1];
+  }
+  uint32_t t = 0;
+  for (uint32_t Q = M; Q > 1; Q >>= 1)
+  {
+    if (X[2] & Q)
+    {
+      t ^= Q - 1;
+    }
+  }
+  for (uint32_t i = 0; i < 3; i++)
+  {
+    X[i] ^= t;
+  }
+
+  // X[0] holds the most significant bit of each triple.
+  const uint32_t coords[3] = { X[2], X[1], X[0] };
+  return interleave(coords, bits);
+}
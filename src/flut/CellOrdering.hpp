@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdint.h>
+#include <string_view>
+#include <vector>
+
+#include "SimulationBackend.hpp"
+
+namespace flut
+{
+  class CellOrdering
+  {
+  public:
+    // Linear voxel indices (x + res.x * (y + res.y * z)) sorted by the grid's cell order.
+    static std::vector<uint32_t> orderedVoxels(const SimulationGrid& grid);
+
+    static const char* name(CellOrder order);
+
+    // Parses one of "linear", "morton" or "hilbert".
+    static bool parse(std::string_view name, CellOrder& order);
+
+  private:
+    static uint64_t mortonCode(uint32_t x, uint32_t y, uint32_t z, uint32_t bits);
+
+    static uint64_t hilbertCode(uint32_t x, uint32_t y, uint32_t z, uint32_t bits);
+  };
+}
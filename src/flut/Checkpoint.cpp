@@ -0,0 +1,187 @@
+#include "Checkpoint.hpp"
+
+#include <chrono>
+#include <filesystem>
+#include <string.h>
+#include <stdio.h>
+
+using namespace flut;
+
+SimulationGrid CheckpointState::grid() const
+{
+  SimulationGrid grid;
+  for (int i = 0; i < 3; i++)
+  {
+    grid.size[i] = header.gridSize[i];
+    grid.origin[i] = header.gridOrigin[i];
+    grid.res[i] = header.gridRes[i];
+  }
+  grid.cellOrder = CellOrder(header.cellOrder);
+  grid.mode = GridMode(header.gridMode);
+  return grid;
+}
+
+void CheckpointState::setGrid(const SimulationGrid& grid)
+{
+  for (int i = 0; i < 3; i++)
+  {
+    header.gridSize[i] = grid.size[i];
+    header.gridOrigin[i] = grid.origin[i];
+    header.gridRes[i] = grid.res[i];
+  }
+  header.cellOrder = uint32_t(grid.cellOrder);
+  header.gridMode = uint32_t(grid.mode);
+}
+
+bool flut::writeCheckpoint(const std::string& path, CheckpointState& state)
+{
+  state.header.magic = Checkpoint::MAGIC;
+  state.header.version = Checkpoint::VERSION;
+  state.header.particleCount = uint32_t(state.particles.size());
+  state.header.particleOffset = Checkpoint::PAGE_SIZE;
+
+  const std::string tempPath = path + ".tmp";
+  FILE* file = fopen(tempPath.c_str(), "wb");
+  if (!file)
+  {
+    fprintf(stderr, "Unable to create checkpoint file %s\n", tempPath.c_str());
+    return false;
+  }
+
+  uint8_t headerPage[Checkpoint::PAGE_SIZE] = {};
+  memcpy(headerPage, &state.header, sizeof(state.header));
+  bool written = fwrite(headerPage, sizeof(headerPage), 1, file) == 1;
+  if (written && !state.particles.empty())
+  {
+    written = fwrite(state.particles.data(), sizeof(Particle), state.particles.size(), file) == state.particles.size();
+  }
+  written = fclose(file) == 0 && written;
+
+  std::error_code error;
+  if (written)
+  {
+    std::filesystem::rename(tempPath, path, error);
+  }
+  if (!written || error)
+  {
+    fprintf(stderr, "Unable to write checkpoint file %s\n", path.c_str());
+    std::filesystem::remove(tempPath, error);
+    return false;
+  }
+  return true;
+}
+
+bool flut::readCheckpoint(const std::string& path, CheckpointState& state)
+{
+  FILE* file = fopen(path.c_str(), "rb");
+  if (!file)
+  {
+    fprintf(stderr, "Unable to open checkpoint file %s\n", path.c_str());
+    return false;
+  }
+
+  CheckpointHeader header;
+  if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != Checkpoint::MAGIC)
+  {
+    fprintf(stderr, "%s is not a checkpoint file\n", path.c_str());
+    fclose(file);
+    return false;
+  }
+  if (header.version != Checkpoint::VERSION)
+  {
+    fprintf(stderr, "Checkpoint file %s has version %u, expected %u\n", path.c_str(), header.version, Checkpoint::VERSION);
+    fclose(file);
+    return false;
+  }
+
+  std::vector<Particle> particles(header.particleCount);
+  const bool read = fseek(file, long(header.particleOffset), SEEK_SET) == 0 &&
+                    fread(particles.data(), sizeof(Particle), particles.size(), file) == particles.size();
+  fclose(file);
+  if (!read || particles.empty())
+  {
+    fprintf(stderr, "Checkpoint file %s is truncated\n", path.c_str());
+    return false;
+  }
+
+  state.header = header;
+  state.particles = std::move(particles);
+  return true;
+}
+
+CheckpointWriter::CheckpointWriter(std::string path)
+  : m_path(std::move(path))
+{
+  m_thread = std::thread(&CheckpointWriter::ioMain, this);
+}
+
+CheckpointWriter::~CheckpointWriter()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_shutdown = true;
+  }
+  m_cv.notify_one();
+  m_thread.join();
+}
+
+bool CheckpointWriter::idle() const
+{
+  return !m_busy.load(std::memory_order_acquire);
+}
+
+bool CheckpointWriter::submit(CheckpointState&& state)
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_busy.load(std::memory_order_relaxed))
+    {
+      m_stats.skipped++;
+      return false;
+    }
+    m_state = std::move(state);
+    m_pending = true;
+    m_busy.store(true, std::memory_order_release);
+  }
+  m_cv.notify_one();
+  return true;
+}
+
+CheckpointWriter::Stats CheckpointWriter::stats() const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_stats;
+}
+
+void CheckpointWriter::ioMain()
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  while (true)
+  {
+    // A pending snapshot is still written on shutdown.
+    m_cv.wait(lock, [this] { return m_pending || m_shutdown; });
+    if (!m_pending)
+    {
+      return;
+    }
+    m_pending = false;
+    lock.unlock();
+
+    const auto start = std::chrono::steady_clock::now();
+    const bool written = writeCheckpoint(m_path, m_state);
+    const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+
+    lock.lock();
+    if (written)
+    {
+      m_stats.written++;
+      m_stats.lastWriteMs = elapsed.count();
+      m_stats.lastFrame = m_state.header.frame;
+    }
+    else
+    {
+      m_stats.failed++;
+    }
+    m_busy.store(false, std::memory_order_release);
+  }
+}
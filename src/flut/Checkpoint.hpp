@@ -0,0 +1,115 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "SimulationBackend.hpp"
+
+namespace flut
+{
+  // On-disk layout of a checkpoint, which a reader may map into memory and use in place:
+  //
+  //   0:               CheckpointHeader, padded to a page
+  //   particleOffset:  particleCount Particle, in the order the backend keeps them
+  //
+  // Values are little-endian, as written by the simulating machine.
+  namespace Checkpoint
+  {
+    constexpr uint32_t PAGE_SIZE = 4096;
+    // "FLUTCKP\0"
+    constexpr uint64_t MAGIC = 0x00504b4354554c46ull;
+    constexpr uint32_t VERSION = 1;
+  }
+
+  struct CheckpointHeader
+  {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t particleCount;
+    uint64_t particleOffset;
+    // Frames and integrations since the start of the run, and the simulated time.
+    uint64_t frame;
+    uint64_t step;
+    double time;
+    uint32_t seed;
+    uint32_t integrationsPerFrame;
+    float gridSize[3];
+    float gridOrigin[3];
+    int32_t gridRes[3];
+    uint32_t cellOrder;
+    uint32_t gridMode;
+    SimulationParams params;
+    // Simulation::SimulationOptions
+    float gravity[3];
+    float deltaTimeMod;
+    int32_t colorMode;
+    float pointScale;
+  };
+
+  static_assert(sizeof(CheckpointHeader) <= Checkpoint::PAGE_SIZE, "The checkpoint header must fit into a page");
+  static_assert(sizeof(Particle) == 32, "The checkpoint stores particles as they are laid out in memory");
+
+  struct CheckpointState
+  {
+    CheckpointHeader header{};
+    std::vector<Particle> particles;
+
+    SimulationGrid grid() const;
+
+    void setGrid(const SimulationGrid& grid);
+  };
+
+  // Writes the state to a temporary file which then replaces path, so that a crash while writing
+  // leaves the previous checkpoint intact. Fills in the magic, version and layout fields.
+  bool writeCheckpoint(const std::string& path, CheckpointState& state);
+
+  bool readCheckpoint(const std::string& path, CheckpointState& state);
+
+  // Writes checkpoints on a background thread, one at a time.
+  class CheckpointWriter
+  {
+  public:
+    struct Stats
+    {
+      uint64_t written = 0;
+      // Snapshots which arrived while the previous one was still being written.
+      uint64_t skipped = 0;
+      uint64_t failed = 0;
+      double lastWriteMs = 0.0;
+      uint64_t lastFrame = 0;
+    };
+
+  public:
+    explicit CheckpointWriter(std::string path);
+
+    ~CheckpointWriter();
+
+  public:
+    // True if a snapshot would be written rather than skipped, to avoid taking it in vain.
+    bool idle() const;
+
+    // Takes over the state for writing, or skips it if the previous one is still being written.
+    bool submit(CheckpointState&& state);
+
+    Stats stats() const;
+
+  private:
+    void ioMain();
+
+  private:
+    std::string m_path;
+    mutable std::mutex m_mutex;
+    std::condition_variable m_cv;
+    CheckpointState m_state;
+    bool m_pending = false;
+    bool m_shutdown = false;
+    std::atomic<bool> m_busy{false};
+    Stats m_stats;
+    std::thread m_thread;
+  };
+}
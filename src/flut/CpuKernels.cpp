@@ -0,0 +1,244 @@
+#include "CpuKernels.hpp"
+
+#include <assert.h>
+#include <cmath>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#endif
+
+using namespace flut;
+
+// Calls func(j) for every neighbor candidate j of particle i, taken from the particle's neighbor
+// list if it has one, and from the grid otherwise.
+template<typename F>
+static void forEachCandidate(const CpuKernelData& data, uint32_t i, NeighborRanges& ranges, F&& func)
+{
+  if (data.neighbors && data.neighborCounts[i] <= data.neighborStride)
+  {
+    const uint32_t* list = data.neighbors + size_t(i) * data.neighborStride;
+    const uint32_t count = data.neighborCounts[i];
+
+    for (uint32_t k = 0; k < count; k++)
+    {
+      func(list[k]);
+    }
+    return;
+  }
+
+  gatherNeighborRanges(data, data.posX[i], data.posY[i], data.posZ[i], ranges);
+
+  for (uint32_t r = 0; r < ranges.count; r++)
+  {
+    for (uint32_t j = ranges.begin[r]; j < ranges.end[r]; j++)
+    {
+      func(j);
+    }
+  }
+}
+
+static void computeDensitiesScalar(const CpuKernelData& data, uint32_t begin, uint32_t end)
+{
+  const float h2 = data.kernelRadius * data.kernelRadius;
+
+  NeighborRanges ranges;
+
+  for (uint32_t i = begin; i < end; i++)
+  {
+    const float px = data.posX[i];
+    const float py = data.posY[i];
+    const float pz = data.posZ[i];
+
+    float sum = 0.0f;
+
+    forEachCandidate(data, i, ranges, [&](uint32_t j) {
+      const float dx = px - data.posX[j];
+      const float dy = py - data.posY[j];
+      const float dz = pz - data.posZ[j];
+      const float r2 = dx * dx + dy * dy + dz * dz;
+
+      if (r2 >= h2)
+      {
+        return;
+      }
+
+      const float d = h2 - r2;
+      sum += d * d * d;
+    });
+
+    const float density = data.mass * data.poly6KernelWeightConst * sum;
+    data.density[i] = density;
+    data.pressure[i] = data.restPressure + data.stiffness * (density - data.restDensity);
+  }
+}
+
+static void computeForcesScalar(const CpuKernelData& data, uint32_t begin, uint32_t end, float dt, glm::vec3 gravity)
+{
+  const float h = data.kernelRadius;
+  const float h2 = h * h;
+
+  NeighborRanges ranges;
+
+  for (uint32_t i = begin; i < end; i++)
+  {
+    const float px = data.posX[i];
+    const float py = data.posY[i];
+    const float pz = data.posZ[i];
+    const float vx = data.velX[i];
+    const float vy = data.velY[i];
+    const float vz = data.velZ[i];
+    const float pi = data.pressure[i];
+
+    float fpx = 0.0f, fpy = 0.0f, fpz = 0.0f;
+    float fvx = 0.0f, fvy = 0.0f, fvz = 0.0f;
+
+    forEachCandidate(data, i, ranges, [&](uint32_t j) {
+      const float dx = px - data.posX[j];
+      const float dy = py - data.posY[j];
+      const float dz = pz - data.posZ[j];
+      const float r2 = dx * dx + dy * dy + dz * dz;
+
+      if (r2 >= h2)
+      {
+        return;
+      }
+
+      const float rLen = std::sqrt(r2);
+      const float invDensity = 1.0f / data.density[j];
+
+      if (rLen > 0.0f)
+      {
+        const float d = h - rLen;
+        const float weightPressure = data.spikyKernelWeightConst * d * d * d / rLen;
+        const float pressureTerm = (pi + data.pressure[j]) * weightPressure * 0.5f * invDensity;
+        fpx += dx * pressureTerm;
+        fpy += dy * pressureTerm;
+        fpz += dz * pressureTerm;
+      }
+
+      const float viscosityTerm = data.viscosityKernelWeightConst * (h - rLen) * invDensity;
+      fvx += (data.filteredVelX[j] - vx) * viscosityTerm;
+      fvy += (data.filteredVelY[j] - vy) * viscosityTerm;
+      fvz += (data.filteredVelZ[j] - vz) * viscosityTerm;
+    });
+
+    const float density = data.density[i];
+    const float visScale = data.mass * data.viscosityCoeff;
+    const float dtOverDensity = dt / density;
+    data.newVelX[i] = vx + (fvx * visScale - fpx * data.mass + gravity.x * density) * dtOverDensity;
+    data.newVelY[i] = vy + (fvy * visScale - fpy * data.mass + gravity.y * density) * dtOverDensity;
+    data.newVelZ[i] = vz + (fvz * visScale - fpz * data.mass + gravity.z * density) * dtOverDensity;
+  }
+}
+
+CpuKernels flut::getScalarKernels()
+{
+  return CpuKernels{ computeDensitiesScalar, computeForcesScalar };
+}
+
+static bool hostSupports(CpuIsa isa)
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  __builtin_cpu_init();
+  switch (isa)
+  {
+  case CpuIsa::Sse4:
+    return __builtin_cpu_supports("sse4.1");
+  case CpuIsa::Avx2:
+    return __builtin_cpu_supports("avx2");
+  case CpuIsa::Avx512:
+    return __builtin_cpu_supports("avx512f");
+  default:
+    return true;
+  }
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+  int regs[4];
+  __cpuid(regs, 1);
+  const bool sse41 = (regs[2] & (1 << 19)) != 0;
+  const bool osxsave = (regs[2] & (1 << 27)) != 0;
+  const unsigned long long xcr0 = osxsave ? _xgetbv(0) : 0;
+  __cpuidex(regs, 7, 0);
+  switch (isa)
+  {
+  case CpuIsa::Sse4:
+    return sse41;
+  case CpuIsa::Avx2:
+    return (xcr0 & 0x6) == 0x6 && (regs[1] & (1 << 5)) != 0;
+  case CpuIsa::Avx512:
+    return (xcr0 & 0xE6) == 0xE6 && (regs[1] & (1 << 16)) != 0;
+  default:
+    return true;
+  }
+#else
+  return isa == CpuIsa::Scalar;
+#endif
+}
+
+bool CpuKernels::isSupported(CpuIsa isa)
+{
+  switch (isa)
+  {
+  case CpuIsa::Sse4:
+    return getSse4Kernels().computeDensities && hostSupports(isa);
+  case CpuIsa::Avx2:
+    return getAvx2Kernels().computeDensities && hostSupports(isa);
+  case CpuIsa::Avx512:
+    return getAvx512Kernels().computeDensities && hostSupports(isa);
+  default:
+    return true;
+  }
+}
+
+CpuIsa CpuKernels::bestIsa()
+{
+  for (CpuIsa isa : { CpuIsa::Avx512, CpuIsa::Avx2, CpuIsa::Sse4 })
+  {
+    if (isSupported(isa))
+    {
+      return isa;
+    }
+  }
+  return CpuIsa::Scalar;
+}
+
+CpuKernels CpuKernels::get(CpuIsa isa)
+{
+  assert(isSupported(isa));
+
+  switch (isa)
+  {
+  case CpuIsa::Sse4:
+    return getSse4Kernels();
+  case CpuIsa::Avx2:
+    return getAvx2Kernels();
+  case CpuIsa::Avx512:
+    return getAvx512Kernels();
+  default:
+    return getScalarKernels();
+  }
+}
+
+const char* CpuKernels::isaName(CpuIsa isa)
+{
+  switch (isa)
+  {
+  case CpuIsa::Sse4:
+    return "SSE4";
+  case CpuIsa::Avx2:
+    return "AVX2";
+  case CpuIsa::Avx512:
+    return "AVX-512";
+  default:
+    return "Scalar";
+  }
+}
+
+bool CpuKernels::parseIsa(std::string_view name, CpuIsa& isa)
+{
+  if (name == "scalar") { isa = CpuIsa::Scalar; }
+  else if (name == "sse4") { isa = CpuIsa::Sse4; }
+  else if (name == "avx2") { isa = CpuIsa::Avx2; }
+  else if (name == "avx512") { isa = CpuIsa::Avx512; }
+  else { return false; }
+  return true;
+}
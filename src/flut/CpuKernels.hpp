@@ -0,0 +1,195 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <stdint.h>
+#include <string_view>
+
+#include "SpatialHash.hpp"
+
+namespace flut
+{
+  enum class CpuIsa
+  {
+    Scalar,
+    Sse4,
+    Avx2,
+    Avx512
+  };
+
+  // Structure-of-arrays view of the cell-sorted particles. Every stream is padded
+  // by CpuKernels::STREAM_PADDING elements so that full-width vector loads never
+  // read past the end of an allocation.
+  struct CpuKernelData
+  {
+    uint32_t particleCount;
+    const float* posX;
+    const float* posY;
+    const float* posZ;
+    const float* velX;
+    const float* velY;
+    const float* velZ;
+    const float* filteredVelX;
+    const float* filteredVelY;
+    const float* filteredVelZ;
+    float* density;
+    float* pressure;
+    float* newVelX;
+    float* newVelY;
+    float* newVelZ;
+    // Indexed by linear voxel index, or by hash slot if hashKeys is set.
+    const uint32_t* voxelOffsets;
+    const uint32_t* voxelCounts;
+    // Keys of the hash table in GridMode::Hashed, null for dense grids.
+    const std::atomic<uint32_t>* hashKeys;
+    uint32_t hashMask;
+    // Whether cells adjacent in x are adjacent in the particle streams, see CellOrder::Linear.
+    bool rowsContiguous;
+    // Cells searched on each side of a particle's cell, at most NeighborRanges::MAX_REACH. Neighbor
+    // lists reach further than the kernel radius, and while they are valid, the particles may have
+    // moved away from the cells they were sorted into.
+    int32_t cellReach;
+    // Verlet neighbor lists with neighborStride entries per particle, or null while there are no
+    // valid lists. Particles whose neighbor count exceeds the stride are searched in the grid.
+    // Like the streams, the lists are padded, and entries past a particle's count hold valid
+    // particle indices, so that full-width index loads and gathers stay in bounds.
+    const uint32_t* neighbors;
+    const uint32_t* neighborCounts;
+    uint32_t neighborStride;
+    glm::ivec3 gridRes;
+    glm::vec3 gridOrigin;
+    glm::vec3 invCellSize;
+    float kernelRadius;
+    float mass;
+    float poly6KernelWeightConst;
+    float spikyKernelWeightConst;
+    float viscosityKernelWeightConst;
+    float viscosityCoeff;
+    float stiffness;
+    float restDensity;
+    float restPressure;
+  };
+
+  struct CpuKernels
+  {
+    constexpr static uint32_t STREAM_PADDING = 16;
+
+    // Step 5: writes density and pressure of particles [begin, end).
+    void (*computeDensities)(const CpuKernelData& data, uint32_t begin, uint32_t end);
+
+    // Step 6: writes the integrated velocity of particles [begin, end). The
+    // output streams may alias the input velocity streams.
+    void (*computeForces)(const CpuKernelData& data, uint32_t begin, uint32_t end, float dt, glm::vec3 gravity);
+
+    // Best instruction set supported by both the build and the host CPU.
+    static CpuIsa bestIsa();
+
+    static bool isSupported(CpuIsa isa);
+
+    static CpuKernels get(CpuIsa isa);
+
+    static const char* isaName(CpuIsa isa);
+
+    // Parses one of "scalar", "sse4", "avx2" or "avx512".
+    static bool parseIsa(std::string_view name, CpuIsa& isa);
+  };
+
+  // With linear cell order, neighbor voxels adjacent in x are also adjacent in the sorted
+  // particle array, so the 27-voxel neighborhood collapses into at most 9 contiguous ranges.
+  // Other orders and hashed grids merge the ranges of voxels which happen to be adjacent in memory.
+  struct NeighborRanges
+  {
+    constexpr static int32_t MAX_REACH = 2;
+    constexpr static uint32_t MAX_COUNT = (2 * MAX_REACH + 1) * (2 * MAX_REACH + 1) * (2 * MAX_REACH + 1);
+
+    uint32_t begin[MAX_COUNT];
+    uint32_t end[MAX_COUNT];
+    uint32_t count = 0;
+    // Linear index of the voxel the ranges were gathered for. The particles are sorted by
+    // voxel, so consecutive particles mostly reuse the ranges of their predecessor.
+    uint32_t voxel = SpatialHash::EMPTY_KEY;
+  };
+
+  static inline void gatherNeighborRanges(const CpuKernelData& data, float px, float py, float pz, NeighborRanges& ranges)
+  {
+    const glm::ivec3& res = data.gridRes;
+    const int32_t vx = static_cast<int32_t>(data.invCellSize.x * (px - data.gridOrigin.x));
+    const int32_t vy = static_cast<int32_t>(data.invCellSize.y * (py - data.gridOrigin.y));
+    const int32_t vz = static_cast<int32_t>(data.invCellSize.z * (pz - data.gridOrigin.z));
+
+    const uint32_t voxel = vx + res.x * (vy + res.y * vz);
+    if (voxel == ranges.voxel)
+    {
+      return;
+    }
+
+    const int32_t reach = data.cellReach;
+    const int32_t x0 = vx > reach ? vx - reach : 0;
+    const int32_t x1 = vx < res.x - 1 - reach ? vx + reach : res.x - 1;
+
+    ranges.count = 0;
+    ranges.voxel = voxel;
+
+    for (int32_t z = vz - reach; z <= vz + reach; z++)
+    {
+      if (static_cast<uint32_t>(z) >= static_cast<uint32_t>(res.z))
+      {
+        continue;
+      }
+
+      for (int32_t y = vy - reach; y <= vy + reach; y++)
+      {
+        if (static_cast<uint32_t>(y) >= static_cast<uint32_t>(res.y))
+        {
+          continue;
+        }
+
+        const uint32_t row = res.x * (y + res.y * z);
+
+        if (data.rowsContiguous)
+        {
+          const uint32_t begin = data.voxelOffsets[row + x0];
+          const uint32_t end = data.voxelOffsets[row + x1] + data.voxelCounts[row + x1];
+
+          if (begin < end)
+          {
+            ranges.begin[ranges.count] = begin;
+            ranges.end[ranges.count] = end;
+            ranges.count++;
+          }
+          continue;
+        }
+
+        for (int32_t x = x0; x <= x1; x++)
+        {
+          const uint32_t cell = data.hashKeys ? SpatialHash::find(data.hashKeys, data.hashMask, glm::ivec3(x, y, z), row + x) : row + x;
+          if (cell == SpatialHash::EMPTY_KEY)
+          {
+            continue;
+          }
+
+          const uint32_t count = data.voxelCounts[cell];
+          if (count == 0)
+          {
+            continue;
+          }
+
+          const uint32_t begin = data.voxelOffsets[cell];
+          if (ranges.count > 0 && ranges.end[ranges.count - 1] == begin)
+          {
+            ranges.end[ranges.count - 1] += count;
+            continue;
+          }
+
+          ranges.begin[ranges.count] = begin;
+          ranges.end[ranges.count] = begin + count;
+          ranges.count++;
+        }
+      }
+    }
+  }
+
+  CpuKernels getScalarKernels();
+  CpuKernels getSse4Kernels();
+  CpuKernels getAvx2Kernels();
+  CpuKernels getAvx512Kernels();
+}
@@ -0,0 +1,66 @@
+#include "CpuKernels.hpp"
+
+#if defined(__AVX2__)
+
+#include <immintrin.h>
+
+#include "CpuKernelsSimd.hpp"
+
+using namespace flut;
+
+namespace
+{
+  struct Avx2Traits
+  {
+    using Float = __m256;
+    using Mask = __m256;
+    using Index = __m256i;
+
+    constexpr static uint32_t WIDTH = 8;
+
+    static Float zero() { return _mm256_setzero_ps(); }
+    static Float set1(float v) { return _mm256_set1_ps(v); }
+    static Float load(const float* p) { return _mm256_loadu_ps(p); }
+    static Index loadIndices(const uint32_t* p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); }
+    static Float gather(const float* p, Index idx) { return _mm256_i32gather_ps(p, idx, 4); }
+    static Float add(Float a, Float b) { return _mm256_add_ps(a, b); }
+    static Float sub(Float a, Float b) { return _mm256_sub_ps(a, b); }
+    static Float mul(Float a, Float b) { return _mm256_mul_ps(a, b); }
+    static Float div(Float a, Float b) { return _mm256_div_ps(a, b); }
+    static Float sqrt(Float a) { return _mm256_sqrt_ps(a); }
+    static Mask lessThan(Float a, Float b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+    static Mask maskAnd(Mask a, Mask b) { return _mm256_and_ps(a, b); }
+    static Float select(Mask m, Float a) { return _mm256_and_ps(m, a); }
+
+    static Mask laneMask(uint32_t remaining)
+    {
+      const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+      const __m256i limit = _mm256_set1_epi32(static_cast<int32_t>(remaining < WIDTH ? remaining : WIDTH));
+      return _mm256_castsi256_ps(_mm256_cmpgt_epi32(limit, lanes));
+    }
+
+    static float reduceAdd(Float a)
+    {
+      const __m128 lo = _mm256_castps256_ps128(a);
+      const __m128 hi = _mm256_extractf128_ps(a, 1);
+      const __m128 v = _mm_add_ps(lo, hi);
+      const __m128 shuf = _mm_movehdup_ps(v);
+      const __m128 sums = _mm_add_ps(v, shuf);
+      return _mm_cvtss_f32(_mm_add_ss(sums, _mm_movehl_ps(shuf, sums)));
+    }
+  };
+}
+
+CpuKernels flut::getAvx2Kernels()
+{
+  return CpuKernels{ computeDensitiesSimd<Avx2Traits>, computeForcesSimd<Avx2Traits> };
+}
+
+#else
+
+flut::CpuKernels flut::getAvx2Kernels()
+{
+  return flut::CpuKernels{ nullptr, nullptr };
+}
+
+#endif
@@ -0,0 +1,64 @@
+#include "CpuKernels.hpp"
+
+#if defined(__AVX512F__)
+
+// GCC flags the deliberately undefined pass-through operands inside its own AVX-512 intrinsics.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+#include <immintrin.h>
+
+#include "CpuKernelsSimd.hpp"
+
+using namespace flut;
+
+namespace
+{
+  struct Avx512Traits
+  {
+    using Float = __m512;
+    using Mask = __mmask16;
+    using Index = __m512i;
+
+    constexpr static uint32_t WIDTH = 16;
+
+    static Float zero() { return _mm512_setzero_ps(); }
+    static Float set1(float v) { return _mm512_set1_ps(v); }
+    static Float load(const float* p) { return _mm512_loadu_ps(p); }
+    static Index loadIndices(const uint32_t* p) { return _mm512_loadu_si512(p); }
+    static Float gather(const float* p, Index idx) { return _mm512_i32gather_ps(idx, p, 4); }
+    static Float add(Float a, Float b) { return _mm512_add_ps(a, b); }
+    static Float sub(Float a, Float b) { return _mm512_sub_ps(a, b); }
+    static Float mul(Float a, Float b) { return _mm512_mul_ps(a, b); }
+    static Float div(Float a, Float b) { return _mm512_div_ps(a, b); }
+    static Float sqrt(Float a) { return _mm512_sqrt_ps(a); }
+    static Mask lessThan(Float a, Float b) { return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ); }
+    static Mask maskAnd(Mask a, Mask b) { return static_cast<Mask>(a & b); }
+    static Float select(Mask m, Float a) { return _mm512_maskz_mov_ps(m, a); }
+
+    static Mask laneMask(uint32_t remaining)
+    {
+      return remaining >= WIDTH ? static_cast<Mask>(0xFFFF) : static_cast<Mask>((1u << remaining) - 1u);
+    }
+
+    static float reduceAdd(Float a)
+    {
+      return _mm512_reduce_add_ps(a);
+    }
+  };
+}
+
+CpuKernels flut::getAvx512Kernels()
+{
+  return CpuKernels{ computeDensitiesSimd<Avx512Traits>, computeForcesSimd<Avx512Traits> };
+}
+
+#else
+
+flut::CpuKernels flut::getAvx512Kernels()
+{
+  return flut::CpuKernels{ nullptr, nullptr };
+}
+
+#endif
@@ -0,0 +1,150 @@
+#pragma once
+
+#include "CpuKernels.hpp"
+
+// Vectorized versions of the scalar kernels in CpuKernels.cpp. This header is
+// only included by the per-ISA translation units, which instantiate the templates
+// with their own vector traits (see CpuKernelsAvx2.cpp for the expected interface).
+// Each SIMD lane processes one neighbor candidate; lanes beyond the end of a
+// neighbor range or outside of the kernel radius are masked out.
+
+namespace flut
+{
+  namespace
+  {
+    // Calls func(load, lanes) for every batch of V::WIDTH neighbor candidates of particle i, where
+    // load(stream) fetches the candidates' elements of a particle stream and lanes masks the valid ones.
+    // Candidates come from the particle's neighbor list if it has one, and from the grid otherwise.
+    template<typename V, typename F>
+    void forEachCandidateBatch(const CpuKernelData& data, uint32_t i, NeighborRanges& ranges, F&& func)
+    {
+      if (data.neighbors && data.neighborCounts[i] <= data.neighborStride)
+      {
+        const uint32_t* list = data.neighbors + size_t(i) * data.neighborStride;
+        const uint32_t count = data.neighborCounts[i];
+
+        for (uint32_t k = 0; k < count; k += V::WIDTH)
+        {
+          const auto indices = V::loadIndices(list + k);
+          func([&](const float* stream) { return V::gather(stream, indices); }, V::laneMask(count - k));
+        }
+        return;
+      }
+
+      gatherNeighborRanges(data, data.posX[i], data.posY[i], data.posZ[i], ranges);
+
+      for (uint32_t r = 0; r < ranges.count; r++)
+      {
+        const uint32_t rangeEnd = ranges.end[r];
+
+        for (uint32_t j = ranges.begin[r]; j < rangeEnd; j += V::WIDTH)
+        {
+          func([&](const float* stream) { return V::load(stream + j); }, V::laneMask(rangeEnd - j));
+        }
+      }
+    }
+
+    template<typename V>
+    void computeDensitiesSimd(const CpuKernelData& data, uint32_t begin, uint32_t end)
+    {
+      using Float = typename V::Float;
+      using Mask = typename V::Mask;
+
+      const Float h2 = V::set1(data.kernelRadius * data.kernelRadius);
+
+      NeighborRanges ranges;
+
+      for (uint32_t i = begin; i < end; i++)
+      {
+        const Float px = V::set1(data.posX[i]);
+        const Float py = V::set1(data.posY[i]);
+        const Float pz = V::set1(data.posZ[i]);
+
+        Float sum = V::zero();
+
+        forEachCandidateBatch<V>(data, i, ranges, [&](auto load, Mask lanes) {
+          const Float dx = V::sub(px, load(data.posX));
+          const Float dy = V::sub(py, load(data.posY));
+          const Float dz = V::sub(pz, load(data.posZ));
+          const Float r2 = V::add(V::add(V::mul(dx, dx), V::mul(dy, dy)), V::mul(dz, dz));
+
+          const Mask mask = V::maskAnd(V::lessThan(r2, h2), lanes);
+
+          const Float d = V::sub(h2, r2);
+          sum = V::add(sum, V::select(mask, V::mul(V::mul(d, d), d)));
+        });
+
+        const float density = data.mass * data.poly6KernelWeightConst * V::reduceAdd(sum);
+        data.density[i] = density;
+        data.pressure[i] = data.restPressure + data.stiffness * (density - data.restDensity);
+      }
+    }
+
+    template<typename V>
+    void computeForcesSimd(const CpuKernelData& data, uint32_t begin, uint32_t end, float dt, glm::vec3 gravity)
+    {
+      using Float = typename V::Float;
+      using Mask = typename V::Mask;
+
+      const Float h = V::set1(data.kernelRadius);
+      const Float h2 = V::set1(data.kernelRadius * data.kernelRadius);
+      const Float zero = V::zero();
+      const Float one = V::set1(1.0f);
+      const Float half = V::set1(0.5f);
+      const Float spikyConst = V::set1(data.spikyKernelWeightConst);
+      const Float viscosityConst = V::set1(data.viscosityKernelWeightConst);
+
+      NeighborRanges ranges;
+
+      for (uint32_t i = begin; i < end; i++)
+      {
+        const Float px = V::set1(data.posX[i]);
+        const Float py = V::set1(data.posY[i]);
+        const Float pz = V::set1(data.posZ[i]);
+        const Float vx = V::set1(data.velX[i]);
+        const Float vy = V::set1(data.velY[i]);
+        const Float vz = V::set1(data.velZ[i]);
+        const Float pi = V::set1(data.pressure[i]);
+
+        Float fpx = zero, fpy = zero, fpz = zero;
+        Float fvx = zero, fvy = zero, fvz = zero;
+
+        forEachCandidateBatch<V>(data, i, ranges, [&](auto load, Mask lanes) {
+          const Float dx = V::sub(px, load(data.posX));
+          const Float dy = V::sub(py, load(data.posY));
+          const Float dz = V::sub(pz, load(data.posZ));
+          const Float r2 = V::add(V::add(V::mul(dx, dx), V::mul(dy, dy)), V::mul(dz, dz));
+
+          const Mask mask = V::maskAnd(V::lessThan(r2, h2), lanes);
+          const Mask pressureMask = V::maskAnd(mask, V::lessThan(zero, r2));
+
+          const Float rLen = V::sqrt(r2);
+          const Float invDensity = V::div(one, load(data.density));
+
+          const Float d = V::sub(h, rLen);
+          const Float weightPressure = V::div(V::mul(spikyConst, V::mul(V::mul(d, d), d)), rLen);
+          const Float pressureSum = V::add(pi, load(data.pressure));
+          const Float pressureTerm = V::select(pressureMask,
+            V::mul(V::mul(V::mul(pressureSum, weightPressure), half), invDensity));
+
+          fpx = V::add(fpx, V::mul(dx, pressureTerm));
+          fpy = V::add(fpy, V::mul(dy, pressureTerm));
+          fpz = V::add(fpz, V::mul(dz, pressureTerm));
+
+          const Float viscosityTerm = V::select(mask, V::mul(V::mul(viscosityConst, d), invDensity));
+
+          fvx = V::add(fvx, V::mul(V::sub(load(data.filteredVelX), vx), viscosityTerm));
+          fvy = V::add(fvy, V::mul(V::sub(load(data.filteredVelY), vy), viscosityTerm));
+          fvz = V::add(fvz, V::mul(V::sub(load(data.filteredVelZ), vz), viscosityTerm));
+        });
+
+        const float density = data.density[i];
+        const float visScale = data.mass * data.viscosityCoeff;
+        const float dtOverDensity = dt / density;
+        data.newVelX[i] = data.velX[i] + (V::reduceAdd(fvx) * visScale - V::reduceAdd(fpx) * data.mass + gravity.x * density) * dtOverDensity;
+        data.newVelY[i] = data.velY[i] + (V::reduceAdd(fvy) * visScale - V::reduceAdd(fpy) * data.mass + gravity.y * density) * dtOverDensity;
+        data.newVelZ[i] = data.velZ[i] + (V::reduceAdd(fvz) * visScale - V::reduceAdd(fpz) * data.mass + gravity.z * density) * dtOverDensity;
+      }
+    }
+  }
+}
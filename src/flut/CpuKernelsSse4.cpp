@@ -0,0 +1,64 @@
+#include "CpuKernels.hpp"
+
+#if defined(__SSE4_1__) || defined(__AVX__) || (defined(_MSC_VER) && defined(_M_X64))
+
+#include <smmintrin.h>
+
+#include "CpuKernelsSimd.hpp"
+
+using namespace flut;
+
+namespace
+{
+  struct Sse4Traits
+  {
+    using Float = __m128;
+    using Mask = __m128;
+    // SSE4 has no gather instruction, so neighbor lists are read element by element.
+    using Index = const uint32_t*;
+
+    constexpr static uint32_t WIDTH = 4;
+
+    static Float zero() { return _mm_setzero_ps(); }
+    static Float set1(float v) { return _mm_set1_ps(v); }
+    static Float load(const float* p) { return _mm_loadu_ps(p); }
+    static Index loadIndices(const uint32_t* p) { return p; }
+    static Float gather(const float* p, Index idx) { return _mm_setr_ps(p[idx[0]], p[idx[1]], p[idx[2]], p[idx[3]]); }
+    static Float add(Float a, Float b) { return _mm_add_ps(a, b); }
+    static Float sub(Float a, Float b) { return _mm_sub_ps(a, b); }
+    static Float mul(Float a, Float b) { return _mm_mul_ps(a, b); }
+    static Float div(Float a, Float b) { return _mm_div_ps(a, b); }
+    static Float sqrt(Float a) { return _mm_sqrt_ps(a); }
+    static Mask lessThan(Float a, Float b) { return _mm_cmplt_ps(a, b); }
+    static Mask maskAnd(Mask a, Mask b) { return _mm_and_ps(a, b); }
+    static Float select(Mask m, Float a) { return _mm_blendv_ps(_mm_setzero_ps(), a, m); }
+
+    static Mask laneMask(uint32_t remaining)
+    {
+      const __m128i lanes = _mm_setr_epi32(0, 1, 2, 3);
+      const __m128i limit = _mm_set1_epi32(static_cast<int32_t>(remaining < WIDTH ? remaining : WIDTH));
+      return _mm_castsi128_ps(_mm_cmpgt_epi32(limit, lanes));
+    }
+
+    static float reduceAdd(Float a)
+    {
+      const __m128 shuf = _mm_movehdup_ps(a);
+      const __m128 sums = _mm_add_ps(a, shuf);
+      return _mm_cvtss_f32(_mm_add_ss(sums, _mm_movehl_ps(shuf, sums)));
+    }
+  };
+}
+
+CpuKernels flut::getSse4Kernels()
+{
+  return CpuKernels{ computeDensitiesSimd<Sse4Traits>, computeForcesSimd<Sse4Traits> };
+}
+
+#else
+
+flut::CpuKernels flut::getSse4Kernels()
+{
+  return flut::CpuKernels{ nullptr, nullptr };
+}
+
+#endif
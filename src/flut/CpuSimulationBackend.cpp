@@ -0,0 +1,873 @@
+#include "CpuSimulationBackend.hpp"
+#include "CellOrdering.hpp"
+#include "SpatialHash.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+using namespace flut;
+
+using clock_type = std::chrono::high_resolution_clock;
+
+constexpr static uint32_t VOXEL_CHUNK_SIZE = 2048;
+constexpr static uint32_t MIN_SORT_BLOCK_SIZE = 4096;
+constexpr static uint32_t MIN_CELL_BLOCK_PARTICLES = 1024;
+constexpr static uint32_t CELL_BLOCKS_PER_THREAD = 8;
+constexpr static float SAFE_BOUNDS = 0.5f;
+constexpr static float WALL_DAMPING = 0.5f;
+
+static double elapsedMs(clock_type::time_point& start)
+{
+  const auto now = clock_type::now();
+  const std::chrono::duration<double, std::milli> span{now - start};
+  start = now;
+  return span.count();
+}
+
+CpuSimulationBackend::CpuSimulationBackend(const std::vector<Particle>& particles, const SimulationGrid& grid, const SimulationParams& params,
+                                           uint32_t threadCount, CpuIsa isa, const NeighborListConfig& neighborLists)
+  : m_pool(threadCount)
+  , m_isa(isa)
+  , m_kernels(CpuKernels::get(isa))
+  , m_particleCount(0)
+  , m_sortBlockCount(1)
+  , m_listConfig(neighborLists)
+  , m_listSkin(0.0f)
+  , m_listReach(1)
+  , m_listsValid(false)
+  , m_timedSteps(0)
+{
+  m_name = "CPU (" + std::string(CpuKernels::isaName(m_isa)) + ", " + std::to_string(m_pool.threadCount()) + " threads)";
+
+  std::fill(std::begin(m_stepMs), std::end(m_stepMs), 0.0);
+  m_movedParticles.resize(m_pool.threadCount());
+
+  reconfigure(grid, params);
+  setParticles(particles);
+}
+
+CpuSimulationBackend::~CpuSimulationBackend()
+{
+}
+
+void CpuSimulationBackend::reconfigure(const SimulationGrid& grid, const SimulationParams& params)
+{
+  const float KERNEL_RADIUS = params.kernelRadius;
+
+  m_grid = grid;
+  m_params = params;
+
+  // Hashed grids do not need any storage per voxel of the domain.
+  if (m_grid.mode == GridMode::Dense)
+  {
+    const uint32_t voxelCount = grid.voxelCount();
+    m_orderedVoxels = CellOrdering::orderedVoxels(grid);
+    m_voxelRanks.resize(voxelCount);
+
+    for (uint32_t r = 0; r < voxelCount; r++)
+    {
+      m_voxelRanks[m_orderedVoxels[r]] = r;
+    }
+  }
+  else
+  {
+    m_orderedVoxels = {};
+    m_voxelRanks = {};
+  }
+
+  // The particles keep their state and are re-binned by the next grid build. Only step 6 does
+  // boundary handling, so they are clamped into the new domain like in the compute shaders.
+  const glm::vec3 boundsL = m_grid.origin + SAFE_BOUNDS;
+  const glm::vec3 boundsH = m_grid.origin + m_grid.size - SAFE_BOUNDS;
+  for (Particle& p : m_particles)
+  {
+    float* position = &p.position_x;
+    for (int a = 0; a < 3; a++)
+    {
+      position[a] = std::clamp(position[a], boundsL[a], boundsH[a]);
+    }
+  }
+  resizeCells();
+
+  // Same constants as the ones baked into the compute shaders.
+  m_invCellSize = m_grid.invCellSize();
+
+  // The lists hold the neighbors up to the kernel radius plus the skin, so more cells than the
+  // direct neighbors are searched for them.
+  const glm::vec3 cellSize = 1.0f / m_invCellSize;
+  const float minCellSize = std::min({ cellSize.x, cellSize.y, cellSize.z });
+  const float maxSkin = NeighborRanges::MAX_REACH * minCellSize - KERNEL_RADIUS;
+  m_listSkin = std::max(std::min(m_listConfig.skin * KERNEL_RADIUS, maxSkin), 0.0f);
+  m_listReach = std::min(static_cast<int32_t>(std::ceil((KERNEL_RADIUS + m_listSkin) / minCellSize)), NeighborRanges::MAX_REACH);
+  invalidateNeighborLists();
+
+  CpuKernelData& data = m_kernelData;
+  data.rowsContiguous = m_grid.mode == GridMode::Dense && m_grid.cellOrder == CellOrder::Linear;
+  data.gridRes = m_grid.res;
+  data.gridOrigin = m_grid.origin;
+  data.invCellSize = m_invCellSize;
+  data.kernelRadius = KERNEL_RADIUS;
+  data.mass = params.mass;
+  data.poly6KernelWeightConst = static_cast<float>(315.0f / (64.0f * M_PI * std::pow(KERNEL_RADIUS, 9)));
+  data.spikyKernelWeightConst = static_cast<float>(15.0f / (M_PI * std::pow(KERNEL_RADIUS, 6)));
+  data.viscosityKernelWeightConst = static_cast<float>(45.0f / (M_PI * std::pow(KERNEL_RADIUS, 6)));
+  data.viscosityCoeff = params.viscosity;
+  data.stiffness = params.stiffness;
+  data.restDensity = params.restDensity;
+  data.restPressure = params.restPressure;
+}
+
+const SimulationGrid& CpuSimulationBackend::grid() const
+{
+  return m_grid;
+}
+
+const SimulationParams& CpuSimulationBackend::params() const
+{
+  return m_params;
+}
+
+size_t CpuSimulationBackend::gridMemoryBytes() const
+{
+  return m_voxelRanks.size() * sizeof(uint32_t) + m_orderedVoxels.size() * sizeof(uint32_t) +
+    m_hashKeys.size() * sizeof(uint32_t) + m_orderedCounts.size() * sizeof(uint32_t) +
+    m_voxelCounts.size() * sizeof(uint32_t) + m_voxelOffsets.size() * sizeof(uint32_t) +
+    m_voxelVelocities.size() * sizeof(glm::vec3) + m_voxelVelocityCounts.size() * sizeof(uint32_t) +
+    m_blockHistograms.size() * sizeof(uint32_t) +
+    m_neighbors.size() * sizeof(uint32_t) + m_neighborCounts.size() * sizeof(uint32_t) +
+    (m_listPosX.size() + m_listPosY.size() + m_listPosZ.size()) * sizeof(float);
+}
+
+void CpuSimulationBackend::resizeCells()
+{
+  const bool hashed = m_grid.mode == GridMode::Hashed;
+  m_cellCount = hashed ? SpatialHash::tableSize(m_particleCount, m_grid.voxelCount()) : m_grid.voxelCount();
+
+  m_orderedCounts.resize(m_cellCount);
+  m_voxelChunkOffsets.resize((m_cellCount + VOXEL_CHUNK_SIZE - 1) / VOXEL_CHUNK_SIZE);
+  m_voxelCounts.assign(m_cellCount, 0);
+  m_voxelOffsets.assign(m_cellCount, 0);
+  m_voxelVelocities.assign(m_cellCount, glm::vec3(0.0f));
+  m_voxelVelocityCounts.assign(m_listConfig.skin > 0.0f ? m_cellCount : 0, 0);
+  m_blockHistograms.resize(size_t(m_sortBlockCount) * m_cellCount);
+
+  if (!hashed)
+  {
+    m_hashKeys = std::vector<std::atomic<uint32_t>>();
+  }
+  else if (m_hashKeys.size() != m_cellCount)
+  {
+    m_hashKeys = std::vector<std::atomic<uint32_t>>(m_cellCount);
+  }
+  for (std::atomic<uint32_t>& key : m_hashKeys)
+  {
+    key.store(SpatialHash::EMPTY_KEY, std::memory_order_relaxed);
+  }
+
+  // Until the next grid build, there is a single cell block.
+  m_cellBlockCount = 1;
+  m_cellBlockRankBounds = { 0, m_cellCount };
+  m_cellBlockParticleBounds = { 0, m_particleCount };
+
+  CpuKernelData& data = m_kernelData;
+  data.voxelOffsets = m_voxelOffsets.data();
+  data.voxelCounts = m_voxelCounts.data();
+  data.hashKeys = hashed ? m_hashKeys.data() : nullptr;
+  data.hashMask = hashed ? m_cellCount - 1 : 0;
+}
+
+void CpuSimulationBackend::resizeNeighborLists()
+{
+  const bool enabled = m_listConfig.skin > 0.0f;
+  const uint32_t stride = m_listConfig.maxNeighbors;
+
+  // Indices past a particle's count are read by full-width loads, so the lists start out as valid indices.
+  m_neighbors.assign(enabled ? size_t(m_particleCount) * stride + CpuKernels::STREAM_PADDING : 0, 0u);
+  m_neighborCounts.assign(enabled ? m_particleCount : 0, 0u);
+  m_listPosX.assign(enabled ? m_particleCount : 0, 0.0f);
+  m_listPosY.assign(enabled ? m_particleCount : 0, 0.0f);
+  m_listPosZ.assign(enabled ? m_particleCount : 0, 0.0f);
+  m_blockDisplacements.assign(m_sortBlockCount, 0.0f);
+  invalidateNeighborLists();
+
+  CpuKernelData& data = m_kernelData;
+  data.neighborCounts = m_neighborCounts.data();
+  data.neighborStride = stride;
+}
+
+void CpuSimulationBackend::invalidateNeighborLists()
+{
+  m_listsValid = false;
+  m_kernelData.neighbors = nullptr;
+  m_kernelData.cellReach = 1;
+}
+
+void CpuSimulationBackend::setParticles(const std::vector<Particle>& particles)
+{
+  m_particleCount = static_cast<uint32_t>(particles.size());
+  m_particles = particles;
+  m_sortedParticles.resize(m_particleCount);
+  m_particleVoxels.resize(m_particleCount);
+
+  // One block per thread; the histograms have to be cleared and scanned in every step, so
+  // small particle counts use fewer blocks.
+  m_sortBlockCount = std::clamp(m_particleCount / MIN_SORT_BLOCK_SIZE, 1u, m_pool.threadCount());
+  m_sortBlockSize = (m_particleCount + m_sortBlockCount - 1) / m_sortBlockCount;
+
+  // Enough cell blocks per thread for stealing to even out the cost differences between
+  // dense and sparse regions.
+  const uint32_t cellBlockCount = m_pool.threadCount() * CELL_BLOCKS_PER_THREAD;
+  m_cellBlockParticles = std::max((m_particleCount + cellBlockCount - 1) / cellBlockCount, MIN_CELL_BLOCK_PARTICLES);
+
+  // The hash table grows with the particle count.
+  resizeCells();
+  resizeNeighborLists();
+
+  const size_t streamSize = m_particleCount + CpuKernels::STREAM_PADDING;
+  for (std::vector<float>* stream : { &m_posX, &m_posY, &m_posZ, &m_velX, &m_velY, &m_velZ,
+                                      &m_filteredVelX, &m_filteredVelY, &m_filteredVelZ, &m_density, &m_pressure })
+  {
+    stream->assign(streamSize, 0.0f);
+  }
+
+  CpuKernelData& data = m_kernelData;
+  data.particleCount = m_particleCount;
+  data.posX = m_posX.data();
+  data.posY = m_posY.data();
+  data.posZ = m_posZ.data();
+  data.velX = m_velX.data();
+  data.velY = m_velY.data();
+  data.velZ = m_velZ.data();
+  data.filteredVelX = m_filteredVelX.data();
+  data.filteredVelY = m_filteredVelY.data();
+  data.filteredVelZ = m_filteredVelZ.data();
+  data.density = m_density.data();
+  data.pressure = m_pressure.data();
+  data.newVelX = m_velX.data();
+  data.newVelY = m_velY.data();
+  data.newVelZ = m_velZ.data();
+}
+
+void CpuSimulationBackend::runSteps(uint32_t firstStep, uint32_t lastStep, float dt, const glm::vec3& gravity)
+{
+  auto runs = [&](uint32_t stepIdx) {
+    return firstStep <= stepIdx && stepIdx <= lastStep;
+  };
+
+  auto time = clock_type::now();
+
+  // Step 1: Count particles per voxel. The positions were integrated by the previous step 6.
+  if (runs(0))
+  {
+    countParticles();
+    m_stepMs[0] += elapsedMs(time);
+  }
+
+  // Steps 2 and 3 are skipped while the neighbor lists are valid, since they refer to the
+  // particles in their current order.
+  // Step 2: Exclusive scan of the voxel counts.
+  if (runs(1) && !m_listsValid)
+  {
+    scanVoxelOffsets();
+    m_stepMs[1] += elapsedMs(time);
+  }
+
+  // Step 3: Write particles to their voxel-sorted location.
+  //         Build the neighbor lists of the sorted particles.
+  if (runs(2) && !m_listsValid)
+  {
+    scatterParticles();
+    if (m_listSkin > 0.0f)
+    {
+      buildNeighborLists();
+    }
+    m_stepMs[2] += elapsedMs(time);
+  }
+
+  // Step 4: Average voxel velocities and filter them at the particle positions.
+  if (runs(3))
+  {
+    computeVoxelVelocities();
+    computeFilteredVelocities();
+    m_stepMs[3] += elapsedMs(time);
+  }
+
+  // Step 5: Compute density and pressure for each particle.
+  if (runs(4))
+  {
+    computeDensities();
+    m_stepMs[4] += elapsedMs(time);
+  }
+
+  // Step 6: Compute pressure and viscosity forces, use them to write new velocity.
+  //         Integrate position, do boundary handling.
+  if (runs(5))
+  {
+    computeForces(dt, gravity);
+    m_stepMs[5] += elapsedMs(time);
+  }
+
+  m_timedSteps++;
+}
+
+void CpuSimulationBackend::readTimes(StepTimings& timings)
+{
+  if (m_timedSteps == 0)
+  {
+    return;
+  }
+
+  for (uint32_t i = 0; i < GlQueryRetriever::SIM_STEP_COUNT; i++)
+  {
+    timings.simStempMs[i] = static_cast<float>(m_stepMs[i] / m_timedSteps);
+    m_stepMs[i] = 0.0;
+  }
+
+  m_timedSteps = 0;
+}
+
+ParticleBuffers CpuSimulationBackend::particleBuffers() const
+{
+  return ParticleBuffers{};
+}
+
+const Particle* CpuSimulationBackend::hostParticles() const
+{
+  return m_particles.data();
+}
+
+uint32_t CpuSimulationBackend::particleCount() const
+{
+  return m_particleCount;
+}
+
+const char* CpuSimulationBackend::name() const
+{
+  return m_name.c_str();
+}
+
+CpuIsa CpuSimulationBackend::isa() const
+{
+  return m_isa;
+}
+
+const ThreadPool& CpuSimulationBackend::threadPool() const
+{
+  return m_pool;
+}
+
+ThreadPool& CpuSimulationBackend::threadPool()
+{
+  return m_pool;
+}
+
+float CpuSimulationBackend::neighborListSkin() const
+{
+  return m_listSkin;
+}
+
+const CpuSimulationBackend::NeighborListStats& CpuSimulationBackend::neighborListStats() const
+{
+  return m_listStats;
+}
+
+glm::ivec3 CpuSimulationBackend::voxelCoord(const Particle& p) const
+{
+  const auto& GRID_ORIGIN = m_grid.origin;
+
+  const auto x = static_cast<int32_t>(m_invCellSize.x * (p.position_x - GRID_ORIGIN.x));
+  const auto y = static_cast<int32_t>(m_invCellSize.y * (p.position_y - GRID_ORIGIN.y));
+  const auto z = static_cast<int32_t>(m_invCellSize.z * (p.position_z - GRID_ORIGIN.z));
+  return glm::ivec3(x, y, z);
+}
+
+uint32_t CpuSimulationBackend::voxelIndex(const glm::ivec3& coord) const
+{
+  return coord.x + m_grid.res.x * (coord.y + m_grid.res.y * coord.z);
+}
+
+uint32_t CpuSimulationBackend::cellIndex(uint32_t rank) const
+{
+  return m_grid.mode == GridMode::Hashed ? rank : m_orderedVoxels[rank];
+}
+
+uint32_t CpuSimulationBackend::insertCell(const glm::ivec3& coord)
+{
+  const uint32_t key = voxelIndex(coord);
+  const uint32_t mask = m_cellCount - 1;
+
+  uint32_t slot = SpatialHash::slot(coord, mask);
+  while (true)
+  {
+    uint32_t slotKey = m_hashKeys[slot].load(std::memory_order_relaxed);
+    if (slotKey == SpatialHash::EMPTY_KEY && m_hashKeys[slot].compare_exchange_strong(slotKey, key, std::memory_order_relaxed))
+    {
+      return slot;
+    }
+    // Otherwise slotKey is the key of the cell which occupies the slot, possibly claimed by another thread just now.
+    if (slotKey == key)
+    {
+      return slot;
+    }
+    slot = (slot + 1) & mask;
+  }
+}
+
+// Trilinear filtering of the voxel velocities, like the texture fetch in simStep6.comp.
+// Unlike the GL_REPEAT default of the sampler, border texels are clamped.
+glm::vec3 CpuSimulationBackend::sampleVelocity(const Particle& p) const
+{
+  const auto& GRID_ORIGIN = m_grid.origin;
+  const auto& GRID_SIZE = m_grid.size;
+  const auto& GRID_RES = m_grid.res;
+
+  const glm::vec3 position{p.position_x, p.position_y, p.position_z};
+  const glm::vec3 texel = (position - GRID_ORIGIN) / GRID_SIZE * glm::vec3(GRID_RES) - 0.5f;
+
+  int32_t i0[3];
+  int32_t i1[3];
+  float f[3];
+  for (int a = 0; a < 3; a++)
+  {
+    const float base = std::floor(texel[a]);
+    f[a] = texel[a] - base;
+    i0[a] = std::clamp(static_cast<int32_t>(base), 0, GRID_RES[a] - 1);
+    i1[a] = std::clamp(static_cast<int32_t>(base) + 1, 0, GRID_RES[a] - 1);
+  }
+
+  auto fetch = [&](int32_t x, int32_t y, int32_t z) {
+    const glm::ivec3 coord{x, y, z};
+    if (m_grid.mode == GridMode::Dense)
+    {
+      return m_voxelVelocities[voxelIndex(coord)];
+    }
+
+    // Unoccupied cells have zero velocity, like empty voxels of the dense grid.
+    const uint32_t slot = SpatialHash::find(m_hashKeys.data(), m_cellCount - 1, coord, voxelIndex(coord));
+    return slot != SpatialHash::EMPTY_KEY ? m_voxelVelocities[slot] : glm::vec3(0.0f);
+  };
+
+  const glm::vec3 c00 = fetch(i0[0], i0[1], i0[2]) * (1.0f - f[0]) + fetch(i1[0], i0[1], i0[2]) * f[0];
+  const glm::vec3 c10 = fetch(i0[0], i1[1], i0[2]) * (1.0f - f[0]) + fetch(i1[0], i1[1], i0[2]) * f[0];
+  const glm::vec3 c01 = fetch(i0[0], i0[1], i1[2]) * (1.0f - f[0]) + fetch(i1[0], i0[1], i1[2]) * f[0];
+  const glm::vec3 c11 = fetch(i0[0], i1[1], i1[2]) * (1.0f - f[0]) + fetch(i1[0], i1[1], i1[2]) * f[0];
+  const glm::vec3 c0 = c00 * (1.0f - f[1]) + c10 * f[1];
+  const glm::vec3 c1 = c01 * (1.0f - f[1]) + c11 * f[1];
+  return c0 * (1.0f - f[2]) + c1 * f[2];
+}
+
+static void integrateParticle(Particle& p, float dt, const glm::vec3& boundsL, const glm::vec3& boundsH)
+{
+  float* position = &p.position_x;
+  float* velocity = &p.velocity_x;
+
+  for (int a = 0; a < 3; a++)
+  {
+    position[a] += velocity[a] * dt;
+    if (position[a] < boundsL[a]) { velocity[a] *= -WALL_DAMPING; position[a] = boundsL[a]; }
+    if (position[a] > boundsH[a]) { velocity[a] *= -WALL_DAMPING; position[a] = boundsH[a]; }
+  }
+}
+
+uint32_t* CpuSimulationBackend::blockHistogram(uint32_t blockIdx)
+{
+  return &m_blockHistograms[size_t(blockIdx) * m_cellCount];
+}
+
+void CpuSimulationBackend::countParticles()
+{
+  const bool hashed = m_grid.mode == GridMode::Hashed;
+
+  if (m_listSkin > 0.0f)
+  {
+    m_listStats.steps++;
+  }
+
+  if (m_listsValid)
+  {
+    // Two particles which have each moved by at most half the skin cannot have come closer
+    // than the lists cover. Otherwise, the particles are re-sorted and the lists rebuilt.
+    const float maxDisplacement = 0.5f * m_listSkin;
+    if (updateStreams() <= maxDisplacement * maxDisplacement)
+    {
+      return;
+    }
+
+    invalidateNeighborLists();
+  }
+
+  if (hashed)
+  {
+    m_pool.parallelFor(m_cellCount, VOXEL_CHUNK_SIZE, [this](uint32_t begin, uint32_t end, uint32_t) {
+      for (uint32_t i = begin; i < end; i++)
+      {
+        m_hashKeys[i].store(SpatialHash::EMPTY_KEY, std::memory_order_relaxed);
+      }
+    });
+  }
+
+  m_pool.parallelFor(m_sortBlockCount, 1, [&](uint32_t blockBegin, uint32_t blockEnd, uint32_t) {
+    for (uint32_t b = blockBegin; b < blockEnd; b++)
+    {
+      uint32_t* histogram = blockHistogram(b);
+      std::fill(histogram, histogram + m_cellCount, 0u);
+
+      const uint32_t begin = b * m_sortBlockSize;
+      const uint32_t end = std::min(begin + m_sortBlockSize, m_particleCount);
+
+      for (uint32_t i = begin; i < end; i++)
+      {
+        const glm::ivec3 coord = voxelCoord(m_particles[i]);
+        const uint32_t rank = hashed ? insertCell(coord) : m_voxelRanks[voxelIndex(coord)];
+        m_particleVoxels[i] = rank;
+        histogram[rank]++;
+      }
+    }
+  });
+}
+
+float CpuSimulationBackend::updateStreams()
+{
+  m_pool.parallelFor(m_sortBlockCount, 1, [&](uint32_t blockBegin, uint32_t blockEnd, uint32_t) {
+    for (uint32_t b = blockBegin; b < blockEnd; b++)
+    {
+      const uint32_t begin = b * m_sortBlockSize;
+      const uint32_t end = std::min(begin + m_sortBlockSize, m_particleCount);
+
+      float maxDistance2 = 0.0f;
+
+      for (uint32_t i = begin; i < end; i++)
+      {
+        const Particle& p = m_particles[i];
+
+        // Without a scatter, the streams are updated here. Boundary handling may have changed the velocity.
+        m_posX[i] = p.position_x;
+        m_posY[i] = p.position_y;
+        m_posZ[i] = p.position_z;
+        m_velX[i] = p.velocity_x;
+        m_velY[i] = p.velocity_y;
+        m_velZ[i] = p.velocity_z;
+
+        const float dx = p.position_x - m_listPosX[i];
+        const float dy = p.position_y - m_listPosY[i];
+        const float dz = p.position_z - m_listPosZ[i];
+        maxDistance2 = std::max(maxDistance2, dx * dx + dy * dy + dz * dz);
+      }
+
+      m_blockDisplacements[b] = maxDistance2;
+    }
+  });
+
+  return *std::max_element(m_blockDisplacements.begin(), m_blockDisplacements.begin() + m_sortBlockCount);
+}
+
+void CpuSimulationBackend::scanVoxelOffsets()
+{
+  // The histograms, the scan and the cell blocks work on cell ranks, i.e. positions in cell order.
+  // With a hashed grid, the ranks are the slots of the hash table.
+  // Reduce the block histograms to cell counts and sum them up per chunk of cells.
+  m_pool.parallelFor(m_cellCount, VOXEL_CHUNK_SIZE, [this](uint32_t begin, uint32_t end, uint32_t) {
+    std::fill(m_orderedCounts.begin() + begin, m_orderedCounts.begin() + end, 0u);
+
+    for (uint32_t b = 0; b < m_sortBlockCount; b++)
+    {
+      const uint32_t* histogram = blockHistogram(b);
+      for (uint32_t r = begin; r < end; r++)
+      {
+        m_orderedCounts[r] += histogram[r];
+      }
+    }
+
+    uint32_t sum = 0;
+    for (uint32_t r = begin; r < end; r++)
+    {
+      sum += m_orderedCounts[r];
+    }
+    m_voxelChunkOffsets[begin / VOXEL_CHUNK_SIZE] = sum;
+  });
+
+  uint32_t offset = 0;
+  for (uint32_t& chunkOffset : m_voxelChunkOffsets)
+  {
+    const uint32_t sum = chunkOffset;
+    chunkOffset = offset;
+    offset += sum;
+  }
+
+  // Cell block t starts at the first cell whose offset reaches t * m_cellBlockParticles.
+  // Blocks beyond the last such cell stay empty.
+  m_cellBlockCount = std::max((offset + m_cellBlockParticles - 1) / m_cellBlockParticles, 1u);
+  m_cellBlockRankBounds.assign(m_cellBlockCount + 1, m_cellCount);
+  m_cellBlockRankBounds[0] = 0;
+
+  // Scan within each chunk. The histogram entries are replaced by the scatter cursors of
+  // their block: blocks are laid out in order within each cell, which keeps the sort stable.
+  m_pool.parallelFor(m_cellCount, VOXEL_CHUNK_SIZE, [this](uint32_t begin, uint32_t end, uint32_t) {
+    uint32_t cursors[VOXEL_CHUNK_SIZE];
+
+    uint32_t offset = m_voxelChunkOffsets[begin / VOXEL_CHUNK_SIZE];
+
+    // First cell block which does not start before this chunk.
+    uint32_t block = begin > 0 ? (offset - m_orderedCounts[begin - 1]) / m_cellBlockParticles + 1 : 1;
+    uint32_t blockStart = block * m_cellBlockParticles;
+
+    for (uint32_t r = begin; r < end; r++)
+    {
+      for (; block < m_cellBlockCount && blockStart <= offset; block++, blockStart += m_cellBlockParticles)
+      {
+        m_cellBlockRankBounds[block] = r;
+      }
+
+      const uint32_t cell = cellIndex(r);
+      m_voxelOffsets[cell] = offset;
+      m_voxelCounts[cell] = m_orderedCounts[r];
+      cursors[r - begin] = offset;
+      offset += m_orderedCounts[r];
+    }
+
+    for (uint32_t b = 0; b < m_sortBlockCount; b++)
+    {
+      uint32_t* histogram = blockHistogram(b);
+      for (uint32_t r = begin; r < end; r++)
+      {
+        const uint32_t count = histogram[r];
+        histogram[r] = cursors[r - begin];
+        cursors[r - begin] += count;
+      }
+    }
+  });
+
+  m_cellBlockParticleBounds.resize(m_cellBlockCount + 1);
+  for (uint32_t t = 0; t <= m_cellBlockCount; t++)
+  {
+    const uint32_t rank = m_cellBlockRankBounds[t];
+    m_cellBlockParticleBounds[t] = rank < m_cellCount ? m_voxelOffsets[cellIndex(rank)] : m_particleCount;
+  }
+}
+
+void CpuSimulationBackend::scatterParticles()
+{
+  // Every block owns its cursors, so no atomics are needed.
+  m_pool.parallelFor(m_sortBlockCount, 1, [this](uint32_t blockBegin, uint32_t blockEnd, uint32_t) {
+    for (uint32_t b = blockBegin; b < blockEnd; b++)
+    {
+      uint32_t* cursors = blockHistogram(b);
+
+      const uint32_t begin = b * m_sortBlockSize;
+      const uint32_t end = std::min(begin + m_sortBlockSize, m_particleCount);
+
+      for (uint32_t i = begin; i < end; i++)
+      {
+        const uint32_t outIdx = cursors[m_particleVoxels[i]]++;
+        const Particle& p = m_particles[i];
+        m_sortedParticles[outIdx] = p;
+        m_posX[outIdx] = p.position_x;
+        m_posY[outIdx] = p.position_y;
+        m_posZ[outIdx] = p.position_z;
+        m_velX[outIdx] = p.velocity_x;
+        m_velY[outIdx] = p.velocity_y;
+        m_velZ[outIdx] = p.velocity_z;
+      }
+    }
+  });
+
+  std::swap(m_particles, m_sortedParticles);
+}
+
+void CpuSimulationBackend::buildNeighborLists()
+{
+  const float radius = m_params.kernelRadius + m_listSkin;
+  const float radius2 = radius * radius;
+  const uint32_t stride = m_listConfig.maxNeighbors;
+
+  std::atomic<uint32_t> overflowParticles{0};
+
+  // Also used by the kernels for particles whose lists overflow, until the next grid build.
+  m_kernelData.cellReach = m_listReach;
+
+  m_pool.parallelForRanges(m_cellBlockParticleBounds.data(), m_cellBlockCount, [&](uint32_t begin, uint32_t end, uint32_t) {
+    NeighborRanges ranges;
+    uint32_t overflows = 0;
+
+    for (uint32_t i = begin; i < end; i++)
+    {
+      const float px = m_posX[i];
+      const float py = m_posY[i];
+      const float pz = m_posZ[i];
+
+      gatherNeighborRanges(m_kernelData, px, py, pz, ranges);
+
+      uint32_t* list = m_neighbors.data() + size_t(i) * stride;
+      uint32_t count = 0;
+
+      for (uint32_t r = 0; r < ranges.count; r++)
+      {
+        for (uint32_t j = ranges.begin[r]; j < ranges.end[r]; j++)
+        {
+          const float dx = px - m_posX[j];
+          const float dy = py - m_posY[j];
+          const float dz = pz - m_posZ[j];
+
+          if (dx * dx + dy * dy + dz * dz < radius2)
+          {
+            // Overflowing particles are still counted, so that the kernels know to search the grid.
+            if (count < stride)
+            {
+              list[count] = j;
+            }
+            count++;
+          }
+        }
+      }
+
+      m_neighborCounts[i] = count;
+      overflows += count > stride ? 1 : 0;
+
+      m_listPosX[i] = px;
+      m_listPosY[i] = py;
+      m_listPosZ[i] = pz;
+    }
+
+    overflowParticles.fetch_add(overflows, std::memory_order_relaxed);
+  });
+
+  m_listsValid = true;
+  m_kernelData.neighbors = m_neighbors.data();
+  m_listStats.builds++;
+  m_listStats.overflowParticles = overflowParticles.load(std::memory_order_relaxed);
+}
+
+void CpuSimulationBackend::computeVoxelVelocities()
+{
+  // While the neighbor lists are reused, the particles stay where the last grid build sorted them,
+  // although some have moved to another cell since. Averaging them into the cell they are stored
+  // in lets the viscosity drift from a simulation which re-sorts every step, so they are moved to
+  // their current cell afterwards. There are few of them, since the lists are rebuilt once a
+  // particle has moved by half the skin.
+  const bool hashed = m_grid.mode == GridMode::Hashed;
+  const bool reused = m_listSkin > 0.0f;
+
+  // A thread may run several cell blocks.
+  for (std::vector<uint32_t>& moved : m_movedParticles)
+  {
+    moved.clear();
+  }
+
+  m_pool.parallelForRanges(m_cellBlockRankBounds.data(), m_cellBlockCount, [&](uint32_t begin, uint32_t end, uint32_t threadIdx) {
+    std::vector<uint32_t>& moved = m_movedParticles[threadIdx];
+
+    for (uint32_t r = begin; r < end; r++)
+    {
+      const uint32_t v = cellIndex(r);
+      const uint32_t count = m_voxelCounts[v];
+      const uint32_t offset = m_voxelOffsets[v];
+      const uint32_t key = hashed ? m_hashKeys[v].load(std::memory_order_relaxed) : v;
+
+      glm::vec3 velocity{0.0f};
+      uint32_t stayed = 0;
+      for (uint32_t i = offset; i < offset + count; i++)
+      {
+        const Particle& p = m_particles[i];
+        if (reused && voxelIndex(voxelCoord(p)) != key)
+        {
+          moved.push_back(i);
+          continue;
+        }
+        velocity += glm::vec3{p.velocity_x, p.velocity_y, p.velocity_z};
+        stayed++;
+      }
+
+      if (reused)
+      {
+        m_voxelVelocities[v] = velocity;
+        m_voxelVelocityCounts[v] = stayed;
+        continue;
+      }
+
+      if (count > 0)
+      {
+        velocity /= static_cast<float>(count);
+      }
+
+      m_voxelVelocities[v] = velocity;
+    }
+  });
+
+  if (!reused)
+  {
+    return;
+  }
+
+  // Cells which were empty at the last build are added to the hash table; their particle count
+  // stays 0, so the kernels skip them.
+  for (const std::vector<uint32_t>& moved : m_movedParticles)
+  {
+    for (uint32_t i : moved)
+    {
+      const Particle& p = m_particles[i];
+      const glm::ivec3 coord = voxelCoord(p);
+      const uint32_t v = hashed ? insertCell(coord) : voxelIndex(coord);
+      m_voxelVelocities[v] += glm::vec3{p.velocity_x, p.velocity_y, p.velocity_z};
+      m_voxelVelocityCounts[v]++;
+    }
+  }
+
+  m_pool.parallelFor(m_cellCount, VOXEL_CHUNK_SIZE, [this](uint32_t begin, uint32_t end, uint32_t) {
+    for (uint32_t v = begin; v < end; v++)
+    {
+      if (m_voxelVelocityCounts[v] > 0)
+      {
+        m_voxelVelocities[v] /= static_cast<float>(m_voxelVelocityCounts[v]);
+      }
+    }
+  });
+}
+
+void CpuSimulationBackend::computeFilteredVelocities()
+{
+  // The viscosity term samples the velocity grid at neighbor positions. Doing it
+  // once per particle instead of once per neighbor pair keeps it out of step 6.
+  m_pool.parallelForRanges(m_cellBlockParticleBounds.data(), m_cellBlockCount, [this](uint32_t begin, uint32_t end, uint32_t) {
+    for (uint32_t i = begin; i < end; i++)
+    {
+      const glm::vec3 velocity = sampleVelocity(m_particles[i]);
+      m_filteredVelX[i] = velocity.x;
+      m_filteredVelY[i] = velocity.y;
+      m_filteredVelZ[i] = velocity.z;
+    }
+  });
+}
+
+void CpuSimulationBackend::computeDensities()
+{
+  m_pool.parallelForRanges(m_cellBlockParticleBounds.data(), m_cellBlockCount, [this](uint32_t begin, uint32_t end, uint32_t) {
+    m_kernels.computeDensities(m_kernelData, begin, end);
+
+    for (uint32_t i = begin; i < end; i++)
+    {
+      m_particles[i].density = m_density[i];
+      m_particles[i].pressure = m_pressure[i];
+    }
+  });
+}
+
+void CpuSimulationBackend::computeForces(float dt, const glm::vec3& gravity)
+{
+  const glm::vec3 boundsL = m_grid.origin + SAFE_BOUNDS;
+  const glm::vec3 boundsH = m_grid.origin + m_grid.size - SAFE_BOUNDS;
+
+  // The kernels of other blocks read the position streams, so the drift only updates the particles.
+  m_pool.parallelForRanges(m_cellBlockParticleBounds.data(), m_cellBlockCount, [&](uint32_t begin, uint32_t end, uint32_t) {
+    m_kernels.computeForces(m_kernelData, begin, end, dt, gravity);
+
+    for (uint32_t i = begin; i < end; i++)
+    {
+      Particle& p = m_particles[i];
+      p.velocity_x = m_velX[i];
+      p.velocity_y = m_velY[i];
+      p.velocity_z = m_velZ[i];
+      integrateParticle(p, dt, boundsL, boundsH);
+    }
+  });
+}
@@ -0,0 +1,181 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "CpuKernels.hpp"
+#include "SimulationBackend.hpp"
+#include "ThreadPool.hpp"
+
+namespace flut
+{
+  class CpuSimulationBackend : public SimulationBackend
+  {
+  public:
+    struct NeighborListStats
+    {
+      uint64_t steps = 0;
+      uint64_t builds = 0;
+      // Particles which had more neighbors than fit into their list at the last build.
+      uint32_t overflowParticles = 0;
+    };
+
+  public:
+    // The skin of the neighbor lists is limited to what NeighborRanges::MAX_REACH cells around a particle cover.
+    CpuSimulationBackend(const std::vector<Particle>& particles, const SimulationGrid& grid, const SimulationParams& params,
+                         uint32_t threadCount = 0, CpuIsa isa = CpuKernels::bestIsa(), const NeighborListConfig& neighborLists = {});
+
+    ~CpuSimulationBackend() override;
+
+  public:
+    void runSteps(uint32_t firstStep, uint32_t lastStep, float dt, const glm::vec3& gravity) override;
+
+    void setParticles(const std::vector<Particle>& particles) override;
+
+    // Takes effect immediately.
+    void reconfigure(const SimulationGrid& grid, const SimulationParams& params) override;
+
+    const SimulationGrid& grid() const override;
+
+    const SimulationParams& params() const override;
+
+    size_t gridMemoryBytes() const override;
+
+    void readTimes(StepTimings& timings) override;
+
+    ParticleBuffers particleBuffers() const override;
+
+    const Particle* hostParticles() const override;
+
+    uint32_t particleCount() const override;
+
+    const char* name() const override;
+
+    CpuIsa isa() const;
+
+    const ThreadPool& threadPool() const;
+
+    ThreadPool& threadPool();
+
+    // Skin of the neighbor lists in world units, 0 if they are disabled.
+    float neighborListSkin() const;
+
+    const NeighborListStats& neighborListStats() const;
+
+  private:
+    // Sizes the per-cell storage for the current grid mode and particle count.
+    void resizeCells();
+
+    // Sizes the neighbor lists for the current particle count and invalidates them.
+    void resizeNeighborLists();
+
+    void invalidateNeighborLists();
+
+    glm::ivec3 voxelCoord(const Particle& p) const;
+
+    uint32_t voxelIndex(const glm::ivec3& coord) const;
+
+    // Index into the per-cell arrays of the cell with the given rank.
+    uint32_t cellIndex(uint32_t rank) const;
+
+    // Slot of the cell in the hash table, which is claimed if the cell is not occupied yet.
+    uint32_t insertCell(const glm::ivec3& coord);
+
+    glm::vec3 sampleVelocity(const Particle& p) const;
+
+    uint32_t* blockHistogram(uint32_t blockIdx);
+
+    void countParticles();
+
+    // Copies the particles into the streams in their current order, which the neighbor lists refer
+    // to. Returns the largest squared distance a particle has moved since the lists were built.
+    float updateStreams();
+
+    void scanVoxelOffsets();
+
+    void scatterParticles();
+
+    void buildNeighborLists();
+
+    void computeVoxelVelocities();
+
+    void computeFilteredVelocities();
+
+    void computeDensities();
+
+    void computeForces(float dt, const glm::vec3& gravity);
+
+  private:
+    ThreadPool m_pool;
+    SimulationGrid m_grid;
+    SimulationParams m_params;
+    CpuIsa m_isa;
+    CpuKernels m_kernels;
+    CpuKernelData m_kernelData;
+    std::string m_name;
+    uint32_t m_particleCount;
+    // Voxels of a dense grid or slots of the hash table.
+    uint32_t m_cellCount;
+    glm::vec3 m_invCellSize;
+    std::vector<Particle> m_particles;
+    std::vector<Particle> m_sortedParticles;
+    // Cell rank of each particle, i.e. its cell's position in the grid's cell order.
+    std::vector<uint32_t> m_particleVoxels;
+    std::vector<uint32_t> m_orderedVoxels;
+    std::vector<uint32_t> m_voxelRanks;
+    std::vector<uint32_t> m_orderedCounts;
+    // Linear voxel index of the cell in each slot, or SpatialHash::EMPTY_KEY.
+    std::vector<std::atomic<uint32_t>> m_hashKeys;
+    // The grid is built with a counting sort over contiguous blocks of particles. Each block
+    // counts into its own histogram, which later holds its scatter cursors.
+    uint32_t m_sortBlockCount;
+    uint32_t m_sortBlockSize;
+    std::vector<uint32_t> m_blockHistograms;
+    std::vector<uint32_t> m_voxelChunkOffsets;
+    // Contiguous blocks of cells with roughly the same number of particles, which are the
+    // tasks of steps 4 to 6. Block t spans the cell ranks [rankBounds[t], rankBounds[t + 1]).
+    uint32_t m_cellBlockCount;
+    uint32_t m_cellBlockParticles;
+    std::vector<uint32_t> m_cellBlockRankBounds;
+    std::vector<uint32_t> m_cellBlockParticleBounds;
+    // Indexed by linear voxel index, or by slot with a hashed grid.
+    std::vector<uint32_t> m_voxelCounts;
+    std::vector<uint32_t> m_voxelOffsets;
+    std::vector<glm::vec3> m_voxelVelocities;
+    // Particles per cell which the velocities average, and the particles which each thread found
+    // outside the cell they are stored in. Only used with neighbor lists.
+    std::vector<uint32_t> m_voxelVelocityCounts;
+    std::vector<std::vector<uint32_t>> m_movedParticles;
+    std::vector<float> m_posX;
+    std::vector<float> m_posY;
+    std::vector<float> m_posZ;
+    std::vector<float> m_velX;
+    std::vector<float> m_velY;
+    std::vector<float> m_velZ;
+    std::vector<float> m_filteredVelX;
+    std::vector<float> m_filteredVelY;
+    std::vector<float> m_filteredVelZ;
+    std::vector<float> m_density;
+    std::vector<float> m_pressure;
+    // Neighbor lists of the sorted particles, and the positions they were built at. While they are
+    // valid, the particles are not re-sorted and the grid keeps the state of the last build.
+    // The lists are searched in m_listReach cells around each particle's cell.
+    NeighborListConfig m_listConfig;
+    float m_listSkin;
+    int32_t m_listReach;
+    bool m_listsValid;
+    std::vector<uint32_t> m_neighbors;
+    std::vector<uint32_t> m_neighborCounts;
+    std::vector<float> m_listPosX;
+    std::vector<float> m_listPosY;
+    std::vector<float> m_listPosZ;
+    std::vector<float> m_blockDisplacements;
+    NeighborListStats m_listStats;
+    double m_stepMs[GlQueryRetriever::SIM_STEP_COUNT];
+    uint32_t m_timedSteps;
+  };
+}
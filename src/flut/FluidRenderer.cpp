@@ -0,0 +1,273 @@
+#include "FluidRenderer.hpp"
+#include "GlHelper.hpp"
+
+#include <glm/gtc/type_ptr.hpp>
+#include <vector>
+
+using namespace flut;
+
+FluidRenderer::FluidRenderer(uint32_t width, uint32_t height, uint32_t particleCount, const SimulationGrid& grid,
+                             float nearPlane, float farPlane)
+  : m_width(width)
+  , m_height(height)
+  , m_particleCount(0)
+  , m_grid(grid)
+  , m_smoothedDepthHandle{0}
+{
+  // Shaders
+  {
+    m_programRenderGeometry = GlHelper::createVertFragShader(SHADERS_DIR "/renderGeometry.vert", SHADERS_DIR "/renderGeometry.frag");
+    m_programRenderCurvature = GlHelper::createVertFragShader(SHADERS_DIR "/renderBoundingBox.vert", SHADERS_DIR "/renderCurvature.frag", {
+      { "NEAR",           nearPlane },
+      { "FAR",            farPlane }
+    });
+    m_programRenderShading = GlHelper::createVertFragShader(SHADERS_DIR "/renderBoundingBox.vert", SHADERS_DIR "/renderShading.frag");
+  }
+
+  // Bounding box
+  glCreateBuffers(1, &m_bufBBoxVertices);
+  glNamedBufferStorage(m_bufBBoxVertices, 8 * sizeof(float) * 3, nullptr, GL_DYNAMIC_STORAGE_BIT);
+  setGrid(grid);
+
+  const std::vector<uint32_t> bboxIndices {
+    0, 1, 2, 2, 3, 0,
+    1, 5, 6, 6, 2, 1,
+    7, 6, 5, 5, 4, 7,
+    4, 0, 3, 3, 7, 4,
+    4, 5, 1, 1, 0, 4,
+    3, 2, 6, 6, 7, 3
+  };
+  glCreateBuffers(1, &m_bufBBoxIndices);
+  glNamedBufferStorage(m_bufBBoxIndices, bboxIndices.size() * sizeof(uint32_t), bboxIndices.data(), 0);
+
+  glCreateVertexArrays(1, &m_vao3);
+  glEnableVertexArrayAttrib(m_vao3, 0);
+  glVertexArrayVertexBuffer(m_vao3, 0, m_bufBBoxVertices, 0, 3 * sizeof(float));
+  glVertexArrayAttribBinding(m_vao3, 0, 0);
+  glVertexArrayAttribFormat(m_vao3, 0, 3, GL_FLOAT, GL_FALSE, 0);
+  glEnableVertexArrayAttrib(m_vao3, 1);
+  glVertexArrayElementBuffer(m_vao3, m_bufBBoxIndices);
+  glVertexArrayAttribBinding(m_vao3, 1, 0);
+  glVertexArrayAttribFormat(m_vao3, 1, 1, GL_FLOAT, GL_FALSE, 3 * sizeof(float));
+
+  // Billboards index buffer
+  glCreateBuffers(1, &m_bufBillboards);
+  glCreateVertexArrays(1, &m_vao1);
+  glVertexArrayElementBuffer(m_vao1, m_bufBillboards);
+  setParticleCount(particleCount);
+
+  // Default state
+  glClearColor(1.0f, 1.0f, 1.0f, 0.0f);
+  glEnable(GL_DEPTH_TEST);
+  glDepthMask(GL_TRUE);
+
+  // Textures and buffers
+  createFrameObjects();
+}
+
+FluidRenderer::~FluidRenderer()
+{
+  deleteFrameObjects();
+  glDeleteProgram(m_programRenderGeometry);
+  glDeleteProgram(m_programRenderCurvature);
+  glDeleteProgram(m_programRenderShading);
+  glDeleteBuffers(1, &m_bufBBoxVertices);
+  glDeleteBuffers(1, &m_bufBBoxIndices);
+  glDeleteBuffers(1, &m_bufBillboards);
+  glDeleteVertexArrays(1, &m_vao1);
+  glDeleteVertexArrays(1, &m_vao3);
+}
+
+void FluidRenderer::setGrid(const SimulationGrid& grid)
+{
+  m_grid = grid;
+
+  const auto& GRID_SIZE = m_grid.size;
+  const auto& GRID_ORIGIN = m_grid.origin;
+
+  const std::vector<glm::vec3> bboxVertices{
+    GRID_ORIGIN + glm::vec3{       0.0f,        0.0f, GRID_SIZE.z},
+    GRID_ORIGIN + glm::vec3{GRID_SIZE.x,        0.0f, GRID_SIZE.z},
+    GRID_ORIGIN + glm::vec3{GRID_SIZE.x, GRID_SIZE.y, GRID_SIZE.z},
+    GRID_ORIGIN + glm::vec3{       0.0f, GRID_SIZE.y, GRID_SIZE.z},
+    GRID_ORIGIN + glm::vec3{       0.0f,        0.0f,        0.0f},
+    GRID_ORIGIN + glm::vec3{GRID_SIZE.x,        0.0f,        0.0f},
+    GRID_ORIGIN + glm::vec3{GRID_SIZE.x, GRID_SIZE.y,        0.0f},
+    GRID_ORIGIN + glm::vec3{       0.0f, GRID_SIZE.y,        0.0f},
+  };
+  glNamedBufferSubData(m_bufBBoxVertices, 0, bboxVertices.size() * sizeof(float) * 3, glm::value_ptr(bboxVertices.data()[0]));
+}
+
+void FluidRenderer::setParticleCount(uint32_t particleCount)
+{
+  if (particleCount == m_particleCount)
+  {
+    return;
+  }
+
+  m_particleCount = particleCount;
+
+  uint32_t billboardIndexCount = 6;
+  uint32_t billboardVertexCount = 4;
+  uint32_t billboardIndices[] = { 0, 1, 2, 2, 1, 3 };
+
+  std::vector<uint32_t> indices(billboardIndexCount * m_particleCount);
+
+  for (uint32_t i = 0; i < indices.size(); i++)
+  {
+    uint32_t particleOffset = i / billboardIndexCount;
+    uint32_t particleIndexOffset = i % billboardIndexCount;
+    indices[i] = billboardIndices[particleIndexOffset] + particleOffset * billboardVertexCount;
+  }
+
+  // Reallocates the data store, the vertex array keeps referring to the buffer.
+  glNamedBufferData(m_bufBillboards, indices.size() * sizeof(uint32_t), indices.data(), GL_STATIC_DRAW);
+}
+
+void FluidRenderer::createFrameObjects()
+{
+  glCreateTextures(GL_TEXTURE_2D, 1, &m_texDepth);
+  glTextureStorage2D(m_texDepth, 1, GL_DEPTH_COMPONENT24, m_width, m_height);
+  glTextureParameteri(m_texDepth, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTextureParameteri(m_texDepth, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  m_texDepthHandle = glGetTextureHandleARB(m_texDepth);
+  glMakeTextureHandleResidentARB(m_texDepthHandle);
+
+  glCreateTextures(GL_TEXTURE_2D, 1, &m_texColor);
+  glTextureStorage2D(m_texColor, 1, GL_RGB32F, m_width, m_height);
+  glTextureParameteri(m_texColor, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTextureParameteri(m_texColor, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  m_texColorHandle = glGetTextureHandleARB(m_texColor);
+  glMakeTextureHandleResidentARB(m_texColorHandle);
+
+  glCreateTextures(GL_TEXTURE_2D, 1, &m_texTemp1);
+  glTextureStorage2D(m_texTemp1, 1, GL_R32F, m_width, m_height);
+  glTextureParameteri(m_texTemp1, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTextureParameteri(m_texTemp1, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  m_texTemp1Handle = glGetTextureHandleARB(m_texTemp1);
+  glMakeTextureHandleResidentARB(m_texTemp1Handle);
+
+  glCreateTextures(GL_TEXTURE_2D, 1, &m_texTemp2);
+  glTextureStorage2D(m_texTemp2, 1, GL_R32F, m_width, m_height);
+  glTextureParameteri(m_texTemp2, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTextureParameteri(m_texTemp2, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  m_texTemp2Handle = glGetTextureHandleARB(m_texTemp2);
+  glMakeTextureHandleResidentARB(m_texTemp2Handle);
+
+  glCreateFramebuffers(1, &m_fbo1);
+  glNamedFramebufferTexture(m_fbo1, GL_DEPTH_ATTACHMENT, m_texDepth, 0);
+  glNamedFramebufferTexture(m_fbo1, GL_COLOR_ATTACHMENT0, m_texColor, 0);
+
+  glCreateFramebuffers(1, &m_fbo2);
+  glNamedFramebufferTexture(m_fbo2, GL_COLOR_ATTACHMENT0, m_texTemp1, 0);
+
+  glCreateFramebuffers(1, &m_fbo3);
+  glNamedFramebufferTexture(m_fbo3, GL_COLOR_ATTACHMENT0, m_texTemp2, 0);
+}
+
+void FluidRenderer::deleteFrameObjects()
+{
+  glDeleteFramebuffers(1, &m_fbo1);
+  glDeleteFramebuffers(1, &m_fbo2);
+  glDeleteFramebuffers(1, &m_fbo3);
+
+  glMakeTextureHandleNonResidentARB(m_texDepthHandle);
+  glDeleteTextures(1, &m_texDepth);
+
+  glMakeTextureHandleNonResidentARB(m_texColorHandle);
+  glDeleteTextures(1, &m_texColor);
+
+  glMakeTextureHandleNonResidentARB(m_texTemp1Handle);
+  glDeleteTextures(1, &m_texTemp1);
+
+  glMakeTextureHandleNonResidentARB(m_texTemp2Handle);
+  glDeleteTextures(1, &m_texTemp2);
+}
+
+
+void FluidRenderer::resize(uint32_t width, uint32_t height)
+{
+  m_width = width;
+  m_height = height;
+  deleteFrameObjects();
+  createFrameObjects();
+}
+
+void FluidRenderer::renderGeometry(const ParticleBuffers& particleBuffers, const glm::mat4& view, const glm::mat4& projection,
+                                   float pointRadius, int32_t colorMode)
+{
+  const glm::mat4 vp = projection * view;
+
+  glBindFramebuffer(GL_FRAMEBUFFER, m_fbo1);
+  glViewport(0, 0, m_width, m_height);
+  glUseProgram(m_programRenderGeometry);
+  glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, particleBuffers.positions);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, particleBuffers.velocities);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, particleBuffers.densities);
+  glProgramUniformMatrix4fv(m_programRenderGeometry, 0, 1, GL_FALSE, glm::value_ptr(vp));
+  glProgramUniformMatrix4fv(m_programRenderGeometry, 1, 1, GL_FALSE, glm::value_ptr(view));
+  glProgramUniformMatrix4fv(m_programRenderGeometry, 2, 1, GL_FALSE, glm::value_ptr(projection));
+  glProgramUniform3fv(m_programRenderGeometry, 3, 1, glm::value_ptr(m_grid.size));
+  glProgramUniform3fv(m_programRenderGeometry, 4, 1, glm::value_ptr(m_grid.origin));
+  glProgramUniform3iv(m_programRenderGeometry, 5, 1, glm::value_ptr(m_grid.res));
+  glProgramUniform1ui(m_programRenderGeometry, 6, m_particleCount);
+  glProgramUniform1f(m_programRenderGeometry, 7, pointRadius);
+  glProgramUniform1i(m_programRenderGeometry, 8, colorMode);
+  glBindVertexArray(m_vao1);
+  const uint32_t index_count = 6 * m_particleCount;
+  glDrawElements(GL_TRIANGLES, index_count, GL_UNSIGNED_INT, nullptr);
+}
+
+void FluidRenderer::renderCurvatureFlow(const glm::mat4& view, const glm::mat4& projection)
+{
+  const glm::mat4 vp = projection * view;
+
+  const uint32_t bboxTriVertexCount = 36;
+  glDisable(GL_DEPTH_TEST);
+  glBindVertexArray(m_vao3);
+  glUseProgram(m_programRenderCurvature);
+  glProgramUniformMatrix4fv(m_programRenderCurvature, 0, 1, GL_FALSE, glm::value_ptr(vp));
+  glProgramUniformMatrix4fv(m_programRenderCurvature, 2, 1, GL_FALSE, glm::value_ptr(projection));
+  glProgramUniform2i(m_programRenderCurvature, 3, m_width, m_height);
+
+  GLuint64 inputDepthTexHandle = m_texDepthHandle;
+  bool swap = false;
+  for (uint32_t i = 0; i < SMOOTH_ITERATIONS; ++i)
+  {
+    glBindFramebuffer(GL_FRAMEBUFFER, swap ? m_fbo3 : m_fbo2);
+    glClear(GL_COLOR_BUFFER_BIT);
+    glProgramUniformHandleui64ARB(m_programRenderCurvature, 1, inputDepthTexHandle);
+    glDrawElements(GL_TRIANGLES, bboxTriVertexCount, GL_UNSIGNED_INT, nullptr);
+    inputDepthTexHandle = swap ? m_texTemp2Handle : m_texTemp1Handle;
+    swap = !swap;
+  }
+  glEnable(GL_DEPTH_TEST);
+
+  m_smoothedDepthHandle = inputDepthTexHandle;
+}
+
+void FluidRenderer::renderShading(const glm::mat4& view, const glm::mat4& projection, const glm::mat4& invProjection)
+{
+  const glm::mat4 vp = projection * view;
+
+  const uint32_t bboxTriVertexCount = 36;
+  glDisable(GL_DEPTH_TEST);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glViewport(0, 0, m_width, m_height);
+  glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+  glBindVertexArray(m_vao3);
+  glUseProgram(m_programRenderShading);
+  glProgramUniformMatrix4fv(m_programRenderShading, 0, 1, GL_FALSE, glm::value_ptr(vp));
+  glProgramUniformHandleui64ARB(m_programRenderShading, 1, m_smoothedDepthHandle);
+  glProgramUniformHandleui64ARB(m_programRenderShading, 2, m_texColorHandle);
+  glProgramUniform1ui(m_programRenderShading, 3, m_width);
+  glProgramUniform1ui(m_programRenderShading, 4, m_height);
+  glProgramUniformMatrix4fv(m_programRenderShading, 5, 1, GL_FALSE, glm::value_ptr(invProjection));
+  glProgramUniformMatrix4fv(m_programRenderShading, 6, 1, GL_FALSE, glm::value_ptr(view));
+  glDrawElements(GL_TRIANGLES, bboxTriVertexCount, GL_UNSIGNED_INT, nullptr);
+  glEnable(GL_DEPTH_TEST);
+}
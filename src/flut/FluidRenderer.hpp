@@ -0,0 +1,73 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <glad/glad.h>
+#include <stdint.h>
+
+#include "SimulationBackend.hpp"
+
+namespace flut
+{
+  // Screen-space fluid rendering: particle billboards, curvature flow smoothing of
+  // the depth buffer and shading of the smoothed surface.
+  class FluidRenderer
+  {
+  public:
+    constexpr static uint32_t SMOOTH_ITERATIONS = 50;
+
+  public:
+    FluidRenderer(uint32_t width, uint32_t height, uint32_t particleCount, const SimulationGrid& grid,
+                  float nearPlane, float farPlane);
+
+    ~FluidRenderer();
+
+  public:
+    void resize(uint32_t width, uint32_t height);
+
+    // Moves the bounding box, which bounds the curvature flow and shading passes, to the grid.
+    void setGrid(const SimulationGrid& grid);
+
+    void setParticleCount(uint32_t particleCount);
+
+    // Step 7: Render the geometry as screen-space spheres.
+    void renderGeometry(const ParticleBuffers& particleBuffers, const glm::mat4& view, const glm::mat4& projection,
+                        float pointRadius, int32_t colorMode);
+
+    // Step 7.1: Perform curvature flow (multiple iterations).
+    void renderCurvatureFlow(const glm::mat4& view, const glm::mat4& projection);
+
+    // Step 7.2: Do blinn-phong shading into the default framebuffer.
+    void renderShading(const glm::mat4& view, const glm::mat4& projection, const glm::mat4& invProjection);
+
+  private:
+    void createFrameObjects();
+
+    void deleteFrameObjects();
+
+  private:
+    uint32_t m_width;
+    uint32_t m_height;
+    uint32_t m_particleCount;
+    SimulationGrid m_grid;
+    GLuint m_programRenderGeometry;
+    GLuint m_programRenderCurvature;
+    GLuint m_programRenderShading;
+    GLuint m_bufBBoxVertices;
+    GLuint m_bufBBoxIndices;
+    GLuint m_bufBillboards;
+    GLuint m_vao1;
+    GLuint m_vao3;
+    GLuint m_fbo1;
+    GLuint m_fbo2;
+    GLuint m_fbo3;
+    GLuint m_texDepth;
+    GLuint64 m_texDepthHandle;
+    GLuint m_texColor;
+    GLuint64 m_texColorHandle;
+    GLuint m_texTemp1;
+    GLuint64 m_texTemp1Handle;
+    GLuint m_texTemp2;
+    GLuint64 m_texTemp2Handle;
+    GLuint64 m_smoothedDepthHandle;
+  };
+}
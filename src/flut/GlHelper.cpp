@@ -2,6 +2,7 @@
 
 #include <sstream>
 #include <fstream>
+#include <cstring>
 
 using namespace flut;
 
@@ -56,6 +57,38 @@ std::string GlHelper::loadFileText(const std::string& filePath)
   return text;
 }
 
+std::string GlHelper::resolveIncludes(const std::string& text, const std::string& dir)
+{
+  const std::string_view directive = "#include \"";
+
+  std::stringstream ss;
+  std::istringstream lines(text);
+  std::string line;
+
+  while (std::getline(lines, line))
+  {
+    const size_t start = line.find_first_not_of(" \t");
+    if (start == std::string::npos || line.compare(start, directive.size(), directive) != 0)
+    {
+      ss << line << "\n";
+      continue;
+    }
+
+    const size_t nameBegin = start + directive.size();
+    const size_t nameEnd = line.find('"', nameBegin);
+    if (nameEnd == std::string::npos)
+    {
+      fprintf(stderr, "Malformed include directive: %s\n", line.c_str());
+      abort();
+    }
+
+    const std::string path = dir + "/" + line.substr(nameBegin, nameEnd - nameBegin);
+    ss << resolveIncludes(loadFileText(path), dir);
+  }
+
+  return ss.str();
+}
+
 std::string GlHelper::preprocessShaderSource(const std::string& text, std::vector<GlHelper::ShaderDefine> defines)
 {
   std::stringstream ss;
@@ -169,7 +202,10 @@ GLuint GlHelper::createComputeShader(const char* path, std::vector<ShaderDefine>
     throw std::runtime_error("Unable to create shader program.");
   }
 
-  std::string source = loadFileText(path);
+  const std::string_view pathView = path;
+  const std::string dir{pathView.substr(0, pathView.find_last_of("/\\"))};
+
+  std::string source = resolveIncludes(loadFileText(path), dir);
   source = preprocessShaderSource(source, defines);
 
   const GLuint sourceHandle = glCreateShader(GL_COMPUTE_SHADER);
@@ -52,6 +52,9 @@ namespace flut
   private:
     static std::string loadFileText(const std::string& filePath);
 
+    // Replaces lines of the form #include "file" by the file's text, resolved relative to dir.
+    static std::string resolveIncludes(const std::string& text, const std::string& dir);
+
     static std::string preprocessShaderSource(const std::string& text, std::vector<ShaderDefine> defines);
 
     static void glDebugOutput(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length,
@@ -0,0 +1,206 @@
+#include "GlParticleReadback.hpp"
+
+using namespace flut;
+
+GlParticleReadback::GlParticleReadback(uint32_t slotCount, bool keepFinished)
+  : m_slots(slotCount)
+  , m_keepFinished(keepFinished)
+{
+}
+
+GlParticleReadback::~GlParticleReadback()
+{
+  for (Slot& slot : m_slots)
+  {
+    glDeleteSync(slot.fence);
+    if (slot.mapping)
+    {
+      glUnmapNamedBuffer(slot.buffer);
+    }
+    glDeleteBuffers(1, &slot.buffer);
+  }
+}
+
+bool GlParticleReadback::request(const ParticleBuffers& buffers, uint32_t particleCount, uint64_t frame, uint64_t step, double time)
+{
+  // A free slot, or else the oldest finished one that nobody acquired, since a newer state replaces it.
+  Slot* target = nullptr;
+  for (Slot& slot : m_slots)
+  {
+    if (slot.state == SlotState::Free)
+    {
+      target = &slot;
+      break;
+    }
+    if (!m_keepFinished && slot.state == SlotState::Ready && (!target || slot.sequence < target->sequence))
+    {
+      target = &slot;
+    }
+  }
+
+  if (!target)
+  {
+    m_stats.dropped++;
+    return false;
+  }
+
+  if (!m_started)
+  {
+    m_started = true;
+    m_startTime = Clock::now();
+  }
+
+  const size_t vec4Size = size_t(particleCount) * sizeof(glm::vec4);
+  const size_t vec2Size = size_t(particleCount) * sizeof(glm::vec2);
+  const size_t size = 2 * vec4Size + vec2Size;
+
+  // The storage is immutable, so a larger particle count needs a new buffer.
+  if (target->capacity < size)
+  {
+    if (target->mapping)
+    {
+      glUnmapNamedBuffer(target->buffer);
+    }
+    glDeleteBuffers(1, &target->buffer);
+
+    glCreateBuffers(1, &target->buffer);
+    glNamedBufferStorage(target->buffer, size, nullptr, GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_CLIENT_STORAGE_BIT);
+    target->mapping = glMapNamedBufferRange(target->buffer, 0, size, GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT);
+    target->capacity = size;
+  }
+
+  // The streams were written by shaders, and the mapping is not coherent.
+  glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+  glCopyNamedBufferSubData(buffers.positions, target->buffer, 0, 0, vec4Size);
+  glCopyNamedBufferSubData(buffers.velocities, target->buffer, 0, vec4Size, vec4Size);
+  glCopyNamedBufferSubData(buffers.densities, target->buffer, 0, 2 * vec4Size, vec2Size);
+  glMemoryBarrier(GL_CLIENT_MAPPED_BUFFER_BARRIER_BIT);
+  target->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+  target->state = SlotState::Pending;
+  target->frame = frame;
+  target->step = step;
+  target->time = time;
+  target->particleCount = particleCount;
+  target->sequence = m_sequence++;
+  return true;
+}
+
+void GlParticleReadback::update(uint64_t frame)
+{
+  for (Slot& slot : m_slots)
+  {
+    if (slot.state != SlotState::Pending)
+    {
+      continue;
+    }
+
+    const GLenum status = glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+    if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+    {
+      continue;
+    }
+    glDeleteSync(slot.fence);
+    slot.fence = nullptr;
+    slot.state = SlotState::Ready;
+
+    m_stats.completed++;
+    m_stats.latencyFrames = uint32_t(frame - slot.frame);
+    m_latencySum += m_stats.latencyFrames;
+    m_stats.meanLatencyFrames = double(m_latencySum) / m_stats.completed;
+    m_completedBytes += size_t(slot.particleCount) * (2 * sizeof(glm::vec4) + sizeof(glm::vec2));
+  }
+
+  if (m_started)
+  {
+    const std::chrono::duration<double> elapsed = Clock::now() - m_startTime;
+    m_stats.bytesPerSecond = elapsed.count() > 0.0 ? m_completedBytes / elapsed.count() : 0.0;
+  }
+}
+
+bool GlParticleReadback::acquire(View& view)
+{
+  Slot* latest = nullptr;
+  for (Slot& slot : m_slots)
+  {
+    if (slot.state == SlotState::Ready && (!latest || slot.sequence > latest->sequence))
+    {
+      latest = &slot;
+    }
+  }
+
+  if (!latest)
+  {
+    return false;
+  }
+
+  // All older finished readbacks are superseded.
+  for (Slot& slot : m_slots)
+  {
+    if (slot.state == SlotState::Ready && slot.sequence < latest->sequence)
+    {
+      slot.state = SlotState::Free;
+    }
+  }
+  hold(*latest, view);
+  return true;
+}
+
+bool GlParticleReadback::acquireNext(View& view)
+{
+  Slot* oldest = nullptr;
+  for (Slot& slot : m_slots)
+  {
+    if (slot.state == SlotState::Ready && (!oldest || slot.sequence < oldest->sequence))
+    {
+      oldest = &slot;
+    }
+  }
+
+  if (!oldest)
+  {
+    return false;
+  }
+  hold(*oldest, view);
+  return true;
+}
+
+void GlParticleReadback::release()
+{
+  for (Slot& slot : m_slots)
+  {
+    if (slot.state == SlotState::Held)
+    {
+      slot.state = SlotState::Free;
+    }
+  }
+}
+
+void GlParticleReadback::hold(Slot& slot, View& view)
+{
+  release();
+  slot.state = SlotState::Held;
+
+  const uint32_t count = slot.particleCount;
+  const auto* bytes = static_cast<const uint8_t*>(slot.mapping);
+  view.frame = slot.frame;
+  view.step = slot.step;
+  view.time = slot.time;
+  view.particleCount = count;
+  view.positions = reinterpret_cast<const glm::vec4*>(bytes);
+  view.velocities = reinterpret_cast<const glm::vec4*>(bytes + size_t(count) * sizeof(glm::vec4));
+  view.densities = reinterpret_cast<const glm::vec2*>(bytes + 2 * size_t(count) * sizeof(glm::vec4));
+}
+
+const GlParticleReadback::Stats& GlParticleReadback::stats() const
+{
+  return m_stats;
+}
+
+void GlParticleReadback::reserve(uint32_t slotCount)
+{
+  if (slotCount > m_slots.size())
+  {
+    m_slots.resize(slotCount);
+  }
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <stddef.h>
+#include <stdint.h>
+#include <chrono>
+#include <vector>
+
+#include "SimulationBackend.hpp"
+
+namespace flut
+{
+  // Copies the particle streams into a ring of persistently mapped staging buffers, each guarded by
+  // a fence, so that the CPU can read the state of a recent frame without stalling the GPU.
+  class GlParticleReadback
+  {
+  public:
+    // Staging buffers unless the constructor is given another count.
+    constexpr static uint32_t SLOT_COUNT = 4;
+
+    // Zero-copy view of a finished readback, valid until release() or the next acquire().
+    struct View
+    {
+      uint64_t frame = 0;
+      // Integration and simulated time of the copied state, as passed to request().
+      uint64_t step = 0;
+      double time = 0.0;
+      uint32_t particleCount = 0;
+      const glm::vec4* positions = nullptr;
+      const glm::vec4* velocities = nullptr;
+      // Density and pressure.
+      const glm::vec2* densities = nullptr;
+    };
+
+    struct Stats
+    {
+      uint64_t completed = 0;
+      // Requests for which all slots were in flight or held.
+      uint64_t dropped = 0;
+      // Frames from the request until the copy was seen finished, of the latest and over all readbacks.
+      uint32_t latencyFrames = 0;
+      double meanLatencyFrames = 0.0;
+      // Bytes of the finished readbacks per second since the first request.
+      double bytesPerSecond = 0.0;
+    };
+
+  public:
+    // With keepFinished, a request never replaces a finished readback which was not acquired yet,
+    // for consumers which need every copy.
+    explicit GlParticleReadback(uint32_t slotCount = SLOT_COUNT, bool keepFinished = false);
+
+    ~GlParticleReadback();
+
+  public:
+    // Copies the buffers into a free slot after the commands issued so far. Returns false and drops
+    // the request if no slot is free.
+    bool request(const ParticleBuffers& buffers, uint32_t particleCount, uint64_t frame, uint64_t step = 0, double time = 0.0);
+
+    // Checks the fences of the pending copies without waiting. Called once per frame.
+    void update(uint64_t frame);
+
+    // Holds the most recent finished readback, which no later request overwrites until it is
+    // released. Returns false if no readback finished since the last acquire().
+    bool acquire(View& view);
+
+    // Like acquire(), but holds the oldest finished readback, for consumers which need every copy.
+    bool acquireNext(View& view);
+
+    void release();
+
+    const Stats& stats() const;
+
+    // Adds free slots up to the count. The buffers of a slot are allocated by its first request.
+    void reserve(uint32_t slotCount);
+
+  private:
+    enum class SlotState
+    {
+      Free,
+      Pending,
+      Ready,
+      Held
+    };
+
+    struct Slot
+    {
+      SlotState state = SlotState::Free;
+      GLuint buffer = 0;
+      void* mapping = nullptr;
+      size_t capacity = 0;
+      GLsync fence = nullptr;
+      uint64_t frame = 0;
+      uint64_t step = 0;
+      double time = 0.0;
+      uint32_t particleCount = 0;
+      // Orders requests of the same frame.
+      uint64_t sequence = 0;
+    };
+
+    using Clock = std::chrono::steady_clock;
+
+  private:
+    // Holds the slot, which must be finished, and releases the previously held one.
+    void hold(Slot& slot, View& view);
+
+  private:
+    std::vector<Slot> m_slots;
+    bool m_keepFinished;
+    Stats m_stats;
+    uint64_t m_sequence = 0;
+    uint64_t m_completedBytes = 0;
+    uint64_t m_latencySum = 0;
+    bool m_started = false;
+    Clock::time_point m_startTime;
+  };
+}
@@ -66,7 +66,7 @@ void GlQueryRetriever::endQuery()
   glEndQuery(GL_TIME_ELAPSED);
 }
 
-void GlQueryRetriever::readFinishedQueries(QueryTimings& timings)
+bool GlQueryRetriever::readFinishedQueries(QueryTimings& timings)
 {
   // If the last query in the frame is available, this means that all previous
   // queries are available.
@@ -74,7 +74,7 @@ void GlQueryRetriever::readFinishedQueries(QueryTimings& timings)
   glGetQueryObjectui64v(m_renderQueries[m_tail], GL_QUERY_RESULT_AVAILABLE, &state);
   if (state == GL_FALSE)
   {
-    return;
+    return false;
   }
 
   glGetQueryObjectui64v(m_renderQueries[m_tail], GL_QUERY_RESULT_NO_WAIT, &state);
@@ -102,4 +102,5 @@ void GlQueryRetriever::readFinishedQueries(QueryTimings& timings)
   }
 
   m_tail = (m_tail + 1) % MAX_FRAME_DELAY;
+  return true;
 }
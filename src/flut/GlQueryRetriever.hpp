@@ -31,7 +31,8 @@ namespace flut
     void beginRenderQuery();
     void endQuery();
 
-    void readFinishedQueries(QueryTimings& timings);
+    // Returns false if the oldest pending frame has not finished yet.
+    bool readFinishedQueries(QueryTimings& timings);
 
   private:
     uint32_t m_head = 1;
@@ -0,0 +1,108 @@
+#include "GlShaderCompiler.hpp"
+
+#include <assert.h>
+
+using namespace flut;
+
+GlShaderCompiler::GlShaderCompiler(ContextFunc workerContext)
+  : m_workerContext(std::move(workerContext))
+{
+  if (m_workerContext)
+  {
+    m_worker = std::thread(&GlShaderCompiler::workerMain, this);
+  }
+}
+
+GlShaderCompiler::~GlShaderCompiler()
+{
+  if (m_worker.joinable())
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_shutdown = true;
+    }
+    m_jobCond.notify_one();
+    m_worker.join();
+  }
+
+  if (m_fence)
+  {
+    glDeleteSync(m_fence);
+  }
+}
+
+void GlShaderCompiler::submit(Job job)
+{
+  assert(!m_busy);
+  m_busy = true;
+
+  if (!m_worker.joinable())
+  {
+    job();
+    m_finished.store(true, std::memory_order_release);
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_job = std::move(job);
+  }
+  m_jobCond.notify_one();
+}
+
+bool GlShaderCompiler::busy() const
+{
+  return m_busy;
+}
+
+bool GlShaderCompiler::poll()
+{
+  if (!m_busy || !m_finished.load(std::memory_order_acquire))
+  {
+    return false;
+  }
+
+  if (m_fence)
+  {
+    if (glClientWaitSync(m_fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+    {
+      return false;
+    }
+    glDeleteSync(m_fence);
+    m_fence = nullptr;
+  }
+
+  m_finished.store(false, std::memory_order_relaxed);
+  m_busy = false;
+  return true;
+}
+
+void GlShaderCompiler::workerMain()
+{
+  m_workerContext(true);
+
+  while (true)
+  {
+    Job job;
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_jobCond.wait(lock, [this] { return m_shutdown || m_job; });
+
+      if (m_shutdown)
+      {
+        break;
+      }
+      job = std::move(m_job);
+      m_job = nullptr;
+    }
+
+    job();
+
+    // The main context may only use the new objects once the worker's commands have completed.
+    m_fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush();
+    m_finished.store(true, std::memory_order_release);
+  }
+
+  m_workerContext(false);
+}
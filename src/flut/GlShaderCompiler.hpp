@@ -0,0 +1,51 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace flut
+{
+  // Runs shader compilation jobs on a worker thread with its own GL context, which shares objects
+  // with the main context. Without a worker context, jobs run synchronously on the calling thread.
+  class GlShaderCompiler
+  {
+  public:
+    // Makes the worker context current on the calling thread, or releases it if the argument is false.
+    using ContextFunc = std::function<void(bool)>;
+
+    using Job = std::function<void()>;
+
+  public:
+    explicit GlShaderCompiler(ContextFunc workerContext);
+
+    ~GlShaderCompiler();
+
+  public:
+    // Starts a job. At most one job may be in flight.
+    void submit(Job job);
+
+    bool busy() const;
+
+    // Called on the main thread. Returns true once, after the job has finished and the GL commands
+    // it issued have completed, so that the objects it created can be used.
+    bool poll();
+
+  private:
+    void workerMain();
+
+  private:
+    ContextFunc m_workerContext;
+    std::thread m_worker;
+    std::mutex m_mutex;
+    std::condition_variable m_jobCond;
+    Job m_job;
+    bool m_shutdown = false;
+    bool m_busy = false;
+    std::atomic<bool> m_finished{false};
+    GLsync m_fence = nullptr;
+  };
+}
@@ -0,0 +1,1126 @@
+#include "GlSimulationBackend.hpp"
+#include "CellOrdering.hpp"
+#include "GlHelper.hpp"
+#include "SpatialHash.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace flut;
+
+constexpr static uint32_t SCAN_BLOCK_SIZE = 512;
+// Cells per axis owned by a workgroup of the cell-tiled kernels, see cellTile.glsl.
+constexpr static int32_t TILE_BRICK_SIZE = 4;
+
+static uint32_t scanBlockCount(const SimulationGrid& grid)
+{
+  return (grid.voxelCount() + SCAN_BLOCK_SIZE - 1) / SCAN_BLOCK_SIZE;
+}
+
+// Layout of timeStepBuf, see simTimeStep.comp.
+struct GpuTimeStep
+{
+  float dt;
+  float remainingTime;
+  uint32_t maxSpeed;
+  uint32_t maxAcceleration;
+  uint32_t frameSteps;
+  float frameMinDt;
+  float frameMaxDt;
+  float frameDtSum;
+  float frameMinCflDt;
+  float frameDroppedTime;
+  float droppedTime;
+};
+
+// Sound speed of the equation of state p = k (rho - rho0).
+static float soundSpeed(const SimulationParams& params)
+{
+  return std::sqrt(params.stiffness);
+}
+
+GlSimulationBackend::GlSimulationBackend(const std::vector<Particle>& particles, const SimulationGrid& grid, const SimulationParams& params,
+                                         GlQueryRetriever* queries, GlKernelMode kernelMode, const SleepConfig& sleep,
+                                         const TimeStepConfig& timeStep, GlShaderCompiler::ContextFunc workerContext)
+  : m_queries(queries)
+  , m_kernelMode(kernelMode)
+  , m_sleepConfig(sleep)
+  , m_sleeping(sleep.velocityThreshold > 0.0f && kernelMode == GlKernelMode::PerParticle)
+  , m_grid(grid)
+  , m_params(params)
+  , m_particleCount(0)
+  , m_compiler(std::make_unique<GlShaderCompiler>(std::move(workerContext)))
+  , m_hasPendingConfig{false}
+  , m_hasQueuedConfig{false}
+  , m_bufPositions{0, 0}
+  , m_bufVelocities{0, 0}
+  , m_bufDensities{0}
+  , m_hashTableSize{0}
+  , m_bufHashKeys{0}
+  , m_bufHashCounts{0}
+  , m_bufHashCells{0}
+  , m_bufHashVelocities{0}
+  , m_bufFilteredVelocities{0}
+  , m_texActiveCells{0}
+  , m_texActiveCellsImgHandle{0}
+  , m_bufActiveSlots{0}
+  , m_bufActiveDispatch{0}
+  , m_bufActiveParticles{0}
+  , m_wakeAll{false}
+  , m_timeStepConfig(timeStep)
+  , m_bufTimeStep{0}
+  , m_bufTimeStepFrames{}
+  , m_timeStepFences{}
+  , m_timeStepHead{0}
+  , m_timeStepTail{0}
+  , m_hasTimeStepStats{false}
+  , m_swapFrame{false}
+{
+  if (!m_sleeping)
+  {
+    m_sleepConfig.velocityThreshold = 0.0f;
+  }
+  m_timeStepConfig.maxSteps = std::clamp(m_timeStepConfig.maxSteps, 1u, GlQueryRetriever::MAX_SIM_ITERS_PER_FRAME);
+
+  m_programs = createPrograms(m_grid, m_params, m_kernelMode, m_sleepConfig, m_timeStepConfig);
+
+  glCreateBuffers(1, &m_bufCounters);
+  glNamedBufferStorage(m_bufCounters, 4, nullptr, GL_DYNAMIC_STORAGE_BIT);
+
+  if (m_sleeping)
+  {
+    glCreateBuffers(1, &m_bufActiveDispatch);
+    glNamedBufferStorage(m_bufActiveDispatch, 4 * sizeof(uint32_t), nullptr, GL_DYNAMIC_STORAGE_BIT);
+  }
+
+  if (m_timeStepConfig.cfl > 0.0f)
+  {
+    const GpuTimeStep timeStepState{};
+    glCreateBuffers(1, &m_bufTimeStep);
+    glNamedBufferStorage(m_bufTimeStep, sizeof(GpuTimeStep), &timeStepState, 0);
+    glCreateBuffers(TIME_STEP_FRAME_DELAY, m_bufTimeStepFrames);
+    for (GLuint buffer : m_bufTimeStepFrames)
+    {
+      glNamedBufferStorage(buffer, sizeof(GpuTimeStep), nullptr, GL_CLIENT_STORAGE_BIT);
+    }
+  }
+
+  createGridResources();
+
+  // Particles
+  setParticles(particles);
+}
+
+GlSimulationBackend::~GlSimulationBackend()
+{
+  // Waits for a compilation in flight.
+  m_compiler.reset();
+  if (m_hasPendingConfig)
+  {
+    deletePrograms(m_pendingPrograms);
+  }
+
+  deletePrograms(m_programs);
+  deleteGridResources();
+  glDeleteBuffers(2, m_bufPositions);
+  glDeleteBuffers(2, m_bufVelocities);
+  glDeleteBuffers(1, &m_bufDensities);
+  glDeleteBuffers(1, &m_bufActiveParticles);
+  glDeleteBuffers(1, &m_bufActiveDispatch);
+  for (GLsync fence : m_timeStepFences)
+  {
+    glDeleteSync(fence);
+  }
+  glDeleteBuffers(TIME_STEP_FRAME_DELAY, m_bufTimeStepFrames);
+  glDeleteBuffers(1, &m_bufTimeStep);
+  glDeleteBuffers(1, &m_bufCounters);
+}
+
+GlSimulationBackend::Programs GlSimulationBackend::createPrograms(const SimulationGrid& grid, const SimulationParams& params,
+                                                                  GlKernelMode kernelMode, const SleepConfig& sleep,
+                                                                  const TimeStepConfig& timeStep)
+{
+  const auto& GRID_SIZE = grid.size;
+  const auto& GRID_ORIGIN = grid.origin;
+  const auto& GRID_RES = grid.res;
+  const float KERNEL_RADIUS = params.kernelRadius;
+
+  glm::vec3 invCellSize = grid.invCellSize();
+
+  float viscosityKernelWeightConst = static_cast<float>(45.0f / (M_PI * std::pow(KERNEL_RADIUS, 6)));
+  float spikyKernelWeightConst = static_cast<float>(15.0f / (M_PI * std::pow(KERNEL_RADIUS, 6)));
+  float poly6KernelWeightConst = static_cast<float>(315.0f / (64.0f * M_PI * std::pow(KERNEL_RADIUS, 9)));
+
+  const bool hashed = grid.mode == GridMode::Hashed;
+  const bool sleeping = sleep.velocityThreshold > 0.0f;
+  const bool adaptive = timeStep.cfl > 0.0f;
+
+  // The steps which look up cells either use the grid textures or the hash table.
+  auto cellDefines = [hashed](std::vector<GlHelper::ShaderDefine> defines) {
+    if (hashed)
+    {
+      defines.push_back({ "HASHED_GRID", 1u });
+    }
+    return defines;
+  };
+
+  // With sleeping particles, the density and force steps run over the list of awake particles.
+  auto neighborDefines = [&](std::vector<GlHelper::ShaderDefine> defines) {
+    if (sleeping)
+    {
+      defines.push_back({ "SLEEPING", 1u });
+      defines.push_back({ "SLEEP_VELOCITY", sleep.velocityThreshold });
+      defines.push_back({ "SLEEP_DENSITY_CHANGE", sleep.densityThreshold });
+      defines.push_back({ "CALM_STEPS", sleep.calmSteps });
+    }
+    return cellDefines(std::move(defines));
+  };
+
+  Programs programs;
+
+  programs.simStep1 = GlHelper::createComputeShader(SHADERS_DIR "/simStep1.comp", cellDefines({
+    { "INV_CELL_SIZE",  invCellSize },
+    { "GRID_ORIGIN",    GRID_ORIGIN },
+    { "GRID_SIZE",      GRID_SIZE },
+    { "GRID_RES",       GRID_RES }
+  }));
+
+  if (hashed)
+  {
+    programs.simStep2Hashed = GlHelper::createComputeShader(SHADERS_DIR "/simStep2Hashed.comp");
+  }
+  else
+  {
+    programs.simStep2 = GlHelper::createComputeShader(SHADERS_DIR "/simStep2.comp", {
+      { "GRID_RES",       GRID_RES }
+    });
+  }
+
+  if (!hashed && grid.cellOrder != CellOrder::Linear)
+  {
+    const uint32_t blockCount = scanBlockCount(grid);
+
+    for (uint32_t pass = 0; pass < 3; pass++)
+    {
+      programs.simStep2Ordered[pass] = GlHelper::createComputeShader(SHADERS_DIR "/simStep2Ordered.comp", {
+        { "GRID_RES",              GRID_RES },
+        { "VOXEL_COUNT",           grid.voxelCount() },
+        { "SCAN_BLOCK_SIZE",       SCAN_BLOCK_SIZE },
+        { "BLOCK_COUNT",           blockCount },
+        { "BLOCKS_PER_INVOCATION", (blockCount + SCAN_BLOCK_SIZE - 1) / SCAN_BLOCK_SIZE },
+        { "SCAN_PASS",             pass }
+      });
+    }
+  }
+
+  programs.simStep3 = GlHelper::createComputeShader(SHADERS_DIR "/simStep3.comp", cellDefines({
+    { "INV_CELL_SIZE",  invCellSize },
+    { "GRID_ORIGIN",    GRID_ORIGIN },
+    { "GRID_SIZE",      GRID_SIZE },
+    { "GRID_RES",       GRID_RES }
+  }));
+
+  if (hashed)
+  {
+    for (uint32_t pass = 0; pass < 2; pass++)
+    {
+      programs.simStep4Hashed[pass] = GlHelper::createComputeShader(SHADERS_DIR "/simStep4Hashed.comp", {
+        { "GRID_SIZE",      GRID_SIZE },
+        { "GRID_ORIGIN",    GRID_ORIGIN },
+        { "GRID_RES",       GRID_RES },
+        { "VELOCITY_PASS",  pass }
+      });
+    }
+  }
+  else
+  {
+    programs.simStep4 = GlHelper::createComputeShader(SHADERS_DIR "/simStep4.comp", {
+      { "GRID_RES",       GRID_RES }
+    });
+  }
+
+  const bool tiled = kernelMode == GlKernelMode::CellTiled;
+
+  programs.simStep5 = GlHelper::createComputeShader(tiled ? SHADERS_DIR "/simStep5Tiled.comp" : SHADERS_DIR "/simStep5.comp", neighborDefines({
+    { "INV_CELL_SIZE",               invCellSize },
+    { "GRID_ORIGIN",                 GRID_ORIGIN },
+    { "GRID_RES",                    GRID_RES },
+    { "MASS",                        params.mass },
+    { "KERNEL_RADIUS",               KERNEL_RADIUS },
+    { "POLY6_KERNEL_WEIGHT_CONST",   poly6KernelWeightConst },
+    { "STIFFNESS_K",                 params.stiffness },
+    { "REST_DENSITY",                params.restDensity },
+    { "REST_PRESSURE",               params.restPressure }
+  }));
+
+  std::vector<GlHelper::ShaderDefine> step6Defines = {
+    { "INV_CELL_SIZE",               invCellSize },
+    { "GRID_SIZE",                   GRID_SIZE },
+    { "GRID_ORIGIN",                 GRID_ORIGIN },
+    { "GRID_RES",                    GRID_RES },
+    { "MASS",                        params.mass },
+    { "KERNEL_RADIUS",               KERNEL_RADIUS },
+    { "VIS_COEFF",                   params.viscosity },
+    { "VIS_KERNEL_WEIGHT_CONST",     viscosityKernelWeightConst },
+    { "SPIKY_KERNEL_WEIGHT_CONST",   spikyKernelWeightConst }
+  };
+  if (adaptive)
+  {
+    step6Defines.push_back({ "ADAPTIVE_DT", 1u });
+  }
+  programs.simStep6 = GlHelper::createComputeShader(tiled ? SHADERS_DIR "/simStep6Tiled.comp" : SHADERS_DIR "/simStep6.comp",
+                                                    neighborDefines(std::move(step6Defines)));
+
+  if (sleeping)
+  {
+    for (uint32_t pass = 0; pass < 3; pass++)
+    {
+      programs.simSleep[pass] = GlHelper::createComputeShader(SHADERS_DIR "/simSleep.comp", cellDefines({
+        { "INV_CELL_SIZE",  invCellSize },
+        { "GRID_ORIGIN",    GRID_ORIGIN },
+        { "GRID_RES",       GRID_RES },
+        { "STIFFNESS_K",    params.stiffness },
+        { "REST_DENSITY",   params.restDensity },
+        { "REST_PRESSURE",  params.restPressure },
+        { "CALM_STEPS",     sleep.calmSteps },
+        { "SLEEP_PASS",     pass }
+      }));
+    }
+  }
+
+  if (adaptive)
+  {
+    programs.simTimeStep = GlHelper::createComputeShader(SHADERS_DIR "/simTimeStep.comp", {
+      { "CFL",            timeStep.cfl },
+      { "MIN_DT",         timeStep.minDt },
+      { "MAX_DT",         timeStep.maxDt },
+      { "KERNEL_RADIUS",  KERNEL_RADIUS },
+      { "SOUND_SPEED",    soundSpeed(params) }
+    });
+  }
+
+  return programs;
+}
+
+void GlSimulationBackend::deletePrograms(const Programs& programs)
+{
+  glDeleteProgram(programs.simStep1);
+  glDeleteProgram(programs.simStep2);
+  for (GLuint program : programs.simStep2Ordered)
+  {
+    glDeleteProgram(program);
+  }
+  glDeleteProgram(programs.simStep2Hashed);
+  for (GLuint program : programs.simStep4Hashed)
+  {
+    glDeleteProgram(program);
+  }
+  glDeleteProgram(programs.simStep3);
+  glDeleteProgram(programs.simStep4);
+  glDeleteProgram(programs.simStep5);
+  glDeleteProgram(programs.simStep6);
+  for (GLuint program : programs.simSleep)
+  {
+    glDeleteProgram(program);
+  }
+  glDeleteProgram(programs.simTimeStep);
+}
+
+void GlSimulationBackend::createGridResources()
+{
+  const auto& GRID_RES = m_grid.res;
+
+  m_bufOrderedVoxels = 0;
+  m_bufScanBlockSums = 0;
+  m_scanBlockCount = 0;
+
+  if (m_grid.mode == GridMode::Hashed)
+  {
+    createHashTable();
+    return;
+  }
+
+  // Uniform grid
+  glCreateTextures(GL_TEXTURE_3D, 1, &m_texGrid);
+  glTextureStorage3D(m_texGrid, 1, GL_R32UI, GRID_RES.x, GRID_RES.y, GRID_RES.z);
+  m_texGridImgHandle = glGetImageHandleARB(m_texGrid, 0, GL_FALSE, 0, GL_R32UI);
+  glMakeImageHandleResidentARB(m_texGridImgHandle, GL_READ_WRITE);
+
+  glCreateTextures(GL_TEXTURE_3D, 1, &m_texCells);
+  glTextureStorage3D(m_texCells, 1, GL_RG32UI, GRID_RES.x, GRID_RES.y, GRID_RES.z);
+  m_texCellsImgHandle = glGetImageHandleARB(m_texCells, 0, GL_FALSE, 0, GL_RG32UI);
+  glMakeImageHandleResidentARB(m_texCellsImgHandle, GL_READ_WRITE);
+
+  if (m_grid.cellOrder != CellOrder::Linear)
+  {
+    m_scanBlockCount = scanBlockCount(m_grid);
+
+    const std::vector<uint32_t> orderedVoxels = CellOrdering::orderedVoxels(m_grid);
+    glCreateBuffers(1, &m_bufOrderedVoxels);
+    glNamedBufferStorage(m_bufOrderedVoxels, orderedVoxels.size() * sizeof(uint32_t), orderedVoxels.data(), 0);
+
+    glCreateBuffers(1, &m_bufScanBlockSums);
+    glNamedBufferStorage(m_bufScanBlockSums, m_scanBlockCount * sizeof(uint32_t), nullptr, 0);
+  }
+
+  if (m_sleeping)
+  {
+    glCreateTextures(GL_TEXTURE_3D, 1, &m_texActiveCells);
+    glTextureStorage3D(m_texActiveCells, 1, GL_R8UI, GRID_RES.x, GRID_RES.y, GRID_RES.z);
+    m_texActiveCellsImgHandle = glGetImageHandleARB(m_texActiveCells, 0, GL_FALSE, 0, GL_R8UI);
+    glMakeImageHandleResidentARB(m_texActiveCellsImgHandle, GL_READ_WRITE);
+  }
+
+  // Velocity texture
+  glCreateTextures(GL_TEXTURE_3D, 1, &m_texVelocity);
+  glTextureParameteri(m_texVelocity, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTextureParameteri(m_texVelocity, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTextureStorage3D(m_texVelocity, 1, GL_RGBA32F, GRID_RES.x, GRID_RES.y, GRID_RES.z);
+  m_texVelocityHandle = glGetTextureHandleARB(m_texVelocity);
+  glMakeTextureHandleResidentARB(m_texVelocityHandle);
+  m_texVelocityImgHandle = glGetImageHandleARB(m_texVelocity, 0, GL_FALSE, 0, GL_RGBA32F);
+  glMakeImageHandleResidentARB(m_texVelocityImgHandle, GL_READ_WRITE);
+}
+
+void GlSimulationBackend::deleteGridResources()
+{
+  if (m_grid.mode == GridMode::Hashed)
+  {
+    deleteHashTable();
+    return;
+  }
+
+  glMakeImageHandleNonResidentARB(m_texGridImgHandle);
+  glDeleteTextures(1, &m_texGrid);
+  glMakeImageHandleNonResidentARB(m_texCellsImgHandle);
+  glDeleteTextures(1, &m_texCells);
+  glMakeImageHandleNonResidentARB(m_texVelocityImgHandle);
+  glMakeTextureHandleNonResidentARB(m_texVelocityHandle);
+  glDeleteTextures(1, &m_texVelocity);
+  glDeleteBuffers(1, &m_bufOrderedVoxels);
+  glDeleteBuffers(1, &m_bufScanBlockSums);
+
+  if (m_sleeping)
+  {
+    glMakeImageHandleNonResidentARB(m_texActiveCellsImgHandle);
+    glDeleteTextures(1, &m_texActiveCells);
+    m_texActiveCells = 0;
+    m_texActiveCellsImgHandle = 0;
+  }
+}
+
+void GlSimulationBackend::createHashTable()
+{
+  m_hashTableSize = SpatialHash::tableSize(m_particleCount, m_grid.voxelCount());
+
+  glCreateBuffers(1, &m_bufHashKeys);
+  glNamedBufferStorage(m_bufHashKeys, m_hashTableSize * sizeof(uint32_t), nullptr, 0);
+
+  glCreateBuffers(1, &m_bufHashCounts);
+  glNamedBufferStorage(m_bufHashCounts, m_hashTableSize * sizeof(uint32_t), nullptr, 0);
+
+  glCreateBuffers(1, &m_bufHashCells);
+  glNamedBufferStorage(m_bufHashCells, m_hashTableSize * sizeof(glm::uvec2), nullptr, 0);
+
+  glCreateBuffers(1, &m_bufHashVelocities);
+  glNamedBufferStorage(m_bufHashVelocities, m_hashTableSize * sizeof(glm::vec4), nullptr, 0);
+
+  glCreateBuffers(1, &m_bufFilteredVelocities);
+  glNamedBufferStorage(m_bufFilteredVelocities, std::max(m_particleCount, 1u) * sizeof(glm::vec4), nullptr, 0);
+
+  if (m_sleeping)
+  {
+    glCreateBuffers(1, &m_bufActiveSlots);
+    glNamedBufferStorage(m_bufActiveSlots, m_hashTableSize * sizeof(uint32_t), nullptr, 0);
+  }
+}
+
+void GlSimulationBackend::deleteHashTable()
+{
+  glDeleteBuffers(1, &m_bufHashKeys);
+  glDeleteBuffers(1, &m_bufHashCounts);
+  glDeleteBuffers(1, &m_bufHashCells);
+  glDeleteBuffers(1, &m_bufHashVelocities);
+  glDeleteBuffers(1, &m_bufFilteredVelocities);
+  glDeleteBuffers(1, &m_bufActiveSlots);
+  m_bufHashKeys = 0;
+  m_bufHashCounts = 0;
+  m_bufHashCells = 0;
+  m_bufHashVelocities = 0;
+  m_bufFilteredVelocities = 0;
+  m_bufActiveSlots = 0;
+  m_hashTableSize = 0;
+}
+
+void GlSimulationBackend::reconfigure(const SimulationGrid& grid, const SimulationParams& params)
+{
+  // Only one compilation runs at a time; later requests replace each other until it is done.
+  if (m_hasPendingConfig)
+  {
+    m_hasQueuedConfig = true;
+    m_queuedGrid = grid;
+    m_queuedParams = params;
+    return;
+  }
+
+  m_hasPendingConfig = true;
+  m_pendingGrid = grid;
+  m_pendingParams = params;
+
+  m_compiler->submit([this, grid, params]() {
+    m_pendingPrograms = createPrograms(grid, params, m_kernelMode, m_sleepConfig, m_timeStepConfig);
+  });
+}
+
+bool GlSimulationBackend::reconfiguring() const
+{
+  return m_hasPendingConfig;
+}
+
+void GlSimulationBackend::applyPendingConfig()
+{
+  if (!m_hasPendingConfig || !m_compiler->poll())
+  {
+    return;
+  }
+
+  // The particles keep their state. Steps 1 and 3 clamp them into the new domain and
+  // rebuild the grid, so only the grid-sized resources are replaced.
+  deletePrograms(m_programs);
+  m_programs = m_pendingPrograms;
+  m_pendingPrograms = Programs{};
+  m_hasPendingConfig = false;
+
+  if (m_pendingGrid != m_grid)
+  {
+    deleteGridResources();
+    m_grid = m_pendingGrid;
+    createGridResources();
+  }
+  m_params = m_pendingParams;
+
+  // The calm particles may not be at rest under the new domain or constants.
+  m_wakeAll = true;
+
+  if (m_hasQueuedConfig)
+  {
+    m_hasQueuedConfig = false;
+    reconfigure(m_queuedGrid, m_queuedParams);
+  }
+}
+
+const SimulationGrid& GlSimulationBackend::grid() const
+{
+  return m_grid;
+}
+
+const SimulationParams& GlSimulationBackend::params() const
+{
+  return m_params;
+}
+
+size_t GlSimulationBackend::gridMemoryBytes() const
+{
+  if (m_grid.mode == GridMode::Hashed)
+  {
+    return size_t(m_hashTableSize) * (2 * sizeof(uint32_t) + sizeof(glm::uvec2) + sizeof(glm::vec4)) +
+      size_t(m_particleCount) * sizeof(glm::vec4) + (m_sleeping ? size_t(m_hashTableSize) * sizeof(uint32_t) : 0);
+  }
+
+  // Grid, cells and velocity textures, and the active cell flags.
+  return size_t(m_grid.voxelCount()) * (sizeof(uint32_t) + sizeof(glm::uvec2) + sizeof(glm::vec4) + (m_sleeping ? sizeof(uint8_t) : 0)) +
+    (m_grid.cellOrder != CellOrder::Linear ? m_grid.voxelCount() + m_scanBlockCount : 0) * sizeof(uint32_t);
+}
+
+void GlSimulationBackend::setParticles(const std::vector<Particle>& particles)
+{
+  const auto particleCount = static_cast<uint32_t>(particles.size());
+
+  // Cell offsets and counts are 32 bit wide, so the particle buffer size is limited by the implementation.
+  {
+    GLint64 maxStorageBlockSize;
+    glGetInteger64v(GL_MAX_SHADER_STORAGE_BLOCK_SIZE, &maxStorageBlockSize);
+
+    GLint maxGroupCount;
+    glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_COUNT, 0, &maxGroupCount);
+
+    if (uint64_t(particleCount) * sizeof(glm::vec4) > uint64_t(maxStorageBlockSize))
+    {
+      fprintf(stderr, "%u particles exceed the maximum shader storage block size of %lld bytes\n", particleCount,
+        static_cast<long long>(maxStorageBlockSize));
+      abort();
+    }
+
+    if ((particleCount + 32 - 1) / 32 > uint32_t(maxGroupCount))
+    {
+      fprintf(stderr, "%u particles exceed the maximum compute work group count of %d\n", particleCount, maxGroupCount);
+      abort();
+    }
+  }
+
+  std::vector<glm::vec4> positions(particleCount);
+  std::vector<glm::vec4> velocities(particleCount);
+  std::vector<glm::vec2> densities(particleCount);
+  for (uint32_t i = 0; i < particleCount; i++)
+  {
+    const Particle& p = particles[i];
+    positions[i] = glm::vec4(p.position_x, p.position_y, p.position_z, 0.0f);
+    velocities[i] = glm::vec4(p.velocity_x, p.velocity_y, p.velocity_z, 0.0f);
+    densities[i] = glm::vec2(p.density, p.pressure);
+  }
+
+  const auto vec4Size = particleCount * sizeof(glm::vec4);
+  const auto vec2Size = particleCount * sizeof(glm::vec2);
+
+  // Buffer storage is immutable, so a different count needs new buffers.
+  if (particleCount != m_particleCount)
+  {
+    glDeleteBuffers(2, m_bufPositions);
+    glDeleteBuffers(2, m_bufVelocities);
+    glDeleteBuffers(1, &m_bufDensities);
+    glCreateBuffers(2, m_bufPositions);
+    glCreateBuffers(2, m_bufVelocities);
+    glCreateBuffers(1, &m_bufDensities);
+    for (uint32_t i = 0; i < 2; i++)
+    {
+      glNamedBufferStorage(m_bufPositions[i], vec4Size, positions.data(), GL_DYNAMIC_STORAGE_BIT);
+      glNamedBufferStorage(m_bufVelocities[i], vec4Size, velocities.data(), GL_DYNAMIC_STORAGE_BIT);
+    }
+    glNamedBufferStorage(m_bufDensities, vec2Size, densities.data(), GL_DYNAMIC_STORAGE_BIT);
+    m_particleCount = particleCount;
+
+    if (m_sleeping)
+    {
+      glDeleteBuffers(1, &m_bufActiveParticles);
+      glCreateBuffers(1, &m_bufActiveParticles);
+      glNamedBufferStorage(m_bufActiveParticles, particleCount * sizeof(uint32_t), nullptr, 0);
+    }
+
+    // The hash table is sized for the particle count.
+    if (m_grid.mode == GridMode::Hashed)
+    {
+      deleteHashTable();
+      createHashTable();
+    }
+  }
+  else
+  {
+    for (uint32_t i = 0; i < 2; i++)
+    {
+      glNamedBufferSubData(m_bufPositions[i], 0, vec4Size, positions.data());
+      glNamedBufferSubData(m_bufVelocities[i], 0, vec4Size, velocities.data());
+    }
+    glNamedBufferSubData(m_bufDensities, 0, vec2Size, densities.data());
+  }
+
+  m_swapFrame = false;
+}
+
+void GlSimulationBackend::runSteps(uint32_t firstStep, uint32_t lastStep, float dt, const glm::vec3& gravity)
+{
+  // A new grid is only valid once it has been built.
+  if (firstStep == 0)
+  {
+    applyPendingConfig();
+  }
+
+  const auto& GRID_RES = m_grid.res;
+
+  // The shaders skip the invocations of the last group which are past the particle count.
+  auto singleDimGroupCountForParticles = [this](uint32_t groupSize) {
+    return (m_particleCount + groupSize - 1) / groupSize;
+  };
+
+  auto runs = [&](uint32_t stepIdx) {
+    return firstStep <= stepIdx && stepIdx <= lastStep;
+  };
+
+  const bool hashed = m_grid.mode == GridMode::Hashed;
+  const uint32_t hashMask = m_hashTableSize - 1;
+
+  // The cell-tiled kernels run one workgroup per brick of cells instead of one invocation per particle,
+  // and with sleeping particles, the dispatch size follows the awake particle count.
+  auto dispatchNeighborKernel = [&](GLuint program, GLint particleCountLocation) {
+    if (m_sleeping)
+    {
+      glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 8, m_bufActiveDispatch);
+      glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 9, m_bufActiveParticles);
+      glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, m_bufActiveDispatch);
+      glDispatchComputeIndirect(0);
+    }
+    else if (m_kernelMode == GlKernelMode::CellTiled)
+    {
+      glDispatchCompute(
+        (GRID_RES.x + TILE_BRICK_SIZE - 1) / TILE_BRICK_SIZE,
+        (GRID_RES.y + TILE_BRICK_SIZE - 1) / TILE_BRICK_SIZE,
+        (GRID_RES.z + TILE_BRICK_SIZE - 1) / TILE_BRICK_SIZE
+      );
+    }
+    else
+    {
+      glProgramUniform1ui(program, particleCountLocation, m_particleCount);
+      glDispatchCompute(singleDimGroupCountForParticles(64), 1, 1);
+    }
+  };
+
+  // Step 1: Write particle count to voxel grid or hash table.
+  //         The positions were integrated by the previous step 6, so the particles are only read.
+  if (runs(0))
+  {
+    beginQuery(0);
+    const uint32_t fClearValue = 0;
+    if (hashed)
+    {
+      const uint32_t emptyKey = SpatialHash::EMPTY_KEY;
+      glClearNamedBufferData(m_bufHashKeys, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &emptyKey);
+      glClearNamedBufferData(m_bufHashCounts, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &fClearValue);
+      glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    }
+    else
+    {
+      glClearTexImage(m_texGrid, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, &fClearValue);
+      glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT);
+    }
+
+    glUseProgram(m_programs.simStep1);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, m_bufPositions[current()]);
+    if (hashed)
+    {
+      glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, m_bufHashKeys);
+      glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, m_bufHashCounts);
+      glProgramUniform1ui(m_programs.simStep1, 3, hashMask);
+    }
+    else
+    {
+      glProgramUniformHandleui64ARB(m_programs.simStep1, 0, m_texGridImgHandle);
+    }
+    glProgramUniform1ui(m_programs.simStep1, 2, m_particleCount);
+    glDispatchCompute(singleDimGroupCountForParticles(32), 1, 1);
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+    endQuery();
+  }
+
+  // Step 2: Write global particle array offsets into voxel grid and cell texture, or into the hash table.
+  if (runs(1) && hashed)
+  {
+    beginQuery(1);
+    const uint32_t uiClearValue = 0;
+    glClearNamedBufferData(m_bufCounters, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &uiClearValue);
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+
+    glUseProgram(m_programs.simStep2Hashed);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, m_bufCounters);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, m_bufHashCounts);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, m_bufHashCells);
+    glDispatchCompute(m_hashTableSize / 64, 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    endQuery();
+  }
+  else if (runs(1) && m_grid.cellOrder != CellOrder::Linear)
+  {
+    beginQuery(1);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, m_bufOrderedVoxels);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, m_bufScanBlockSums);
+
+    for (uint32_t pass = 0; pass < 3; pass++)
+    {
+      glUseProgram(m_programs.simStep2Ordered[pass]);
+      glProgramUniformHandleui64ARB(m_programs.simStep2Ordered[pass], 0, m_texGridImgHandle);
+      glProgramUniformHandleui64ARB(m_programs.simStep2Ordered[pass], 1, m_texCellsImgHandle);
+      glDispatchCompute(pass == 1 ? 1 : m_scanBlockCount, 1, 1);
+      glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+    }
+    endQuery();
+  }
+  else if (runs(1))
+  {
+    beginQuery(1);
+    const uint32_t uiClearValue = 0;
+    glClearNamedBufferData(m_bufCounters, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &uiClearValue);
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+
+    glUseProgram(m_programs.simStep2);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, m_bufCounters);
+    glProgramUniformHandleui64ARB(m_programs.simStep2, 0, m_texGridImgHandle);
+    glProgramUniformHandleui64ARB(m_programs.simStep2, 1, m_texCellsImgHandle);
+    glDispatchCompute(
+      (GRID_RES.x + 4 - 1) / 4,
+      (GRID_RES.y + 4 - 1) / 4,
+      (GRID_RES.z + 4 - 1) / 4
+    );
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    endQuery();
+  }
+
+  // Step 3: Write positions and velocities to their new location in the second buffers.
+  //         Write particle count to voxel grid (again).
+  if (runs(2))
+  {
+    beginQuery(2);
+    glUseProgram(m_programs.simStep3);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, m_bufPositions[current()]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, m_bufPositions[1 - current()]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, m_bufVelocities[current()]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, m_bufVelocities[1 - current()]);
+    if (hashed)
+    {
+      glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, m_bufHashKeys);
+      glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, m_bufHashCounts);
+      glProgramUniform1ui(m_programs.simStep3, 2, hashMask);
+    }
+    else
+    {
+      glProgramUniformHandleui64ARB(m_programs.simStep3, 0, m_texGridImgHandle);
+    }
+    glProgramUniform1ui(m_programs.simStep3, 1, m_particleCount);
+    glDispatchCompute(singleDimGroupCountForParticles(32), 1, 1);
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+
+    // The sorted particles are the input of the following steps and of the next iteration.
+    m_swapFrame = !m_swapFrame;
+
+    if (m_sleeping)
+    {
+      compactAwakeParticles();
+    }
+    endQuery();
+  }
+
+  // Step 4: Write average voxel velocities into second 3D-texture.
+  //         With a hashed grid, average the cell velocities and filter them at the particle positions.
+  if (runs(3) && hashed)
+  {
+    beginQuery(3);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, m_bufPositions[current()]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, m_bufVelocities[current()]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, m_bufHashKeys);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, m_bufHashCells);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, m_bufHashVelocities);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, m_bufFilteredVelocities);
+
+    for (uint32_t pass = 0; pass < 2; pass++)
+    {
+      glUseProgram(m_programs.simStep4Hashed[pass]);
+      glProgramUniform1ui(m_programs.simStep4Hashed[pass], 0, hashMask);
+      glProgramUniform1ui(m_programs.simStep4Hashed[pass], 1, m_particleCount);
+      glDispatchCompute(pass == 0 ? m_hashTableSize / 64 : singleDimGroupCountForParticles(32), 1, 1);
+      glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    }
+    endQuery();
+  }
+  else if (runs(3))
+  {
+    beginQuery(3);
+    glUseProgram(m_programs.simStep4);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, m_bufVelocities[current()]);
+    glProgramUniformHandleui64ARB(m_programs.simStep4, 0, m_texCellsImgHandle);
+    glProgramUniformHandleui64ARB(m_programs.simStep4, 1, m_texVelocityImgHandle);
+    glDispatchCompute(
+      (GRID_RES.x + 4 - 1) / 4,
+      (GRID_RES.y + 4 - 1) / 4,
+      (GRID_RES.z + 4 - 1) / 4
+    );
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+    endQuery();
+  }
+
+  // Step 5: Compute density and pressure for each particle.
+  if (runs(4))
+  {
+    beginQuery(4);
+    glUseProgram(m_programs.simStep5);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, m_bufPositions[current()]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, m_bufDensities);
+    if (hashed)
+    {
+      glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, m_bufHashKeys);
+      glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, m_bufHashCells);
+      glProgramUniform1ui(m_programs.simStep5, 2, hashMask);
+    }
+    else
+    {
+      glProgramUniformHandleui64ARB(m_programs.simStep5, 0, m_texCellsImgHandle);
+    }
+    dispatchNeighborKernel(m_programs.simStep5, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    endQuery();
+  }
+
+  // Step 6: Compute pressure and viscosity forces, use them to write new velocity.
+  //         For the old velocity, we use the coarse 3d-texture and do trilinear HW filtering,
+  //         or the velocities filtered in step 4 with a hashed grid.
+  //         Integrate position, do boundary handling and write positions and velocities to the second buffers.
+  if (runs(5))
+  {
+    beginQuery(5);
+    glUseProgram(m_programs.simStep6);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, m_bufPositions[current()]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, m_bufPositions[1 - current()]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, m_bufVelocities[current()]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, m_bufVelocities[1 - current()]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, m_bufDensities);
+    if (hashed)
+    {
+      glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, m_bufHashKeys);
+      glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, m_bufHashCells);
+      glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, m_bufFilteredVelocities);
+      glProgramUniform1ui(m_programs.simStep6, 5, hashMask);
+    }
+    else
+    {
+      glProgramUniformHandleui64ARB(m_programs.simStep6, 0, m_texCellsImgHandle);
+      glProgramUniformHandleui64ARB(m_programs.simStep6, 1, m_texVelocityHandle);
+    }
+    if (m_bufTimeStep != 0)
+    {
+      glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 10, m_bufTimeStep);
+    }
+    else
+    {
+      glProgramUniform1f(m_programs.simStep6, 2, dt);
+    }
+    glProgramUniform3fv(m_programs.simStep6, 3, 1, &gravity[0]);
+    dispatchNeighborKernel(m_programs.simStep6, 4);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    endQuery();
+
+    // The drifted particles keep the sorted order and are the input of the next iteration.
+    m_swapFrame = !m_swapFrame;
+  }
+
+  if (m_queries)
+  {
+    m_queries->incSimIter();
+  }
+}
+
+uint32_t GlSimulationBackend::advance(float frameTime, const glm::vec3& gravity)
+{
+  if (m_bufTimeStep == 0 || frameTime <= 0.0f)
+  {
+    return 0;
+  }
+
+  pollTimeStepFrames();
+
+  // The GPU chooses each dt, but the integration count is needed here. It follows from the CFL
+  // limit of the latest finished frame, or from the sound speed until there is one.
+  float cflDt = m_timeStepConfig.cfl * m_params.kernelRadius / soundSpeed(m_params);
+  float backlog = 0.0f;
+  if (m_hasTimeStepStats)
+  {
+    cflDt = m_timeStepStats.cflDt;
+    backlog = m_timeStepStats.backlog;
+  }
+  cflDt = std::clamp(cflDt, m_timeStepConfig.minDt, m_timeStepConfig.maxDt);
+
+  const float steps = std::ceil((frameTime + backlog) / cflDt - 0.001f);
+  const uint32_t stepCount = std::clamp(uint32_t(steps), 1u, m_timeStepConfig.maxSteps);
+
+  for (uint32_t i = 0; i < stepCount; i++)
+  {
+    glUseProgram(m_programs.simTimeStep);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 10, m_bufTimeStep);
+    glProgramUniform1f(m_programs.simTimeStep, 0, i == 0 ? frameTime : 0.0f);
+    glProgramUniform1ui(m_programs.simTimeStep, 1, stepCount - i);
+    glDispatchCompute(1, 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    step(0.0f, gravity);
+  }
+
+  recordTimeStepFrame();
+  return stepCount;
+}
+
+bool GlSimulationBackend::readTimeStepStats(TimeStepStats& stats)
+{
+  pollTimeStepFrames();
+
+  if (!m_hasTimeStepStats)
+  {
+    return false;
+  }
+  stats = m_timeStepStats;
+  return true;
+}
+
+void GlSimulationBackend::recordTimeStepFrame()
+{
+  // If the GPU is so far behind that all copies are in flight, the frame goes unreported.
+  if (m_timeStepHead - m_timeStepTail == TIME_STEP_FRAME_DELAY)
+  {
+    return;
+  }
+
+  const uint32_t slot = m_timeStepHead % TIME_STEP_FRAME_DELAY;
+  glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+  glCopyNamedBufferSubData(m_bufTimeStep, m_bufTimeStepFrames[slot], 0, 0, sizeof(GpuTimeStep));
+  m_timeStepFences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  m_timeStepHead++;
+}
+
+void GlSimulationBackend::pollTimeStepFrames()
+{
+  while (m_timeStepTail != m_timeStepHead)
+  {
+    const uint32_t slot = m_timeStepTail % TIME_STEP_FRAME_DELAY;
+    const GLenum status = glClientWaitSync(m_timeStepFences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+    if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+    {
+      return;
+    }
+    glDeleteSync(m_timeStepFences[slot]);
+    m_timeStepFences[slot] = nullptr;
+    m_timeStepTail++;
+
+    GpuTimeStep frame;
+    glGetNamedBufferSubData(m_bufTimeStepFrames[slot], 0, sizeof(frame), &frame);
+
+    m_timeStepStats.steps = frame.frameSteps;
+    m_timeStepStats.minDt = frame.frameMinDt;
+    m_timeStepStats.maxDt = frame.frameMaxDt;
+    m_timeStepStats.meanDt = frame.frameSteps > 0 ? frame.frameDtSum / frame.frameSteps : 0.0f;
+    m_timeStepStats.cflDt = frame.frameMinCflDt;
+    m_timeStepStats.backlog = frame.remainingTime;
+    m_timeStepStats.droppedTime = frame.frameDroppedTime;
+    m_timeStepStats.totalDroppedTime = frame.droppedTime;
+    m_hasTimeStepStats = true;
+  }
+}
+
+void GlSimulationBackend::compactAwakeParticles()
+{
+  const bool hashed = m_grid.mode == GridMode::Hashed;
+  const uint32_t clearValue = 0;
+
+  if (hashed)
+  {
+    glClearNamedBufferData(m_bufActiveSlots, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &clearValue);
+  }
+  else
+  {
+    glClearTexImage(m_texActiveCells, 0, GL_RED_INTEGER, GL_UNSIGNED_BYTE, &clearValue);
+  }
+  glClearNamedBufferData(m_bufActiveDispatch, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &clearValue);
+  glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+
+  // The sleeping particles are copied to the buffers which step 6 writes.
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, m_bufPositions[current()]);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, m_bufPositions[1 - current()]);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, m_bufVelocities[current()]);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, m_bufVelocities[1 - current()]);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, m_bufDensities);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 8, m_bufActiveDispatch);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 9, m_bufActiveParticles);
+  if (hashed)
+  {
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, m_bufHashKeys);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, m_bufActiveSlots);
+  }
+
+  for (uint32_t pass = 0; pass < 3; pass++)
+  {
+    const GLuint program = m_programs.simSleep[pass];
+
+    glUseProgram(program);
+    if (hashed)
+    {
+      glProgramUniform1ui(program, 2, m_hashTableSize - 1);
+    }
+    else
+    {
+      glProgramUniformHandleui64ARB(program, 0, m_texActiveCellsImgHandle);
+    }
+    glProgramUniform1ui(program, 1, m_particleCount);
+    glProgramUniform1i(program, 3, m_wakeAll ? 1 : 0);
+    glDispatchCompute(pass == 2 ? 1 : (m_particleCount + 32 - 1) / 32, 1, 1);
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+  }
+
+  m_wakeAll = false;
+}
+
+uint32_t GlSimulationBackend::current() const
+{
+  return m_swapFrame ? 0 : 1;
+}
+
+void GlSimulationBackend::beginQuery(uint32_t stepIdx)
+{
+  if (m_queries)
+  {
+    m_queries->beginSimQuery(stepIdx);
+  }
+}
+
+void GlSimulationBackend::endQuery()
+{
+  if (m_queries)
+  {
+    m_queries->endQuery();
+  }
+}
+
+ParticleBuffers GlSimulationBackend::particleBuffers() const
+{
+  return ParticleBuffers{ m_bufPositions[current()], m_bufVelocities[current()], m_bufDensities };
+}
+
+void GlSimulationBackend::readParticles(const ParticleBuffers& buffers, uint32_t particleCount, std::vector<Particle>& particles)
+{
+  std::vector<glm::vec4> positions(particleCount);
+  std::vector<glm::vec4> velocities(particleCount);
+  std::vector<glm::vec2> densities(particleCount);
+  glGetNamedBufferSubData(buffers.positions, 0, particleCount * sizeof(glm::vec4), positions.data());
+  glGetNamedBufferSubData(buffers.velocities, 0, particleCount * sizeof(glm::vec4), velocities.data());
+  glGetNamedBufferSubData(buffers.densities, 0, particleCount * sizeof(glm::vec2), densities.data());
+
+  particles.resize(particleCount);
+  for (uint32_t i = 0; i < particleCount; i++)
+  {
+    particles[i] = Particle{ positions[i].x, positions[i].y, positions[i].z, densities[i].x,
+                             velocities[i].x, velocities[i].y, velocities[i].z, densities[i].y };
+  }
+}
+
+const Particle* GlSimulationBackend::hostParticles() const
+{
+  return nullptr;
+}
+
+uint32_t GlSimulationBackend::particleCount() const
+{
+  return m_particleCount;
+}
+
+uint32_t GlSimulationBackend::awakeParticleCount() const
+{
+  if (!m_sleeping)
+  {
+    return m_particleCount;
+  }
+
+  uint32_t count = 0;
+  glGetNamedBufferSubData(m_bufActiveDispatch, 3 * sizeof(uint32_t), sizeof(count), &count);
+  return count;
+}
+
+const char* GlSimulationBackend::name() const
+{
+  return m_kernelMode == GlKernelMode::CellTiled ? "GPU (OpenGL, cell-tiled)" : "GPU (OpenGL)";
+}
+
+const char* GlSimulationBackend::kernelModeName(GlKernelMode mode)
+{
+  return mode == GlKernelMode::CellTiled ? "CellTiled" : "PerParticle";
+}
+
+bool GlSimulationBackend::parseKernelMode(std::string_view name, GlKernelMode& mode)
+{
+  if (name == "particle") { mode = GlKernelMode::PerParticle; return true; }
+  if (name == "tiled") { mode = GlKernelMode::CellTiled; return true; }
+  return false;
+}
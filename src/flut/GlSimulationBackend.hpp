@@ -0,0 +1,189 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <stdint.h>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+#include "SimulationBackend.hpp"
+#include "GlQueryRetriever.hpp"
+#include "GlShaderCompiler.hpp"
+
+namespace flut
+{
+  class GlSimulationBackend : public SimulationBackend
+  {
+  public:
+    // Step timings are recorded in the query retriever unless it is null. Reconfigurations compile
+    // their shaders on the worker context if one is given, and block otherwise. Sleeping particles
+    // are only supported by the per-particle kernels. With an adaptive time step, step 6 reads dt
+    // from a GPU buffer and ignores the dt passed to runSteps.
+    GlSimulationBackend(const std::vector<Particle>& particles, const SimulationGrid& grid, const SimulationParams& params,
+                        GlQueryRetriever* queries, GlKernelMode kernelMode = GlKernelMode::PerParticle,
+                        const SleepConfig& sleep = SleepConfig{}, const TimeStepConfig& timeStep = TimeStepConfig{},
+                        GlShaderCompiler::ContextFunc workerContext = nullptr);
+
+    ~GlSimulationBackend() override;
+
+  public:
+    void runSteps(uint32_t firstStep, uint32_t lastStep, float dt, const glm::vec3& gravity) override;
+
+    uint32_t advance(float frameTime, const glm::vec3& gravity) override;
+
+    bool readTimeStepStats(TimeStepStats& stats) override;
+
+    void setParticles(const std::vector<Particle>& particles) override;
+
+    void reconfigure(const SimulationGrid& grid, const SimulationParams& params) override;
+
+    bool reconfiguring() const override;
+
+    const SimulationGrid& grid() const override;
+
+    const SimulationParams& params() const override;
+
+    size_t gridMemoryBytes() const override;
+
+    ParticleBuffers particleBuffers() const override;
+
+    const Particle* hostParticles() const override;
+
+    uint32_t particleCount() const override;
+
+    uint32_t awakeParticleCount() const override;
+
+    const char* name() const override;
+
+    // Reads the particle streams back into the interleaved layout.
+    static void readParticles(const ParticleBuffers& buffers, uint32_t particleCount, std::vector<Particle>& particles);
+
+    static const char* kernelModeName(GlKernelMode mode);
+
+    // Parses one of "particle" or "tiled".
+    static bool parseKernelMode(std::string_view name, GlKernelMode& mode);
+
+  private:
+    constexpr static uint32_t TIME_STEP_FRAME_DELAY = 4;
+
+    // Programs specialized for one grid and set of physical constants.
+    struct Programs
+    {
+      GLuint simStep1 = 0;
+      GLuint simStep2 = 0;
+      // Step 2 for cell orders other than CellOrder::Linear, one program per scan pass.
+      GLuint simStep2Ordered[3] = {0, 0, 0};
+      // Steps 2 and 4 for GridMode::Hashed, see simStep4Hashed.comp for the two passes.
+      GLuint simStep2Hashed = 0;
+      GLuint simStep4Hashed[2] = {0, 0};
+      GLuint simStep3 = 0;
+      GLuint simStep4 = 0;
+      // Per-particle or cell-tiled, depending on the kernel mode.
+      GLuint simStep5 = 0;
+      GLuint simStep6 = 0;
+      // Compaction of the awake particles, see simSleep.comp for the three passes.
+      GLuint simSleep[3] = {0, 0, 0};
+      GLuint simTimeStep = 0;
+    };
+
+    static Programs createPrograms(const SimulationGrid& grid, const SimulationParams& params, GlKernelMode kernelMode,
+                                   const SleepConfig& sleep, const TimeStepConfig& timeStep);
+
+    static void deletePrograms(const Programs& programs);
+
+    void createGridResources();
+
+    void deleteGridResources();
+
+    // Sized by the particle count, so also recreated by setParticles.
+    void createHashTable();
+
+    void deleteHashTable();
+
+    void applyPendingConfig();
+
+    // Lists the awake particles for steps 5 and 6 and copies the sleeping ones, see simSleep.comp.
+    void compactAwakeParticles();
+
+    // Copies the time steps of the frame which advance() just issued, to be read once it has finished.
+    void recordTimeStepFrame();
+
+    // Reads the frames which have finished, without waiting for the others.
+    void pollTimeStepFrames();
+
+    // Index of the position and velocity buffers which hold the latest state.
+    uint32_t current() const;
+
+    void beginQuery(uint32_t stepIdx);
+
+    void endQuery();
+
+  private:
+    GlQueryRetriever* m_queries;
+    GlKernelMode m_kernelMode;
+    SleepConfig m_sleepConfig;
+    bool m_sleeping;
+    SimulationGrid m_grid;
+    SimulationParams m_params;
+    uint32_t m_particleCount;
+    Programs m_programs;
+    std::unique_ptr<GlShaderCompiler> m_compiler;
+    // Configuration whose programs are being compiled, and the latest one requested in the meantime.
+    bool m_hasPendingConfig;
+    SimulationGrid m_pendingGrid;
+    SimulationParams m_pendingParams;
+    Programs m_pendingPrograms;
+    bool m_hasQueuedConfig;
+    SimulationGrid m_queuedGrid;
+    SimulationParams m_queuedParams;
+    // Positions and velocities are double-buffered, since step 3 scatters them into the sorted
+    // order and step 6 drifts them while the neighbors are read from the sorted ones. Densities
+    // are only written by step 5, after the sort.
+    GLuint m_bufPositions[2];
+    GLuint m_bufVelocities[2];
+    GLuint m_bufDensities;
+    GLuint m_bufCounters;
+    GLuint m_bufOrderedVoxels;
+    GLuint m_bufScanBlockSums;
+    uint32_t m_scanBlockCount;
+    // Particle counts, then scatter cursors during grid construction.
+    GLuint m_texGrid;
+    GLuint64 m_texGridImgHandle;
+    // Particle offset and count of each cell.
+    GLuint m_texCells;
+    GLuint64 m_texCellsImgHandle;
+    GLuint m_texVelocity;
+    GLuint64 m_texVelocityHandle;
+    GLuint64 m_texVelocityImgHandle;
+    // Replace the textures above with GridMode::Hashed: keys, particle counts and then scatter
+    // cursors, particle offset and count, and average velocity of each slot.
+    uint32_t m_hashTableSize;
+    GLuint m_bufHashKeys;
+    GLuint m_bufHashCounts;
+    GLuint m_bufHashCells;
+    GLuint m_bufHashVelocities;
+    // Velocity of the hashed cells filtered at each particle position.
+    GLuint m_bufFilteredVelocities;
+    // Flags of the cells with active particles, per voxel or per slot of the hash table.
+    GLuint m_texActiveCells;
+    GLuint64 m_texActiveCellsImgHandle;
+    GLuint m_bufActiveSlots;
+    // Indirect dispatch size of steps 5 and 6 followed by the awake particle count, and the awake particles.
+    GLuint m_bufActiveDispatch;
+    GLuint m_bufActiveParticles;
+    // Wakes all particles in the next compaction, e.g. after the physical constants changed.
+    bool m_wakeAll;
+    TimeStepConfig m_timeStepConfig;
+    // Time step of the next integration, the largest speed and acceleration, and statistics of the
+    // current frame, see simTimeStep.comp.
+    GLuint m_bufTimeStep;
+    // Copies of the statistics of the last frames, each readable once its fence has signaled.
+    GLuint m_bufTimeStepFrames[TIME_STEP_FRAME_DELAY];
+    GLsync m_timeStepFences[TIME_STEP_FRAME_DELAY];
+    uint32_t m_timeStepHead;
+    uint32_t m_timeStepTail;
+    bool m_hasTimeStepStats;
+    TimeStepStats m_timeStepStats;
+    bool m_swapFrame;
+  };
+}
@@ -0,0 +1,148 @@
+#include "ParticleSpawner.hpp"
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace flut;
+
+constexpr static uint32_t PARTICLE_CHUNK_SIZE = 4096;
+constexpr static float SAFE_BOUNDS = 0.5f;
+
+static float latticeDensity(float spacing, const SimulationParams& params)
+{
+  const float h = params.kernelRadius;
+  const double h2 = h * h;
+  const double poly6KernelWeightConst = 315.0 / (64.0 * M_PI * std::pow(h, 9));
+
+  const int32_t range = static_cast<int32_t>(h / spacing);
+
+  double sum = 0.0;
+  for (int32_t z = -range; z <= range; z++)
+  {
+    for (int32_t y = -range; y <= range; y++)
+    {
+      for (int32_t x = -range; x <= range; x++)
+      {
+        const double r2 = double(x * x + y * y + z * z) * spacing * spacing;
+        if (r2 < h2)
+        {
+          const double d = h2 - r2;
+          sum += d * d * d;
+        }
+      }
+    }
+  }
+
+  return static_cast<float>(params.mass * poly6KernelWeightConst * sum);
+}
+
+float ParticleSpawner::latticeSpacing(float targetDensity, const SimulationParams& params)
+{
+  // The density decreases monotonically with the spacing until neighbors leave the kernel
+  // radius, at which point only the self-contribution remains.
+  float lo = params.kernelRadius * 0.01f;
+  float hi = params.kernelRadius;
+
+  if (latticeDensity(hi, params) >= targetDensity)
+  {
+    return hi;
+  }
+
+  for (uint32_t i = 0; i < 32; i++)
+  {
+    const float mid = (lo + hi) * 0.5f;
+    (latticeDensity(mid, params) > targetDensity ? lo : hi) = mid;
+  }
+
+  return (lo + hi) * 0.5f;
+}
+
+uint32_t ParticleSpawner::maxBlockParticleCount(float targetDensity, const SimulationGrid& grid, const SimulationParams& params)
+{
+  const glm::vec3 maxExtent = grid.size - 2.0f * SAFE_BOUNDS;
+  const glm::vec3 sites = glm::floor(maxExtent / latticeSpacing(targetDensity, params));
+  const double count = double(sites.x) * double(sites.y) * double(sites.z);
+  return static_cast<uint32_t>(std::min(count, double(UINT32_MAX)));
+}
+
+float ParticleSpawner::random(uint32_t seed, uint64_t counter)
+{
+  // SplitMix64 finalizer applied to the (seed, counter) pair.
+  uint64_t x = counter + (uint64_t(seed) << 32 | seed) * 0x9E3779B97F4A7C15ull;
+  x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+  x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+  x = x ^ (x >> 31);
+  return (x >> 40) * (1.0f / 16777216.0f);
+}
+
+std::vector<Particle> ParticleSpawner::spawnBlock(uint32_t particleCount, uint32_t seed, float targetDensity,
+                                                  const SimulationGrid& grid, const SimulationParams& params)
+{
+  return spawnLattice(particleCount, seed, latticeSpacing(targetDensity, params), grid);
+}
+
+std::vector<Particle> ParticleSpawner::spawnFilled(uint32_t particleCount, uint32_t seed, float fillRatio,
+                                                   const SimulationGrid& grid)
+{
+  const glm::vec3 extent = grid.size - 2.0f * SAFE_BOUNDS;
+  const float spacing = std::cbrt(fillRatio * extent.x * extent.y * extent.z / particleCount);
+  return spawnLattice(particleCount, seed, spacing, grid);
+}
+
+std::vector<Particle> ParticleSpawner::spawnLattice(uint32_t particleCount, uint32_t seed, float spacing,
+                                                    const SimulationGrid& grid)
+{
+  const glm::vec3 maxExtent = grid.size - 2.0f * SAFE_BOUNDS;
+
+  // Scale the domain down to a block which holds all particles. The top layer may be partially filled.
+  const float scale = std::cbrt(particleCount * spacing * spacing * spacing / (maxExtent.x * maxExtent.y * maxExtent.z));
+  const uint32_t sitesX = std::clamp(static_cast<uint32_t>(std::round(maxExtent.x * scale / spacing)), 1u, std::max(static_cast<uint32_t>(maxExtent.x / spacing), 1u));
+  const uint32_t sitesZ = std::clamp(static_cast<uint32_t>(std::round(maxExtent.z * scale / spacing)), 1u, std::max(static_cast<uint32_t>(maxExtent.z / spacing), 1u));
+  const uint32_t sitesY = (particleCount + sitesX * sitesZ - 1) / (sitesX * sitesZ);
+
+  // Lattice sites lie half a spacing inside the block, so allow the block to be one spacing too large.
+  const glm::vec3 blockSize = glm::vec3(sitesX, sitesY, sitesZ) * spacing;
+  if (blockSize.y > maxExtent.y + spacing)
+  {
+    fprintf(stderr, "%u particles with spacing %.4f do not fit into the simulation domain\n", particleCount, spacing);
+    abort();
+  }
+
+  const glm::vec3 blockOrigin = grid.origin + (grid.size - blockSize) * 0.5f + spacing * 0.5f;
+  const float jitter = spacing * JITTER;
+
+  std::vector<Particle> particles(particleCount);
+
+  ThreadPool pool;
+  pool.parallelFor(particleCount, PARTICLE_CHUNK_SIZE, [&](uint32_t begin, uint32_t end, uint32_t threadIdx) {
+    for (uint32_t i = begin; i < end; i++)
+    {
+      const uint32_t x = i % sitesX;
+      const uint32_t z = (i / sitesX) % sitesZ;
+      const uint32_t y = i / (sitesX * sitesZ);
+
+      const uint64_t counter = uint64_t(i) * 3;
+      const glm::vec3 offset{
+        (random(seed, counter + 0) * 2.0f - 1.0f) * jitter,
+        (random(seed, counter + 1) * 2.0f - 1.0f) * jitter,
+        (random(seed, counter + 2) * 2.0f - 1.0f) * jitter
+      };
+      const glm::vec3 position = blockOrigin + glm::vec3(x, y, z) * spacing + offset;
+
+      Particle& p = particles[i];
+      p.position_x = position.x;
+      p.position_y = position.y;
+      p.position_z = position.z;
+      p.density = 0.0f;
+      p.velocity_x = 0.0f;
+      p.velocity_y = 0.0f;
+      p.velocity_z = 0.0f;
+      p.pressure = 0.0f;
+    }
+  });
+
+  return particles;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include "SimulationBackend.hpp"
+
+namespace flut
+{
+  class ParticleSpawner
+  {
+  public:
+    // Maximum per-axis displacement of a particle from its lattice site, relative to the lattice spacing.
+    constexpr static float JITTER = 0.1f;
+
+  public:
+    // Fills a block at the center of the simulation domain with particles at rest. The particles are
+    // placed on a jittered cubic lattice whose spacing makes the SPH density of the block match the
+    // given target density with the kernel radius and mass of params, and the block has the aspect
+    // ratio of the domain. Each particle only depends on the seed and its index, so the result is
+    // reproducible and generated in parallel.
+    static std::vector<Particle> spawnBlock(uint32_t particleCount, uint32_t seed, float targetDensity,
+                                            const SimulationGrid& grid, const SimulationParams& params);
+
+    // Same as spawnBlock, but the lattice spacing is chosen so that the block covers the given
+    // fraction of the domain volume inside the boundaries.
+    static std::vector<Particle> spawnFilled(uint32_t particleCount, uint32_t seed, float fillRatio,
+                                             const SimulationGrid& grid);
+
+    // Largest particle count which spawnBlock can place inside the domain at the given target density.
+    static uint32_t maxBlockParticleCount(float targetDensity, const SimulationGrid& grid, const SimulationParams& params);
+
+    // Lattice spacing at which the poly6 density sum of an unjittered lattice equals the target density.
+    static float latticeSpacing(float targetDensity, const SimulationParams& params);
+
+    // Counter-based random number in [0, 1) for the given seed and counter.
+    static float random(uint32_t seed, uint64_t counter);
+
+  private:
+    static std::vector<Particle> spawnLattice(uint32_t particleCount, uint32_t seed, float spacing,
+                                              const SimulationGrid& grid);
+  };
+}
@@ -0,0 +1,253 @@
+#include "ReplaySimulationBackend.hpp"
+
+#include <algorithm>
+#include <string.h>
+#include <stdio.h>
+
+using namespace flut;
+
+std::unique_ptr<ReplaySimulationBackend> ReplaySimulationBackend::create(const std::string& path, uint32_t threadCount)
+{
+  auto pool = std::make_unique<ThreadPool>(threadCount);
+  std::unique_ptr<TrajectoryReader> reader = TrajectoryReader::open(path, pool.get());
+  if (!reader)
+  {
+    return nullptr;
+  }
+  return std::unique_ptr<ReplaySimulationBackend>(new ReplaySimulationBackend(std::move(pool), std::move(reader)));
+}
+
+ReplaySimulationBackend::ReplaySimulationBackend(std::unique_ptr<ThreadPool> pool, std::unique_ptr<TrajectoryReader> reader)
+  : m_pool(std::move(pool))
+  , m_reader(std::move(reader))
+  , m_particleCount(m_reader->header().particleCount)
+  , m_slot{0}
+  , m_frame{0}
+  , m_failedFrame{UINT64_MAX}
+  , m_empty{true}
+  , m_time(m_reader->entry(0).time)
+  , m_playing{false}
+{
+  const TrajectoryHeader& header = m_reader->header();
+  for (int i = 0; i < 3; i++)
+  {
+    m_grid.size[i] = header.gridSize[i];
+    m_grid.origin[i] = header.gridOrigin[i];
+    m_grid.res[i] = header.gridRes[i];
+  }
+  m_grid.cellOrder = CellOrder(header.cellOrder);
+  m_grid.mode = GridMode(header.gridMode);
+  m_params = header.params;
+
+  const size_t vec4Size = size_t(m_particleCount) * sizeof(glm::vec4);
+  const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+  for (Slot& slot : m_slots)
+  {
+    glCreateBuffers(1, &slot.positions);
+    glCreateBuffers(1, &slot.velocities);
+    glNamedBufferStorage(slot.positions, vec4Size, nullptr, flags);
+    glNamedBufferStorage(slot.velocities, vec4Size, nullptr, flags);
+    slot.positionMapping = static_cast<glm::vec4*>(glMapNamedBufferRange(slot.positions, 0, vec4Size, flags));
+    slot.velocityMapping = static_cast<glm::vec4*>(glMapNamedBufferRange(slot.velocities, 0, vec4Size, flags));
+  }
+
+  const std::vector<glm::vec2> densities(m_particleCount, glm::vec2(0.0f));
+  glCreateBuffers(1, &m_densities);
+  glNamedBufferStorage(m_densities, m_particleCount * sizeof(glm::vec2), densities.data(), 0);
+
+  if (header.frameStride == 0)
+  {
+    m_decodedPositions.resize(m_particleCount);
+    m_decodedVelocities.resize(m_particleCount);
+  }
+
+  m_reader->prefetch(0, PREFETCH_FRAMES);
+  update(0.0);
+}
+
+ReplaySimulationBackend::~ReplaySimulationBackend()
+{
+  for (Slot& slot : m_slots)
+  {
+    glDeleteSync(slot.fence);
+    glUnmapNamedBuffer(slot.positions);
+    glUnmapNamedBuffer(slot.velocities);
+    glDeleteBuffers(1, &slot.positions);
+    glDeleteBuffers(1, &slot.velocities);
+  }
+  glDeleteBuffers(1, &m_densities);
+}
+
+void ReplaySimulationBackend::runSteps(uint32_t firstStep, uint32_t lastStep, float dt, const glm::vec3& gravity)
+{
+}
+
+void ReplaySimulationBackend::setParticles(const std::vector<Particle>& particles)
+{
+  fprintf(stderr, "The particles of a replay cannot be replaced\n");
+}
+
+void ReplaySimulationBackend::reconfigure(const SimulationGrid& grid, const SimulationParams& params)
+{
+  fprintf(stderr, "A replay cannot be reconfigured\n");
+}
+
+const SimulationGrid& ReplaySimulationBackend::grid() const
+{
+  return m_grid;
+}
+
+const SimulationParams& ReplaySimulationBackend::params() const
+{
+  return m_params;
+}
+
+size_t ReplaySimulationBackend::gridMemoryBytes() const
+{
+  return 0;
+}
+
+ParticleBuffers ReplaySimulationBackend::particleBuffers() const
+{
+  return { m_slots[m_slot].positions, m_slots[m_slot].velocities, m_densities };
+}
+
+const Particle* ReplaySimulationBackend::hostParticles() const
+{
+  return nullptr;
+}
+
+uint32_t ReplaySimulationBackend::particleCount() const
+{
+  return m_particleCount;
+}
+
+const char* ReplaySimulationBackend::name() const
+{
+  return "Replay";
+}
+
+void ReplaySimulationBackend::update(double frameTime)
+{
+  const uint64_t lastFrame = m_reader->frameCount() - 1;
+  if (m_playing)
+  {
+    m_time += frameTime;
+    if (m_time >= m_reader->entry(lastFrame).time)
+    {
+      m_time = m_reader->entry(lastFrame).time;
+      m_playing = false;
+    }
+  }
+
+  const uint64_t frame = m_reader->frameAt(m_time);
+  if ((m_empty || frame != m_frame) && frame != m_failedFrame)
+  {
+    upload(frame);
+  }
+
+  // The pages of the frames to come are read while the current ones are drawn.
+  if (m_playing)
+  {
+    m_reader->prefetch(frame + 1, PREFETCH_FRAMES);
+  }
+}
+
+void ReplaySimulationBackend::seek(uint64_t frame)
+{
+  frame = std::min(frame, m_reader->frameCount() - 1);
+  m_time = m_reader->entry(frame).time;
+  m_reader->prefetch(frame, 1);
+}
+
+void ReplaySimulationBackend::setPlaying(bool playing)
+{
+  // Playing at the end starts over. The shown frame may be an earlier one if the last is corrupt.
+  if (playing && m_reader->frameAt(m_time) + 1 == m_reader->frameCount())
+  {
+    seek(0);
+  }
+  m_playing = playing;
+}
+
+bool ReplaySimulationBackend::playing() const
+{
+  return m_playing;
+}
+
+uint64_t ReplaySimulationBackend::frame() const
+{
+  return m_frame;
+}
+
+uint64_t ReplaySimulationBackend::step() const
+{
+  return m_reader->entry(m_frame).step;
+}
+
+double ReplaySimulationBackend::time() const
+{
+  return m_reader->entry(m_frame).time;
+}
+
+uint64_t ReplaySimulationBackend::frameCount() const
+{
+  return m_reader->frameCount();
+}
+
+const TrajectoryReader& ReplaySimulationBackend::reader() const
+{
+  return *m_reader;
+}
+
+bool ReplaySimulationBackend::upload(uint64_t frame)
+{
+  // The shown slot is drawn by the commands issued since its upload.
+  Slot& shown = m_slots[m_slot];
+  glDeleteSync(shown.fence);
+  shown.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+  const uint32_t next = (m_slot + 1) % SLOT_COUNT;
+  Slot& slot = m_slots[next];
+  if (slot.fence)
+  {
+    // Only waits if the GPU is SLOT_COUNT - 1 frames behind.
+    glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, UINT64_MAX);
+    glDeleteSync(slot.fence);
+    slot.fence = nullptr;
+  }
+
+  bool read;
+  if (m_decodedPositions.empty())
+  {
+    read = m_reader->read(frame, slot.positionMapping, slot.velocityMapping);
+  }
+  else
+  {
+    read = m_reader->read(frame, m_decodedPositions.data(), m_decodedVelocities.data());
+    if (read)
+    {
+      const size_t size = size_t(m_particleCount) * sizeof(glm::vec4);
+      memcpy(slot.positionMapping, m_decodedPositions.data(), size);
+      memcpy(slot.velocityMapping, m_decodedVelocities.data(), size);
+    }
+  }
+
+  // A corrupt frame keeps the previous one on screen, or none at all.
+  if (!read)
+  {
+    fprintf(stderr, "Trajectory frame %llu is corrupt\n", static_cast<unsigned long long>(frame));
+    m_failedFrame = frame;
+    if (!m_empty)
+    {
+      return false;
+    }
+    std::fill_n(slot.positionMapping, m_particleCount, glm::vec4(0.0f));
+    std::fill_n(slot.velocityMapping, m_particleCount, glm::vec4(0.0f));
+  }
+
+  m_slot = next;
+  m_frame = frame;
+  m_empty = false;
+  return read;
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "SimulationBackend.hpp"
+#include "ThreadPool.hpp"
+#include "TrajectoryReader.hpp"
+
+namespace flut
+{
+  // Plays back a recorded trajectory instead of simulating, so that recordings can be inspected
+  // with the regular renderer. Frames are copied from the mapped file into a ring of persistently
+  // mapped buffers, each guarded by a fence, so that the upload of the next frame never waits for
+  // the GPU to finish drawing the current one.
+  //
+  // Densities are not recorded; the density color mode shows every particle as invalid.
+  class ReplaySimulationBackend : public SimulationBackend
+  {
+  public:
+    constexpr static uint32_t SLOT_COUNT = 3;
+    // Frames ahead of the shown one which are prefetched from the file.
+    constexpr static uint32_t PREFETCH_FRAMES = 8;
+
+  public:
+    // Opens the recording, or returns nullptr. Compressed frames are decoded on threadCount threads,
+    // 0 uses all hardware threads.
+    static std::unique_ptr<ReplaySimulationBackend> create(const std::string& path, uint32_t threadCount = 0);
+
+    ~ReplaySimulationBackend() override;
+
+  public:
+    // Recordings cannot be simulated, respawned or reconfigured.
+    void runSteps(uint32_t firstStep, uint32_t lastStep, float dt, const glm::vec3& gravity) override;
+
+    void setParticles(const std::vector<Particle>& particles) override;
+
+    void reconfigure(const SimulationGrid& grid, const SimulationParams& params) override;
+
+    // Grid and physical constants at the start of the recording.
+    const SimulationGrid& grid() const override;
+
+    const SimulationParams& params() const override;
+
+    size_t gridMemoryBytes() const override;
+
+    ParticleBuffers particleBuffers() const override;
+
+    const Particle* hostParticles() const override;
+
+    uint32_t particleCount() const override;
+
+    const char* name() const override;
+
+  public:
+    // Advances the playback time by the simulated time of a rendered frame while playing, and shows
+    // the last frame recorded at or before it. Playback pauses at the end of the recording.
+    void update(double frameTime);
+
+    // Jumps to a frame, which update() shows.
+    void seek(uint64_t frame);
+
+    void setPlaying(bool playing);
+
+    bool playing() const;
+
+    // Shown frame, and its integration and simulated time.
+    uint64_t frame() const;
+
+    uint64_t step() const;
+
+    double time() const;
+
+    uint64_t frameCount() const;
+
+    const TrajectoryReader& reader() const;
+
+  private:
+    struct Slot
+    {
+      GLuint positions = 0;
+      GLuint velocities = 0;
+      glm::vec4* positionMapping = nullptr;
+      glm::vec4* velocityMapping = nullptr;
+      // Signaled once the commands which draw this slot have finished.
+      GLsync fence = nullptr;
+    };
+
+    ReplaySimulationBackend(std::unique_ptr<ThreadPool> pool, std::unique_ptr<TrajectoryReader> reader);
+
+    // Copies a frame into the next slot, which becomes the shown one. Returns false if the frame is
+    // corrupt.
+    bool upload(uint64_t frame);
+
+  private:
+    std::unique_ptr<ThreadPool> m_pool;
+    std::unique_ptr<TrajectoryReader> m_reader;
+    SimulationGrid m_grid;
+    SimulationParams m_params;
+    uint32_t m_particleCount;
+    Slot m_slots[SLOT_COUNT];
+    uint32_t m_slot;
+    GLuint m_densities;
+    // Compressed frames are decoded here and then copied to the write-combined mapping in one pass.
+    std::vector<glm::vec4> m_decodedPositions;
+    std::vector<glm::vec4> m_decodedVelocities;
+    uint64_t m_frame;
+    // Last frame which turned out corrupt, so that update() does not read it again every frame.
+    uint64_t m_failedFrame;
+    // Nothing was uploaded yet.
+    bool m_empty;
+    // Playback time, which selects the shown frame.
+    double m_time;
+    bool m_playing;
+  };
+}
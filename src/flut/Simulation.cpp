@@ -1,301 +1,182 @@
 #include "Simulation.hpp"
+#include "Camera.hpp"
 #include "GlHelper.hpp"
+#include "GlParticleReadback.hpp"
 #include "GlQueryRetriever.hpp"
+#include "GlSimulationBackend.hpp"
+#include "CpuSimulationBackend.hpp"
+#include "FluidRenderer.hpp"
+#include "ParticleSpawner.hpp"
+#include "ReplaySimulationBackend.hpp"
 
-#include <glm/gtc/type_ptr.hpp>
+#include <algorithm>
 #include <iostream>
 #include <fstream>
 #include <limits>
 #include <cmath>
+#include <stdio.h>
+#include <string.h>
 
 using namespace flut;
 
-struct Particle
-{
-  float position_x;
-  float position_y;
-  float position_z;
-  float density;
-  float velocity_x;
-  float velocity_y;
-  float velocity_z;
-  float pressure;
-};
-
-Simulation::Simulation(uint32_t width, uint32_t height)
+Simulation::Simulation(uint32_t width, uint32_t height, const StartupOptions& startupOptions,
+                       GlShaderCompiler::ContextFunc workerContext)
   : m_width(width)
   , m_height(height)
   , m_newWidth(width)
   , m_newHeight(height)
-  , m_swapFrame{false}
   , m_frame{0}
   , m_integrationsPerFrame{1}
+  , m_seed(startupOptions.seed)
+  , m_grid(GRID)
+  , m_readbackInterval(startupOptions.readbackInterval)
+  , m_adaptiveTimeStep{false}
+  , m_replay{nullptr}
+  , m_step{0}
+  , m_simTime{0.0}
+  , m_droppedTime{0.0}
+  , m_trajectoryInterval(std::max(startupOptions.trajectory.frameInterval, 1u))
+  , m_checkpointInterval(startupOptions.checkpointInterval)
 {
 #ifndef NDEBUG
   GlHelper::enableDebugHooks();
 #endif
 
-  // Pad particle count so that we can get rid of bounds checks in shaders.
-  m_particleCount = (MIN_PARTICLE_COUNT + MAX_GROUP_SIZE - 1) / MAX_GROUP_SIZE * MAX_GROUP_SIZE;
-
-  // Shaders
-  {
-    glm::vec3 invCellSize = glm::vec3(GRID_RES) * (1.0f - 0.001f) / GRID_SIZE;
-
-    float viscosityKernelWeightConst = static_cast<float>(45.0f / (M_PI * std::pow(KERNEL_RADIUS, 6)));
-    float spikyKernelWeightConst = static_cast<float>(15.0f / (M_PI * std::pow(KERNEL_RADIUS, 6)));
-    float poly6KernelWeightConst = static_cast<float>(315.0f / (64.0f * M_PI * std::pow(KERNEL_RADIUS, 9)));
-
-    m_programSimStep1 = GlHelper::createComputeShader(SHADERS_DIR "/simStep1.comp", {
-      { "INV_CELL_SIZE",  invCellSize },
-      { "GRID_ORIGIN",    GRID_ORIGIN },
-      { "GRID_SIZE",      GRID_SIZE }
-    });
-
-    m_programSimStep2 = GlHelper::createComputeShader(SHADERS_DIR "/simStep2.comp", {
-      { "GRID_RES",       GRID_RES }
-    });
-
-    m_programSimStep3 = GlHelper::createComputeShader(SHADERS_DIR "/simStep3.comp", {
-      { "INV_CELL_SIZE",  invCellSize },
-      { "GRID_ORIGIN",    GRID_ORIGIN }
-    });
-
-    m_programSimStep4 = GlHelper::createComputeShader(SHADERS_DIR "/simStep4.comp", {
-      { "GRID_RES",       GRID_RES }
-    });
-
-    m_programSimStep5 = GlHelper::createComputeShader(SHADERS_DIR "/simStep5.comp", {
-      { "INV_CELL_SIZE",               invCellSize },
-      { "GRID_ORIGIN",                 GRID_ORIGIN },
-      { "GRID_RES",                    GRID_RES },
-      { "MASS",                        MASS },
-      { "KERNEL_RADIUS",               KERNEL_RADIUS },
-      { "POLY6_KERNEL_WEIGHT_CONST",   poly6KernelWeightConst },
-      { "STIFFNESS_K",                 STIFFNESS },
-      { "REST_DENSITY",                REST_DENSITY },
-      { "REST_PRESSURE",               REST_PRESSURE }
-    });
-
-    m_programSimStep6 = GlHelper::createComputeShader(SHADERS_DIR "/simStep6.comp", {
-      { "INV_CELL_SIZE",               invCellSize },
-      { "GRID_SIZE",                   GRID_SIZE },
-      { "GRID_ORIGIN",                 GRID_ORIGIN },
-      { "GRID_RES",                    GRID_RES },
-      { "MASS",                        MASS },
-      { "KERNEL_RADIUS",               KERNEL_RADIUS },
-      { "VIS_COEFF",                   VIS_COEFF },
-      { "VIS_KERNEL_WEIGHT_CONST",     viscosityKernelWeightConst },
-      { "SPIKY_KERNEL_WEIGHT_CONST",   spikyKernelWeightConst }
-    });
-
-    m_programRenderGeometry = GlHelper::createVertFragShader(SHADERS_DIR "/renderGeometry.vert", SHADERS_DIR "/renderGeometry.frag");
-    m_programRenderCurvature = GlHelper::createVertFragShader(SHADERS_DIR "/renderBoundingBox.vert", SHADERS_DIR "/renderCurvature.frag", {
-      { "NEAR",           Camera::NEAR_PLANE },
-      { "FAR",            Camera::FAR_PLANE }
-    });
-    m_programRenderShading = GlHelper::createVertFragShader(SHADERS_DIR "/renderBoundingBox.vert", SHADERS_DIR "/renderShading.frag");
-  }
-
-  // Bounding box
-  const std::vector<glm::vec3> bboxVertices{
-    GRID_ORIGIN + glm::vec3{       0.0f,        0.0f, GRID_SIZE.z},
-    GRID_ORIGIN + glm::vec3{GRID_SIZE.x,        0.0f, GRID_SIZE.z},
-    GRID_ORIGIN + glm::vec3{GRID_SIZE.x, GRID_SIZE.y, GRID_SIZE.z},
-    GRID_ORIGIN + glm::vec3{       0.0f, GRID_SIZE.y, GRID_SIZE.z},
-    GRID_ORIGIN + glm::vec3{       0.0f,        0.0f,        0.0f},
-    GRID_ORIGIN + glm::vec3{GRID_SIZE.x,        0.0f,        0.0f},
-    GRID_ORIGIN + glm::vec3{GRID_SIZE.x, GRID_SIZE.y,        0.0f},
-    GRID_ORIGIN + glm::vec3{       0.0f, GRID_SIZE.y,        0.0f},
-  };
-  glCreateBuffers(1, &m_bufBBoxVertices);
-  glNamedBufferStorage(m_bufBBoxVertices, bboxVertices.size() * sizeof(float) * 3, glm::value_ptr(bboxVertices.data()[0]), 0);
-
-  const std::vector<uint32_t> bboxIndices {
-    0, 1, 2, 2, 3, 0,
-    1, 5, 6, 6, 2, 1,
-    7, 6, 5, 5, 4, 7,
-    4, 0, 3, 3, 7, 4,
-    4, 5, 1, 1, 0, 4,
-    3, 2, 6, 6, 7, 3
-  };
-  glCreateBuffers(1, &m_bufBBoxIndices);
-  glNamedBufferStorage(m_bufBBoxIndices, bboxIndices.size() * sizeof(uint32_t), bboxIndices.data(), 0);
-
-  glCreateVertexArrays(1, &m_vao3);
-  glEnableVertexArrayAttrib(m_vao3, 0);
-  glVertexArrayVertexBuffer(m_vao3, 0, m_bufBBoxVertices, 0, 3 * sizeof(float));
-  glVertexArrayAttribBinding(m_vao3, 0, 0);
-  glVertexArrayAttribFormat(m_vao3, 0, 3, GL_FLOAT, GL_FALSE, 0);
-  glEnableVertexArrayAttrib(m_vao3, 1);
-  glVertexArrayElementBuffer(m_vao3, m_bufBBoxIndices);
-  glVertexArrayAttribBinding(m_vao3, 1, 0);
-  glVertexArrayAttribFormat(m_vao3, 1, 1, GL_FLOAT, GL_FALSE, 3 * sizeof(float));
-
-  // Uniform grid
-  glCreateTextures(GL_TEXTURE_3D, 1, &m_texGrid);
-  glTextureStorage3D(m_texGrid, 1, GL_R32UI, GRID_RES.x, GRID_RES.y, GRID_RES.z);
-  m_texGridImgHandle = glGetImageHandleARB(m_texGrid, 0, GL_FALSE, 0, GL_R32UI);
-  glMakeImageHandleResidentARB(m_texGridImgHandle, GL_READ_WRITE);
-
-  glCreateBuffers(1, &m_bufCounters);
-  glNamedBufferStorage(m_bufCounters, 4, nullptr, GL_DYNAMIC_STORAGE_BIT);
-
-  // Velocity texture
-  glCreateTextures(GL_TEXTURE_3D, 1, &m_texVelocity);
-  glTextureParameteri(m_texVelocity, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-  glTextureParameteri(m_texVelocity, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-  glTextureStorage3D(m_texVelocity, 1, GL_RGBA32F, GRID_RES.x, GRID_RES.y, GRID_RES.z);
-  m_texVelocityHandle = glGetTextureHandleARB(m_texVelocity);
-  glMakeTextureHandleResidentARB(m_texVelocityHandle);
-  m_texVelocityImgHandle = glGetImageHandleARB(m_texVelocity, 0, GL_FALSE, 0, GL_RGBA32F);
-  glMakeImageHandleResidentARB(m_texVelocityImgHandle, GL_READ_WRITE);
-
-  // Billboards index buffer
-  {
-    uint32_t billboardIndexCount = 6;
-    uint32_t billboardVertexCount = 4;
-    uint32_t billboardIndices[] = { 0, 1, 2, 2, 1, 3 };
-
-    std::vector<uint32_t> indices(billboardIndexCount * m_particleCount);
-
-    for (uint32_t i = 0; i < indices.size(); i++)
+  m_grid.cellOrder = startupOptions.cellOrder;
+  m_grid.mode = startupOptions.gridMode;
+  SimulationParams params = PARAMS;
+
+  // Initial particles, either spawned or settled ones from a checkpoint. Replays show recorded ones.
+  std::vector<Particle> particles;
+  std::unique_ptr<ReplaySimulationBackend> replay;
+  if (!startupOptions.replayPath.empty())
+  {
+    replay = ReplaySimulationBackend::create(startupOptions.replayPath, startupOptions.cpuThreadCount);
+    if (!replay)
     {
-      uint32_t particleOffset = i / billboardIndexCount;
-      uint32_t particleIndexOffset = i % billboardIndexCount;
-      indices[i] = billboardIndices[particleIndexOffset] + particleOffset * billboardVertexCount;
+      fprintf(stderr, "Unable to replay the trajectory\n");
+      abort();
     }
-
-    glCreateBuffers(1, &m_bufBillboards);
-    glNamedBufferData(m_bufBillboards, indices.size() * sizeof(uint32_t), indices.data(), GL_STATIC_DRAW);
+    m_grid = replay->grid();
+    params = replay->params();
+    m_particleCount = replay->particleCount();
+  }
+  else if (!startupOptions.restorePath.empty())
+  {
+    CheckpointState checkpoint;
+    if (!readCheckpoint(startupOptions.restorePath, checkpoint))
+    {
+      fprintf(stderr, "Unable to restore the simulation\n");
+      abort();
+    }
+    const CheckpointHeader& header = checkpoint.header;
+    m_grid = checkpoint.grid();
+    params = header.params;
+    m_particleCount = header.particleCount;
+    m_seed = header.seed;
+    m_frame = header.frame;
+    m_step = header.step;
+    m_simTime = header.time;
+    m_integrationsPerFrame = header.integrationsPerFrame;
+    std::copy(header.gravity, header.gravity + 3, m_options.gravity);
+    m_options.deltaTimeMod = header.deltaTimeMod;
+    m_options.colorMode = header.colorMode;
+    m_options.pointScale = header.pointScale;
+    particles = std::move(checkpoint.particles);
+  }
+  else
+  {
+    m_particleCount = std::clamp(startupOptions.particleCount, 1u, ParticleSpawner::maxBlockParticleCount(SPAWN_DENSITY, m_grid, params));
+    particles = ParticleSpawner::spawnBlock(m_particleCount, m_seed, SPAWN_DENSITY, m_grid, params);
   }
 
-  // Initial particles
-  std::vector<Particle> particles;
-  particles.resize(m_particleCount);
-  for (uint32_t i = 0; i < m_particleCount; ++i)
-  {
-    Particle& p = particles[i];
-    const float x = ((std::rand() % 10000) / 10000.0f) * (GRID_SIZE.x * 0.5);
-    const float y = ((std::rand() % 10000) / 10000.0f) * (GRID_SIZE.y * 0.5);
-    const float z = ((std::rand() % 10000) / 10000.0f) * (GRID_SIZE.z * 0.5);
-    p.position_x = GRID_ORIGIN.x + GRID_SIZE.x * 0.25f + x;
-    p.position_y = GRID_ORIGIN.y + GRID_SIZE.y * 0.25f + y;
-    p.position_z = GRID_ORIGIN.z + GRID_SIZE.z * 0.25f + z;
-    p.density = 0.0f;
-    p.velocity_x = 0.0f;
-    p.velocity_y = 0.0f;
-    p.velocity_z = 0.0f;
-    p.pressure = 0.0f;
-  }
-
-  const auto size = m_particleCount * sizeof(Particle);
-  glCreateBuffers(1, &m_bufParticles1);
-  glCreateBuffers(1, &m_bufParticles2);
-  glNamedBufferStorage(m_bufParticles1, size, particles.data(), 0);
-  glNamedBufferStorage(m_bufParticles2, size, particles.data(), 0);
-
-  glCreateVertexArrays(1, &m_vao1);
-  glVertexArrayElementBuffer(m_vao1, m_bufBillboards);
-  glCreateVertexArrays(1, &m_vao2);
-  glVertexArrayElementBuffer(m_vao2, m_bufBillboards);
-
-  // Default state
-  glClearColor(1.0f, 1.0f, 1.0f, 0.0f);
-  glEnable(GL_DEPTH_TEST);
-  glDepthMask(GL_TRUE);
-
-  // Textures and buffers
-  createFrameObjects();
+  m_renderer = std::make_unique<FluidRenderer>(width, height, m_particleCount, m_grid, Camera::NEAR_PLANE, Camera::FAR_PLANE);
 
   // Timer queries
   m_queries = std::make_unique<GlQueryRetriever>();
-}
-
-void flut::Simulation::createFrameObjects()
-{
-  glCreateTextures(GL_TEXTURE_2D, 1, &m_texDepth);
-  glTextureStorage2D(m_texDepth, 1, GL_DEPTH_COMPONENT24, m_width, m_height);
-  glTextureParameteri(m_texDepth, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-  glTextureParameteri(m_texDepth, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-  m_texDepthHandle = glGetTextureHandleARB(m_texDepth);
-  glMakeTextureHandleResidentARB(m_texDepthHandle);
 
-  glCreateTextures(GL_TEXTURE_2D, 1, &m_texColor);
-  glTextureStorage2D(m_texColor, 1, GL_RGB32F, m_width, m_height);
-  glTextureParameteri(m_texColor, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-  glTextureParameteri(m_texColor, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-  m_texColorHandle = glGetTextureHandleARB(m_texColor);
-  glMakeTextureHandleResidentARB(m_texColorHandle);
-
-  glCreateTextures(GL_TEXTURE_2D, 1, &m_texTemp1);
-  glTextureStorage2D(m_texTemp1, 1, GL_R32F, m_width, m_height);
-  glTextureParameteri(m_texTemp1, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-  glTextureParameteri(m_texTemp1, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-  m_texTemp1Handle = glGetTextureHandleARB(m_texTemp1);
-  glMakeTextureHandleResidentARB(m_texTemp1Handle);
-
-  glCreateTextures(GL_TEXTURE_2D, 1, &m_texTemp2);
-  glTextureStorage2D(m_texTemp2, 1, GL_R32F, m_width, m_height);
-  glTextureParameteri(m_texTemp2, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-  glTextureParameteri(m_texTemp2, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-  m_texTemp2Handle = glGetTextureHandleARB(m_texTemp2);
-  glMakeTextureHandleResidentARB(m_texTemp2Handle);
-
-  glCreateFramebuffers(1, &m_fbo1);
-  glNamedFramebufferTexture(m_fbo1, GL_DEPTH_ATTACHMENT, m_texDepth, 0);
-  glNamedFramebufferTexture(m_fbo1, GL_COLOR_ATTACHMENT0, m_texColor, 0);
-
-  glCreateFramebuffers(1, &m_fbo2);
-  glNamedFramebufferTexture(m_fbo2, GL_COLOR_ATTACHMENT0, m_texTemp1, 0);
-
-  glCreateFramebuffers(1, &m_fbo3);
-  glNamedFramebufferTexture(m_fbo3, GL_COLOR_ATTACHMENT0, m_texTemp2, 0);
-}
+  if (m_readbackInterval > 0)
+  {
+    m_readback = std::make_unique<GlParticleReadback>();
+  }
 
-void flut::Simulation::deleteFrameObjects()
-{
-  glDeleteFramebuffers(1, &m_fbo1);
-  glDeleteFramebuffers(1, &m_fbo2);
-  glDeleteFramebuffers(1, &m_fbo3);
+  if (replay)
+  {
+    if (!startupOptions.trajectoryPath.empty() || m_checkpointInterval > 0)
+    {
+      fprintf(stderr, "Replays are neither recorded nor checkpointed\n");
+    }
+    m_replay = replay.get();
+    m_backend = std::move(replay);
+  }
+  else if (startupOptions.backend == BackendType::Cpu)
+  {
+    m_backend = std::make_unique<CpuSimulationBackend>(particles, m_grid, params, startupOptions.cpuThreadCount, startupOptions.cpuIsa,
+                                                       startupOptions.neighborLists);
 
-  glMakeTextureHandleNonResidentARB(m_texDepthHandle);
-  glDeleteTextures(1, &m_texDepth);
+    createHostBuffers();
+    uploadHostParticles(particles.data());
 
-  glMakeTextureHandleNonResidentARB(m_texColorHandle);
-  glDeleteTextures(1, &m_texColor);
+    if (startupOptions.glKernelMode != GlKernelMode::PerParticle)
+    {
+      fprintf(stderr, "Cell-tiled kernels are only supported by the GL backend\n");
+    }
+    if (startupOptions.sleep.velocityThreshold > 0.0f)
+    {
+      fprintf(stderr, "Sleeping particles are only supported by the GL backend\n");
+    }
+    if (startupOptions.timeStep.cfl > 0.0f)
+    {
+      fprintf(stderr, "The adaptive time step is only supported by the GL backend\n");
+    }
+  }
+  else
+  {
+    if (startupOptions.neighborLists.skin > 0.0f)
+    {
+      fprintf(stderr, "Neighbor lists are only supported by the CPU backend\n");
+    }
+    if (startupOptions.sleep.velocityThreshold > 0.0f && startupOptions.glKernelMode != GlKernelMode::PerParticle)
+    {
+      fprintf(stderr, "Sleeping particles are only supported with per-particle kernels\n");
+    }
+    m_backend = std::make_unique<GlSimulationBackend>(particles, m_grid, params, m_queries.get(), startupOptions.glKernelMode,
+                                                      startupOptions.sleep, startupOptions.timeStep, std::move(workerContext));
+    m_adaptiveTimeStep = startupOptions.timeStep.cfl > 0.0f;
+  }
 
-  glMakeTextureHandleNonResidentARB(m_texTemp1Handle);
-  glDeleteTextures(1, &m_texTemp1);
+  if (!startupOptions.trajectoryPath.empty() && !m_replay)
+  {
+    TrajectoryWriter::Config trajectory = startupOptions.trajectory;
+    trajectory.frameInterval = m_adaptiveTimeStep ? 0 : m_trajectoryInterval;
+    m_trajectory = TrajectoryWriter::create(startupOptions.trajectoryPath, m_particleCount, m_grid, params,
+                                            m_adaptiveTimeStep ? 0.0f : DT, trajectory);
+    if (m_trajectory && m_backend->particleBuffers().positions != 0)
+    {
+      m_trajectoryReadback = std::make_unique<GlParticleReadback>(trajectoryReadbackSlots(), true);
+    }
+  }
 
-  glMakeTextureHandleNonResidentARB(m_texTemp2Handle);
-  glDeleteTextures(1, &m_texTemp2);
+  if (!startupOptions.checkpointPath.empty() && m_checkpointInterval > 0 && !m_replay)
+  {
+    m_checkpointWriter = std::make_unique<CheckpointWriter>(startupOptions.checkpointPath);
+    if (m_backend->particleBuffers().positions != 0)
+    {
+      m_checkpointReadback = std::make_unique<GlParticleReadback>();
+    }
+  }
 }
 
 Simulation::~Simulation()
 {
-  deleteFrameObjects();
-  glDeleteProgram(m_programSimStep1);
-  glDeleteProgram(m_programSimStep2);
-  glDeleteProgram(m_programSimStep3);
-  glDeleteProgram(m_programSimStep5);
-  glDeleteProgram(m_programSimStep6);
-  glDeleteProgram(m_programRenderGeometry);
-  glDeleteProgram(m_programRenderCurvature);
-  glDeleteProgram(m_programRenderShading);
-  glDeleteBuffers(1, &m_bufBBoxVertices);
-  glDeleteBuffers(1, &m_bufBBoxIndices);
-  glDeleteBuffers(1, &m_bufParticles1);
-  glDeleteBuffers(1, &m_bufParticles2);
-  glMakeImageHandleNonResidentARB(m_texGridImgHandle);
-  glDeleteTextures(1, &m_texGrid);
-  glMakeImageHandleNonResidentARB(m_texVelocityImgHandle);
-  glMakeTextureHandleNonResidentARB(m_texVelocityHandle);
-  glDeleteTextures(1, &m_texVelocity);
-  glDeleteBuffers(1, &m_bufCounters);
-  glDeleteVertexArrays(1, &m_vao1);
-  glDeleteVertexArrays(1, &m_vao2);
-  glDeleteVertexArrays(1, &m_vao3);
+  m_backend.reset();
+  m_renderer.reset();
+  m_readback.reset();
+  m_trajectoryReadback.reset();
+  m_trajectory.reset();
+  m_checkpointReadback.reset();
+  m_checkpointWriter.reset();
+  deleteHostBuffers();
 }
 
 void Simulation::render(const Camera& camera, float dt)
@@ -307,168 +188,113 @@ void Simulation::render(const Camera& camera, float dt)
   {
     m_width = m_newWidth;
     m_height = m_newHeight;
-    deleteFrameObjects();
-    createFrameObjects();
-  }
-
-  for (uint32_t f = 0; f < m_integrationsPerFrame; f++)
-  {
-    float dt = DT * m_options.deltaTimeMod;
-
-    auto singleDimGroupCountForParticles = [this](uint32_t groupSize) {
-      assert(groupSize <= MAX_GROUP_SIZE && (m_particleCount % groupSize) == 0);
-      return m_particleCount / groupSize;
-    };
-
-    // Step 1: Integrate position, do boundary handling.
-    //         Write particle count to voxel grid.
-    m_queries->beginSimQuery(0);
-    const uint32_t fClearValue = 0;
-    glClearTexImage(m_texGrid, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, &fClearValue);
-    glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT);
-
-    glUseProgram(m_programSimStep1);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, m_swapFrame ? m_bufParticles1 : m_bufParticles2);
-    glProgramUniformHandleui64ARB(m_programSimStep1, 0, m_texGridImgHandle);
-    glProgramUniform1f(m_programSimStep1, 1, dt);
-    glDispatchCompute(singleDimGroupCountForParticles(32), 1, 1);
-    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
-    m_queries->endQuery();
-
-    // Step 2: Write global particle array offsets into voxel grid.
-    m_queries->beginSimQuery(1);
-    const uint32_t uiClearValue = 0;
-    glClearNamedBufferData(m_bufCounters, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &uiClearValue);
-    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    m_renderer->resize(m_width, m_height);
+  }
 
-    glUseProgram(m_programSimStep2);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, m_bufCounters);
-    glProgramUniformHandleui64ARB(m_programSimStep2, 0, m_texGridImgHandle);
-    glDispatchCompute(
-      (GRID_RES.x + 4 - 1) / 4,
-      (GRID_RES.y + 4 - 1) / 4,
-      (GRID_RES.z + 4 - 1) / 4
-    );
-    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
-    m_queries->endQuery();
-
-    // Step 3: Write particles to new location in second particle buffer.
-    //         Write particle count to voxel grid (again).
-    m_queries->beginSimQuery(2);
-    glUseProgram(m_programSimStep3);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, m_swapFrame ? m_bufParticles1 : m_bufParticles2);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, m_swapFrame ? m_bufParticles2 : m_bufParticles1);
-    glProgramUniformHandleui64ARB(m_programSimStep3, 0, m_texGridImgHandle);
-    glDispatchCompute(singleDimGroupCountForParticles(32), 1, 1);
-    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
-    m_queries->endQuery();
-
-    // Step 4: Write average voxel velocities into second 3D-texture.
-    m_queries->beginSimQuery(3);
-    glUseProgram(m_programSimStep4);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, m_swapFrame ? m_bufParticles2 : m_bufParticles1);
-    glProgramUniformHandleui64ARB(m_programSimStep4, 0, m_texGridImgHandle);
-    glProgramUniformHandleui64ARB(m_programSimStep4, 1, m_texVelocityImgHandle);
-    glDispatchCompute(
-      (GRID_RES.x + 4 - 1) / 4,
-      (GRID_RES.y + 4 - 1) / 4,
-      (GRID_RES.z + 4 - 1) / 4
-    );
-    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
-    m_queries->endQuery();
-
-    // Step 5: Compute density and pressure for each particle.
-    m_queries->beginSimQuery(4);
-    glUseProgram(m_programSimStep5);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, m_swapFrame ? m_bufParticles2 : m_bufParticles1);
-    glProgramUniformHandleui64ARB(m_programSimStep5, 0, m_texGridImgHandle);
-    glDispatchCompute(singleDimGroupCountForParticles(64), 1, 1);
-    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
-    m_queries->endQuery();
-
-    // Step 6: Compute pressure and viscosity forces, use them to write new velocity.
-    //         For the old velocity, we use the coarse 3d-texture and do trilinear HW filtering.
-    m_queries->beginSimQuery(5);
-    glUseProgram(m_programSimStep6);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, m_swapFrame ? m_bufParticles2 : m_bufParticles1);
-    glProgramUniformHandleui64ARB(m_programSimStep6, 0, m_texGridImgHandle);
-    glProgramUniformHandleui64ARB(m_programSimStep6, 1, m_texVelocityHandle);
-    glProgramUniform1f(m_programSimStep6, 2, dt);
-    glProgramUniform3fv(m_programSimStep6, 3, 1, &m_options.gravity[0]);
-    glDispatchCompute(singleDimGroupCountForParticles(64), 1, 1);
-    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
-    m_queries->endQuery();
-
-    m_swapFrame = !m_swapFrame;
-    m_queries->incSimIter();
-  }
-
-  // Step 7: Render the geometry as screen-space spheres.
-  m_queries->beginRenderQuery();
-  glBindFramebuffer(GL_FRAMEBUFFER, m_fbo1);
-  glUseProgram(m_programRenderGeometry);
-  glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
-  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-  const float pointRadius = KERNEL_RADIUS * m_options.pointScale;
+  const glm::vec3 gravity(m_options.gravity[0], m_options.gravity[1], m_options.gravity[2]);
+
+  // Replays play back as much simulated time per frame as the simulation would advance.
+  if (m_replay)
+  {
+    m_replay->update(DT * m_options.deltaTimeMod * m_integrationsPerFrame);
+    m_step = m_replay->step();
+    m_simTime = m_replay->time();
+  }
+  // The adaptive time step advances as much simulated time as the fixed integrations would, in as
+  // few integrations as are stable.
+  else if (m_adaptiveTimeStep)
+  {
+    const float frameTime = DT * m_options.deltaTimeMod * m_integrationsPerFrame;
+    const uint64_t previousStep = m_step;
+    m_step += m_backend->advance(frameTime, gravity);
+
+    // The GPU drops time which the CFL limit cannot catch up with, which becomes known a few frames
+    // later. It is taken off at most one frame at a time, so that the simulated time never decreases.
+    double dropped = 0.0;
+    if (m_backend->readTimeStepStats(m_timeStepStats))
+    {
+      dropped = std::min(double(m_timeStepStats.totalDroppedTime) - m_droppedTime, double(frameTime));
+      m_droppedTime += dropped;
+    }
+    m_simTime += frameTime - dropped;
+
+    // A frame runs several integrations, so it is recorded whenever they cross a multiple of the interval.
+    if (m_trajectory && m_step / m_trajectoryInterval != previousStep / m_trajectoryInterval)
+    {
+      recordTrajectory();
+    }
+  }
+  else
+  {
+    for (uint32_t f = 0; f < m_integrationsPerFrame; f++)
+    {
+      float dt = DT * m_options.deltaTimeMod;
+
+      m_backend->step(dt, gravity);
+
+      m_step++;
+      m_simTime += dt;
+      if (m_trajectory && m_step % m_trajectoryInterval == 0)
+      {
+        recordTrajectory();
+      }
+    }
+  }
+
+  // The steps above applied the configuration of the checkpoint, which replaces their result.
+  if (m_pendingCheckpoint && !m_backend->reconfiguring())
+  {
+    applyCheckpoint(*m_pendingCheckpoint);
+    m_pendingCheckpoint.reset();
+  }
+
+  // The backend switches to a new configuration on its own time.
+  if (m_backend->grid() != m_grid)
+  {
+    m_grid = m_backend->grid();
+    m_renderer->setGrid(m_grid);
+  }
+
+  ParticleBuffers particleBuffers = m_backend->particleBuffers();
+  if (particleBuffers.positions == 0)
+  {
+    uploadHostParticles(m_backend->hostParticles());
+    particleBuffers = m_hostBuffers;
+  }
+
+  if (m_readback)
+  {
+    if (m_frame % m_readbackInterval == 0)
+    {
+      m_readback->request(particleBuffers, m_backend->particleCount(), m_frame);
+    }
+    m_readback->update(m_frame);
+  }
+
+  if (m_trajectoryReadback)
+  {
+    m_trajectoryReadback->update(m_frame);
+    writeTrajectoryReadbacks();
+  }
+
+  if (m_checkpointWriter)
+  {
+    updateCheckpoints(particleBuffers);
+  }
+
+  const float pointRadius = m_backend->params().kernelRadius * m_options.pointScale;
   const auto& view = camera.view();
   const auto& projection = camera.projection();
   const auto& invProjection = camera.invProjection();
-  const glm::mat4 vp = projection * view;
-  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, m_swapFrame ? m_bufParticles2 : m_bufParticles1);
-  glProgramUniformMatrix4fv(m_programRenderGeometry, 0, 1, GL_FALSE, glm::value_ptr(vp));
-  glProgramUniformMatrix4fv(m_programRenderGeometry, 1, 1, GL_FALSE, glm::value_ptr(view));
-  glProgramUniformMatrix4fv(m_programRenderGeometry, 2, 1, GL_FALSE, glm::value_ptr(projection));
-  glProgramUniform3fv(m_programRenderGeometry, 3, 1, glm::value_ptr(GRID_SIZE));
-  glProgramUniform3fv(m_programRenderGeometry, 4, 1, glm::value_ptr(GRID_ORIGIN));
-  glProgramUniform3iv(m_programRenderGeometry, 5, 1, glm::value_ptr(GRID_RES));
-  glProgramUniform1ui(m_programRenderGeometry, 6, m_particleCount);
-  glProgramUniform1f(m_programRenderGeometry, 7, pointRadius);
-  glProgramUniform1i(m_programRenderGeometry, 8, m_options.colorMode);
-  glBindVertexArray(m_swapFrame ? m_vao2 : m_vao1);
-  const uint32_t index_count = 6 * m_particleCount;
-  glDrawElements(GL_TRIANGLES, index_count, GL_UNSIGNED_INT, nullptr);
-
-  // Step 7.1: Perform curvature flow (multiple iterations).
-  const uint32_t bboxTriVertexCount = 36;
-  glDisable(GL_DEPTH_TEST);
-  glBindVertexArray(m_vao3);
-  glUseProgram(m_programRenderCurvature);
-  glProgramUniformMatrix4fv(m_programRenderCurvature, 0, 1, GL_FALSE, glm::value_ptr(vp));
-  glProgramUniformMatrix4fv(m_programRenderCurvature, 2, 1, GL_FALSE, glm::value_ptr(projection));
-  glProgramUniform2i(m_programRenderCurvature, 3, m_width, m_height);
-
-  GLuint64 inputDepthTexHandle = m_texDepthHandle;
-  bool swap = false;
-  for (uint32_t i = 0; i < SMOOTH_ITERATIONS; ++i)
-  {
-    glBindFramebuffer(GL_FRAMEBUFFER, swap ? m_fbo3 : m_fbo2);
-    glClear(GL_COLOR_BUFFER_BIT);
-    glProgramUniformHandleui64ARB(m_programRenderCurvature, 1, inputDepthTexHandle);
-    glDrawElements(GL_TRIANGLES, bboxTriVertexCount, GL_UNSIGNED_INT, nullptr);
-    inputDepthTexHandle = swap ? m_texTemp2Handle : m_texTemp1Handle;
-    swap = !swap;
-  }
-
-  // Step 7.2: Do blinn-phong shading.
-  glBindFramebuffer(GL_FRAMEBUFFER, 0);
-  glViewport(0, 0, m_width, m_height);
-  glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
-  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-  glUseProgram(m_programRenderShading);
-  glProgramUniformMatrix4fv(m_programRenderShading, 0, 1, GL_FALSE, glm::value_ptr(vp));
-  glProgramUniformHandleui64ARB(m_programRenderShading, 1, inputDepthTexHandle);
-  glProgramUniformHandleui64ARB(m_programRenderShading, 2, m_texColorHandle);
-  glProgramUniform1ui(m_programRenderShading, 3, m_width);
-  glProgramUniform1ui(m_programRenderShading, 4, m_height);
-  glProgramUniformMatrix4fv(m_programRenderShading, 5, 1, GL_FALSE, glm::value_ptr(invProjection));
-  glProgramUniformMatrix4fv(m_programRenderShading, 6, 1, GL_FALSE, glm::value_ptr(view));
-  glDrawElements(GL_TRIANGLES, bboxTriVertexCount, GL_UNSIGNED_INT, nullptr);
-  glEnable(GL_DEPTH_TEST);
 
+  m_queries->beginRenderQuery();
+  m_renderer->renderGeometry(particleBuffers, view, projection, pointRadius, m_options.colorMode);
+  m_renderer->renderCurvatureFlow(view, projection);
+  m_renderer->renderShading(view, projection, invProjection);
   m_queries->endQuery();
 
   m_queries->readFinishedQueries(m_time);
+  m_backend->readTimes(m_time);
 
   m_queries->incFrame();
 }
@@ -492,9 +318,388 @@ const Simulation::SimulationTimes& Simulation::times() const
 void flut::Simulation::setIntegrationsPerFrame(uint32_t ipF)
 {
   m_integrationsPerFrame = ipF;
+  if (m_trajectoryReadback)
+  {
+    m_trajectoryReadback->reserve(trajectoryReadbackSlots());
+  }
+}
+
+uint32_t flut::Simulation::integrationsPerFrame() const
+{
+  return m_integrationsPerFrame;
 }
 
 uint32_t flut::Simulation::particleCount() const
 {
   return m_particleCount;
 }
+
+void flut::Simulation::setParticleCount(uint32_t particleCount)
+{
+  if (m_replay)
+  {
+    fprintf(stderr, "The particle count of a replay is fixed\n");
+    return;
+  }
+
+  m_particleCount = std::clamp(particleCount, 1u, maxParticleCount());
+
+  const std::vector<Particle> particles = ParticleSpawner::spawnBlock(m_particleCount, m_seed, SPAWN_DENSITY, m_grid, m_backend->params());
+
+  m_backend->setParticles(particles);
+  m_renderer->setParticleCount(m_particleCount);
+
+  if (m_hostBuffers.positions != 0)
+  {
+    createHostBuffers();
+    uploadHostParticles(particles.data());
+  }
+}
+
+void flut::Simulation::createHostBuffers()
+{
+  deleteHostBuffers();
+
+  glCreateBuffers(1, &m_hostBuffers.positions);
+  glCreateBuffers(1, &m_hostBuffers.velocities);
+  glCreateBuffers(1, &m_hostBuffers.densities);
+  glNamedBufferStorage(m_hostBuffers.positions, m_particleCount * sizeof(glm::vec4), nullptr, GL_DYNAMIC_STORAGE_BIT);
+  glNamedBufferStorage(m_hostBuffers.velocities, m_particleCount * sizeof(glm::vec4), nullptr, GL_DYNAMIC_STORAGE_BIT);
+  glNamedBufferStorage(m_hostBuffers.densities, m_particleCount * sizeof(glm::vec2), nullptr, GL_DYNAMIC_STORAGE_BIT);
+}
+
+void flut::Simulation::deleteHostBuffers()
+{
+  glDeleteBuffers(1, &m_hostBuffers.positions);
+  glDeleteBuffers(1, &m_hostBuffers.velocities);
+  glDeleteBuffers(1, &m_hostBuffers.densities);
+  m_hostBuffers = ParticleBuffers{};
+}
+
+void flut::Simulation::uploadHostParticles(const Particle* particles)
+{
+  m_hostVec4Staging.resize(m_particleCount);
+  m_hostVec2Staging.resize(m_particleCount);
+
+  for (uint32_t i = 0; i < m_particleCount; i++)
+  {
+    m_hostVec4Staging[i] = glm::vec4(particles[i].position_x, particles[i].position_y, particles[i].position_z, 0.0f);
+    m_hostVec2Staging[i] = glm::vec2(particles[i].density, particles[i].pressure);
+  }
+  glNamedBufferSubData(m_hostBuffers.positions, 0, m_particleCount * sizeof(glm::vec4), m_hostVec4Staging.data());
+  glNamedBufferSubData(m_hostBuffers.densities, 0, m_particleCount * sizeof(glm::vec2), m_hostVec2Staging.data());
+
+  for (uint32_t i = 0; i < m_particleCount; i++)
+  {
+    m_hostVec4Staging[i] = glm::vec4(particles[i].velocity_x, particles[i].velocity_y, particles[i].velocity_z, 0.0f);
+  }
+  glNamedBufferSubData(m_hostBuffers.velocities, 0, m_particleCount * sizeof(glm::vec4), m_hostVec4Staging.data());
+}
+
+uint32_t flut::Simulation::maxParticleCount() const
+{
+  return ParticleSpawner::maxBlockParticleCount(SPAWN_DENSITY, m_grid, m_backend->params());
+}
+
+void flut::Simulation::reconfigure(const glm::vec3& domainSize, const SimulationParams& params)
+{
+  SimulationGrid grid = SimulationGrid::fromSize(domainSize, params.kernelRadius);
+  grid.cellOrder = m_grid.cellOrder;
+  grid.mode = m_grid.mode;
+
+  if (m_pendingCheckpoint)
+  {
+    fprintf(stderr, "A checkpoint is being restored, the configuration is unchanged\n");
+    return;
+  }
+  m_backend->reconfigure(grid, params);
+}
+
+bool flut::Simulation::reconfiguring() const
+{
+  return m_backend->reconfiguring();
+}
+
+const SimulationGrid& flut::Simulation::grid() const
+{
+  return m_grid;
+}
+
+const SimulationParams& flut::Simulation::params() const
+{
+  return m_backend->params();
+}
+
+const char* flut::Simulation::backendName() const
+{
+  return m_backend->name();
+}
+
+size_t flut::Simulation::gridMemoryBytes() const
+{
+  return m_backend->gridMemoryBytes();
+}
+
+const TimeStepStats* flut::Simulation::timeStepStats() const
+{
+  return m_adaptiveTimeStep ? &m_timeStepStats : nullptr;
+}
+
+GlParticleReadback* flut::Simulation::readback()
+{
+  return m_readback.get();
+}
+
+ReplaySimulationBackend* flut::Simulation::replay()
+{
+  return m_replay;
+}
+
+const TrajectoryWriter* flut::Simulation::trajectory() const
+{
+  return m_trajectory.get();
+}
+
+void flut::Simulation::recordTrajectory()
+{
+  if (m_backend->particleCount() != m_trajectory->particleCount())
+  {
+    fprintf(stderr, "The particle count changed, trajectory recording stopped\n");
+    m_trajectoryReadback.reset();
+    m_trajectory.reset();
+    return;
+  }
+
+  if (m_trajectoryReadback)
+  {
+    if (!m_trajectoryReadback->request(m_backend->particleBuffers(), m_backend->particleCount(), m_frame, m_step, m_simTime))
+    {
+      m_trajectory->dropFrame();
+    }
+    return;
+  }
+
+  TrajectoryWriter::Frame frame;
+  if (!m_trajectory->beginFrame(frame))
+  {
+    return;
+  }
+  const Particle* particles = m_backend->hostParticles();
+  for (uint32_t i = 0; i < m_trajectory->particleCount(); i++)
+  {
+    frame.positions[i] = glm::vec4(particles[i].position_x, particles[i].position_y, particles[i].position_z, 0.0f);
+    frame.velocities[i] = glm::vec4(particles[i].velocity_x, particles[i].velocity_y, particles[i].velocity_z, 0.0f);
+  }
+  m_trajectory->endFrame(m_step, m_simTime);
+}
+
+void flut::Simulation::writeTrajectoryReadbacks()
+{
+  GlParticleReadback::View view;
+  while (m_trajectoryReadback->acquireNext(view))
+  {
+    TrajectoryWriter::Frame frame;
+    if (view.particleCount == m_trajectory->particleCount() && m_trajectory->beginFrame(frame))
+    {
+      const size_t size = size_t(view.particleCount) * sizeof(glm::vec4);
+      memcpy(frame.positions, view.positions, size);
+      memcpy(frame.velocities, view.velocities, size);
+      m_trajectory->endFrame(view.step, view.time);
+    }
+  }
+  m_trajectoryReadback->release();
+}
+
+uint32_t flut::Simulation::trajectoryReadbackSlots() const
+{
+  // A frame records every interval-th of its integrations, or once with the adaptive time step.
+  const uint32_t framesPerRender = m_adaptiveTimeStep ? 1 : (m_integrationsPerFrame + m_trajectoryInterval - 1) / m_trajectoryInterval;
+  return std::max(framesPerRender, 1u) * (TRAJECTORY_READBACK_LATENCY + 1);
+}
+
+bool flut::Simulation::saveCheckpoint(const std::string& path)
+{
+  CheckpointState state;
+  fillCheckpointHeader(state, m_frame, m_step, m_simTime);
+  state.particles.resize(m_backend->particleCount());
+
+  const ParticleBuffers buffers = m_backend->particleBuffers();
+  if (buffers.positions == 0)
+  {
+    std::copy_n(m_backend->hostParticles(), state.particles.size(), state.particles.data());
+  }
+  else
+  {
+    const uint32_t count = m_backend->particleCount();
+    std::vector<glm::vec4> positions(count);
+    std::vector<glm::vec4> velocities(count);
+    std::vector<glm::vec2> densities(count);
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    glGetNamedBufferSubData(buffers.positions, 0, count * sizeof(glm::vec4), positions.data());
+    glGetNamedBufferSubData(buffers.velocities, 0, count * sizeof(glm::vec4), velocities.data());
+    glGetNamedBufferSubData(buffers.densities, 0, count * sizeof(glm::vec2), densities.data());
+    for (uint32_t i = 0; i < count; i++)
+    {
+      state.particles[i] = { positions[i].x, positions[i].y, positions[i].z, densities[i].x,
+                             velocities[i].x, velocities[i].y, velocities[i].z, densities[i].y };
+    }
+  }
+
+  return writeCheckpoint(path, state);
+}
+
+bool flut::Simulation::loadCheckpoint(const std::string& path)
+{
+  if (m_replay)
+  {
+    fprintf(stderr, "Checkpoints cannot be loaded into a replay\n");
+    return false;
+  }
+
+  CheckpointState checkpoint;
+  if (!readCheckpoint(path, checkpoint))
+  {
+    return false;
+  }
+
+  // The counters jump to those of the checkpoint, which a recording cannot represent, and copies
+  // in flight carry the labels of the discarded state.
+  if (m_trajectory)
+  {
+    fprintf(stderr, "Loading a checkpoint ends the trajectory recording\n");
+    m_trajectoryReadback.reset();
+    m_trajectory.reset();
+  }
+  if (m_readback)
+  {
+    m_readback = std::make_unique<GlParticleReadback>();
+  }
+  if (m_checkpointReadback)
+  {
+    m_checkpointReadback = std::make_unique<GlParticleReadback>();
+    m_checkpointHeaders.clear();
+  }
+
+  const CheckpointHeader& header = checkpoint.header;
+  const SimulationGrid grid = checkpoint.grid();
+  if (grid != m_backend->grid() || !(header.params == m_backend->params()))
+  {
+    m_backend->reconfigure(grid, header.params);
+  }
+
+  // The particles would be clamped into the old domain until a deferred reconfiguration is applied.
+  if (m_backend->reconfiguring())
+  {
+    m_pendingCheckpoint = std::make_unique<CheckpointState>(std::move(checkpoint));
+  }
+  else
+  {
+    applyCheckpoint(checkpoint);
+  }
+  return true;
+}
+
+bool flut::Simulation::restoring() const
+{
+  return m_pendingCheckpoint != nullptr;
+}
+
+void flut::Simulation::applyCheckpoint(const CheckpointState& checkpoint)
+{
+  const CheckpointHeader& header = checkpoint.header;
+  if (m_backend->grid() != m_grid)
+  {
+    m_grid = m_backend->grid();
+    m_renderer->setGrid(m_grid);
+  }
+
+  m_particleCount = header.particleCount;
+  m_backend->setParticles(checkpoint.particles);
+  m_renderer->setParticleCount(m_particleCount);
+  if (m_hostBuffers.positions != 0)
+  {
+    createHostBuffers();
+    uploadHostParticles(checkpoint.particles.data());
+  }
+
+  m_seed = header.seed;
+  m_frame = header.frame;
+  m_step = header.step;
+  m_simTime = header.time;
+  m_integrationsPerFrame = header.integrationsPerFrame;
+  std::copy(header.gravity, header.gravity + 3, m_options.gravity);
+  m_options.deltaTimeMod = header.deltaTimeMod;
+  m_options.colorMode = header.colorMode;
+  m_options.pointScale = header.pointScale;
+}
+
+const CheckpointWriter* flut::Simulation::checkpointWriter() const
+{
+  return m_checkpointWriter.get();
+}
+
+void flut::Simulation::fillCheckpointHeader(CheckpointState& state, uint64_t frame, uint64_t step, double time) const
+{
+  CheckpointHeader& header = state.header;
+  header.frame = frame;
+  header.step = step;
+  header.time = time;
+  header.seed = m_seed;
+  header.integrationsPerFrame = m_integrationsPerFrame;
+  state.setGrid(m_grid);
+  header.params = m_backend->params();
+  std::copy(m_options.gravity, m_options.gravity + 3, header.gravity);
+  header.deltaTimeMod = m_options.deltaTimeMod;
+  header.colorMode = m_options.colorMode;
+  header.pointScale = m_options.pointScale;
+}
+
+void flut::Simulation::updateCheckpoints(const ParticleBuffers& particleBuffers)
+{
+  // While the previous checkpoint is being written, snapshots would only be skipped.
+  const bool due = m_frame % m_checkpointInterval == 0 && m_checkpointWriter->idle();
+
+  if (!m_checkpointReadback)
+  {
+    if (due)
+    {
+      CheckpointState state;
+      fillCheckpointHeader(state, m_frame, m_step, m_simTime);
+      const Particle* particles = m_backend->hostParticles();
+      state.particles.assign(particles, particles + m_backend->particleCount());
+      m_checkpointWriter->submit(std::move(state));
+    }
+    return;
+  }
+
+  if (due && m_checkpointReadback->request(particleBuffers, m_backend->particleCount(), m_frame, m_step, m_simTime))
+  {
+    CheckpointState state;
+    fillCheckpointHeader(state, m_frame, m_step, m_simTime);
+    m_checkpointHeaders.push_back(state.header);
+  }
+  m_checkpointReadback->update(m_frame);
+
+  GlParticleReadback::View view;
+  if (m_checkpointReadback->acquire(view))
+  {
+    // Older readbacks are superseded by the acquired one, or were replaced by later requests.
+    while (m_checkpointHeaders.front().frame != view.frame)
+    {
+      m_checkpointHeaders.pop_front();
+    }
+    CheckpointState state;
+    state.header = m_checkpointHeaders.front();
+    m_checkpointHeaders.pop_front();
+    state.particles.resize(view.particleCount);
+    for (uint32_t i = 0; i < view.particleCount; i++)
+    {
+      const glm::vec4& position = view.positions[i];
+      const glm::vec4& velocity = view.velocities[i];
+      const glm::vec2& density = view.densities[i];
+      state.particles[i] = { position.x, position.y, position.z, density.x, velocity.x, velocity.y, velocity.z, density.y };
+    }
+    m_checkpointReadback->release();
+    m_checkpointWriter->submit(std::move(state));
+  }
+}
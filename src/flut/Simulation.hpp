@@ -3,16 +3,64 @@
 #include <glm/glm.hpp>
 #include <glad/glad.h>
 #include <stdint.h>
+#include <deque>
 #include <memory>
+#include <string>
+#include <vector>
 
-#include "Camera.hpp"
+#include "Checkpoint.hpp"
+#include "CpuKernels.hpp"
 #include "GlQueryRetriever.hpp"
+#include "GlShaderCompiler.hpp"
+#include "SimulationBackend.hpp"
+#include "TrajectoryWriter.hpp"
 
 namespace flut
 {
+  class Camera;
+  class FluidRenderer;
+  class GlParticleReadback;
+  class ReplaySimulationBackend;
+
   class Simulation
   {
   public:
+    enum class BackendType
+    {
+      Gl,
+      Cpu
+    };
+
+    struct StartupOptions
+    {
+      BackendType backend = BackendType::Gl;
+      CpuIsa cpuIsa = CpuKernels::bestIsa();
+      uint32_t cpuThreadCount = 0;
+      uint32_t particleCount = DEFAULT_PARTICLE_COUNT;
+      uint32_t seed = 1;
+      CellOrder cellOrder = CellOrder::Linear;
+      GridMode gridMode = GridMode::Dense;
+      // Only supported by the CPU backend.
+      NeighborListConfig neighborLists;
+      // Only supported by the GL backend.
+      GlKernelMode glKernelMode = GlKernelMode::PerParticle;
+      SleepConfig sleep;
+      TimeStepConfig timeStep;
+      // Copies the particles to the CPU every N frames without stalling, 0 disables the readback.
+      uint32_t readbackInterval = 0;
+      // Records the positions and velocities every N integrations into this file, if not empty.
+      std::string trajectoryPath;
+      TrajectoryWriter::Config trajectory;
+      // Starts from this checkpoint instead of spawning the fluid, if not empty.
+      std::string restorePath;
+      // Snapshots the state every N frames without stalling and writes it to checkpointPath on a
+      // background thread, 0 disables the periodic checkpoints.
+      std::string checkpointPath;
+      uint32_t checkpointInterval = 0;
+      // Plays back this trajectory file instead of simulating, if not empty.
+      std::string replayPath;
+    };
+
     struct SimulationOptions
     {
       float gravity[3] = {0.0f, -9.81f, 0.0f};
@@ -33,19 +81,25 @@ namespace flut
     constexpr static float VIS_COEFF = 0.035f;
     constexpr static float REST_DENSITY = 998.27f;
     constexpr static float REST_PRESSURE = 0.0f;
-    constexpr static uint32_t MIN_PARTICLE_COUNT = 100000;
-
-    const glm::vec3 GRID_SIZE = glm::vec3{ 11.0f, 8.0f, 2.5f } * glm::vec3{ 2.0f };
-    const glm::vec3 GRID_ORIGIN = GRID_SIZE * -0.5f;
-    const glm::ivec3 GRID_RES = glm::ivec3((GRID_SIZE / CELL_SIZE) + 1.0f);
-    const uint32_t GRID_VOXEL_COUNT = GRID_RES.x * GRID_RES.y * GRID_RES.z;
-
-  private:
-    constexpr static uint32_t SMOOTH_ITERATIONS = 50;
-    constexpr static uint32_t MAX_GROUP_SIZE = 512;
+    // With the constants above, the fluid settles far below REST_DENSITY: a lattice at REST_DENSITY
+    // holds ~300 particles per grid cell. Spawning close to the settled density avoids the initial
+    // pressure explosion.
+    constexpr static float SPAWN_DENSITY = 6.0f;
+    constexpr static uint32_t DEFAULT_PARTICLE_COUNT = 100000;
+    // Frames after which the readback of a trajectory frame is usually seen finished.
+    constexpr static uint32_t TRAJECTORY_READBACK_LATENCY = 3;
+
+    inline static const glm::vec3 GRID_SIZE = glm::vec3{ 11.0f, 8.0f, 2.5f } * glm::vec3{ 2.0f };
+    inline static const glm::vec3 GRID_ORIGIN = GRID_SIZE * -0.5f;
+    inline static const glm::ivec3 GRID_RES = glm::ivec3((GRID_SIZE / CELL_SIZE) + 1.0f);
+    inline static const uint32_t GRID_VOXEL_COUNT = GRID_RES.x * GRID_RES.y * GRID_RES.z;
+    inline static const SimulationGrid GRID = { GRID_SIZE, GRID_ORIGIN, GRID_RES };
+    inline static const SimulationParams PARAMS = { MASS, KERNEL_RADIUS, STIFFNESS, VIS_COEFF, REST_DENSITY, REST_PRESSURE };
 
   public:
-    Simulation(uint32_t width, uint32_t height);
+    // The GL backend compiles the shaders of reconfigurations on the worker context, if one is given.
+    Simulation(uint32_t width, uint32_t height, const StartupOptions& startupOptions,
+               GlShaderCompiler::ContextFunc workerContext = nullptr);
 
     ~Simulation();
 
@@ -60,12 +114,80 @@ namespace flut
 
     void setIntegrationsPerFrame(uint32_t ipF);
 
+    uint32_t integrationsPerFrame() const;
+
     uint32_t particleCount() const;
 
+    // Respawns the fluid with the given number of particles, clamped to what fits into the domain.
+    void setParticleCount(uint32_t particleCount);
+
+    uint32_t maxParticleCount() const;
+
+    // Resizes the domain, with a grid whose cells are as large as the kernel radius, and changes the
+    // physical constants. The fluid keeps its state; the change may take effect a few frames later.
+    void reconfigure(const glm::vec3& domainSize, const SimulationParams& params);
+
+    bool reconfiguring() const;
+
+    const SimulationGrid& grid() const;
+
+    const SimulationParams& params() const;
+
+    const char* backendName() const;
+
+    size_t gridMemoryBytes() const;
+
+    // Time steps of a recent frame, or nullptr with the fixed time step.
+    const TimeStepStats* timeStepStats() const;
+
+    // Particle state of recent frames, or nullptr without a readback interval.
+    GlParticleReadback* readback();
+
+    // Playback controls, or nullptr if the simulation is not a replay.
+    ReplaySimulationBackend* replay();
+
+    // Stats of the trajectory recording, or nullptr if nothing is recorded.
+    const TrajectoryWriter* trajectory() const;
+
+    // Writes the particles, the grid, the physical constants, the options and the frame counters.
+    // Waits for the GPU to finish the pending steps.
+    bool saveCheckpoint(const std::string& path);
+
+    // Continues the simulation from a checkpoint. A different grid is applied like reconfigure(), and
+    // the particles are restored once it has taken effect.
+    bool loadCheckpoint(const std::string& path);
+
+    // True while a loaded checkpoint waits for its configuration to take effect.
+    bool restoring() const;
+
+    // Stats of the periodic checkpoints, or nullptr if they are disabled.
+    const CheckpointWriter* checkpointWriter() const;
+
   private:
-    void createFrameObjects();
+    // Backends whose state lives in host memory are rendered from these buffers.
+    void createHostBuffers();
+
+    void deleteHostBuffers();
+
+    void uploadHostParticles(const Particle* particles);
+
+    // Queues the current state for the trajectory file. GL state goes through a readback first.
+    void recordTrajectory();
+
+    // Hands the finished trajectory readbacks to the writer.
+    void writeTrajectoryReadbacks();
+
+    // Readback buffers which hold the trajectory frames of a rendered frame until they are written.
+    uint32_t trajectoryReadbackSlots() const;
+
+    // Fills in the header of a checkpoint from the current configuration.
+    void fillCheckpointHeader(CheckpointState& state, uint64_t frame, uint64_t step, double time) const;
+
+    // Replaces the particles, the counters and the options with those of a checkpoint.
+    void applyCheckpoint(const CheckpointState& state);
 
-    void deleteFrameObjects();
+    // Takes the periodic checkpoint snapshots and hands them to the writer.
+    void updateCheckpoints(const ParticleBuffers& particleBuffers);
 
   private:
     uint32_t m_width;
@@ -76,42 +198,35 @@ namespace flut
     SimulationTimes m_time;
     SimulationOptions m_options;
     std::unique_ptr<GlQueryRetriever> m_queries;
+    std::unique_ptr<SimulationBackend> m_backend;
+    std::unique_ptr<FluidRenderer> m_renderer;
     uint32_t m_integrationsPerFrame;
     uint32_t m_particleCount;
-    GLuint m_programSimStep1;
-    GLuint m_programSimStep2;
-    GLuint m_programSimStep3;
-    GLuint m_programSimStep4;
-    GLuint m_programSimStep5;
-    GLuint m_programSimStep6;
-    GLuint m_programRenderGeometry;
-    GLuint m_programRenderCurvature;
-    GLuint m_programRenderShading;
-    GLuint m_bufBBoxVertices;
-    GLuint m_bufBBoxIndices;
-    GLuint m_bufParticles1;
-    GLuint m_bufParticles2;
-    GLuint m_bufCounters;
-    GLuint m_bufBillboards;
-    GLuint m_texGrid;
-    GLuint64 m_texGridImgHandle;
-    GLuint m_texVelocity;
-    GLuint64 m_texVelocityHandle;
-    GLuint64 m_texVelocityImgHandle;
-    GLuint m_vao1;
-    GLuint m_vao2;
-    GLuint m_vao3;
-    GLuint m_fbo1;
-    GLuint m_fbo2;
-    GLuint m_fbo3;
-    GLuint m_texDepth;
-    GLuint64 m_texDepthHandle;
-    GLuint m_texColor;
-    GLuint64 m_texColorHandle;
-    GLuint m_texTemp1;
-    GLuint64 m_texTemp1Handle;
-    GLuint m_texTemp2;
-    GLuint64 m_texTemp2Handle;
-    bool m_swapFrame;
+    uint32_t m_seed;
+    SimulationGrid m_grid;
+    ParticleBuffers m_hostBuffers;
+    std::vector<glm::vec4> m_hostVec4Staging;
+    std::vector<glm::vec2> m_hostVec2Staging;
+    std::unique_ptr<GlParticleReadback> m_readback;
+    uint32_t m_readbackInterval;
+    bool m_adaptiveTimeStep;
+    TimeStepStats m_timeStepStats;
+    // Owned by m_backend.
+    ReplaySimulationBackend* m_replay;
+    // Integrations and simulated time since the start.
+    uint64_t m_step;
+    double m_simTime;
+    // Dropped time of the adaptive time step which was taken off the simulated time so far.
+    double m_droppedTime;
+    std::unique_ptr<TrajectoryWriter> m_trajectory;
+    std::unique_ptr<GlParticleReadback> m_trajectoryReadback;
+    uint32_t m_trajectoryInterval;
+    std::unique_ptr<CheckpointWriter> m_checkpointWriter;
+    std::unique_ptr<GlParticleReadback> m_checkpointReadback;
+    // Headers of the checkpoint readbacks in flight, filled in when they were requested, since the
+    // configuration may change before the copy is finished.
+    std::deque<CheckpointHeader> m_checkpointHeaders;
+    uint32_t m_checkpointInterval;
+    std::unique_ptr<CheckpointState> m_pendingCheckpoint;
   };
 }
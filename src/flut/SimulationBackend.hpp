@@ -0,0 +1,241 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <glad/glad.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "GlQueryRetriever.hpp"
+
+namespace flut
+{
+  struct Particle
+  {
+    float position_x;
+    float position_y;
+    float position_z;
+    float density;
+    float velocity_x;
+    float velocity_y;
+    float velocity_z;
+    float pressure;
+  };
+
+  // Particle state on the GPU, split into streams which are indexed by the sorted particle id, so
+  // that each pass only fetches the attributes it needs. Positions and velocities are vec4 with
+  // an unused w, densities hold the density and pressure as vec2.
+  struct ParticleBuffers
+  {
+    GLuint positions = 0;
+    GLuint velocities = 0;
+    GLuint densities = 0;
+  };
+
+  // Order in which the cells, and with them the particles, are laid out in the sorted particle
+  // buffer. Space-filling curves keep neighboring cells closer together in memory.
+  enum class CellOrder
+  {
+    Linear,
+    Morton,
+    Hilbert
+  };
+
+  // Storage of the neighbor search structure. A dense grid has one entry per cell of the domain,
+  // a hashed grid only holds the occupied cells in a table sized by the particle count.
+  enum class GridMode
+  {
+    Dense,
+    Hashed
+  };
+
+  // Uniform grid which spans the simulation domain and is used for the neighbor search.
+  struct SimulationGrid
+  {
+    glm::vec3 size;
+    glm::vec3 origin;
+    glm::ivec3 res;
+    CellOrder cellOrder = CellOrder::Linear;
+    // With GridMode::Hashed, the cell order is given by the hash table and cellOrder is ignored.
+    GridMode mode = GridMode::Dense;
+
+    // Grid which covers a domain of the given size, centered at the origin.
+    static SimulationGrid fromSize(const glm::vec3& size, float cellSize)
+    {
+      return SimulationGrid{size, size * -0.5f, glm::ivec3((size / cellSize) + 1.0f)};
+    }
+
+    // Grid with the given resolution, centered at the origin.
+    static SimulationGrid fromResolution(const glm::ivec3& res, float cellSize)
+    {
+      // Half a cell less than res cells, so that the resolution derived from the size rounds back to res.
+      const glm::vec3 size = (glm::vec3(res) - 0.5f) * cellSize;
+      return SimulationGrid{size, size * -0.5f, res};
+    }
+
+    uint32_t voxelCount() const
+    {
+      return res.x * res.y * res.z;
+    }
+
+    // Slightly smaller than the real inverse so that positions on the upper bound stay inside the grid.
+    glm::vec3 invCellSize() const
+    {
+      return glm::vec3(res) * (1.0f - 0.001f) / size;
+    }
+
+    bool operator==(const SimulationGrid& other) const
+    {
+      return size == other.size && origin == other.origin && res == other.res && cellOrder == other.cellOrder &&
+        mode == other.mode;
+    }
+
+    bool operator!=(const SimulationGrid& other) const
+    {
+      return !(*this == other);
+    }
+  };
+
+  // Physical constants, which the GL backend bakes into its shaders. The grid's cell size must
+  // not be smaller than the kernel radius.
+  struct SimulationParams
+  {
+    float mass;
+    float kernelRadius;
+    float stiffness;
+    float viscosity;
+    float restDensity;
+    float restPressure;
+
+    bool operator==(const SimulationParams& other) const
+    {
+      return mass == other.mass && kernelRadius == other.kernelRadius && stiffness == other.stiffness &&
+        viscosity == other.viscosity && restDensity == other.restDensity && restPressure == other.restPressure;
+    }
+  };
+
+  // Density and force kernels of the GL backend. Cell-tiled kernels run one workgroup per brick
+  // of cells, which stages the particles of the brick's neighborhood in shared memory.
+  enum class GlKernelMode
+  {
+    PerParticle,
+    CellTiled
+  };
+
+  // Verlet neighbor lists: each particle stores the neighbors within the kernel radius plus a skin,
+  // which are reused until some particle has moved by more than half the skin.
+  struct NeighborListConfig
+  {
+    // Skin as a fraction of the kernel radius, 0 disables the lists.
+    float skin = 0.0f;
+    // Particles with more neighbors are searched in the grid instead.
+    uint32_t maxNeighbors = 96;
+  };
+
+  // Sleeping particles: a particle whose speed and density change stay below the thresholds for a
+  // number of integrations keeps its state and is skipped by the density and force steps, until
+  // a particle in its own or a neighboring cell becomes active again.
+  struct SleepConfig
+  {
+    // Speed below which a particle is calm, 0 disables sleeping.
+    float velocityThreshold = 0.0f;
+    // Change of the density per integration, relative to the density, below which a particle is calm.
+    float densityThreshold = 0.001f;
+    // Consecutive calm integrations after which a particle sleeps.
+    uint32_t calmSteps = 32;
+  };
+
+  // Adaptive time step: each integration's dt is limited by the CFL condition on the sound speed
+  // and the largest speed and acceleration of the previous integration, and a frame runs as few
+  // integrations as the limit allows.
+  struct TimeStepConfig
+  {
+    // Fraction of the kernel radius which information may travel per integration, 0 disables the adaptive step.
+    float cfl = 0.0f;
+    float minDt = 0.0001f;
+    float maxDt = 0.003f;
+    // Integrations per frame, at most GlQueryRetriever::MAX_SIM_ITERS_PER_FRAME.
+    uint32_t maxSteps = 16;
+  };
+
+  // Time steps of the integrations of one frame.
+  struct TimeStepStats
+  {
+    uint32_t steps = 0;
+    float minDt = 0.0f;
+    float maxDt = 0.0f;
+    float meanDt = 0.0f;
+    // Smallest CFL limit of the frame.
+    float cflDt = 0.0f;
+    // Simulated time which did not fit into the frame and carries over to the next one.
+    float backlog = 0.0f;
+    // Simulated time which was dropped because the backlog would have exceeded one frame, in this
+    // frame and since the backend was created.
+    float droppedTime = 0.0f;
+    float totalDroppedTime = 0.0f;
+  };
+
+  class SimulationBackend
+  {
+  public:
+    using StepTimings = GlQueryRetriever::QueryTimings;
+
+  public:
+    virtual ~SimulationBackend() = default;
+
+  public:
+    // Runs simulation steps 1 to 6 once.
+    void step(float dt, const glm::vec3& gravity)
+    {
+      runSteps(0, GlQueryRetriever::SIM_STEP_COUNT - 1, dt, gravity);
+    }
+
+    // Runs the zero-based simulation steps [firstStep, lastStep]. Steps 1 to 3 rebuild the
+    // grid and only make sense as a group; other ranges may be repeated to time a stage in isolation.
+    virtual void runSteps(uint32_t firstStep, uint32_t lastStep, float dt, const glm::vec3& gravity) = 0;
+
+    // Advances the simulated time by frameTime in integrations with an adaptive time step, see
+    // TimeStepConfig, and returns their count. Backends without one return 0 and leave it to step().
+    virtual uint32_t advance(float frameTime, const glm::vec3& gravity) { return 0; }
+
+    // Time steps of the latest frame of advance() which has finished, false if none has yet.
+    // Does not wait for the GPU.
+    virtual bool readTimeStepStats(TimeStepStats& stats) { return false; }
+
+    // Replaces the simulated particles, reallocating the particle storage if the count changes.
+    virtual void setParticles(const std::vector<Particle>& particles) = 0;
+
+    // Switches to another grid or other physical constants while keeping the particles, which are
+    // re-binned by the next grid build. Backends may defer the switch until it can be done
+    // without stalling; grid() and params() report what is currently simulated.
+    virtual void reconfigure(const SimulationGrid& grid, const SimulationParams& params) = 0;
+
+    // True while a reconfiguration has not been applied yet.
+    virtual bool reconfiguring() const { return false; }
+
+    virtual const SimulationGrid& grid() const = 0;
+
+    virtual const SimulationParams& params() const = 0;
+
+    // Bytes allocated for the neighbor search structure, i.e. the grid or hash table and the
+    // per-cell velocities.
+    virtual size_t gridMemoryBytes() const = 0;
+
+    // Backends which are not timed by GPU queries report their averaged step times here.
+    virtual void readTimes(StepTimings& timings) {}
+
+    // Buffers containing the latest particle state, or all 0 if the state lives in host memory.
+    virtual ParticleBuffers particleBuffers() const = 0;
+
+    // Latest particle state, or nullptr if the state lives in GPU memory.
+    virtual const Particle* hostParticles() const = 0;
+
+    virtual uint32_t particleCount() const = 0;
+
+    // Particles which the density and force steps processed in the last integration, see SleepConfig.
+    // May wait for the GPU to finish.
+    virtual uint32_t awakeParticleCount() const { return particleCount(); }
+
+    virtual const char* name() const = 0;
+  };
+}
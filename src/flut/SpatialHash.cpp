@@ -0,0 +1,32 @@
+#include "SpatialHash.hpp"
+
+#include <algorithm>
+
+using namespace flut;
+
+// Also a multiple of the workgroup size of simStep2Hashed.comp.
+constexpr static uint32_t MIN_TABLE_SIZE = 64;
+
+uint32_t SpatialHash::tableSize(uint32_t particleCount, uint32_t voxelCount)
+{
+  const uint32_t maxOccupiedCells = std::min(particleCount, voxelCount);
+
+  uint32_t size = MIN_TABLE_SIZE;
+  while (size < maxOccupiedCells * 2u)
+  {
+    size <<= 1;
+  }
+  return size;
+}
+
+const char* SpatialHash::name(GridMode mode)
+{
+  return mode == GridMode::Hashed ? "Hashed" : "Dense";
+}
+
+bool SpatialHash::parse(std::string_view name, GridMode& mode)
+{
+  if (name == "dense") { mode = GridMode::Dense; return true; }
+  if (name == "hashed") { mode = GridMode::Hashed; return true; }
+  return false;
+}
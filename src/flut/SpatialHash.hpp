@@ -0,0 +1,54 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <atomic>
+#include <stdint.h>
+#include <string_view>
+
+#include "SimulationBackend.hpp"
+
+namespace flut
+{
+  // Hash table of the occupied cells of a grid in GridMode::Hashed. Keys are linear voxel
+  // indices and collisions are resolved by linear probing. spatialHash.glsl implements the
+  // same lookup for the compute shaders.
+  class SpatialHash
+  {
+  public:
+    constexpr static uint32_t EMPTY_KEY = 0xFFFFFFFF;
+
+    constexpr static int32_t SLOT_RUN = 4;
+
+    // Power of two with at least twice as many slots as cells can be occupied, which keeps
+    // the probe sequences short.
+    static uint32_t tableSize(uint32_t particleCount, uint32_t voxelCount);
+
+    // Runs of SLOT_RUN cells adjacent in x map to adjacent slots, so that they stay contiguous in the
+    // sorted particles like the rows of a dense grid. Longer runs cluster in the table and slow down probing.
+    static uint32_t slot(const glm::ivec3& coord, uint32_t mask)
+    {
+      const uint32_t run = (uint32_t(coord.x / SLOT_RUN) * 73856093u) ^ (uint32_t(coord.y) * 19349663u) ^ (uint32_t(coord.z) * 83492791u);
+      return (run * SLOT_RUN + uint32_t(coord.x % SLOT_RUN)) & mask;
+    }
+
+    // Slot of the cell with the given coordinate and key, or EMPTY_KEY if the cell is not occupied.
+    static uint32_t find(const std::atomic<uint32_t>* keys, uint32_t mask, const glm::ivec3& coord, uint32_t key)
+    {
+      uint32_t s = slot(coord, mask);
+      while (true)
+      {
+        const uint32_t slotKey = keys[s].load(std::memory_order_relaxed);
+        if (slotKey == key || slotKey == EMPTY_KEY)
+        {
+          return slotKey == key ? s : EMPTY_KEY;
+        }
+        s = (s + 1) & mask;
+      }
+    }
+
+    static const char* name(GridMode mode);
+
+    // Parses one of "dense" or "hashed".
+    static bool parse(std::string_view name, GridMode& mode);
+  };
+}
@@ -0,0 +1,264 @@
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <assert.h>
+
+using namespace flut;
+
+using clock_type = std::chrono::high_resolution_clock;
+
+static uint64_t packRange(uint32_t begin, uint32_t end)
+{
+  return begin | (uint64_t(end) << 32);
+}
+
+static double elapsedMs(clock_type::time_point start)
+{
+  const std::chrono::duration<double, std::milli> span{clock_type::now() - start};
+  return span.count();
+}
+
+ThreadPool::ThreadPool(uint32_t threadCount)
+{
+  if (threadCount == 0)
+  {
+    threadCount = std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  m_workerStates.reset(new Worker[threadCount]);
+
+  // The calling thread acts as worker 0.
+  for (uint32_t i = 1; i < threadCount; i++)
+  {
+    m_workers.emplace_back(&ThreadPool::workerMain, this, i);
+  }
+}
+
+ThreadPool::~ThreadPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_shutdown = true;
+  }
+  m_jobCond.notify_all();
+
+  for (std::thread& worker : m_workers)
+  {
+    worker.join();
+  }
+}
+
+uint32_t ThreadPool::threadCount() const
+{
+  return static_cast<uint32_t>(m_workers.size()) + 1;
+}
+
+const ThreadPool::WorkerStats& ThreadPool::workerStats(uint32_t threadIdx) const
+{
+  return m_workerStates[threadIdx].stats;
+}
+
+ThreadPool::WorkerStats ThreadPool::totalStats() const
+{
+  WorkerStats total;
+  for (uint32_t i = 0; i < threadCount(); i++)
+  {
+    const WorkerStats& stats = m_workerStates[i].stats;
+    total.tasks += stats.tasks;
+    total.stolenTasks += stats.stolenTasks;
+    total.steals += stats.steals;
+    total.busyMs += stats.busyMs;
+    total.idleMs += stats.idleMs;
+  }
+  return total;
+}
+
+void ThreadPool::resetStats()
+{
+  for (uint32_t i = 0; i < threadCount(); i++)
+  {
+    m_workerStates[i].stats = WorkerStats{};
+  }
+}
+
+void ThreadPool::run(uint32_t count, uint32_t chunkSize, const uint32_t* bounds, void* ctx, JobFunc func)
+{
+  assert(chunkSize > 0);
+
+  if (count == 0)
+  {
+    return;
+  }
+
+  m_jobCtx = ctx;
+  m_jobFunc = func;
+  m_jobCount = count;
+  m_jobChunkSize = chunkSize;
+  m_jobBounds = bounds;
+
+  const uint32_t taskCount = bounds ? count : (count + chunkSize - 1) / chunkSize;
+  const uint32_t threadCount = this->threadCount();
+  const auto startTime = clock_type::now();
+
+  for (uint32_t i = 0; i < threadCount; i++)
+  {
+    m_workerStates[i].jobBusyMs = 0.0;
+  }
+
+  // Not worth waking up the workers.
+  if (taskCount == 1 || m_workers.empty())
+  {
+    m_workerStates[0].tasks.store(packRange(0, taskCount), std::memory_order_relaxed);
+    processJob(0);
+  }
+  else
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      for (uint32_t i = 0; i < threadCount; i++)
+      {
+        const uint32_t begin = uint64_t(taskCount) * i / threadCount;
+        const uint32_t end = uint64_t(taskCount) * (i + 1) / threadCount;
+        m_workerStates[i].tasks.store(packRange(begin, end), std::memory_order_relaxed);
+      }
+      m_busyWorkers = static_cast<uint32_t>(m_workers.size());
+      m_jobId++;
+    }
+    m_jobCond.notify_all();
+
+    processJob(0);
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_doneCond.wait(lock, [this] { return m_busyWorkers == 0; });
+  }
+
+  const double jobMs = elapsedMs(startTime);
+  for (uint32_t i = 0; i < threadCount; i++)
+  {
+    Worker& worker = m_workerStates[i];
+    worker.stats.busyMs += worker.jobBusyMs;
+    worker.stats.idleMs += std::max(0.0, jobMs - worker.jobBusyMs);
+  }
+}
+
+void ThreadPool::taskRange(uint32_t task, uint32_t& begin, uint32_t& end) const
+{
+  if (m_jobBounds)
+  {
+    begin = m_jobBounds[task];
+    end = m_jobBounds[task + 1];
+  }
+  else
+  {
+    begin = task * m_jobChunkSize;
+    end = std::min(begin + m_jobChunkSize, m_jobCount);
+  }
+}
+
+bool ThreadPool::popTask(Worker& worker, uint32_t& task)
+{
+  uint64_t range = worker.tasks.load(std::memory_order_acquire);
+
+  while (true)
+  {
+    const auto begin = static_cast<uint32_t>(range);
+    const auto end = static_cast<uint32_t>(range >> 32);
+    if (begin >= end)
+    {
+      return false;
+    }
+
+    if (worker.tasks.compare_exchange_weak(range, packRange(begin + 1, end), std::memory_order_acq_rel))
+    {
+      task = begin;
+      return true;
+    }
+  }
+}
+
+bool ThreadPool::stealTask(uint32_t threadIdx, uint32_t& task)
+{
+  const uint32_t threadCount = this->threadCount();
+  Worker& self = m_workerStates[threadIdx];
+
+  for (uint32_t i = 1; i < threadCount; i++)
+  {
+    Worker& victim = m_workerStates[(threadIdx + i) % threadCount];
+    uint64_t range = victim.tasks.load(std::memory_order_acquire);
+
+    while (true)
+    {
+      const auto begin = static_cast<uint32_t>(range);
+      const auto end = static_cast<uint32_t>(range >> 32);
+      if (begin >= end)
+      {
+        break;
+      }
+
+      // Take the back half, which is the furthest away from what the victim works on.
+      const uint32_t stolenBegin = end - (end - begin + 1) / 2;
+      if (!victim.tasks.compare_exchange_weak(range, packRange(begin, stolenBegin), std::memory_order_acq_rel))
+      {
+        continue;
+      }
+
+      // Our deque is empty, so no other thread modifies it.
+      self.tasks.store(packRange(stolenBegin + 1, end), std::memory_order_release);
+      self.stats.steals++;
+      self.stats.stolenTasks += end - stolenBegin;
+      task = stolenBegin;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void ThreadPool::processJob(uint32_t threadIdx)
+{
+  Worker& self = m_workerStates[threadIdx];
+  uint32_t task;
+
+  while (popTask(self, task) || stealTask(threadIdx, task))
+  {
+    uint32_t begin;
+    uint32_t end;
+    taskRange(task, begin, end);
+
+    const auto startTime = clock_type::now();
+    if (begin < end)
+    {
+      m_jobFunc(m_jobCtx, begin, end, threadIdx);
+    }
+    self.jobBusyMs += elapsedMs(startTime);
+    self.stats.tasks++;
+  }
+}
+
+void ThreadPool::workerMain(uint32_t threadIdx)
+{
+  uint64_t lastJobId = 0;
+
+  while (true)
+  {
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_jobCond.wait(lock, [&] { return m_shutdown || m_jobId != lastJobId; });
+
+      if (m_shutdown)
+      {
+        return;
+      }
+      lastJobId = m_jobId;
+    }
+
+    processJob(threadIdx);
+
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_busyWorkers--;
+    }
+    m_doneCond.notify_one();
+  }
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace flut
+{
+  // Work-stealing pool: the tasks of a job are split evenly across per-worker deques. Workers
+  // take tasks from the front of their own deque and steal the back half of another worker's
+  // deque once theirs runs empty.
+  class ThreadPool
+  {
+  public:
+    struct WorkerStats
+    {
+      uint64_t tasks = 0;
+      // Tasks which were moved to this worker by stealing, and the number of steals doing so.
+      uint64_t stolenTasks = 0;
+      uint64_t steals = 0;
+      double busyMs = 0.0;
+      // Time within jobs which this worker spent without a task.
+      double idleMs = 0.0;
+    };
+
+  public:
+    // A thread count of 0 uses all hardware threads.
+    explicit ThreadPool(uint32_t threadCount = 0);
+
+    ~ThreadPool();
+
+  public:
+    uint32_t threadCount() const;
+
+    // Calls func(begin, end, threadIdx) for consecutive chunks of [0, count) on all
+    // threads, including the calling one. Returns once every chunk has been processed.
+    template<typename F>
+    void parallelFor(uint32_t count, uint32_t chunkSize, F&& func)
+    {
+      run(count, chunkSize, nullptr, &func, invoker<F>());
+    }
+
+    // Calls func(bounds[t], bounds[t + 1], threadIdx) for every task t < taskCount.
+    // Tasks are expected to be of similar cost.
+    template<typename F>
+    void parallelForRanges(const uint32_t* bounds, uint32_t taskCount, F&& func)
+    {
+      run(taskCount, 1, bounds, &func, invoker<F>());
+    }
+
+    // Statistics since the last reset. Must not be called while a job is running.
+    const WorkerStats& workerStats(uint32_t threadIdx) const;
+
+    WorkerStats totalStats() const;
+
+    void resetStats();
+
+  private:
+    using JobFunc = void (*)(void* ctx, uint32_t begin, uint32_t end, uint32_t threadIdx);
+
+    template<typename F>
+    static JobFunc invoker()
+    {
+      return [](void* ctx, uint32_t begin, uint32_t end, uint32_t threadIdx) {
+        (*static_cast<std::remove_reference_t<F>*>(ctx))(begin, end, threadIdx);
+      };
+    }
+
+    struct alignas(64) Worker
+    {
+      // Remaining task indices [begin, end), packed as begin | end << 32 so that the owner
+      // and thieves can update them with a single compare-exchange.
+      std::atomic<uint64_t> tasks{0};
+      double jobBusyMs = 0.0;
+      WorkerStats stats;
+    };
+
+    void run(uint32_t count, uint32_t chunkSize, const uint32_t* bounds, void* ctx, JobFunc func);
+
+    void taskRange(uint32_t task, uint32_t& begin, uint32_t& end) const;
+
+    bool popTask(Worker& worker, uint32_t& task);
+
+    bool stealTask(uint32_t threadIdx, uint32_t& task);
+
+    void processJob(uint32_t threadIdx);
+
+    void workerMain(uint32_t threadIdx);
+
+  private:
+    std::vector<std::thread> m_workers;
+    std::unique_ptr<Worker[]> m_workerStates;
+    std::mutex m_mutex;
+    std::condition_variable m_jobCond;
+    std::condition_variable m_doneCond;
+    uint64_t m_jobId = 0;
+    uint32_t m_busyWorkers = 0;
+    bool m_shutdown = false;
+
+    void* m_jobCtx = nullptr;
+    JobFunc m_jobFunc = nullptr;
+    uint32_t m_jobCount = 0;
+    uint32_t m_jobChunkSize = 1;
+    const uint32_t* m_jobBounds = nullptr;
+  };
+}
@@ -0,0 +1,455 @@
+#include "TrajectoryCodec.hpp"
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <string.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+using namespace flut;
+
+namespace
+{
+  // "FLTC"
+  constexpr uint32_t FRAME_MAGIC = 0x43544c46u;
+  constexpr uint32_t CHANNEL_COUNT = 6;
+  constexpr uint32_t GROUP_SIZE = TrajectoryCodec::GROUP_SIZE;
+  // Bit width, exception count and exception bit width.
+  constexpr uint32_t GROUP_HEADER_SIZE = 3;
+  // Quantized values stay within this range, so that the difference of two fits into 32 bits.
+  constexpr double MAX_QUANTIZED = double(1 << 30);
+
+  struct FrameHeader
+  {
+    uint32_t magic;
+    uint32_t particleCount;
+    uint32_t blockCount;
+    float positionStep;
+    float velocityStep;
+    float origin[3];
+    // Followed by blockCount + 1 offsets of the blocks, relative to the end of the offsets.
+  };
+
+  uint32_t zigzag(int32_t value)
+  {
+    return (uint32_t(value) << 1) ^ uint32_t(value >> 31);
+  }
+
+  int32_t unzigzag(uint32_t value)
+  {
+    return int32_t(value >> 1) ^ -int32_t(value & 1);
+  }
+
+  uint32_t bitWidth(uint32_t value)
+  {
+    if (value == 0)
+    {
+      return 0;
+    }
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanReverse(&index, value);
+    return index + 1;
+#else
+    return 32 - __builtin_clz(value);
+#endif
+  }
+
+  // Packs the low width bits of the values, in whole 32-bit words.
+  uint8_t* packBits(const uint32_t* values, uint32_t count, uint32_t width, uint8_t* out)
+  {
+    if (width == 0)
+    {
+      return out;
+    }
+
+    const uint64_t mask = (uint64_t(1) << width) - 1;
+    uint64_t bits = 0;
+    uint32_t bitCount = 0;
+    for (uint32_t i = 0; i < count; i++)
+    {
+      bits |= (values[i] & mask) << bitCount;
+      bitCount += width;
+      if (bitCount >= 32)
+      {
+        const uint32_t word = uint32_t(bits);
+        memcpy(out, &word, sizeof(word));
+        out += sizeof(word);
+        bits >>= 32;
+        bitCount -= 32;
+      }
+    }
+    if (bitCount > 0)
+    {
+      const uint32_t word = uint32_t(bits);
+      memcpy(out, &word, sizeof(word));
+      out += sizeof(word);
+    }
+    return out;
+  }
+
+  const uint8_t* unpackBits(const uint8_t* in, uint32_t count, uint32_t width, uint32_t* values)
+  {
+    if (width == 0)
+    {
+      std::fill_n(values, count, 0u);
+      return in;
+    }
+
+    const uint64_t mask = (uint64_t(1) << width) - 1;
+    uint64_t bits = 0;
+    uint32_t bitCount = 0;
+    for (uint32_t i = 0; i < count; i++)
+    {
+      if (bitCount < width)
+      {
+        uint32_t word;
+        memcpy(&word, in, sizeof(word));
+        in += sizeof(word);
+        bits |= uint64_t(word) << bitCount;
+        bitCount += 32;
+      }
+      values[i] = uint32_t(bits & mask);
+      bits >>= width;
+      bitCount -= width;
+    }
+    return in;
+  }
+
+  uint32_t packedSize(uint32_t count, uint32_t width)
+  {
+    return (count * width + 31) / 32 * 4;
+  }
+
+  uint32_t maxGroupSize()
+  {
+    return GROUP_HEADER_SIZE + packedSize(GROUP_SIZE, 32);
+  }
+
+  // Writes a group of zigzagged residuals, padded with zeros to GROUP_SIZE.
+  uint8_t* encodeGroup(const uint32_t* values, uint8_t* out)
+  {
+    uint32_t widthCounts[33] = {};
+    for (uint32_t i = 0; i < GROUP_SIZE; i++)
+    {
+      widthCounts[bitWidth(values[i])]++;
+    }
+    uint32_t maxWidth = 32;
+    while (maxWidth > 0 && widthCounts[maxWidth] == 0)
+    {
+      maxWidth--;
+    }
+
+    // Going down from the widest value, every narrower width turns more values into exceptions.
+    uint32_t bestWidth = maxWidth;
+    uint32_t bestSize = packedSize(GROUP_SIZE, maxWidth);
+    uint32_t exceptionCount = 0;
+    for (uint32_t width = maxWidth; width-- > 0;)
+    {
+      exceptionCount += widthCounts[width + 1];
+      const uint32_t size = packedSize(GROUP_SIZE, width) + exceptionCount + packedSize(exceptionCount, maxWidth - width);
+      if (size < bestSize)
+      {
+        bestSize = size;
+        bestWidth = width;
+      }
+    }
+
+    uint8_t exceptionIndices[GROUP_SIZE];
+    uint32_t exceptionValues[GROUP_SIZE];
+    exceptionCount = 0;
+    for (uint32_t i = 0; i < GROUP_SIZE; i++)
+    {
+      if (bestWidth < 32 && values[i] >> bestWidth)
+      {
+        exceptionIndices[exceptionCount] = uint8_t(i);
+        exceptionValues[exceptionCount] = values[i] >> bestWidth;
+        exceptionCount++;
+      }
+    }
+
+    const uint32_t exceptionWidth = maxWidth - bestWidth;
+    out[0] = uint8_t(bestWidth);
+    out[1] = uint8_t(exceptionCount);
+    out[2] = uint8_t(exceptionWidth);
+    out += GROUP_HEADER_SIZE;
+    out = packBits(values, GROUP_SIZE, bestWidth, out);
+    memcpy(out, exceptionIndices, exceptionCount);
+    out += exceptionCount;
+    return packBits(exceptionValues, exceptionCount, exceptionWidth, out);
+  }
+
+  const uint8_t* decodeGroup(const uint8_t* in, const uint8_t* end, uint32_t* values)
+  {
+    if (end - in < ptrdiff_t(GROUP_HEADER_SIZE))
+    {
+      return nullptr;
+    }
+    const uint32_t width = in[0];
+    const uint32_t exceptionCount = in[1];
+    const uint32_t exceptionWidth = in[2];
+    in += GROUP_HEADER_SIZE;
+    if (width > 32 || exceptionCount > GROUP_SIZE || width + exceptionWidth > 32 ||
+        end - in < ptrdiff_t(packedSize(GROUP_SIZE, width) + exceptionCount + packedSize(exceptionCount, exceptionWidth)))
+    {
+      return nullptr;
+    }
+
+    in = unpackBits(in, GROUP_SIZE, width, values);
+    const uint8_t* exceptionIndices = in;
+    in += exceptionCount;
+    uint32_t exceptionValues[GROUP_SIZE];
+    in = unpackBits(in, exceptionCount, exceptionWidth, exceptionValues);
+    for (uint32_t i = 0; i < exceptionCount; i++)
+    {
+      if (exceptionIndices[i] >= GROUP_SIZE)
+      {
+        return nullptr;
+      }
+      // Exceptions only occur below a width of 32.
+      values[exceptionIndices[i]] |= exceptionValues[i] << (width & 31);
+    }
+    return in;
+  }
+
+  size_t maxBlockSize(uint32_t particleCount)
+  {
+    const uint32_t groupCount = (particleCount + GROUP_SIZE - 1) / GROUP_SIZE;
+    return size_t(CHANNEL_COUNT) * groupCount * maxGroupSize();
+  }
+
+  // Quantizes and codes one component of the particles of a block. Returns nullptr if a value is
+  // out of range.
+  uint8_t* encodeChannel(const glm::vec4* vectors, uint32_t count, uint32_t component, float offset, float step, uint8_t* out)
+  {
+    const double invStep = 1.0 / double(step);
+    uint32_t residuals[GROUP_SIZE];
+    int32_t previous = 0;
+    for (uint32_t first = 0; first < count; first += GROUP_SIZE)
+    {
+      const uint32_t groupCount = std::min(count - first, GROUP_SIZE);
+      for (uint32_t i = 0; i < groupCount; i++)
+      {
+        const double scaled = (double(vectors[first + i][component]) - double(offset)) * invStep;
+        // Also rejects NaN.
+        if (!(std::abs(scaled) < MAX_QUANTIZED))
+        {
+          return nullptr;
+        }
+        const int32_t quantized = int32_t(std::floor(scaled + 0.5));
+        residuals[i] = zigzag(quantized - previous);
+        previous = quantized;
+      }
+      std::fill(residuals + groupCount, residuals + GROUP_SIZE, 0u);
+      out = encodeGroup(residuals, out);
+    }
+    return out;
+  }
+
+  const uint8_t* decodeChannel(const uint8_t* in, const uint8_t* end, glm::vec4* vectors, uint32_t count, uint32_t component,
+                               float offset, float step)
+  {
+    uint32_t residuals[GROUP_SIZE];
+    int32_t previous = 0;
+    for (uint32_t first = 0; first < count && in; first += GROUP_SIZE)
+    {
+      in = decodeGroup(in, end, residuals);
+      if (!in)
+      {
+        return nullptr;
+      }
+      const uint32_t groupCount = std::min(count - first, GROUP_SIZE);
+      for (uint32_t i = 0; i < groupCount; i++)
+      {
+        previous = int32_t(uint32_t(previous) + uint32_t(unzigzag(residuals[i])));
+        vectors[first + i][component] = float(double(offset) + double(previous) * step);
+      }
+    }
+    return in;
+  }
+}
+
+TrajectoryCodec::TrajectoryCodec(ThreadPool* pool)
+  : m_pool(pool)
+{
+}
+
+bool TrajectoryCodec::encode(const Config& config, const glm::vec3& origin, const glm::vec4* positions, const glm::vec4* velocities,
+                             uint32_t particleCount, std::vector<uint8_t>& out)
+{
+  const uint32_t blockCount = (particleCount + BLOCK_SIZE - 1) / BLOCK_SIZE;
+  const float positionStep = 2.0f * config.positionError;
+  const float velocityStep = 2.0f * config.velocityError;
+  if (!(positionStep > 0.0f) || !(velocityStep > 0.0f))
+  {
+    return false;
+  }
+
+  if (m_blocks.size() < blockCount)
+  {
+    m_blocks.resize(blockCount);
+  }
+
+  std::atomic<bool> valid{true};
+  std::vector<uint32_t> blockSizes(blockCount);
+  auto encodeBlocks = [&](uint32_t begin, uint32_t end, uint32_t) {
+    for (uint32_t b = begin; b < end; b++)
+    {
+      const uint32_t first = b * BLOCK_SIZE;
+      const uint32_t count = std::min(particleCount - first, BLOCK_SIZE);
+      std::vector<uint8_t>& block = m_blocks[b];
+      block.resize(maxBlockSize(count));
+
+      uint8_t* out = block.data();
+      for (uint32_t c = 0; c < 3 && out; c++)
+      {
+        out = encodeChannel(positions + first, count, c, origin[c], positionStep, out);
+      }
+      for (uint32_t c = 0; c < 3 && out; c++)
+      {
+        out = encodeChannel(velocities + first, count, c, 0.0f, velocityStep, out);
+      }
+
+      if (!out)
+      {
+        valid = false;
+        return;
+      }
+      blockSizes[b] = uint32_t(out - block.data());
+    }
+  };
+
+  if (m_pool)
+  {
+    m_pool->parallelFor(blockCount, 1, encodeBlocks);
+  }
+  else
+  {
+    encodeBlocks(0, blockCount, 0);
+  }
+
+  if (!valid)
+  {
+    return false;
+  }
+
+  FrameHeader header;
+  header.magic = FRAME_MAGIC;
+  header.particleCount = particleCount;
+  header.blockCount = blockCount;
+  header.positionStep = positionStep;
+  header.velocityStep = velocityStep;
+  for (int c = 0; c < 3; c++)
+  {
+    header.origin[c] = origin[c];
+  }
+
+  std::vector<uint32_t> offsets(blockCount + 1, 0);
+  for (uint32_t b = 0; b < blockCount; b++)
+  {
+    offsets[b + 1] = offsets[b] + blockSizes[b];
+  }
+
+  const size_t offsetsSize = offsets.size() * sizeof(uint32_t);
+  out.resize(sizeof(header) + offsetsSize + offsets.back());
+  uint8_t* bytes = out.data();
+  memcpy(bytes, &header, sizeof(header));
+  memcpy(bytes + sizeof(header), offsets.data(), offsetsSize);
+  bytes += sizeof(header) + offsetsSize;
+  for (uint32_t b = 0; b < blockCount; b++)
+  {
+    memcpy(bytes + offsets[b], m_blocks[b].data(), blockSizes[b]);
+  }
+  return true;
+}
+
+uint32_t TrajectoryCodec::particleCount(const uint8_t* data, size_t size)
+{
+  FrameHeader header;
+  if (size < sizeof(header))
+  {
+    return 0;
+  }
+  memcpy(&header, data, sizeof(header));
+  return header.magic == FRAME_MAGIC ? header.particleCount : 0;
+}
+
+bool TrajectoryCodec::decode(const uint8_t* data, size_t size, glm::vec4* positions, glm::vec4* velocities)
+{
+  FrameHeader header;
+  if (size < sizeof(header))
+  {
+    return false;
+  }
+  memcpy(&header, data, sizeof(header));
+
+  const uint32_t particleCount = header.particleCount;
+  const uint32_t blockCount = header.blockCount;
+  const size_t offsetsSize = (size_t(blockCount) + 1) * sizeof(uint32_t);
+  if (header.magic != FRAME_MAGIC || blockCount != (particleCount + BLOCK_SIZE - 1) / BLOCK_SIZE ||
+      size < sizeof(header) + offsetsSize)
+  {
+    return false;
+  }
+
+  std::vector<uint32_t> offsets(blockCount + 1);
+  memcpy(offsets.data(), data + sizeof(header), offsetsSize);
+  const uint8_t* blocks = data + sizeof(header) + offsetsSize;
+  const size_t blocksSize = size - sizeof(header) - offsetsSize;
+
+  std::atomic<bool> valid{true};
+  auto decodeBlocks = [&](uint32_t begin, uint32_t end, uint32_t) {
+    for (uint32_t b = begin; b < end; b++)
+    {
+      if (offsets[b] > offsets[b + 1] || offsets[b + 1] > blocksSize)
+      {
+        valid = false;
+        return;
+      }
+
+      const uint32_t first = b * BLOCK_SIZE;
+      const uint32_t count = std::min(particleCount - first, BLOCK_SIZE);
+      const uint8_t* in = blocks + offsets[b];
+      const uint8_t* blockEnd = blocks + offsets[b + 1];
+      for (uint32_t c = 0; c < 3 && in; c++)
+      {
+        in = decodeChannel(in, blockEnd, positions + first, count, c, header.origin[c], header.positionStep);
+      }
+      for (uint32_t c = 0; c < 3 && in; c++)
+      {
+        in = decodeChannel(in, blockEnd, velocities + first, count, c, 0.0f, header.velocityStep);
+      }
+
+      if (!in)
+      {
+        valid = false;
+        return;
+      }
+      for (uint32_t i = first; i < first + count; i++)
+      {
+        positions[i].w = 0.0f;
+        velocities[i].w = 0.0f;
+      }
+    }
+  };
+
+  if (m_pool)
+  {
+    m_pool->parallelFor(blockCount, 1, decodeBlocks);
+  }
+  else
+  {
+    decodeBlocks(0, blockCount, 0);
+  }
+  return valid;
+}
+
+size_t TrajectoryCodec::maxEncodedSize(uint32_t particleCount)
+{
+  const uint32_t blockCount = (particleCount + BLOCK_SIZE - 1) / BLOCK_SIZE;
+  return sizeof(FrameHeader) + (size_t(blockCount) + 1) * sizeof(uint32_t) + maxBlockSize(particleCount) + size_t(blockCount) * CHANNEL_COUNT * maxGroupSize();
+}
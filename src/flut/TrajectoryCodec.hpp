@@ -0,0 +1,65 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace flut
+{
+  class ThreadPool;
+
+  // Lossy codec for the positions and velocities of a trajectory frame, which relies on the
+  // particles being sorted by cell:
+  //
+  // - Quantization: every component is rounded to a multiple of twice its error bound, positions
+  //   relative to the grid origin, so that no decoded value is off by more than the bound.
+  // - Prediction: each quantized value is replaced by its difference to the previous particle,
+  //   which is small since neighbors in the sorted order are neighbors in space. The residuals
+  //   are zigzag encoded, mapping small magnitudes to small unsigned numbers.
+  // - Packing: groups of GROUP_SIZE residuals are packed with the bit width that minimizes their
+  //   size, and the few residuals which do not fit are patched in as exceptions (PFor).
+  //
+  // Blocks of BLOCK_SIZE particles are coded independently, in parallel if a pool is given, and
+  // can be decoded on their own. The w components are not stored and decode as 0.
+  //
+  // Temporal prediction from the previous frame does not pay off: the sort moves every particle
+  // that changes its cell, so the same index holds a different particle in the next frame.
+  class TrajectoryCodec
+  {
+  public:
+    constexpr static uint32_t BLOCK_SIZE = 8192;
+    constexpr static uint32_t GROUP_SIZE = 128;
+
+    struct Config
+    {
+      // Maximum absolute error of each component, in m and m/s. Holds up to the float rounding of
+      // the decoded value.
+      float positionError = 0.0f;
+      float velocityError = 0.0f;
+    };
+
+  public:
+    explicit TrajectoryCodec(ThreadPool* pool = nullptr);
+
+  public:
+    // Replaces out with the compressed frame. Returns false if a component is not finite or too
+    // large to be quantized at the error bound.
+    bool encode(const Config& config, const glm::vec3& origin, const glm::vec4* positions, const glm::vec4* velocities,
+                uint32_t particleCount, std::vector<uint8_t>& out);
+
+    // Particle count of a compressed frame, or 0 if the data is not one.
+    static uint32_t particleCount(const uint8_t* data, size_t size);
+
+    // Decodes a frame into arrays of particleCount(data, size) elements. Returns false if the data
+    // is corrupt.
+    bool decode(const uint8_t* data, size_t size, glm::vec4* positions, glm::vec4* velocities);
+
+    // Upper bound of the compressed size of a frame.
+    static size_t maxEncodedSize(uint32_t particleCount);
+
+  private:
+    ThreadPool* m_pool;
+    std::vector<std::vector<uint8_t>> m_blocks;
+  };
+}
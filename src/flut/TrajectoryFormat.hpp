@@ -0,0 +1,122 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <stdint.h>
+
+#include "SimulationBackend.hpp"
+
+namespace flut
+{
+  // On-disk layout of a recorded trajectory, which a reader maps into memory and uses in place.
+  // All offsets are from the start of the file and multiples of the page size:
+  //
+  //   0:            TrajectoryHeader, padded to a page
+  //   frameOffset:  frameCount chunks, each a TrajectoryFrameHeader followed by the positions and
+  //                 then the velocities of all particles as vec4, in sorted order; w holds backend
+  //                 state and is not part of the trajectory. Compressed recordings store a
+  //                 TrajectoryCodec frame instead, and their chunks vary in size.
+  //   indexOffset:  frameCount TrajectoryIndexEntry, written when the recording is closed
+  //
+  // Values are little-endian, as written by the simulating machine.
+  namespace Trajectory
+  {
+    constexpr uint32_t PAGE_SIZE = 4096;
+    // "FLUTTRJ\0"
+    constexpr uint64_t MAGIC = 0x004a5254544c5546ull;
+    constexpr uint32_t VERSION = 2;
+
+    inline uint64_t alignToPage(uint64_t bytes)
+    {
+      return (bytes + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE;
+    }
+  }
+
+  struct TrajectoryHeader
+  {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t particleCount;
+    uint64_t frameOffset;
+    // Bytes per frame chunk, a multiple of the page size, or 0 if the chunks vary in size.
+    uint64_t frameStride;
+    // Frames which are completely on disk. The header is rewritten after every batch of frames,
+    // so a recording whose writer died is readable up to its last batch.
+    uint64_t frameCount;
+    // 0 until the recording is closed.
+    uint64_t indexOffset;
+    // Integrations between frames. Both are 0 with the adaptive time step, which records at most one
+    // frame per rendered frame, after the integrations of the frame crossed a multiple of the interval.
+    uint32_t frameInterval;
+    float dt;
+    // Grid and physical constants at the start of the recording.
+    float gridSize[3];
+    float gridOrigin[3];
+    int32_t gridRes[3];
+    uint32_t cellOrder;
+    uint32_t gridMode;
+    SimulationParams params;
+    // Error bounds of the TrajectoryCodec, 0 for uncompressed frames.
+    float positionError;
+    float velocityError;
+  };
+
+  static_assert(sizeof(TrajectoryHeader) <= Trajectory::PAGE_SIZE, "The trajectory header must fit into a page");
+
+  struct alignas(64) TrajectoryFrameHeader
+  {
+    // Sequence number among the frames handed to the writer, which skips dropped frames.
+    uint64_t frame;
+    // Integrations since the start of the simulation, and the simulated time.
+    uint64_t step;
+    double time;
+    uint32_t particleCount;
+    // Bytes from this header to the next one, and of the compressed frame after the header, which
+    // is 0 for uncompressed frames.
+    uint64_t chunkSize;
+    uint64_t compressedSize;
+
+    const uint8_t* compressed() const
+    {
+      return reinterpret_cast<const uint8_t*>(this + 1);
+    }
+
+    const glm::vec4* positions() const
+    {
+      return reinterpret_cast<const glm::vec4*>(this + 1);
+    }
+
+    const glm::vec4* velocities() const
+    {
+      return positions() + particleCount;
+    }
+
+    // Chunk size of a frame with the given particle count.
+    static uint64_t stride(uint32_t particleCount)
+    {
+      return Trajectory::alignToPage(sizeof(TrajectoryFrameHeader) + 2 * uint64_t(particleCount) * sizeof(glm::vec4));
+    }
+  };
+
+  static_assert(sizeof(TrajectoryFrameHeader) == 64, "Particle data must start 64 bytes into a frame chunk");
+
+  struct TrajectoryIndexEntry
+  {
+    uint64_t offset;
+    uint64_t step;
+    double time;
+  };
+
+  // Frame at an offset of a mapped recording, from the index or a previous frame.
+  inline const TrajectoryFrameHeader* trajectoryFrame(const void* file, uint64_t offset)
+  {
+    return reinterpret_cast<const TrajectoryFrameHeader*>(static_cast<const uint8_t*>(file) + offset);
+  }
+
+  // Index of a mapped recording, or nullptr if it was not closed. Without one, the frames are
+  // found by following their chunk sizes from frameOffset.
+  inline const TrajectoryIndexEntry* trajectoryIndex(const void* file, const TrajectoryHeader& header)
+  {
+    return header.indexOffset ? reinterpret_cast<const TrajectoryIndexEntry*>(static_cast<const uint8_t*>(file) + header.indexOffset)
+                              : nullptr;
+  }
+}
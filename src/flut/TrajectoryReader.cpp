@@ -0,0 +1,270 @@
+#include "TrajectoryReader.hpp"
+
+#include <algorithm>
+#include <string.h>
+#include <stdio.h>
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace flut;
+
+#ifdef _WIN32
+struct TrajectoryReader::Mapping
+{
+  HANDLE file = INVALID_HANDLE_VALUE;
+  HANDLE mapping = nullptr;
+  void* data = nullptr;
+  uint64_t size = 0;
+
+  ~Mapping()
+  {
+    if (data)
+    {
+      UnmapViewOfFile(data);
+    }
+    if (mapping)
+    {
+      CloseHandle(mapping);
+    }
+    if (file != INVALID_HANDLE_VALUE)
+    {
+      CloseHandle(file);
+    }
+  }
+
+  bool open(const std::string& path)
+  {
+    file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    LARGE_INTEGER fileSize;
+    if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &fileSize))
+    {
+      fprintf(stderr, "Unable to open trajectory file %s\n", path.c_str());
+      return false;
+    }
+    size = uint64_t(fileSize.QuadPart);
+    if (size == 0)
+    {
+      return true;
+    }
+
+    mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    data = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    if (!data)
+    {
+      fprintf(stderr, "Unable to map trajectory file %s\n", path.c_str());
+      return false;
+    }
+    return true;
+  }
+
+  // Windows reads ahead on its own; the hint is not needed for correctness.
+  void willNeed(uint64_t offset, uint64_t length) const
+  {
+  }
+};
+#else
+struct TrajectoryReader::Mapping
+{
+  void* data = nullptr;
+  uint64_t size = 0;
+
+  ~Mapping()
+  {
+    if (data)
+    {
+      munmap(data, size);
+    }
+  }
+
+  bool open(const std::string& path)
+  {
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    struct stat status;
+    if (fd < 0 || fstat(fd, &status) != 0)
+    {
+      fprintf(stderr, "Unable to open trajectory file %s: %s\n", path.c_str(), strerror(errno));
+      if (fd >= 0)
+      {
+        close(fd);
+      }
+      return false;
+    }
+    size = uint64_t(status.st_size);
+    if (size == 0)
+    {
+      close(fd);
+      return true;
+    }
+
+    // The mapping keeps the file open.
+    data = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+      data = nullptr;
+      fprintf(stderr, "Unable to map trajectory file %s: %s\n", path.c_str(), strerror(errno));
+      return false;
+    }
+
+    // Frames are prefetched explicitly, so the kernel's read-ahead would only waste memory when
+    // scrubbing.
+    madvise(data, size, MADV_RANDOM);
+    return true;
+  }
+
+  void willNeed(uint64_t offset, uint64_t length) const
+  {
+    // madvise needs a page-aligned address.
+    const uint64_t pageSize = uint64_t(sysconf(_SC_PAGESIZE));
+    const uint64_t begin = offset / pageSize * pageSize;
+    const uint64_t end = std::min(offset + length, size);
+    madvise(static_cast<uint8_t*>(data) + begin, end - begin, MADV_WILLNEED);
+  }
+};
+#endif
+
+std::unique_ptr<TrajectoryReader> TrajectoryReader::open(const std::string& path, ThreadPool* pool)
+{
+  auto mapping = std::make_unique<Mapping>();
+  if (!mapping->open(path))
+  {
+    return nullptr;
+  }
+
+  std::unique_ptr<TrajectoryReader> reader{new TrajectoryReader(std::move(mapping), pool)};
+  if (!reader->load(path))
+  {
+    return nullptr;
+  }
+  return reader;
+}
+
+TrajectoryReader::TrajectoryReader(std::unique_ptr<Mapping> mapping, ThreadPool* pool)
+  : m_mapping(std::move(mapping))
+  , m_data(static_cast<const uint8_t*>(m_mapping->data))
+  , m_size(m_mapping->size)
+  , m_header{}
+  , m_codec(pool)
+{
+}
+
+TrajectoryReader::~TrajectoryReader()
+{
+}
+
+bool TrajectoryReader::load(const std::string& path)
+{
+  if (m_size < Trajectory::PAGE_SIZE || memcmp(m_data, &Trajectory::MAGIC, sizeof(Trajectory::MAGIC)) != 0)
+  {
+    fprintf(stderr, "%s is not a trajectory file\n", path.c_str());
+    return false;
+  }
+  memcpy(&m_header, m_data, sizeof(m_header));
+  if (m_header.version != Trajectory::VERSION)
+  {
+    fprintf(stderr, "Trajectory file %s has version %u, expected %u\n", path.c_str(), m_header.version, Trajectory::VERSION);
+    return false;
+  }
+  if (m_header.frameCount == 0 || m_header.particleCount == 0)
+  {
+    fprintf(stderr, "Trajectory file %s holds no frames\n", path.c_str());
+    return false;
+  }
+
+  const uint64_t frameCount = m_header.frameCount;
+  const TrajectoryIndexEntry* index = trajectoryIndex(m_data, m_header);
+  if (index && (m_header.indexOffset > m_size || (m_size - m_header.indexOffset) / sizeof(TrajectoryIndexEntry) < frameCount))
+  {
+    index = nullptr;
+  }
+
+  // Without an index, the writer died, but every frame up to frameCount is on disk.
+  m_entries.resize(frameCount);
+  uint64_t offset = m_header.frameOffset;
+  for (uint64_t i = 0; i < frameCount; i++)
+  {
+    if (index)
+    {
+      offset = index[i].offset;
+    }
+
+    const TrajectoryFrameHeader* frame = trajectoryFrame(m_data, offset);
+    const bool mapped = offset <= m_size && m_size - offset >= sizeof(TrajectoryFrameHeader);
+    if (!mapped || frame->chunkSize < sizeof(TrajectoryFrameHeader) || frame->chunkSize > m_size - offset ||
+        frame->particleCount != m_header.particleCount ||
+        (m_header.frameStride ? 2 * uint64_t(frame->particleCount) * sizeof(glm::vec4) : frame->compressedSize) >
+          frame->chunkSize - sizeof(TrajectoryFrameHeader))
+    {
+      fprintf(stderr, "Trajectory file %s is truncated after %llu frames\n", path.c_str(), static_cast<unsigned long long>(i));
+      m_entries.resize(i);
+      break;
+    }
+
+    m_entries[i] = { offset, frame->step, frame->time };
+    offset += frame->chunkSize;
+  }
+
+  return !m_entries.empty();
+}
+
+const TrajectoryHeader& TrajectoryReader::header() const
+{
+  return m_header;
+}
+
+uint64_t TrajectoryReader::frameCount() const
+{
+  return m_entries.size();
+}
+
+const TrajectoryIndexEntry& TrajectoryReader::entry(uint64_t frame) const
+{
+  return m_entries[frame];
+}
+
+uint64_t TrajectoryReader::frameAt(double time) const
+{
+  const auto next = std::upper_bound(m_entries.begin(), m_entries.end(), time,
+                                     [](double t, const TrajectoryIndexEntry& entry) { return t < entry.time; });
+  return next == m_entries.begin() ? 0 : uint64_t(next - m_entries.begin()) - 1;
+}
+
+void TrajectoryReader::prefetch(uint64_t first, uint64_t count) const
+{
+  const uint64_t last = std::min(first + count, frameCount());
+  if (first >= last)
+  {
+    return;
+  }
+
+  // Consecutive frames are contiguous in the file.
+  const TrajectoryFrameHeader* lastFrame = trajectoryFrame(m_data, m_entries[last - 1].offset);
+  const uint64_t begin = m_entries[first].offset;
+  m_mapping->willNeed(begin, m_entries[last - 1].offset + lastFrame->chunkSize - begin);
+}
+
+bool TrajectoryReader::read(uint64_t frame, glm::vec4* positions, glm::vec4* velocities)
+{
+  const TrajectoryFrameHeader* header = trajectoryFrame(m_data, m_entries[frame].offset);
+  const uint32_t count = m_header.particleCount;
+
+  if (m_header.frameStride)
+  {
+    memcpy(positions, header->positions(), count * sizeof(glm::vec4));
+    memcpy(velocities, header->velocities(), count * sizeof(glm::vec4));
+    return true;
+  }
+
+  return TrajectoryCodec::particleCount(header->compressed(), header->compressedSize) == count &&
+         m_codec.decode(header->compressed(), header->compressedSize, positions, velocities);
+}
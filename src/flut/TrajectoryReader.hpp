@@ -0,0 +1,63 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "TrajectoryCodec.hpp"
+#include "TrajectoryFormat.hpp"
+
+namespace flut
+{
+  class ThreadPool;
+
+  // Maps a recorded trajectory, see TrajectoryFormat.hpp, into memory. Frames are read from the
+  // mapping on demand, so recordings larger than the RAM can be opened; the kernel pages them in
+  // when they are touched or prefetched and drops them again under memory pressure.
+  class TrajectoryReader
+  {
+  public:
+    // Maps and validates the file, or returns nullptr. Compressed frames are decoded on the pool,
+    // if one is given.
+    static std::unique_ptr<TrajectoryReader> open(const std::string& path, ThreadPool* pool = nullptr);
+
+    ~TrajectoryReader();
+
+  public:
+    const TrajectoryHeader& header() const;
+
+    uint64_t frameCount() const;
+
+    // Offset, step and simulated time of a frame.
+    const TrajectoryIndexEntry& entry(uint64_t frame) const;
+
+    // Last frame recorded at or before the time, or the first frame.
+    uint64_t frameAt(double time) const;
+
+    // Asks the kernel to read the frames [first, first + count) ahead. Does not wait.
+    void prefetch(uint64_t first, uint64_t count) const;
+
+    // Copies or decodes a frame into arrays of header().particleCount elements. Returns false if
+    // the frame is corrupt.
+    bool read(uint64_t frame, glm::vec4* positions, glm::vec4* velocities);
+
+  private:
+    struct Mapping;
+
+    TrajectoryReader(std::unique_ptr<Mapping> mapping, ThreadPool* pool);
+
+    // Checks the header and collects the frame offsets, from the index or by following the chunks.
+    bool load(const std::string& path);
+
+  private:
+    std::unique_ptr<Mapping> m_mapping;
+    const uint8_t* m_data;
+    uint64_t m_size;
+    TrajectoryHeader m_header;
+    std::vector<TrajectoryIndexEntry> m_entries;
+    TrajectoryCodec m_codec;
+  };
+}
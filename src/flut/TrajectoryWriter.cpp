@@ -0,0 +1,455 @@
+#include "TrajectoryWriter.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <malloc.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+using namespace flut;
+
+#ifdef _WIN32
+struct TrajectoryWriter::FileHandle
+{
+  HANDLE handle = INVALID_HANDLE_VALUE;
+
+  ~FileHandle()
+  {
+    if (handle != INVALID_HANDLE_VALUE)
+    {
+      CloseHandle(handle);
+    }
+  }
+};
+#else
+struct TrajectoryWriter::FileHandle
+{
+  int fd = -1;
+
+  ~FileHandle()
+  {
+    if (fd >= 0)
+    {
+      close(fd);
+    }
+  }
+};
+#endif
+
+// Direct I/O needs buffers aligned to the page size.
+static uint8_t* allocatePages(size_t size)
+{
+#ifdef _WIN32
+  void* pages = _aligned_malloc(size, Trajectory::PAGE_SIZE);
+#else
+  void* pages = aligned_alloc(Trajectory::PAGE_SIZE, size);
+#endif
+  if (!pages)
+  {
+    fprintf(stderr, "Unable to allocate %zu bytes for the trajectory writer\n", size);
+    abort();
+  }
+  memset(pages, 0, size);
+  return static_cast<uint8_t*>(pages);
+}
+
+static void freePages(uint8_t* pages)
+{
+#ifdef _WIN32
+  _aligned_free(pages);
+#else
+  free(pages);
+#endif
+}
+
+// Writes the buffers one after another starting at offset.
+template<typename File>
+static bool writeBuffers(const File& file, const uint8_t* const* buffers, const uint64_t* sizes, uint32_t count, uint64_t offset)
+{
+#ifdef _WIN32
+  for (uint32_t i = 0; i < count; i++)
+  {
+    uint64_t written = 0;
+    while (written < sizes[i])
+    {
+      const uint64_t at = offset + written;
+      OVERLAPPED overlapped{};
+      overlapped.Offset = DWORD(at);
+      overlapped.OffsetHigh = DWORD(at >> 32);
+      DWORD bytes = 0;
+      const DWORD size = DWORD(std::min<uint64_t>(sizes[i] - written, 1u << 30));
+      if (!WriteFile(file.handle, buffers[i] + written, size, &bytes, &overlapped) || bytes == 0)
+      {
+        return false;
+      }
+      written += bytes;
+    }
+    offset += sizes[i];
+  }
+  return true;
+#else
+  constexpr uint32_t MAX_IOVECS = 64;
+  iovec iovecs[MAX_IOVECS];
+
+  for (uint32_t first = 0; first < count; first += MAX_IOVECS)
+  {
+    const uint32_t batch = std::min(count - first, MAX_IOVECS);
+    uint64_t batchSize = 0;
+    for (uint32_t i = 0; i < batch; i++)
+    {
+      iovecs[i].iov_base = const_cast<uint8_t*>(buffers[first + i]);
+      iovecs[i].iov_len = sizes[first + i];
+      batchSize += sizes[first + i];
+    }
+
+    ssize_t written = pwritev(file.fd, iovecs, int(batch), off_t(offset));
+    if (written != ssize_t(batchSize))
+    {
+      // Short or interrupted writes finish buffer by buffer.
+      uint64_t done = written > 0 ? uint64_t(written) : 0;
+      uint64_t at = offset;
+      for (uint32_t i = first; i < first + batch; i++)
+      {
+        uint64_t within = std::min(done, sizes[i]);
+        done -= within;
+        while (within < sizes[i])
+        {
+          written = pwrite(file.fd, buffers[i] + within, sizes[i] - within, off_t(at + within));
+          if (written < 0 && errno == EINTR)
+          {
+            continue;
+          }
+          if (written <= 0)
+          {
+            return false;
+          }
+          within += uint64_t(written);
+        }
+        at += sizes[i];
+      }
+    }
+    offset += batchSize;
+  }
+  return true;
+#endif
+}
+
+std::unique_ptr<TrajectoryWriter> TrajectoryWriter::create(const std::string& path, uint32_t particleCount, const SimulationGrid& grid,
+                                                           const SimulationParams& params, float dt, const Config& config)
+{
+  const bool compressed = config.codec.positionError > 0.0f || config.codec.velocityError > 0.0f;
+  if (compressed && !(config.codec.positionError > 0.0f && config.codec.velocityError > 0.0f))
+  {
+    fprintf(stderr, "Compressing a trajectory needs both a position and a velocity error bound\n");
+    return nullptr;
+  }
+
+  auto file = std::make_unique<FileHandle>();
+
+#ifdef _WIN32
+  const DWORD flags = FILE_ATTRIBUTE_NORMAL | (config.directIo ? FILE_FLAG_NO_BUFFERING | FILE_FLAG_WRITE_THROUGH : 0);
+  file->handle = CreateFileA(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, flags, nullptr);
+  if (file->handle == INVALID_HANDLE_VALUE)
+  {
+    fprintf(stderr, "Unable to create trajectory file %s\n", path.c_str());
+    return nullptr;
+  }
+#else
+  int flags = O_WRONLY | O_CREAT | O_TRUNC;
+#ifdef O_DIRECT
+  if (config.directIo)
+  {
+    file->fd = open(path.c_str(), flags | O_DIRECT, 0644);
+    if (file->fd < 0 && errno == EINVAL)
+    {
+      fprintf(stderr, "The file system does not support direct I/O, writing %s through the page cache\n", path.c_str());
+    }
+  }
+#else
+  if (config.directIo)
+  {
+    fprintf(stderr, "Direct I/O is not supported on this platform, writing %s through the page cache\n", path.c_str());
+  }
+#endif
+  if (file->fd < 0)
+  {
+    file->fd = open(path.c_str(), flags, 0644);
+  }
+  if (file->fd < 0)
+  {
+    fprintf(stderr, "Unable to create trajectory file %s: %s\n", path.c_str(), strerror(errno));
+    return nullptr;
+  }
+#endif
+
+  TrajectoryHeader header{};
+  header.magic = Trajectory::MAGIC;
+  header.version = Trajectory::VERSION;
+  header.particleCount = particleCount;
+  header.frameOffset = Trajectory::PAGE_SIZE;
+  header.frameStride = compressed ? 0 : TrajectoryFrameHeader::stride(particleCount);
+  header.frameInterval = config.frameInterval;
+  header.dt = dt;
+  for (int i = 0; i < 3; i++)
+  {
+    header.gridSize[i] = grid.size[i];
+    header.gridOrigin[i] = grid.origin[i];
+    header.gridRes[i] = grid.res[i];
+  }
+  header.cellOrder = uint32_t(grid.cellOrder);
+  header.gridMode = uint32_t(grid.mode);
+  header.params = params;
+  header.positionError = config.codec.positionError;
+  header.velocityError = config.codec.velocityError;
+
+  std::unique_ptr<TrajectoryWriter> writer{new TrajectoryWriter(std::move(file), header, config.codecThreadCount)};
+  if (!writer->writeHeader())
+  {
+    fprintf(stderr, "Unable to write trajectory file %s\n", path.c_str());
+    return nullptr;
+  }
+  writer->m_thread = std::thread(&TrajectoryWriter::ioMain, writer.get());
+  return writer;
+}
+
+TrajectoryWriter::TrajectoryWriter(std::unique_ptr<FileHandle> file, const TrajectoryHeader& header, uint32_t codecThreadCount)
+  : m_file(std::move(file))
+  , m_header(header)
+  , m_nextOffset(header.frameOffset)
+{
+  const uint64_t stride = TrajectoryFrameHeader::stride(m_header.particleCount);
+  for (uint8_t*& chunk : m_chunks)
+  {
+    chunk = allocatePages(stride);
+  }
+  m_headerPage = allocatePages(Trajectory::PAGE_SIZE);
+
+  if (compressed())
+  {
+    const uint64_t compressedStride = Trajectory::alignToPage(sizeof(TrajectoryFrameHeader) + TrajectoryCodec::maxEncodedSize(m_header.particleCount));
+    for (uint8_t*& chunk : m_compressedChunks)
+    {
+      chunk = allocatePages(compressedStride);
+    }
+    if (codecThreadCount != 1)
+    {
+      m_codecPool = std::make_unique<ThreadPool>(codecThreadCount);
+    }
+    m_codec = std::make_unique<TrajectoryCodec>(m_codecPool.get());
+  }
+}
+
+TrajectoryWriter::~TrajectoryWriter()
+{
+  if (m_thread.joinable())
+  {
+    m_shutdown.store(true, std::memory_order_release);
+    m_thread.join();
+  }
+
+  // The index follows the last frame.
+  if (!m_failed && m_header.frameCount > 0)
+  {
+    const size_t indexSize = Trajectory::alignToPage(m_index.size() * sizeof(TrajectoryIndexEntry));
+    uint8_t* index = allocatePages(indexSize);
+    memcpy(index, m_index.data(), m_index.size() * sizeof(TrajectoryIndexEntry));
+
+    const uint64_t indexOffset = m_nextOffset;
+    const uint64_t size = indexSize;
+    if (writeBuffers(*m_file, &index, &size, 1, indexOffset))
+    {
+      m_header.indexOffset = indexOffset;
+      writeHeader();
+    }
+    freePages(index);
+  }
+
+  for (uint8_t* chunk : m_chunks)
+  {
+    freePages(chunk);
+  }
+  for (uint8_t* chunk : m_compressedChunks)
+  {
+    freePages(chunk);
+  }
+  freePages(m_headerPage);
+}
+
+bool TrajectoryWriter::beginFrame(Frame& frame)
+{
+  const uint64_t head = m_head.load(std::memory_order_relaxed);
+  if (head - m_tail.load(std::memory_order_acquire) == QUEUE_DEPTH)
+  {
+    m_framesDropped.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+
+  uint8_t* chunk = m_chunks[head % QUEUE_DEPTH];
+  frame.positions = reinterpret_cast<glm::vec4*>(chunk + sizeof(TrajectoryFrameHeader));
+  frame.velocities = frame.positions + m_header.particleCount;
+  return true;
+}
+
+void TrajectoryWriter::endFrame(uint64_t step, double time)
+{
+  const uint64_t head = m_head.load(std::memory_order_relaxed);
+
+  auto* frameHeader = reinterpret_cast<TrajectoryFrameHeader*>(m_chunks[head % QUEUE_DEPTH]);
+  frameHeader->frame = head;
+  frameHeader->step = step;
+  frameHeader->time = time;
+  frameHeader->particleCount = m_header.particleCount;
+  frameHeader->chunkSize = TrajectoryFrameHeader::stride(m_header.particleCount);
+  frameHeader->compressedSize = 0;
+
+  m_head.store(head + 1, std::memory_order_release);
+}
+
+void TrajectoryWriter::dropFrame()
+{
+  m_framesDropped.fetch_add(1, std::memory_order_relaxed);
+}
+
+uint32_t TrajectoryWriter::particleCount() const
+{
+  return m_header.particleCount;
+}
+
+TrajectoryWriter::Stats TrajectoryWriter::stats() const
+{
+  Stats stats;
+  stats.framesWritten = m_framesWritten.load(std::memory_order_relaxed);
+  stats.framesDropped = m_framesDropped.load(std::memory_order_relaxed);
+  stats.bytesWritten = m_bytesWritten.load(std::memory_order_relaxed);
+  stats.uncompressedBytes = m_uncompressedBytes.load(std::memory_order_relaxed);
+  stats.batches = m_batches.load(std::memory_order_relaxed);
+  return stats;
+}
+
+void TrajectoryWriter::ioMain()
+{
+  while (true)
+  {
+    const uint64_t tail = m_tail.load(std::memory_order_relaxed);
+    // Reading the flag first ensures that no frame queued before the shutdown is missed.
+    const bool shutdown = m_shutdown.load(std::memory_order_acquire);
+    const uint64_t head = m_head.load(std::memory_order_acquire);
+
+    if (head == tail)
+    {
+      if (shutdown)
+      {
+        return;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      continue;
+    }
+
+    // After a failed write, the queue is still drained so that the simulation keeps running.
+    if (!m_failed && !writeFrames(tail, head))
+    {
+      fprintf(stderr, "Writing the trajectory failed, recording stopped\n");
+      m_failed = true;
+    }
+    m_tail.store(head, std::memory_order_release);
+  }
+}
+
+bool TrajectoryWriter::writeFrames(uint64_t first, uint64_t last)
+{
+  const uint8_t* buffers[QUEUE_DEPTH];
+  uint64_t sizes[QUEUE_DEPTH];
+  uint32_t count = 0;
+  uint64_t size = 0;
+  const uint64_t offset = m_nextOffset;
+
+  for (uint64_t frame = first; frame < last; frame++)
+  {
+    const uint8_t* chunk = m_chunks[frame % QUEUE_DEPTH];
+    uint64_t chunkSize = reinterpret_cast<const TrajectoryFrameHeader*>(chunk)->chunkSize;
+    if (compressed())
+    {
+      chunk = m_compressedChunks[frame % QUEUE_DEPTH];
+      chunkSize = compressFrame(frame);
+      if (chunkSize == 0)
+      {
+        m_framesDropped.fetch_add(1, std::memory_order_relaxed);
+        continue;
+      }
+    }
+
+    const auto* frameHeader = reinterpret_cast<const TrajectoryFrameHeader*>(chunk);
+    m_index.push_back({ offset + size, frameHeader->step, frameHeader->time });
+    buffers[count] = chunk;
+    sizes[count] = chunkSize;
+    count++;
+    size += chunkSize;
+  }
+
+  if (!writeBuffers(*m_file, buffers, sizes, count, offset))
+  {
+    return false;
+  }
+
+  m_nextOffset += size;
+  m_header.frameCount += count;
+  m_framesWritten.store(m_header.frameCount, std::memory_order_relaxed);
+  m_bytesWritten.fetch_add(size, std::memory_order_relaxed);
+  m_uncompressedBytes.fetch_add(count * TrajectoryFrameHeader::stride(m_header.particleCount), std::memory_order_relaxed);
+  m_batches.fetch_add(1, std::memory_order_relaxed);
+  return writeHeader();
+}
+
+uint64_t TrajectoryWriter::compressFrame(uint64_t frame)
+{
+  const auto* source = reinterpret_cast<const TrajectoryFrameHeader*>(m_chunks[frame % QUEUE_DEPTH]);
+  const uint32_t count = m_header.particleCount;
+  const glm::vec3 origin(m_header.gridOrigin[0], m_header.gridOrigin[1], m_header.gridOrigin[2]);
+  const auto* positions = reinterpret_cast<const glm::vec4*>(source + 1);
+
+  TrajectoryCodec::Config config;
+  config.positionError = m_header.positionError;
+  config.velocityError = m_header.velocityError;
+  if (!m_codec->encode(config, origin, positions, positions + count, count, m_encoded))
+  {
+    fprintf(stderr, "Frame %llu of the trajectory cannot be compressed and is dropped\n", static_cast<unsigned long long>(frame));
+    return 0;
+  }
+
+  uint8_t* chunk = m_compressedChunks[frame % QUEUE_DEPTH];
+  auto* frameHeader = reinterpret_cast<TrajectoryFrameHeader*>(chunk);
+  *frameHeader = *source;
+  frameHeader->compressedSize = m_encoded.size();
+  frameHeader->chunkSize = Trajectory::alignToPage(sizeof(TrajectoryFrameHeader) + m_encoded.size());
+
+  // The padding is written as well and must not leak older frames.
+  uint8_t* data = chunk + sizeof(TrajectoryFrameHeader);
+  memcpy(data, m_encoded.data(), m_encoded.size());
+  memset(data + m_encoded.size(), 0, frameHeader->chunkSize - sizeof(TrajectoryFrameHeader) - m_encoded.size());
+  return frameHeader->chunkSize;
+}
+
+bool TrajectoryWriter::compressed() const
+{
+  return m_header.frameStride == 0;
+}
+
+bool TrajectoryWriter::writeHeader()
+{
+  memcpy(m_headerPage, &m_header, sizeof(m_header));
+  const uint8_t* page = m_headerPage;
+  const uint64_t size = Trajectory::PAGE_SIZE;
+  return writeBuffers(*m_file, &page, &size, 1, 0);
+}
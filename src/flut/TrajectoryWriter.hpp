@@ -0,0 +1,126 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "SimulationBackend.hpp"
+#include "ThreadPool.hpp"
+#include "TrajectoryCodec.hpp"
+#include "TrajectoryFormat.hpp"
+
+namespace flut
+{
+  // Records frames of a simulation into a file of page-aligned chunks, see TrajectoryFormat.hpp.
+  // The simulation thread fills preallocated chunks, which it hands to a dedicated I/O thread
+  // through a lock-free single-producer single-consumer ring. Consecutive chunks are written with
+  // one vectored pwrite. The simulation never waits for the disk: if the ring is full, the frame
+  // is dropped and counted. With error bounds, the I/O thread compresses the chunks before writing.
+  class TrajectoryWriter
+  {
+  public:
+    constexpr static uint32_t QUEUE_DEPTH = 8;
+
+    struct Config
+    {
+      // Integrations between frames, only stored in the header. 0 if the spacing varies.
+      uint32_t frameInterval = 1;
+      // Bypasses the page cache if the file system supports it.
+      bool directIo = false;
+      // Error bounds of zero store the frames uncompressed.
+      TrajectoryCodec::Config codec;
+      // Threads compressing a frame, including the I/O thread.
+      uint32_t codecThreadCount = 1;
+    };
+
+    struct Stats
+    {
+      uint64_t framesWritten = 0;
+      // Frames which found the ring full, could not be compressed or were lost before they reached
+      // the writer, see dropFrame().
+      uint64_t framesDropped = 0;
+      uint64_t bytesWritten = 0;
+      // Size of the written frames before compression.
+      uint64_t uncompressedBytes = 0;
+      uint64_t batches = 0;
+    };
+
+    // Chunk to be filled by the simulation thread.
+    struct Frame
+    {
+      glm::vec4* positions;
+      glm::vec4* velocities;
+    };
+
+  public:
+    // Creates the file and starts the I/O thread, or returns nullptr.
+    static std::unique_ptr<TrajectoryWriter> create(const std::string& path, uint32_t particleCount, const SimulationGrid& grid,
+                                                    const SimulationParams& params, float dt, const Config& config);
+
+    // Writes the queued frames and the index.
+    ~TrajectoryWriter();
+
+  public:
+    // Reserves the next chunk. Returns false and counts the frame as dropped if the ring is full.
+    bool beginFrame(Frame& frame);
+
+    // Queues the reserved chunk for writing.
+    void endFrame(uint64_t step, double time);
+
+    // Counts a frame as dropped which never reached beginFrame(), e.g. because its readback from the
+    // GPU found no free buffer.
+    void dropFrame();
+
+    uint32_t particleCount() const;
+
+    Stats stats() const;
+
+  private:
+    struct FileHandle;
+
+    TrajectoryWriter(std::unique_ptr<FileHandle> file, const TrajectoryHeader& header, uint32_t codecThreadCount);
+
+    void ioMain();
+
+    // Writes the chunks [first, last) of the ring and then the header with the new frame count.
+    bool writeFrames(uint64_t first, uint64_t last);
+
+    // Compresses a chunk of the ring into its counterpart in m_compressedChunks and returns the
+    // size of the compressed chunk, or 0 if it cannot be compressed.
+    uint64_t compressFrame(uint64_t frame);
+
+    bool compressed() const;
+
+    bool writeHeader();
+
+  private:
+    std::unique_ptr<FileHandle> m_file;
+    TrajectoryHeader m_header;
+    // Page-aligned chunk buffers and the page holding the header.
+    uint8_t* m_chunks[QUEUE_DEPTH];
+    uint8_t* m_headerPage;
+    // Only used with compression.
+    uint8_t* m_compressedChunks[QUEUE_DEPTH] = {};
+    std::unique_ptr<ThreadPool> m_codecPool;
+    std::unique_ptr<TrajectoryCodec> m_codec;
+    std::vector<uint8_t> m_encoded;
+    // Chunks [m_tail, m_head) are queued, m_head is the next one to fill.
+    std::atomic<uint64_t> m_head{0};
+    std::atomic<uint64_t> m_tail{0};
+    std::atomic<bool> m_shutdown{false};
+    std::atomic<uint64_t> m_framesWritten{0};
+    std::atomic<uint64_t> m_framesDropped{0};
+    std::atomic<uint64_t> m_bytesWritten{0};
+    std::atomic<uint64_t> m_uncompressedBytes{0};
+    std::atomic<uint64_t> m_batches{0};
+    bool m_failed = false;
+    // Only accessed by the I/O thread.
+    std::vector<TrajectoryIndexEntry> m_index;
+    uint64_t m_nextOffset;
+    std::thread m_thread;
+  };
+}
@@ -46,6 +46,17 @@ Window::Window(const char* title, uint32_t width, uint32_t height)
     abort();
   }
 
+  // Shares objects with the main context. Creating it makes it current, so switch back afterwards.
+  SDL_GL_SetAttribute(SDL_GL_SHARE_WITH_CURRENT_CONTEXT, 1);
+  m_workerContext = SDL_GL_CreateContext(m_window);
+
+  if (!m_workerContext) {
+    fprintf(stderr, "%s", SDL_GetError());
+    abort();
+  }
+
+  SDL_GL_MakeCurrent(m_window, m_context);
+
   if (!gladLoadGLLoader(SDL_GL_GetProcAddress)) {
     fprintf(stderr, "Unable to initialize Glad");
     abort();
@@ -71,6 +82,7 @@ Window::Window(const char* title, uint32_t width, uint32_t height)
 Window::~Window()
 {
   ImGui_ImplSdlGlad_Shutdown();
+  SDL_GL_DeleteContext(m_workerContext);
   SDL_GL_DeleteContext(m_context);
   SDL_DestroyWindow(m_window);
   SDL_QuitSubSystem(SDL_INIT_VIDEO);
@@ -168,6 +180,11 @@ bool Window::keyDown() const
   return states[SDL_SCANCODE_S] != 0;
 }
 
+void Window::makeWorkerContextCurrent(bool current)
+{
+  SDL_GL_MakeCurrent(current ? m_window : nullptr, current ? m_workerContext : nullptr);
+}
+
 void Window::resize(std::function<void(uint32_t, uint32_t)> callback)
 {
   m_resizeCallback = callback;
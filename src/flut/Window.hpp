@@ -36,10 +36,14 @@ namespace flut
 
     void resize(std::function<void(uint32_t, uint32_t)> callback);
 
+    // The worker context shares objects with the main context and is meant for background threads.
+    void makeWorkerContextCurrent(bool current);
+
   private:
     bool m_shouldClose;
     SDL_Window* m_window;
     SDL_GLContext m_context;
+    SDL_GLContext m_workerContext;
     std::function<void(uint32_t, uint32_t)> m_resizeCallback;
   };
 }
@@ -1,12 +1,20 @@
 #include "Simulation.hpp"
+#include "CellOrdering.hpp"
+#include "SpatialHash.hpp"
 #include "Camera.hpp"
 #include "Window.hpp"
+#include "GlParticleReadback.hpp"
 #include "GlQueryRetriever.hpp"
+#include "GlSimulationBackend.hpp"
+#include "ReplaySimulationBackend.hpp"
 
 #include <imgui.h>
+#include <algorithm>
 #include <chrono>
 #include <fstream>
 #include <iostream>
+#include <string>
+#include <string_view>
 #include <vector>
 
 using namespace flut;
@@ -16,9 +24,150 @@ int main(int argc, char* argv[])
   constexpr uint32_t WIDTH = 1200;
   constexpr uint32_t HEIGHT = 800;
 
+  Simulation::StartupOptions startupOptions;
+
+  for (int i = 1; i < argc; i++)
+  {
+    const std::string_view arg{argv[i]};
+
+    if (arg == "--cpu")
+    {
+      startupOptions.backend = Simulation::BackendType::Cpu;
+    }
+    else if (arg.substr(0, 14) == "--cpu-threads=")
+    {
+      startupOptions.cpuThreadCount = static_cast<uint32_t>(std::stoul(std::string(arg.substr(14))));
+    }
+    else if (arg.substr(0, 12) == "--particles=")
+    {
+      startupOptions.particleCount = static_cast<uint32_t>(std::stoul(std::string(arg.substr(12))));
+    }
+    else if (arg.substr(0, 6) == "--isa=")
+    {
+      const std::string_view name = arg.substr(6);
+      CpuIsa isa;
+      if (!CpuKernels::parseIsa(name, isa))
+      {
+        fprintf(stderr, "Unknown instruction set %s\n", argv[i]);
+        return EXIT_FAILURE;
+      }
+      if (!CpuKernels::isSupported(isa))
+      {
+        fprintf(stderr, "Instruction set %s is not supported\n", CpuKernels::isaName(isa));
+        return EXIT_FAILURE;
+      }
+      startupOptions.cpuIsa = isa;
+    }
+    else if (arg.substr(0, 13) == "--cell-order=")
+    {
+      if (!CellOrdering::parse(arg.substr(13), startupOptions.cellOrder))
+      {
+        fprintf(stderr, "Unknown cell order %s\n", argv[i]);
+        return EXIT_FAILURE;
+      }
+    }
+    else if (arg.substr(0, 14) == "--verlet-skin=")
+    {
+      startupOptions.neighborLists.skin = std::stof(std::string(arg.substr(14)));
+    }
+    else if (arg.substr(0, 23) == "--verlet-max-neighbors=")
+    {
+      startupOptions.neighborLists.maxNeighbors = static_cast<uint32_t>(std::stoul(std::string(arg.substr(23))));
+    }
+    else if (arg.substr(0, 7) == "--grid=")
+    {
+      if (!SpatialHash::parse(arg.substr(7), startupOptions.gridMode))
+      {
+        fprintf(stderr, "Unknown grid mode %s\n", argv[i]);
+        return EXIT_FAILURE;
+      }
+    }
+    else if (arg.substr(0, 13) == "--gl-kernels=")
+    {
+      if (!GlSimulationBackend::parseKernelMode(arg.substr(13), startupOptions.glKernelMode))
+      {
+        fprintf(stderr, "Unknown kernel mode %s\n", argv[i]);
+        return EXIT_FAILURE;
+      }
+    }
+    else if (arg.substr(0, 17) == "--sleep-velocity=")
+    {
+      startupOptions.sleep.velocityThreshold = std::stof(std::string(arg.substr(17)));
+    }
+    else if (arg.substr(0, 16) == "--sleep-density=")
+    {
+      startupOptions.sleep.densityThreshold = std::stof(std::string(arg.substr(16)));
+    }
+    else if (arg.substr(0, 14) == "--sleep-steps=")
+    {
+      startupOptions.sleep.calmSteps = static_cast<uint32_t>(std::stoul(std::string(arg.substr(14))));
+    }
+    else if (arg.substr(0, 20) == "--readback-interval=")
+    {
+      startupOptions.readbackInterval = static_cast<uint32_t>(std::stoul(std::string(arg.substr(20))));
+    }
+    else if (arg.substr(0, 13) == "--trajectory=")
+    {
+      startupOptions.trajectoryPath = std::string(arg.substr(13));
+    }
+    else if (arg.substr(0, 22) == "--trajectory-interval=")
+    {
+      startupOptions.trajectory.frameInterval = static_cast<uint32_t>(std::stoul(std::string(arg.substr(22))));
+    }
+    else if (arg == "--trajectory-direct")
+    {
+      startupOptions.trajectory.directIo = true;
+    }
+    else if (arg.substr(0, 28) == "--trajectory-position-error=")
+    {
+      startupOptions.trajectory.codec.positionError = std::stof(std::string(arg.substr(28)));
+    }
+    else if (arg.substr(0, 28) == "--trajectory-velocity-error=")
+    {
+      startupOptions.trajectory.codec.velocityError = std::stof(std::string(arg.substr(28)));
+    }
+    else if (arg.substr(0, 21) == "--trajectory-threads=")
+    {
+      startupOptions.trajectory.codecThreadCount = static_cast<uint32_t>(std::stoul(std::string(arg.substr(21))));
+    }
+    else if (arg.substr(0, 10) == "--restore=")
+    {
+      startupOptions.restorePath = std::string(arg.substr(10));
+    }
+    else if (arg.substr(0, 13) == "--checkpoint=")
+    {
+      startupOptions.checkpointPath = std::string(arg.substr(13));
+    }
+    else if (arg.substr(0, 22) == "--checkpoint-interval=")
+    {
+      startupOptions.checkpointInterval = static_cast<uint32_t>(std::stoul(std::string(arg.substr(22))));
+    }
+    else if (arg.substr(0, 9) == "--replay=")
+    {
+      startupOptions.replayPath = std::string(arg.substr(9));
+    }
+    else if (arg.substr(0, 6) == "--cfl=")
+    {
+      startupOptions.timeStep.cfl = std::stof(std::string(arg.substr(6)));
+    }
+    else if (arg.substr(0, 9) == "--max-dt=")
+    {
+      startupOptions.timeStep.maxDt = std::stof(std::string(arg.substr(9)));
+    }
+    else if (arg.substr(0, 12) == "--max-steps=")
+    {
+      startupOptions.timeStep.maxSteps = static_cast<uint32_t>(std::stoul(std::string(arg.substr(12))));
+    }
+    else
+    {
+      fprintf(stderr, "Unknown argument %s\n", argv[i]);
+      return EXIT_FAILURE;
+    }
+  }
+
   Window window{"flut", WIDTH, HEIGHT};
   Camera camera{window};
-  Simulation simulation{WIDTH, HEIGHT};
+  Simulation simulation{WIDTH, HEIGHT, startupOptions, [&](bool current) { window.makeWorkerContextCurrent(current); }};
 
   window.resize([&](uint32_t width, uint32_t height) {
     simulation.resize(width, height);
@@ -29,7 +178,13 @@ int main(int argc, char* argv[])
   using clock = std::chrono::high_resolution_clock;
   auto lastTime = clock::now();
 
-  int ipF = 8;
+  int ipF = startupOptions.restorePath.empty() ? 8 : static_cast<int>(simulation.integrationsPerFrame());
+  int particleCount = static_cast<int>(simulation.particleCount());
+  glm::vec3 domainSize = simulation.grid().size;
+  SimulationParams params = simulation.params();
+  float readbackMeanSpeed = 0.0f;
+  bool loadingCheckpoint = false;
+  const std::string checkpointPath = startupOptions.checkpointPath.empty() ? "flut.checkpoint" : startupOptions.checkpointPath;
 
   while (!window.shouldClose())
   {
@@ -55,9 +210,19 @@ int main(int argc, char* argv[])
     ImGui::SetNextWindowPos({50, 50});
     ImGui::Begin("SPH GPU Fluid Simulation", nullptr, ImGuiWindowFlags_AlwaysAutoResize | ImGuiWindowFlags_NoMove);
 
-    ImGui::Text("Particles: %d", simulation.particleCount());
-    ImGui::Text("Delta-time: %f", simulation.DT * options.deltaTimeMod);
-    ImGui::Text("Grid: %dx%dx%d", simulation.GRID_RES.x, simulation.GRID_RES.y, simulation.GRID_RES.z);
+    ImGui::Text("Backend: %s", simulation.backendName());
+    ImGui::Text("Particles: %d (max. %d)", simulation.particleCount(), simulation.maxParticleCount());
+    if (const TimeStepStats* timeSteps = simulation.timeStepStats())
+    {
+      ImGui::Text("Delta-time: %f (%f - %f, CFL %f), %u integrations, %f s dropped", timeSteps->meanDt, timeSteps->minDt,
+        timeSteps->maxDt, timeSteps->cflDt, timeSteps->steps, timeSteps->totalDroppedTime);
+    }
+    else
+    {
+      ImGui::Text("Delta-time: %f", simulation.DT * options.deltaTimeMod);
+    }
+    ImGui::Text("Grid: %dx%dx%d (%s, %.1f MiB)", simulation.grid().res.x, simulation.grid().res.y, simulation.grid().res.z,
+      SpatialHash::name(simulation.grid().mode), simulation.gridMemoryBytes() / (1024.0f * 1024.0f));
     ImGui::Text("Frame: %.2fms", deltaTime * 1000.0f);
 
     ImGui::Text("Step 1  Step 2  Step 3  Step 4  Step 5  Step 6  Render");
@@ -65,10 +230,65 @@ int main(int argc, char* argv[])
                 times.simStempMs[0], times.simStempMs[1], times.simStempMs[2],
                 times.simStempMs[3], times.simStempMs[4], times.simStempMs[5], times.renderMs);
 
+    float stepMs = 0.0f;
+    for (float ms : times.simStempMs) { stepMs += ms; }
+    ImGui::Text("Throughput: %.2fM particles/s", stepMs > 0.0f ? simulation.particleCount() / (stepMs * 1000.0f) : 0.0f);
+
+    if (GlParticleReadback* readback = simulation.readback())
+    {
+      GlParticleReadback::View view;
+      if (readback->acquire(view))
+      {
+        float speedSum = 0.0f;
+        for (uint32_t i = 0; i < view.particleCount; i++)
+        {
+          speedSum += glm::length(glm::vec3(view.velocities[i]));
+        }
+        readbackMeanSpeed = view.particleCount > 0 ? speedSum / view.particleCount : 0.0f;
+        readback->release();
+      }
+
+      const GlParticleReadback::Stats& stats = readback->stats();
+      ImGui::Text("Readback: %u frames latency, %.1f MiB/s, mean speed %.3f m/s", stats.latencyFrames,
+        stats.bytesPerSecond / (1024.0 * 1024.0), readbackMeanSpeed);
+    }
+
+    if (const TrajectoryWriter* trajectory = simulation.trajectory())
+    {
+      const TrajectoryWriter::Stats stats = trajectory->stats();
+      ImGui::Text("Trajectory: %llu frames, %llu dropped, %.1f MiB in %llu writes, ratio %.2f", static_cast<unsigned long long>(stats.framesWritten),
+        static_cast<unsigned long long>(stats.framesDropped), stats.bytesWritten / (1024.0 * 1024.0), static_cast<unsigned long long>(stats.batches),
+        stats.bytesWritten > 0 ? double(stats.uncompressedBytes) / stats.bytesWritten : 1.0);
+    }
+
+    if (ReplaySimulationBackend* replay = simulation.replay())
+    {
+      ImGui::Text("Replay: frame %llu of %llu, step %llu, %.3f s", static_cast<unsigned long long>(replay->frame()),
+        static_cast<unsigned long long>(replay->frameCount()), static_cast<unsigned long long>(replay->step()), replay->time());
+      if (ImGui::Button(replay->playing() ? "Pause" : "Play"))
+      {
+        replay->setPlaying(!replay->playing());
+      }
+      ImGui::SameLine();
+      int replayFrame = static_cast<int>(replay->frame());
+      if (ImGui::SliderInt("Frame", &replayFrame, 0, static_cast<int>(replay->frameCount()) - 1))
+      {
+        replay->seek(static_cast<uint64_t>(replayFrame));
+      }
+    }
+
     ImGui::SliderFloat("Delta-Time mod", &options.deltaTimeMod, 0.0f, 2.0f, nullptr, 1.0f);
 
     ImGui::DragInt("Integrations per Frame", &ipF, 1.0f, 0, GlQueryRetriever::MAX_SIM_ITERS_PER_FRAME);
 
+    ImGui::InputInt("Particle count", &particleCount, 10000, 100000);
+    ImGui::SameLine();
+    if (ImGui::Button("Respawn"))
+    {
+      simulation.setParticleCount(static_cast<uint32_t>(std::max(particleCount, 1)));
+      particleCount = static_cast<int>(simulation.particleCount());
+    }
+
     ImGui::DragFloat3("Gravity", &options.gravity[0], 0.075f, -10.0f, 10.0f, nullptr, 1.0f);
 
     ImGui::Text("Particle Color:");
@@ -83,6 +303,49 @@ int main(int argc, char* argv[])
 
     ImGui::DragFloat("Point scale", &options.pointScale, 0.01f, 0.1f, 2.5f);
 
+    ImGui::Text("Domain:");
+    ImGui::DragFloat3("Size", &domainSize[0], 0.1f, 2.0f, 200.0f);
+    ImGui::DragFloat("Kernel radius", &params.kernelRadius, 0.001f, 0.05f, 1.0f, "%.4f");
+    ImGui::DragFloat("Stiffness", &params.stiffness, 1.0f, 1.0f, 2000.0f);
+    ImGui::DragFloat("Viscosity", &params.viscosity, 0.001f, 0.0f, 1.0f, "%.4f");
+    if (ImGui::Button("Apply"))
+    {
+      simulation.reconfigure(domainSize, params);
+    }
+    if (simulation.reconfiguring())
+    {
+      ImGui::SameLine();
+      ImGui::Text("Compiling shaders...");
+    }
+
+    ImGui::Text("Checkpoint:");
+    if (ImGui::Button("Save"))
+    {
+      simulation.saveCheckpoint(checkpointPath);
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("Load"))
+    {
+      loadingCheckpoint = simulation.loadCheckpoint(checkpointPath);
+    }
+    // The state is only restored once the new configuration has taken effect.
+    if (loadingCheckpoint && !simulation.restoring())
+    {
+      loadingCheckpoint = false;
+      ipF = static_cast<int>(simulation.integrationsPerFrame());
+      particleCount = static_cast<int>(simulation.particleCount());
+      params = simulation.params();
+      domainSize = simulation.grid().size;
+    }
+    ImGui::SameLine();
+    ImGui::Text("%s", checkpointPath.c_str());
+    if (const CheckpointWriter* checkpointWriter = simulation.checkpointWriter())
+    {
+      const CheckpointWriter::Stats stats = checkpointWriter->stats();
+      ImGui::Text("Periodic: %llu written, last at frame %llu in %.1f ms", static_cast<unsigned long long>(stats.written),
+        static_cast<unsigned long long>(stats.lastFrame), stats.lastWriteMs);
+    }
+
     ImGui::End();
 
     window.swap();